@@ -0,0 +1,1283 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Bench.cpp
+ *
+ * Microbenchmarks for the emulator's hot kernels. Built with "make bench" as a
+ * separate binary that links every emulator object except Main.
+ *
+ * Each kernel is driven through the same entry points the emulator uses, on
+ * synthetic, deterministic data, so that a change to one core can be measured
+ * without a ROM set or a running game. Results are given in nanoseconds per
+ * operation, where an operation is kernel-specific (an emulated instruction,
+ * a bus access, an output sample, ...) and printed next to each result.
+ *
+ * The iteration count of each kernel is calibrated so that a single sample
+ * runs for at least -min-time milliseconds. The fastest of -samples samples,
+ * being the one least disturbed by the rest of the system, is reported
+ * together with the spread between the fastest and the slowest.
+ *
+ * Results can be written to a flat JSON object with -save and compared
+ * against such a file with -baseline; a kernel more than -threshold percent
+ * slower than its baseline is flagged and makes the exit status non-zero.
+ *
+ * CNew3D::CacheModel() is not covered: it requires a live OpenGL context and
+ * recorded display lists, neither of which is available here.
+ */
+
+#include "Supermodel.h"
+#include "Model3/Model3.h"
+#include "Model3/DSB.h"
+#include "CPU/Z80/Z80.h"
+#include "Sound/SCSP.h"
+#include "Sound/SCSPDSP.h"
+#include "Graphics/IRender3D.h"
+#include "Graphics/SoftRender2D.h"
+#include "OSD/Logger.h"
+#include "OSD/Thread.h"
+#include "OSD/Video.h"
+#include "Util/MemoryArena.h"
+#include "Util/NewConfig.h"
+#include "Util/WriteWatch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/******************************************************************************
+ OSD Hooks
+
+ Normally provided by Main.cpp. Nothing is ever rendered by the benchmarks.
+******************************************************************************/
+
+bool BeginFrameVideo()
+{
+  return false;
+}
+
+void EndFrameVideo()
+{
+}
+
+
+/******************************************************************************
+ Helpers
+******************************************************************************/
+
+// Defeats dead code elimination of kernel results
+static volatile uint32_t s_sink;
+
+// Deterministic pseudo-random source so that every run sees the same data
+class CLCG
+{
+public:
+  uint32_t Next(void)
+  {
+    m_state = m_state * 1664525 + 1013904223;
+    return m_state;
+  }
+
+  CLCG(uint32_t seed = 0x5D0DE1)
+    : m_state(seed)
+  {
+  }
+
+private:
+  uint32_t m_state;
+};
+
+static Util::Config::Node BenchConfig(bool gpuMultiThreaded)
+{
+  Util::Config::Node config("Global");
+  config.Set("MultiThreaded", false);
+  config.Set("GPUMultiThreaded", gpuMultiThreaded);
+  config.Set("EmulateSound", true);
+  config.Set("EmulateDSB", true);
+  config.Set("SoundVolume", 100);
+  config.Set("MusicVolume", 100);
+  config.Set("Balance", 0);
+  config.Set("FlipStereo", false);
+  config.Set("LegacySoundDSP", false);
+  config.Set("SoundIdleSkip", false);
+  return config;
+}
+
+// IRender3D that discards everything, for driving CReal3D without OpenGL
+class CNullRender3D: public IRender3D
+{
+public:
+  void RenderFrame(void) {}
+  void BeginFrame(void) {}
+  void EndFrame(void) {}
+  void UploadTextures(unsigned level, unsigned x, unsigned y, unsigned width, unsigned height) {}
+  void AttachMemory(const uint32_t *cullingRAMLoPtr, const uint32_t *cullingRAMHiPtr, const uint32_t *polyRAMPtr, const uint32_t *vromPtr, const uint16_t *textureRAMPtr) {}
+  void SetStepping(int stepping) {}
+  bool Init(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned yRes, unsigned totalXRes, unsigned totalYRes, unsigned aaTarget) { return OKAY; }
+  void SetSunClamp(bool enable) {}
+  void SetSignedShade(bool enable) {}
+  float GetLosValue(int layer) { return 0.0f; }
+  void GetFrameStats(Render3DStats *stats) { *stats = {}; }
+};
+
+
+/******************************************************************************
+ Kernels
+******************************************************************************/
+
+/*
+ * IBenchmark:
+ *
+ * A single kernel. Init() is called once before timing starts; Run(reps)
+ * executes the kernel reps times and returns the number of operations that
+ * were performed, which the per-operation time is computed from.
+ */
+class IBenchmark
+{
+public:
+  virtual const char *GetName(void) const = 0;
+  virtual const char *GetUnit(void) const = 0;
+  virtual bool Init(void) = 0;
+  virtual uint64_t Run(uint64_t reps) = 0;
+
+  virtual ~IBenchmark()
+  {
+  }
+};
+
+/*
+ * PowerPC interpreter executing a load/modify/store loop from flat RAM,
+ * optionally with the RAM mapped into a fastmem window.
+ */
+class CPPCBenchmark: public IBenchmark, public IBus
+{
+public:
+  const char *GetName(void) const { return m_fastMemEnabled ? "ppc.interpreter_fastmem" : "ppc.interpreter"; }
+  const char *GetUnit(void) const { return "instruction"; }
+
+  bool Init(void)
+  {
+    m_ram.assign(RAM_SIZE / 4, 0);
+    UINT32 *ram = m_ram.data();
+    if (m_fastMemEnabled)
+    {
+      m_pool = Util::MemoryArena::Allocate("PowerPC RAM", RAM_SIZE, Util::MemoryArena::SHARED);
+      ram = (UINT32 *) m_pool;
+      if (NULL == ram || OKAY != m_fastMem.Init(this, m_pool) || OKAY != m_fastMem.Map(0, 0, RAM_SIZE, true))
+        return FAIL;
+    }
+
+    // Program at 0x100 walks a 1KB table at 0x2000, mixing each entry. The
+    // branches are relative, so it runs from the reset vector mirror too.
+    static const uint32_t program[] =
+    {
+      Addi(3, 0, 0),            // 100: li      r3,0
+      Addi(7, 0, 0x2000),       // 104: li      r7,0x2000
+      Rlwinm(4, 3, 2, 22, 29),  // 108: rlwinm  r4,r3,2,22,29
+      X31(4, 4, 7, 266),        // 10C: add     r4,r4,r7
+      DForm(32, 5, 4, 0),       // 110: lwz     r5,0(r4)
+      X31(5, 5, 3, 266),        // 114: add     r5,r5,r3
+      Rlwinm(6, 5, 3, 0, 28),   // 118: rlwinm  r6,r5,3,0,28
+      X31(5, 5, 6, 316),        // 11C: xor     r5,r5,r6
+      DForm(36, 5, 4, 0),       // 120: stw     r5,0(r4)
+      Addi(3, 3, 1),            // 124: addi    r3,r3,1
+      DForm(11, 0, 3, 0x1000),  // 128: cmpwi   r3,0x1000
+      (16u<<26)|(4<<21)|(2<<16)|((0x108-0x12C)&0xFFFC), // 12C: bne 108
+      Addi(3, 0, 0),            // 130: li      r3,0
+      (18u<<26)|((0x108-0x134)&0x03FFFFFC)              // 134: b   108
+    };
+    for (size_t i = 0; i < sizeof(program)/sizeof(program[0]); i++)
+      ram[0x100/4 + i] = program[i];
+
+    PPC_CONFIG config;
+    config.pvr = PPC_MODEL_603R;
+    config.bus_frequency = BUS_FREQUENCY_66MHZ;
+    config.bus_frequency_multiplier = 0x25;
+    ppc_attach_bus(this);
+    ppc_set_fastmem(m_fastMemEnabled ? &m_fastMem : NULL);
+    ppc_init(&config);
+    m_fetch[0].start = 0;
+    m_fetch[0].end = RAM_SIZE - 1;
+    m_fetch[0].ptr = ram;
+    m_fetch[1].start = 0xFFF00000;  // reset vector mirror, so execution begins at 0x100
+    m_fetch[1].end = 0xFFF00000 + RAM_SIZE - 1;
+    m_fetch[1].ptr = ram;
+    m_fetch[2].start = 0;
+    m_fetch[2].end = 0;
+    m_fetch[2].ptr = NULL;
+    ppc_set_fetch(m_fetch);
+    ppc_reset();
+    return OKAY;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    uint64_t executed = 0;
+    for (uint64_t i = 0; i < reps; i++)
+      executed += ppc_execute(1000);
+    return executed;
+  }
+
+  UINT32 Read32(UINT32 addr)
+  {
+    return addr < RAM_SIZE ? m_ram[addr/4] : 0xFFFFFFFF;
+  }
+
+  void Write32(UINT32 addr, UINT32 data)
+  {
+    if (addr < RAM_SIZE)
+      m_ram[addr/4] = data;
+  }
+
+  CPPCBenchmark(bool fastMem)
+    : m_fastMemEnabled(fastMem)
+  {
+  }
+
+  ~CPPCBenchmark(void)
+  {
+    ppc_set_fastmem(NULL);
+    if (m_pool != NULL)
+      Util::MemoryArena::Free(m_pool);
+  }
+
+private:
+  static const uint32_t RAM_SIZE = 0x10000;
+
+  static constexpr uint32_t DForm(uint32_t op, uint32_t d, uint32_t a, uint32_t imm)
+  {
+    return (op << 26) | (d << 21) | (a << 16) | (imm & 0xFFFF);
+  }
+
+  static constexpr uint32_t Addi(uint32_t d, uint32_t a, uint32_t imm)
+  {
+    return DForm(14, d, a, imm);
+  }
+
+  static constexpr uint32_t X31(uint32_t d, uint32_t a, uint32_t b, uint32_t xo)
+  {
+    return (31u << 26) | (d << 21) | (a << 16) | (b << 11) | (xo << 1);
+  }
+
+  static constexpr uint32_t Rlwinm(uint32_t a, uint32_t s, uint32_t sh, uint32_t mb, uint32_t me)
+  {
+    return (21u << 26) | (s << 21) | (a << 16) | (sh << 11) | (mb << 6) | (me << 1);
+  }
+
+  bool m_fastMemEnabled;
+  UINT8 *m_pool = NULL;
+  CPPCFastMem m_fastMem;
+  std::vector<uint32_t> m_ram;
+  PPC_FETCH_REGION m_fetch[3];
+};
+
+/*
+ * CModel3 address decoding for a mix of RAM, Real3D, tile generator and CROM
+ * accesses, as seen from the PowerPC.
+ */
+class CModel3BusBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return "model3.bus"; }
+  const char *GetUnit(void) const { return "access"; }
+
+  bool Init(void)
+  {
+    m_model3.reset(new CModel3(m_config));
+    return m_model3->Init();
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    uint32_t sum = 0;
+    for (uint64_t i = 0; i < reps; i++)
+    {
+      uint32_t offset = (uint32_t(i) * 0x44) & 0x3FFFC;
+      sum += m_model3->Read32(0x00100000 + offset);
+      m_model3->Write32(0x00200000 + offset, sum);
+      m_model3->Write32(0x8C000000 + offset, sum);
+      m_model3->Write32(0x98000000 + offset, sum);
+      m_model3->Write32(0xF1000000 + offset, sum);
+      sum += m_model3->Read32(0xF1000000 + offset);
+      sum += m_model3->Read32(0xFF800000 + offset);
+    }
+    s_sink = sum;
+    return reps * 7;
+  }
+
+  CModel3BusBenchmark()
+    : m_config(BenchConfig(true))
+  {
+  }
+
+private:
+  Util::Config::Node m_config;
+  std::unique_ptr<CModel3> m_model3;
+};
+
+/*
+ * Real3D texture FIFO upload of a 256x256 16-bit texture with mipmaps. This
+ * is CReal3D::StoreTexture() plus the FIFO writes that feed it.
+ */
+class CTextureBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return "real3d.store_texture"; }
+  const char *GetUnit(void) const { return "texel"; }
+
+  bool Init(void)
+  {
+    m_texels = 0;
+    for (unsigned size = 256; size > 0; size /= 2)
+      m_texels += size * size;
+    CLCG rng;
+    m_data.resize((m_texels + 1) / 2);
+    for (auto &word: m_data)
+      word = rng.Next();
+    m_vrom.assign(0x1000, 0);
+    m_irq.Init();
+    m_gpu.SetStepping(0x21);
+    if (OKAY != m_gpu.Init(m_vrom.data(), NULL, &m_irq, 0x100))
+      return FAIL;
+    m_gpu.AttachRenderer(&m_render3D);
+    m_gpu.Reset();
+    return OKAY;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    // Header: 16-bit, both bytes written, 256x256, with mipmaps, at (0,0)
+    const uint32_t header = (1 << 23) | (1 << 22) | (1 << 21) | (3 << 17) | (3 << 14);
+    for (uint64_t i = 0; i < reps; i++)
+    {
+      m_gpu.WriteTextureFIFO(uint32_t(m_data.size() * 8));
+      m_gpu.WriteTextureFIFO(header);
+      for (uint32_t word: m_data)
+        m_gpu.WriteTextureFIFO(word);
+      m_gpu.Flush();
+    }
+    return reps * m_texels;
+  }
+
+  CTextureBenchmark()
+    : m_config(BenchConfig(false)),
+      m_gpu(m_config)
+  {
+  }
+
+private:
+  Util::Config::Node m_config;
+  CNullRender3D m_render3D;
+  CIRQ m_irq;
+  CReal3D m_gpu;
+  std::vector<uint8_t> m_vrom;
+  std::vector<uint32_t> m_data;
+  uint64_t m_texels;
+};
+
+/*
+ * Tile generator layers drawn on the CPU (CSoftRender2D) from random VRAM,
+ * all four layers enabled, two of them above 3D.
+ */
+class CTileGenBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return "tilegen.render_software"; }
+  const char *GetUnit(void) const { return "frame"; }
+
+  bool Init(void)
+  {
+    CLCG rng;
+    m_vram.resize(0x120000 / 4);
+    for (auto &word: m_vram)
+      word = rng.Next();
+    m_regs.assign(32, 0);
+    m_regs[0x20 / 4] = 0x3300;  // layers 0 and 1 above 3D, 4-bit
+    for (int i = 0; i < 4; i++)
+      m_regs[0x60 / 4 + i] = 0x80000000 | (rng.Next() & 0x01FF03FF);
+    m_bottom.resize(CSoftRender2D::WIDTH * CSoftRender2D::HEIGHT);
+    m_top.resize(CSoftRender2D::WIDTH * CSoftRender2D::HEIGHT);
+    return m_render.Init(0);
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    for (uint64_t i = 0; i < reps; i++)
+      m_render.Render(m_vram.data(), m_regs.data(), m_bottom.data(), m_top.data());
+    s_sink = m_bottom[0] ^ m_top[0];
+    return reps;
+  }
+
+private:
+  CSoftRender2D m_render;
+  std::vector<uint32_t> m_vram;
+  std::vector<uint32_t> m_regs;
+  std::vector<uint32_t> m_bottom;
+  std::vector<uint32_t> m_top;
+};
+
+/*
+ * Real3D read-only snapshot update (CReal3D::UpdateSnapshot()) at the end of
+ * a frame in which a scattered set of culling and polygon RAM pages changed.
+ */
+class CSnapshotBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return "real3d.update_snapshot"; }
+  const char *GetUnit(void) const { return "frame"; }
+
+  bool Init(void)
+  {
+    m_vrom.assign(0x1000, 0);
+    m_irq.Init();
+    m_gpu.SetStepping(0x21);
+    if (OKAY != m_gpu.Init(m_vrom.data(), NULL, &m_irq, 0x100))
+      return FAIL;
+    m_gpu.AttachRenderer(&m_render3D);
+    m_gpu.Reset();
+    return OKAY;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    uint32_t copied = 0;
+    for (uint64_t i = 0; i < reps; i++)
+    {
+      for (int j = 0; j < 64; j++)
+        m_gpu.WritePolygonRAM(m_rng.Next() & 0x3FFFFC, j);
+      for (int j = 0; j < 16; j++)
+        m_gpu.WriteLowCullingRAM(m_rng.Next() & 0x3FFFFC, j);
+      copied += m_gpu.SyncSnapshots();
+    }
+    s_sink = copied;
+    return reps;
+  }
+
+  CSnapshotBenchmark()
+    : m_config(BenchConfig(true)),
+      m_gpu(m_config)
+  {
+  }
+
+private:
+  Util::Config::Node m_config;
+  CNullRender3D m_render3D;
+  CIRQ m_irq;
+  CReal3D m_gpu;
+  std::vector<uint8_t> m_vrom;
+  CLCG m_rng;
+};
+
+/*
+ * A frame of bulk polygon RAM upload (256 KB written sequentially) followed by
+ * the snapshot update, with either dirty tracking method.
+ */
+class CBulkUploadBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return m_name; }
+  const char *GetUnit(void) const { return "frame"; }
+
+  bool Init(void)
+  {
+    m_vrom.assign(0x1000, 0);
+    m_irq.Init();
+    m_gpu.SetStepping(0x21);
+    if (OKAY != m_gpu.Init(m_vrom.data(), NULL, &m_irq, 0x100))
+      return FAIL;
+    m_gpu.AttachRenderer(&m_render3D);
+    m_gpu.Reset();
+    return OKAY;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    uint32_t copied = 0;
+    for (uint64_t i = 0; i < reps; i++)
+    {
+      uint32_t base = (uint32_t(i) * 0x40000) & 0x3FFFFF;
+      for (uint32_t offset = 0; offset < 0x40000; offset += 4)
+        m_gpu.WritePolygonRAM(base + offset, offset);
+      copied += m_gpu.SyncSnapshots();
+    }
+    s_sink = copied;
+    return reps;
+  }
+
+  CBulkUploadBenchmark(const char *name, const char *tracking)
+    : m_name(name),
+      m_config(TrackingConfig(tracking)),
+      m_gpu(m_config)
+  {
+  }
+
+private:
+  static Util::Config::Node TrackingConfig(const char *tracking)
+  {
+    Util::Config::Node config = BenchConfig(true);
+    config.Set("GPUDirtyTracking", tracking);
+    return config;
+  }
+
+  const char *m_name;
+  Util::Config::Node m_config;
+  CNullRender3D m_render3D;
+  CIRQ m_irq;
+  CReal3D m_gpu;
+  std::vector<uint8_t> m_vrom;
+};
+
+/*
+ * Dependent loads scattered over 64 MB of arena memory, the access pattern of
+ * texture decoding and culling RAM traversal at its worst, in regular or huge
+ * pages. Measures TLB reach.
+ */
+class CArenaBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return m_name; }
+  const char *GetUnit(void) const { return "load"; }
+
+  bool Init(void)
+  {
+    m_mem = (uint32_t *) Util::MemoryArena::Allocate(m_name, SIZE, m_flags);
+    if (NULL == m_mem)
+      return FAIL;
+
+    // One cycle through all cache lines in random order (Sattolo's algorithm)
+    const uint32_t lines = SIZE / 64;
+    std::vector<uint32_t> order(lines);
+    for (uint32_t i = 0; i < lines; i++)
+      order[i] = i;
+    CLCG rng;
+    for (uint32_t i = lines - 1; i > 0; i--)
+      std::swap(order[i], order[(rng.Next() >> 8) % i]);
+    for (uint32_t i = 0; i < lines; i++)
+      m_mem[order[i] * 16] = order[(i + 1) % lines] * 16;
+    return OKAY;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    uint32_t index = m_index;
+    for (uint64_t i = 0; i < reps; i++)
+      index = m_mem[index];
+    m_index = index;
+    return reps;
+  }
+
+  CArenaBenchmark(const char *name, unsigned flags)
+    : m_name(name),
+      m_flags(flags)
+  {
+  }
+
+  ~CArenaBenchmark()
+  {
+    if (m_mem != NULL)
+      Util::MemoryArena::Free((uint8_t *) m_mem);
+  }
+
+private:
+  static const uint32_t SIZE = 64 * 1024 * 1024;
+
+  const char *m_name;
+  unsigned m_flags;
+  uint32_t *m_mem = NULL;
+  uint32_t m_index = 0;
+};
+
+/*
+ * SCSP sample generation (SCSP_DoMasterSamples(), via SCSP_Update()) with all
+ * 32 master slots keyed on and looping. The 68K is not run.
+ */
+class CSCSPBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return "scsp.master_samples"; }
+  const char *GetUnit(void) const { return "sample"; }
+
+  bool Init(void)
+  {
+    CLCG rng;
+    for (auto &byte: m_ram)
+      byte = uint8_t(rng.Next() >> 24);
+    if (OKAY != SCSP_Init(m_config, 2))
+      return FAIL;
+    m_initialized = true;
+    SCSP_SetRAM(0, m_ram.data());
+    SCSP_SetRAM(1, m_ram.data() + 0x100000);
+    SCSP_SetCB(Run68K, Interrupt68K, Cycles68K, End68K);
+    SCSP_SetBuffers(m_buffer[0], m_buffer[1], m_buffer[2], m_buffer[3], NUM_SAMPLES_PER_FRAME);
+
+    SCSP_Master_w16(0x400, 0x000F);                       // master volume
+    for (unsigned slot = 0; slot < 32; slot++)
+    {
+      unsigned reg = slot * 0x20;
+      SCSP_Master_w16(reg + 0x00, 0x0020 | ((slot >> 4) & 0xF)); // LPCTL=normal loop, SA high
+      SCSP_Master_w16(reg + 0x02, (slot << 12) & 0xFFFF);        // SA low
+      SCSP_Master_w16(reg + 0x04, 0x0000);                       // LSA
+      SCSP_Master_w16(reg + 0x06, 0x07FF);                       // LEA
+      SCSP_Master_w16(reg + 0x08, 0x001F);                       // AR
+      SCSP_Master_w16(reg + 0x0A, 0x001F);                       // RR
+      SCSP_Master_w16(reg + 0x0C, 0x0010);                       // TL
+      SCSP_Master_w16(reg + 0x10, slot * 31);                    // FNS
+      SCSP_Master_w16(reg + 0x14, ((slot & 0xF) << 3) | 3);      // ISEL, IMXL
+      SCSP_Master_w16(reg + 0x16, 0xA000 | ((slot & 0x1F) << 8)); // DISDL, DIPAN
+    }
+    for (unsigned slot = 0; slot < 32; slot++)
+      SCSP_Master_w16(slot * 0x20, 0x1820 | ((slot >> 4) & 0xF)); // KYONEX|KYONB
+    return OKAY;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    for (uint64_t i = 0; i < reps; i++)
+      SCSP_Update();
+    return reps * NUM_SAMPLES_PER_FRAME;
+  }
+
+  CSCSPBenchmark()
+    : m_config(BenchConfig(false)),
+      m_ram(0x200000)
+  {
+  }
+
+  ~CSCSPBenchmark()
+  {
+    if (m_initialized)
+      SCSP_Deinit();
+  }
+
+private:
+  static int Run68K(int cycles) { return 0; }
+  static void Interrupt68K(int irq) {}
+  static int Cycles68K(void) { return 0; }
+  static void End68K(void) {}
+
+  Util::Config::Node m_config;
+  std::vector<uint8_t> m_ram;
+  float m_buffer[4][NUM_SAMPLES_PER_FRAME];
+  bool m_initialized = false;
+};
+
+/*
+ * SCSP DSP step over a full 128-step microprogram with valid input
+ * addresses.
+ */
+class CSCSPDSPBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return "scspdsp.step"; }
+  const char *GetUnit(void) const { return "sample"; }
+
+  bool Init(void)
+  {
+    CLCG rng;
+    m_ram.assign(0x80000, 0);
+    SCSPDSP_Init(&m_dsp);
+    m_dsp.SCSPRAM = m_ram.data();
+    m_dsp.SCSPRAM_LENGTH = (uint32_t) m_ram.size();
+    m_dsp.RBP = 0;
+    m_dsp.RBL = 0x8000;
+    for (int i = 0; i < 64; i++)
+      m_dsp.COEF[i] = INT16(rng.Next() >> 20);
+    for (int i = 0; i < 32; i++)
+      m_dsp.MADRS[i] = UINT16(rng.Next() >> 16);
+    for (int step = 0; step < 128; step++)
+    {
+      UINT16 *mpro = &m_dsp.MPRO[step * 4];
+      for (int i = 0; i < 4; i++)
+        mpro[i] = UINT16(rng.Next() >> 16);
+      unsigned ira = (rng.Next() >> 16) % 0x32;
+      mpro[1] = UINT16((mpro[1] & ~(0x3F << 6)) | (ira << 6));
+    }
+    SCSPDSP_Start(&m_dsp);
+    return OKAY;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    for (uint64_t i = 0; i < reps; i++)
+    {
+      SCSPDSP_SetSample(&m_dsp, INT32(m_rng.Next()) >> 12, int(i & 0xF), 7);
+      SCSPDSP_Step(&m_dsp);
+    }
+    s_sink = m_dsp.EFREG[0];
+    return reps;
+  }
+
+private:
+  _SCSPDSP m_dsp;
+  std::vector<UINT16> m_ram;
+  CLCG m_rng;
+};
+
+/*
+ * DSB MPEG up-sampling from 32KHz to 44.1KHz and mixing, one frame at a time.
+ */
+class CResamplerBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return "dsb.resampler"; }
+  const char *GetUnit(void) const { return "sample"; }
+
+  bool Init(void)
+  {
+    CLCG rng;
+    for (int i = 0; i < IN_SIZE + 2; i++)
+    {
+      m_inL[i] = INT16(rng.Next() >> 16);
+      m_inR[i] = INT16(rng.Next() >> 16);
+    }
+    memset(m_outL, 0, sizeof(m_outL));
+    memset(m_outR, 0, sizeof(m_outR));
+    m_resampler.Reset();
+    return OKAY;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    for (uint64_t i = 0; i < reps; i++)
+      s_sink = m_resampler.UpSampleAndMix(m_outL, m_outR, m_inL, m_inR, 0xFF, 0xFF, NUM_SAMPLES_PER_FRAME, IN_SIZE, 44100, 32000);
+    return reps * NUM_SAMPLES_PER_FRAME;
+  }
+
+  CResamplerBenchmark()
+    : m_config(BenchConfig(false)),
+      m_resampler(m_config)
+  {
+  }
+
+private:
+  static const int IN_SIZE = 32000/60 + 2;
+
+  Util::Config::Node m_config;
+  CDSBResampler m_resampler;
+  INT16 m_inL[IN_SIZE + 2];
+  INT16 m_inR[IN_SIZE + 2];
+  float m_outL[NUM_SAMPLES_PER_FRAME];
+  float m_outR[NUM_SAMPLES_PER_FRAME];
+};
+
+/*
+ * Z80 interpreter running a byte-table update loop with idle skipping off.
+ */
+class CZ80Benchmark: public IBenchmark, public IBus
+{
+public:
+  const char *GetName(void) const { return "z80.run"; }
+  const char *GetUnit(void) const { return "cycle"; }
+
+  bool Init(void)
+  {
+    static const UINT8 program[] =
+    {
+      0x21, 0x00, 0x80, // 0000: ld   hl,8000h
+      0x06, 0x00,       // 0003: ld   b,0
+      0x7E,             // 0005: ld   a,(hl)
+      0x80,             // 0006: add  a,b
+      0xEE, 0x5A,       // 0007: xor  5Ah
+      0x77,             // 0009: ld   (hl),a
+      0x23,             // 000A: inc  hl
+      0x10, 0xF8,       // 000B: djnz 0005h
+      0xC3, 0x00, 0x00  // 000D: jp   0000h
+    };
+    memset(m_ram, 0, sizeof(m_ram));
+    memcpy(m_ram, program, sizeof(program));
+    m_z80.Init(this, NULL);
+    m_z80.SetIdleSkip(false);
+    m_z80.Reset();
+    return OKAY;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    uint64_t cycles = 0;
+    for (uint64_t i = 0; i < reps; i++)
+      cycles += m_z80.Run(4000);
+    return cycles;
+  }
+
+  UINT8 Read8(UINT32 addr)
+  {
+    return m_ram[addr & 0xFFFF];
+  }
+
+  void Write8(UINT32 addr, UINT8 data)
+  {
+    m_ram[addr & 0xFFFF] = data;
+  }
+
+private:
+  CZ80 m_z80;
+  UINT8 m_ram[0x10000];
+};
+
+/*
+ * Security board block cipher (CCrypto::block_decrypt()), one 16-bit word at
+ * a time. The stream and decompression layers around it are not exercised:
+ * on anything but genuine encrypted data they run off their line buffers.
+ */
+class CCryptoBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return "crypto.block_decrypt"; }
+  const char *GetUnit(void) const { return "word"; }
+
+  bool Init(void)
+  {
+    return OKAY;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    uint32_t sum = 0;
+    for (uint64_t i = 0; i < reps; i++)
+    {
+      uint16_t counter = uint16_t(m_counter++);
+      sum += CCrypto::block_decrypt(0x29222AC8, 0x1234, counter, uint16_t(counter * 0x9E37));
+    }
+    s_sink = sum;
+    return reps;
+  }
+
+private:
+  uint32_t m_counter = 0;
+};
+
+/*
+ * Per-frame board handoff as done by CModel3::EmulateFrame(): wake a board
+ * thread with a CEvent, then wait on a CBarrier for it to finish. The board
+ * does no work, so this is the round-trip cost of the notify path alone. Run
+ * with spinning (the defaults of ThreadWakeSpin and ThreadSyncSpin) and
+ * without, where every handoff goes through the kernel.
+ */
+class CHandoffBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return m_name; }
+  const char *GetUnit(void) const { return "frame"; }
+
+  bool Init(void)
+  {
+    m_wake = CThread::CreateEvent(m_wakeSpin);
+    m_done = CThread::CreateBarrier(m_syncSpin);
+    if (m_wake == NULL || m_done == NULL)
+      return FAIL;
+    m_thread = CThread::CreateThread("BenchBoard", Board, this);
+    return m_thread != NULL ? OKAY : FAIL;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    for (uint64_t i = 0; i < reps; i++)
+    {
+      m_done->Reset(1);
+      m_wake->Set();
+      m_done->Wait();
+    }
+    return reps;
+  }
+
+  CHandoffBenchmark(const char *name, UINT32 wakeSpin, UINT32 syncSpin)
+    : m_name(name),
+      m_wakeSpin(wakeSpin),
+      m_syncSpin(syncSpin)
+  {
+  }
+
+  ~CHandoffBenchmark()
+  {
+    if (m_thread != NULL)
+    {
+      m_stop = true;
+      m_wake->Set();
+      m_thread->Wait();
+      delete m_thread;
+    }
+    delete m_wake;
+    delete m_done;
+  }
+
+private:
+  static int Board(void *data)
+  {
+    CHandoffBenchmark *self = (CHandoffBenchmark *) data;
+    for (;;)
+    {
+      self->m_wake->Wait();
+      if (self->m_stop)
+        return 0;
+      self->m_done->Arrive();
+    }
+  }
+
+  const char *m_name;
+  UINT32 m_wakeSpin;
+  UINT32 m_syncSpin;
+  CEvent *m_wake = NULL;
+  CBarrier *m_done = NULL;
+  CThread *m_thread = NULL;
+  bool m_stop = false;
+};
+
+/*
+ * The same handoff through CSemaphore and CMutex/CCondVar, the way
+ * EmulateFrame() used to do it, for comparison.
+ */
+class CSemaphoreHandoffBenchmark: public IBenchmark
+{
+public:
+  const char *GetName(void) const { return "thread.handoff_semaphore"; }
+  const char *GetUnit(void) const { return "frame"; }
+
+  bool Init(void)
+  {
+    m_wake = CThread::CreateSemaphore(0);
+    m_lock = CThread::CreateMutex();
+    m_cond = CThread::CreateCondVar();
+    if (m_wake == NULL || m_lock == NULL || m_cond == NULL)
+      return FAIL;
+    m_thread = CThread::CreateThread("BenchBoard", Board, this);
+    return m_thread != NULL ? OKAY : FAIL;
+  }
+
+  uint64_t Run(uint64_t reps)
+  {
+    for (uint64_t i = 0; i < reps; i++)
+    {
+      m_wake->Post();
+      m_lock->Lock();
+      while (!m_done)
+        m_cond->Wait(m_lock);
+      m_done = false;
+      m_lock->Unlock();
+    }
+    return reps;
+  }
+
+  ~CSemaphoreHandoffBenchmark()
+  {
+    if (m_thread != NULL)
+    {
+      m_stop = true;
+      m_wake->Post();
+      m_thread->Wait();
+      delete m_thread;
+    }
+    delete m_wake;
+    delete m_lock;
+    delete m_cond;
+  }
+
+private:
+  static int Board(void *data)
+  {
+    CSemaphoreHandoffBenchmark *self = (CSemaphoreHandoffBenchmark *) data;
+    for (;;)
+    {
+      self->m_wake->Wait();
+      if (self->m_stop)
+        return 0;
+      self->m_lock->Lock();
+      self->m_done = true;
+      self->m_cond->SignalAll();
+      self->m_lock->Unlock();
+    }
+  }
+
+  CSemaphore *m_wake = NULL;
+  CMutex *m_lock = NULL;
+  CCondVar *m_cond = NULL;
+  CThread *m_thread = NULL;
+  bool m_done = false;
+  bool m_stop = false;
+};
+
+static std::vector<std::unique_ptr<IBenchmark>> CreateBenchmarks(void)
+{
+  std::vector<std::unique_ptr<IBenchmark>> benchmarks;
+  benchmarks.emplace_back(new CPPCBenchmark(false));
+  if (CPPCFastMem::IsSupported())
+    benchmarks.emplace_back(new CPPCBenchmark(true));
+  benchmarks.emplace_back(new CModel3BusBenchmark());
+  benchmarks.emplace_back(new CTextureBenchmark());
+  benchmarks.emplace_back(new CSnapshotBenchmark());
+  benchmarks.emplace_back(new CTileGenBenchmark());
+  benchmarks.emplace_back(new CBulkUploadBenchmark("real3d.bulk_upload", "software"));
+  if (Util::WriteWatch::IsSupported())
+    benchmarks.emplace_back(new CBulkUploadBenchmark("real3d.bulk_upload_hardware", "hardware"));
+  benchmarks.emplace_back(new CArenaBenchmark("memory.random_load", Util::MemoryArena::SMALL_PAGES));
+  benchmarks.emplace_back(new CArenaBenchmark("memory.random_load_huge", 0));
+  benchmarks.emplace_back(new CSCSPBenchmark());
+  benchmarks.emplace_back(new CSCSPDSPBenchmark());
+  benchmarks.emplace_back(new CResamplerBenchmark());
+  benchmarks.emplace_back(new CZ80Benchmark());
+  benchmarks.emplace_back(new CCryptoBenchmark());
+  benchmarks.emplace_back(new CHandoffBenchmark("thread.handoff", 50, 200));
+  benchmarks.emplace_back(new CHandoffBenchmark("thread.handoff_blocking", 0, 0));
+  benchmarks.emplace_back(new CSemaphoreHandoffBenchmark());
+  return benchmarks;
+}
+
+
+/******************************************************************************
+ Measurement
+******************************************************************************/
+
+struct BenchResult
+{
+  double nsPerOp;   // fastest sample
+  double spread;    // (slowest - fastest) / fastest
+};
+
+static double TimeRun(IBenchmark *bench, uint64_t reps, uint64_t *ops)
+{
+  auto start = std::chrono::steady_clock::now();
+  *ops = bench->Run(reps);
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+static BenchResult Measure(IBenchmark *bench, unsigned samples, double minTimeMs)
+{
+  // Calibrate the repetition count; this doubles as a warm-up
+  double minTimeNs = minTimeMs * 1e6;
+  uint64_t reps = 1;
+  uint64_t ops;
+  double ns;
+  while ((ns = TimeRun(bench, reps, &ops)) < minTimeNs / 4)
+    reps *= 2;
+  reps = std::max<uint64_t>(1, uint64_t(std::ceil(double(reps) * minTimeNs / ns)));
+
+  std::vector<double> nsPerOp;
+  for (unsigned i = 0; i < samples; i++)
+  {
+    ns = TimeRun(bench, reps, &ops);
+    nsPerOp.push_back(ns / double(std::max<uint64_t>(1, ops)));
+  }
+  std::sort(nsPerOp.begin(), nsPerOp.end());
+
+  BenchResult result;
+  result.nsPerOp = nsPerOp.front();
+  result.spread = (nsPerOp.back() - nsPerOp.front()) / result.nsPerOp;
+  return result;
+}
+
+
+/******************************************************************************
+ Baselines
+
+ A baseline is a flat JSON object mapping kernel names to ns/op, e.g.:
+
+   {
+     "ppc.interpreter": 3.1415,
+     "z80.run": 1.4142
+   }
+******************************************************************************/
+
+static bool LoadBaseline(std::map<std::string, double> *baseline, const std::string &path)
+{
+  std::ifstream file(path);
+  if (!file)
+    return ErrorLog("Unable to open benchmark baseline '%s'.", path.c_str());
+  std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  size_t pos = 0;
+  while ((pos = text.find('"', pos)) != std::string::npos)
+  {
+    size_t end = text.find('"', pos + 1);
+    if (end == std::string::npos)
+      break;
+    std::string key = text.substr(pos + 1, end - pos - 1);
+    pos = text.find_first_not_of(" \t\r\n", end + 1);
+    if (pos == std::string::npos || text[pos] != ':')
+    {
+      pos = end + 1;
+      continue;
+    }
+    const char *value = text.c_str() + pos + 1;
+    char *valueEnd;
+    double ns = strtod(value, &valueEnd);
+    if (valueEnd != value)
+      (*baseline)[key] = ns;
+    pos = valueEnd - text.c_str();
+  }
+
+  if (baseline->empty())
+    return ErrorLog("Benchmark baseline '%s' contains no results.", path.c_str());
+  return OKAY;
+}
+
+static bool SaveBaseline(const std::vector<std::pair<std::string, double>> &results, const std::string &path)
+{
+  FILE *fp = fopen(path.c_str(), "w");
+  if (NULL == fp)
+    return ErrorLog("Unable to write benchmark results to '%s'.", path.c_str());
+  fprintf(fp, "{\n");
+  for (size_t i = 0; i < results.size(); i++)
+    fprintf(fp, "  \"%s\": %.4f%s\n", results[i].first.c_str(), results[i].second, i + 1 < results.size() ? "," : "");
+  fprintf(fp, "}\n");
+  fclose(fp);
+  return OKAY;
+}
+
+
+/******************************************************************************
+ Entry Point
+******************************************************************************/
+
+static void Help(void)
+{
+  puts("Usage: bench [options]");
+  puts("Runs microbenchmarks of the emulator's hot kernels.");
+  puts("");
+  puts("Options:");
+  puts("  -filter=<text>          Run only kernels whose name contains <text>");
+  puts("  -samples=<n>            Timed samples per kernel, fastest is reported");
+  puts("                          [Default: 7]");
+  puts("  -min-time=<ms>          Minimum duration of one sample [Default: 100]");
+  puts("  -save=<file>            Write results to a JSON baseline file");
+  puts("  -baseline=<file>        Compare against a JSON baseline file");
+  puts("  -threshold=<percent>    Slowdown over baseline that counts as a");
+  puts("                          regression [Default: 5]");
+  puts("  -list                   List kernels and exit");
+  puts("  -help                   Print this message");
+  puts("");
+  puts("Exit status is 1 if any kernel regressed against the baseline.");
+}
+
+static bool ParseValue(const std::string &arg, const char *option, std::string *value)
+{
+  size_t len = strlen(option);
+  if (arg.compare(0, len, option) != 0 || arg.size() <= len || arg[len] != '=')
+    return false;
+  *value = arg.substr(len + 1);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  SetLogger(std::make_shared<CConsoleErrorLogger>());
+
+  std::string filter;
+  std::string savePath;
+  std::string baselinePath;
+  unsigned samples = 7;
+  double minTimeMs = 100;
+  double threshold = 5;
+  bool list = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg(argv[i]);
+    std::string value;
+    if (ParseValue(arg, "-filter", &value))
+      filter = value;
+    else if (ParseValue(arg, "-samples", &value))
+      samples = std::max(1, atoi(value.c_str()));
+    else if (ParseValue(arg, "-min-time", &value))
+      minTimeMs = std::max(1.0, atof(value.c_str()));
+    else if (ParseValue(arg, "-save", &value))
+      savePath = value;
+    else if (ParseValue(arg, "-baseline", &value))
+      baselinePath = value;
+    else if (ParseValue(arg, "-threshold", &value))
+      threshold = std::max(0.0, atof(value.c_str()));
+    else if (arg == "-list")
+      list = true;
+    else if (arg == "-help" || arg == "--help" || arg == "-?")
+    {
+      Help();
+      return 0;
+    }
+    else
+    {
+      ErrorLog("Unrecognized option: %s", arg.c_str());
+      return 1;
+    }
+  }
+
+  std::map<std::string, double> baseline;
+  if (!baselinePath.empty() && OKAY != LoadBaseline(&baseline, baselinePath))
+    return 1;
+
+  auto benchmarks = CreateBenchmarks();
+  if (list)
+  {
+    for (auto &bench: benchmarks)
+      printf("%-24s ns per %s\n", bench->GetName(), bench->GetUnit());
+    return 0;
+  }
+
+  printf("%-24s %10s %7s  %-12s", "Kernel", "ns/op", "spread", "op");
+  if (!baseline.empty())
+    printf(" %10s %8s", "baseline", "change");
+  printf("\n");
+
+  std::vector<std::pair<std::string, double>> results;
+  unsigned regressions = 0;
+  for (auto &bench: benchmarks)
+  {
+    std::string name(bench->GetName());
+    std::string unit(bench->GetUnit());
+    if (!filter.empty() && name.find(filter) == std::string::npos)
+      continue;
+    if (OKAY != bench->Init())
+    {
+      ErrorLog("Unable to initialize benchmark %s.", name.c_str());
+      return 1;
+    }
+
+    BenchResult result = Measure(bench.get(), samples, minTimeMs);
+    results.emplace_back(name, result.nsPerOp);
+    bench.reset();  // release memory before the next kernel
+
+    printf("%-24s %10.3f %6.1f%%  %-12s", name.c_str(), result.nsPerOp, 100 * result.spread, unit.c_str());
+    auto it = baseline.find(name);
+    if (it != baseline.end() && it->second > 0)
+    {
+      double change = 100 * (result.nsPerOp - it->second) / it->second;
+      bool regressed = change > threshold;
+      printf(" %10.3f %+7.1f%%%s", it->second, change, regressed ? "  REGRESSION" : "");
+      regressions += regressed ? 1 : 0;
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+
+  if (!savePath.empty() && OKAY != SaveBaseline(results, savePath))
+    return 1;
+  if (regressions)
+  {
+    printf("%u kernel(s) regressed by more than %1.1f%%.\n", regressions, threshold);
+    return 1;
+  }
+  return 0;
+}
@@ -28,27 +28,86 @@
 
 #include "BlockFile.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <cstdint>
 #include "Supermodel.h"
 
 
+/******************************************************************************
+ Stream Access
+ 
+ Everything goes through these so that a block file can live either in a
+ file on disk or in a memory buffer.
+******************************************************************************/
+
+bool CBlockFile::IsOpen(void) const
+{
+  return fp != NULL || writeBuffer != NULL || readData != NULL;
+}
+
+long int CBlockFile::Tell(void) const
+{
+  if (fp != NULL)
+    return ftell(fp);
+  return memPos;
+}
+
+void CBlockFile::Seek(long int pos)
+{
+  if (fp != NULL)
+    fseek(fp, pos, SEEK_SET);
+  else
+    memPos = pos;
+}
+
+size_t CBlockFile::RawRead(void *data, size_t numBytes)
+{
+  if (fp != NULL)
+    return fread(data, sizeof(uint8_t), numBytes, fp);
+  if (readData == NULL || memPos >= fileSize)
+    return 0;
+  if (numBytes > size_t(fileSize - memPos))
+    numBytes = fileSize - memPos;
+  memcpy(data, readData + memPos, numBytes);
+  memPos += numBytes;
+  return numBytes;
+}
+
+void CBlockFile::RawWrite(const void *data, size_t numBytes)
+{
+  if (fp != NULL)
+  {
+    fwrite(data, sizeof(uint8_t), numBytes, fp);
+    return;
+  }
+  if (writeBuffer == NULL)
+    return;
+  const uint8_t *bytes = (const uint8_t *) data;
+  size_t pos = memPos;
+  size_t overwrite = pos < writeBuffer->size() ? std::min(numBytes, writeBuffer->size() - pos) : 0;
+  memcpy(writeBuffer->data() + pos, bytes, overwrite);
+  writeBuffer->insert(writeBuffer->end(), bytes + overwrite, bytes + numBytes);
+  memPos += numBytes;
+}
+
+
 /******************************************************************************
  Output Functions
 ******************************************************************************/
 
 void CBlockFile::ReadString(std::string *str, uint32_t length)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return;
   str->clear();
   //TODO: use fstream to get rid of this ugly hack
   bool keep_loading = true;
   for (uint32_t i = 0; i < length; i++)
   {
-    char c;
-    fread(&c, sizeof(char), 1, fp);
+    char c = 0;
+    RawRead(&c, sizeof(char));
     if (keep_loading)
     {
       if (!c)
@@ -61,16 +120,16 @@ void CBlockFile::ReadString(std::string *str, uint32_t length)
 
 unsigned CBlockFile::ReadBytes(void *data, uint32_t numBytes)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return 0;
-  return fread(data, sizeof(uint8_t), numBytes, fp);
+  return RawRead(data, numBytes);
 }
 
 unsigned CBlockFile::ReadDWord(uint32_t *data)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return 0;
-  fread(data, sizeof(uint32_t), 1, fp);
+  RawRead(data, sizeof(uint32_t));
   return 4;
 }
   
@@ -79,46 +138,46 @@ void CBlockFile::UpdateBlockSize(void)
   long int  curPos;
   unsigned  newBlockSize;
   
-  if (NULL == fp)
+  if (!IsOpen())
     return;
-  curPos = ftell(fp);       // save current file position
-  fseek(fp, blockStartPos, SEEK_SET);
+  curPos = Tell();          // save current file position
+  Seek(blockStartPos);
   newBlockSize = curPos - blockStartPos;
-  fwrite(&newBlockSize, sizeof(uint32_t), 1, fp);
-  fseek(fp, curPos, SEEK_SET);  // go back
+  RawWrite(&newBlockSize, sizeof(uint32_t));
+  Seek(curPos);             // go back
 }
 
 void CBlockFile::WriteByte(uint8_t data)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return;
-  fwrite(&data, sizeof(uint8_t), 1, fp);
+  RawWrite(&data, sizeof(uint8_t));
   UpdateBlockSize();
 }
 
 void CBlockFile::WriteDWord(uint32_t data)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return;
-  fwrite(&data, sizeof(uint32_t), 1, fp);
+  RawWrite(&data, sizeof(uint32_t));
   UpdateBlockSize();
 }
 
 void CBlockFile::WriteBytes(const void *data, uint32_t numBytes)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return;
-  fwrite(data, sizeof(uint8_t), numBytes, fp);
+  RawWrite(data, numBytes);
   UpdateBlockSize();
 }
 
 void CBlockFile::WriteBlockHeader(const std::string &name, const std::string &comment)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return;
   
   // Record current block starting position
-  blockStartPos = ftell(fp);
+  blockStartPos = Tell();
 
   // Write the total block length field
   WriteDWord(0);  // will be automatically updated as we write the file
@@ -130,7 +189,7 @@ void CBlockFile::WriteBlockHeader(const std::string &name, const std::string &co
   Write(comment);
   
   // Record the start of the current data section
-  dataStartPos = ftell(fp);
+  dataStartPos = Tell();
 } 
 
 
@@ -195,7 +254,7 @@ bool CBlockFile::FindBlock(const std::string &name)
   if (mode != 'r')
     return FAIL;
     
-  fseek(fp, 0, SEEK_SET);
+  Seek(0);
   
   long int  curPos = 0;
   while (curPos < fileSize)
@@ -215,13 +274,13 @@ bool CBlockFile::FindBlock(const std::string &name)
     // Is this the block we want?
     if (block_name == name)
     {
-      fseek(fp, blockStartPos + 12 + name_length + comment_length, SEEK_SET); // move to beginning of data
-      dataStartPos = ftell(fp);
+      Seek(blockStartPos + 12 + name_length + comment_length); // move to beginning of data
+      dataStartPos = Tell();
       return OKAY;
     }
     
     // Move to next block
-    fseek(fp, blockStartPos + block_length, SEEK_SET);
+    Seek(blockStartPos + block_length);
     curPos = blockStartPos + block_length;
     if (block_length == 0)  // this would never advance
       break;
@@ -239,6 +298,16 @@ bool CBlockFile::Create(const std::string &file, const std::string &headerName,
   WriteBlockHeader(headerName, comment);
   return OKAY;
 }
+
+bool CBlockFile::Create(std::vector<uint8_t> *buffer, const std::string &headerName, const std::string &comment)
+{
+  buffer->clear();
+  writeBuffer = buffer;
+  memPos = 0;
+  mode = 'w';
+  WriteBlockHeader(headerName, comment);
+  return OKAY;
+}
   
 bool CBlockFile::Load(const std::string &file)
 {
@@ -256,18 +325,34 @@ bool CBlockFile::Load(const std::string &file)
   
   return OKAY;
 }
+
+bool CBlockFile::Load(const uint8_t *data, size_t size)
+{
+  if (NULL == data)
+    return FAIL;
+  readData = data;
+  fileSize = size;
+  memPos = 0;
+  mode = 'r';
+  return OKAY;
+}
   
 void CBlockFile::Close(void)
 {
   if (fp != NULL)
     fclose(fp);
   fp = NULL;
+  writeBuffer = NULL;
+  readData = NULL;
   mode = 0;
 }
 
 CBlockFile::CBlockFile(void)
 {
   fp = NULL;
+  writeBuffer = NULL;
+  readData = NULL;
+  memPos = 0;
   mode = 0;   // neither reading nor writing (do nothing)
 }
 
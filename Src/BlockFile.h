@@ -29,7 +29,9 @@
 #define INCLUDED_BLOCKFILE_H
 
 #include <cstdint>
+#include <cstdio>
 #include <string>
+#include <vector>
 
 /*
  * CBlockFile:
@@ -40,6 +42,10 @@
  * All strings (comments and names) will be truncated to 1024 bytes, not
  * including the null terminator.
  *
+ * Besides files on disk, block files can be created in and loaded from
+ * memory buffers, which is how in-memory snapshots (e.g., rewind) are taken
+ * without touching the file system.
+ *
  * Members do not generate any output messages.
  */
 class CBlockFile
@@ -151,6 +157,23 @@ public:
    */
   bool Create(const std::string &file, const std::string &headerName, const std::string &comment);
 
+  /*
+   * Create(buffer, headerName, comment):
+   *
+   * Same as above but writes to a memory buffer, which is cleared first (its
+   * capacity is kept, so reusing a buffer avoids reallocating it). The buffer
+   * must remain valid until Close() is called.
+   *
+   * Parameters:
+   *    buffer      Buffer to write to.
+   *    headerName  Block name for header. Must be unique and not NULL.
+   *    comment     Comment string that will be embedded into file header.
+   *
+   * Returns:
+   *    OKAY.
+   */
+  bool Create(std::vector<uint8_t> *buffer, const std::string &headerName, const std::string &comment);
+
   /*
    * Load(file):
    *
@@ -167,6 +190,21 @@ public:
    */
   bool Load(const std::string &file);
 
+  /*
+   * Load(data, size):
+   *
+   * Opens a block file held in memory for reading. The data is not copied
+   * and must remain valid until Close() is called.
+   *
+   * Parameters:
+   *    data  Block file contents.
+   *    size  Size in bytes.
+   *
+   * Returns:
+   *    OKAY if data is non-NULL, otherwise FAIL.
+   */
+  bool Load(const uint8_t *data, size_t size);
+
   /*
    * Close(void):
    *
@@ -184,6 +222,13 @@ public:
   ~CBlockFile(void);
 
 private:
+  // Stream access (file or memory)
+  bool      IsOpen(void) const;
+  long int  Tell(void) const;
+  void      Seek(long int pos);
+  size_t    RawRead(void *data, size_t numBytes);
+  void      RawWrite(const void *data, size_t numBytes);
+
   // Helper functions
   void      ReadString(std::string *str, uint32_t length);
   unsigned  ReadBytes(void *data, uint32_t numBytes);
@@ -200,6 +245,11 @@ private:
   long int  fileSize;       // size of file in bytes
   long int  blockStartPos;  // points to beginning of current block (or file) header
   long int  dataStartPos;   // points to beginning of current block's data section 
+
+  // Memory state data (used instead of fp when non-NULL)
+  std::vector<uint8_t> *writeBuffer;
+  const uint8_t        *readData;
+  long int              memPos;
 };
 
 
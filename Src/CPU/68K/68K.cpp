@@ -39,6 +39,10 @@
 #include "Musashi/m68k.h"	// Musashi 68K core
 #include "Debugger/CPU/Musashi68KDebug.h"
 
+// Musashi internals (m68kcpu.c), used directly by idle loop detection
+extern "C" m68ki_cpu_core m68ki_cpu;
+extern "C" int m68ki_remaining_cycles;
+
 /******************************************************************************
  Internal Context
 
@@ -50,6 +54,13 @@
 // Bus
 static IBus	*s_Bus = NULL;
 
+// Direct-access page tables: the attached map and the one actually consulted
+// by the memory handlers (an empty map when none is attached or a debugger is
+// watching the bus)
+static M68KMemoryMap		s_NoMap;
+static M68KMemoryMap		*s_Map = NULL;
+static const M68KMemoryMap	*s_Pages = &s_NoMap;
+
 #ifdef SUPERMODEL_DEBUGGER
 // Debugger
 static Debugger::CMusashi68KDebug *s_Debug = NULL;
@@ -58,6 +69,29 @@ static Debugger::CMusashi68KDebug *s_Debug = NULL;
 // IRQ callback
 static int	(*IRQAck)(int nIRQ) = NULL;
 
+// Idle loop detection: state at the last backward branch. s_IdleEvents is
+// bumped by anything that could make the next loop iteration differ.
+static bool		s_IdleSkip = false;
+static UINT32	s_IdleEvents = 0;
+static struct
+{
+	UINT32	pc;			// branch address (0xFFFFFFFF if none yet)
+	UINT32	events;
+	int		cycles;		// cycles remaining in timeslice
+	UINT32	dar[16];
+	UINT32	flags[8];
+} s_Idle;
+
+static void UpdatePages(void)
+{
+	s_Pages = (NULL != s_Map) ? s_Map : &s_NoMap;
+#ifdef SUPERMODEL_DEBUGGER
+	// Debugger wraps the bus to catch memory watches, so don't bypass it
+	if (NULL != s_Debug)
+		s_Pages = &s_NoMap;
+#endif // SUPERMODEL_DEBUGGER
+}
+
 #ifdef SUPERMODEL_DEBUGGER
 // Cycles remaining in timeslice
 static int s_lastCycles;
@@ -228,6 +262,7 @@ void M68KLoadState(CBlockFile *StateFile, const char *name)
 
 void M68KSetIRQ(int irqLevel)
 {
+	++s_IdleEvents;
 	m68k_set_irq(irqLevel);
 }
 
@@ -240,6 +275,7 @@ int M68KRun(int numCycles)
 		s_lastCycles += numCycles;
 	}
 #endif // SUPERMODEL_DEBUGGER
+	s_Idle.pc = 0xFFFFFFFF;
 	int doneCycles = m68k_execute(numCycles);
 #ifdef SUPERMODEL_DEBUGGER
 	if (s_Debug != NULL)
@@ -251,6 +287,16 @@ int M68KRun(int numCycles)
 	return doneCycles;
 }
 
+int M68KGetCyclesRun(void)
+{
+	return m68k_cycles_run();
+}
+
+void M68KEndTimeslice(void)
+{
+	m68k_end_timeslice();
+}
+
 void M68KReset(void)
 {
 	m68k_pulse_reset();
@@ -273,12 +319,26 @@ void M68KAttachBus(IBus *BusPtr)
 	DebugLog("Attached bus to 68K\n");
 }
 
+void M68KAttachMemoryMap(M68KMemoryMap *MapPtr)
+{
+	s_Map = MapPtr;
+	UpdatePages();
+}
+
+void M68KSetIdleSkip(bool enable)
+{
+	s_IdleSkip = enable;
+	s_Idle.pc = 0xFFFFFFFF;
+}
+
 // Context switching
 
 void M68KGetContext(M68KCtx *Dest)
 {
 	Dest->IRQAck = IRQAck;
 	Dest->Bus = s_Bus;
+	Dest->Map = s_Map;
+	Dest->IdleSkip = s_IdleSkip;
 #ifdef SUPERMODEL_DEBUGGER
 	Dest->Debug = s_Debug;
 #endif // SUPERMODEL_DEBUGGER
@@ -289,9 +349,13 @@ void M68KSetContext(M68KCtx *Src)
 {
 	IRQAck = Src->IRQAck;
 	s_Bus = Src->Bus;
+	s_Map = Src->Map;
+	s_IdleSkip = Src->IdleSkip;
+	s_Idle.pc = 0xFFFFFFFF;
 #ifdef SUPERMODEL_DEBUGGER
 	s_Debug = Src->Debug;
 #endif // SUPERMODEL_DEBUGGER
+	UpdatePages();
 	m68k_set_context(&(Src->musashiCtx));
 }
 
@@ -303,10 +367,14 @@ bool M68KInit(void)
 	m68k_set_cpu_type(M68K_CPU_TYPE_68000);
 	m68k_set_int_ack_callback(M68KIRQCallback);
 	s_Bus = NULL;
+	s_Map = NULL;
+	s_IdleSkip = false;
+	s_Idle.pc = 0xFFFFFFFF;
 #ifdef SUPERMODEL_DEBUGGER
 	s_Debug = NULL;
 	m68k_set_instr_hook_callback(M68KDebugCallback);
 #endif // SUPERMODEL_DEBUGGER
+	UpdatePages();
 	DebugLog("Initialized 68K\n");
 	return OKAY;
 }
@@ -390,6 +458,7 @@ void M68KDebugCallback()
 
 int M68KIRQCallback(int nIRQ)
 {
+	++s_IdleEvents;
 #ifdef SUPERMODEL_DEBUGGER
 	if (s_Debug != NULL)
 	{
@@ -406,49 +475,169 @@ int M68KIRQCallback(int nIRQ)
 		return IRQAck(nIRQ);
 }
 
-unsigned int FASTCALL M68KFetch8(unsigned int a)
+/*
+ * Memory handlers consult the direct-access page tables first and only call
+ * into the bus for unmapped pages. Memory is word-swapped: bytes are at a^1
+ * and 16-bit words are stored natively. 32-bit accesses that would straddle a
+ * page boundary are split into two 16-bit accesses.
+ */
+
+#define PAGE(a)		(((a) >> M68K_PAGE_BITS) & (M68K_NUM_PAGES - 1))
+#define OFFSET(a)	((a) & M68K_PAGE_MASK)
+
+static inline unsigned int ReadMem8(unsigned int a)
 {
+	const UINT8 *p = s_Pages->read[PAGE(a)];
+	if (p != NULL)
+		return p[OFFSET(a) ^ 1];
+	++s_IdleEvents;
 	return s_Bus->Read8(a);
 }
 
-unsigned int FASTCALL M68KFetch16(unsigned int a)
+static inline unsigned int ReadMem16(unsigned int a)
 {
+	const UINT8 *p = s_Pages->read[PAGE(a)];
+	if (p != NULL)
+		return *(const UINT16 *) &p[OFFSET(a)];
+	++s_IdleEvents;
 	return s_Bus->Read16(a);
 }
 
-unsigned int FASTCALL M68KFetch32(unsigned int a)
+static inline unsigned int ReadMem32(unsigned int a)
 {
+	const UINT8 *p = s_Pages->read[PAGE(a)];
+	if (p != NULL && OFFSET(a) <= (M68K_PAGE_SIZE - 4))
+	{
+		UINT32 hi = *(const UINT16 *) &p[OFFSET(a) + 0];
+		UINT32 lo = *(const UINT16 *) &p[OFFSET(a) + 2];
+		return (hi << 16) | lo;
+	}
+	if (p != NULL || s_Pages->read[PAGE(a + 2)] != NULL)
+		return (ReadMem16(a) << 16) | ReadMem16((a + 2) & 0xFFFFFF);
+	++s_IdleEvents;
 	return s_Bus->Read32(a);
 }
 
+static inline void WriteMem8(unsigned int a, unsigned int d)
+{
+	UINT8 *p = s_Pages->write[PAGE(a)];
+	++s_IdleEvents;
+	if (p != NULL)
+		p[OFFSET(a) ^ 1] = (UINT8) d;
+	else
+		s_Bus->Write8(a, d);
+}
+
+static inline void WriteMem16(unsigned int a, unsigned int d)
+{
+	UINT8 *p = s_Pages->write[PAGE(a)];
+	++s_IdleEvents;
+	if (p != NULL)
+		*(UINT16 *) &p[OFFSET(a)] = (UINT16) d;
+	else
+		s_Bus->Write16(a, d);
+}
+
+static inline void WriteMem32(unsigned int a, unsigned int d)
+{
+	UINT8 *p = s_Pages->write[PAGE(a)];
+	++s_IdleEvents;
+	if (p != NULL && OFFSET(a) <= (M68K_PAGE_SIZE - 4))
+	{
+		*(UINT16 *) &p[OFFSET(a) + 0] = (UINT16) (d >> 16);
+		*(UINT16 *) &p[OFFSET(a) + 2] = (UINT16) d;
+	}
+	else if (p != NULL || s_Pages->write[PAGE(a + 2)] != NULL)
+	{
+		WriteMem16(a, d >> 16);
+		WriteMem16((a + 2) & 0xFFFFFF, d & 0xFFFF);
+	}
+	else
+		s_Bus->Write32(a, d);
+}
+
+#undef PAGE
+#undef OFFSET
+
+/*
+ * Idle loop detection. Called on every backward branch. If nothing has
+ * happened since the last time the same branch was taken that could make the next
+ * iteration behave differently, the loop will spin until the end of the
+ * timeslice, so the whole iterations are consumed at once and the remainder is
+ * executed normally, leaving the cycle count exactly as it would have been.
+ */
+void M68KBackwardBranch(unsigned int pc)
+{
+	if (!s_IdleSkip)
+		return;
+#ifdef SUPERMODEL_DEBUGGER
+	if (s_Debug != NULL)
+		return;
+#endif // SUPERMODEL_DEBUGGER
+
+	const m68ki_cpu_core &cpu = m68ki_cpu;
+	UINT32 flags[8] = { cpu.x_flag, cpu.n_flag, cpu.not_z_flag, cpu.v_flag, cpu.c_flag, cpu.s_flag, cpu.int_mask, cpu.int_level };
+	int cycles = m68ki_remaining_cycles;
+
+	if (pc == s_Idle.pc && s_IdleEvents == s_Idle.events && s_Idle.cycles > cycles && cycles > 0 &&
+		!memcmp(cpu.dar, s_Idle.dar, sizeof(s_Idle.dar)) && !memcmp(flags, s_Idle.flags, sizeof(flags)))
+	{
+		// The branch's own cycles are charged after this, so always leave at
+		// least one cycle to land where normal execution would have stopped
+		cycles = (cycles - 1) % (s_Idle.cycles - cycles) + 1;
+		m68ki_remaining_cycles = cycles;
+	}
+
+	s_Idle.pc = pc;
+	s_Idle.events = s_IdleEvents;
+	s_Idle.cycles = cycles;
+	memcpy(s_Idle.dar, cpu.dar, sizeof(s_Idle.dar));
+	memcpy(s_Idle.flags, flags, sizeof(flags));
+}
+
+unsigned int FASTCALL M68KFetch8(unsigned int a)
+{
+	return ReadMem8(a);
+}
+
+unsigned int FASTCALL M68KFetch16(unsigned int a)
+{
+	return ReadMem16(a);
+}
+
+unsigned int FASTCALL M68KFetch32(unsigned int a)
+{
+	return ReadMem32(a);
+}
+
 unsigned int FASTCALL M68KRead8(unsigned int a)
 {
-	return s_Bus->Read8(a);
+	return ReadMem8(a);
 }
 
 unsigned int FASTCALL M68KRead16(unsigned int a)
 {
-	return s_Bus->Read16(a);
+	return ReadMem16(a);
 }
 
 unsigned int FASTCALL M68KRead32(unsigned int a)
 {
-	return s_Bus->Read32(a);
+	return ReadMem32(a);
 }
 
 void FASTCALL M68KWrite8(unsigned int a, unsigned int d)
 {
-	s_Bus->Write8(a, d);
+	WriteMem8(a, d);
 }
 
 void FASTCALL M68KWrite16(unsigned int a, unsigned int d)
 {
-	s_Bus->Write16(a, d);
+	WriteMem16(a, d);
 }
 
 void FASTCALL M68KWrite32(unsigned int a, unsigned int d)
 {
-	s_Bus->Write32(a, d);
+	WriteMem32(a, d);
 }
 
 }	// extern "C"
@@ -59,11 +59,39 @@ namespace Debugger {
 #define M68K_IRQ_AUTOVECTOR	M68K_INT_ACK_AUTOVECTOR	// signals an autovectored interrupt
 #define M68K_IRQ_SPURIOUS	M68K_INT_ACK_SPURIOUS	// signals a spurious interrupt
 
+// Direct memory map granularity (24-bit address space split into 64KB pages)
+#define M68K_PAGE_BITS		16
+#define M68K_PAGE_SIZE		(1 << M68K_PAGE_BITS)
+#define M68K_PAGE_MASK		(M68K_PAGE_SIZE - 1)
+#define M68K_NUM_PAGES		(1 << (24 - M68K_PAGE_BITS))
+
 
 /******************************************************************************
  CPU Context
 ******************************************************************************/
 
+/*
+ * M68KMemoryMap:
+ *
+ * Page tables for direct access to plain RAM and ROM. Each entry points to the
+ * host memory backing the start of a 64KB page, stored in the same word-
+ * swapped format the bus handlers use (byte address a is at ptr[a^1]). NULL
+ * entries (the default) fall back to the bus handlers, so any page containing
+ * registers, side effects, or anything narrower than 64KB must be left NULL.
+ * Mirrors are expressed by pointing several entries at the same memory.
+ */
+struct M68KMemoryMap
+{
+	const UINT8	*read[M68K_NUM_PAGES];	// reads and instruction fetches
+	UINT8		*write[M68K_NUM_PAGES];	// writes
+
+	M68KMemoryMap(void)
+	{
+		memset(read, 0, sizeof(read));
+		memset(write, 0, sizeof(write));
+	}
+};
+
 /*
  * M68KCtx:
  *
@@ -76,6 +104,8 @@ typedef struct SM68KCtx
 public:
 	m68ki_cpu_core	musashiCtx;		// CPU context
 	IBus			*Bus;			// memory handlers
+	M68KMemoryMap	*Map;			// direct-access page tables (may be NULL)
+	bool			IdleSkip;		// skip idle loops (see M68KSetIdleSkip())
 	int				(*IRQAck)(int);	// IRQ acknowledge callback
 #ifdef SUPERMODEL_DEBUGGER
 	Debugger::CMusashi68KDebug *Debug;        // holds debugger (if attached)
@@ -84,6 +114,8 @@ public:
 	SM68KCtx(void)
 	{
 		Bus = NULL;
+		Map = NULL;
+		IdleSkip = false;
 		IRQAck = NULL;
 		memset(&musashiCtx, 0, sizeof(musashiCtx));	// very important! garbage in context at reset can cause very strange bugs
 #ifdef SUPERMODEL_DEBUGGER
@@ -94,6 +126,7 @@ public:
 	~SM68KCtx(void)
 	{
 		Bus = NULL;
+		Map = NULL;
 		IRQAck = NULL;
 	}
 } M68KCtx;;
@@ -199,6 +232,25 @@ extern void M68KSetIRQ(int irqLevel);
  */
 extern int M68KRun(int numCycles);
 
+/*
+ * M68KGetCyclesRun():
+ *
+ * Returns the number of cycles executed so far in the current call to
+ * M68KRun(). Intended for use from within memory handlers.
+ *
+ * Returns:
+ *		Number of cycles executed.
+ */
+extern int M68KGetCyclesRun(void);
+
+/*
+ * M68KEndTimeslice():
+ *
+ * Makes M68KRun() return after the current instruction. Intended for use from
+ * within memory handlers.
+ */
+extern void M68KEndTimeslice(void);
+
 /*
  * M68KReset():
  *
@@ -230,6 +282,30 @@ extern void M68KSetIRQCallback(int (*F)(int));
  */
 extern void M68KAttachBus(IBus *BusPtr);
 
+/*
+ * M68KAttachMemoryMap(M68KMemoryMap *MapPtr):
+ *
+ * Attaches direct-access page tables to the 68K. Fetches, reads, and writes
+ * that fall in a mapped page go straight to host memory; everything else is
+ * passed to the bus. The map is referenced, not copied, so owners may re-point
+ * entries at any time (e.g., on bank switches). M68KInit() detaches any map.
+ *
+ * Parameters:
+ *		MapPtr	Pointer to page tables or NULL to route everything to the bus.
+ */
+extern void M68KAttachMemoryMap(M68KMemoryMap *MapPtr);
+
+/*
+ * M68KSetIdleSkip(enable):
+ *
+ * Enables or disables skipping of idle loops: backward branches taken again
+ * with unchanged registers and no bus activity. Disabled by default.
+ *
+ * Parameters:
+ *		enable	True to skip idle loops.
+ */
+extern void M68KSetIdleSkip(bool enable);
+
 /*
  * M68KInit():
  *
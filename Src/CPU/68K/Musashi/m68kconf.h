@@ -150,6 +150,13 @@
 #define M68K_SET_PC_CALLBACK(A)     your_pc_changed_handler_function(A)
 
 
+/* If ON, CPU will call the backward branch callback when a relative branch
+ * is taken backwards.  Used to detect idle loops.
+ */
+#define M68K_BACKWARD_BRANCH_HOOK       OPT_SPECIFY_HANDLER
+#define M68K_BACKWARD_BRANCH_CALLBACK(A) M68KBackwardBranch(A)
+
+
 /* If ON, CPU will call the instruction hook callback before every
  * instruction.
  */
@@ -221,6 +228,7 @@ unsigned int FASTCALL M68KRead32(unsigned int a);
 void FASTCALL M68KWrite8(unsigned int a, unsigned int d);
 void FASTCALL M68KWrite16(unsigned int a, unsigned int d);
 void FASTCALL M68KWrite32(unsigned int a, unsigned int d);
+void M68KBackwardBranch(unsigned int pc);
 
 /* Read data relative to the PC */
 #define m68k_read_pcrelative_8(address) M68KFetch8(address)
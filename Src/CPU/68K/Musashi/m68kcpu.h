@@ -515,6 +515,12 @@
 	#define m68ki_pc_changed(A)
 #endif /* M68K_MONITOR_PC */
 
+#if M68K_BACKWARD_BRANCH_HOOK	/* handler must be specified */
+	#define m68ki_backward_branch(A) M68K_BACKWARD_BRANCH_CALLBACK(ADDRESS_68K(A))
+#else
+	#define m68ki_backward_branch(A)
+#endif /* M68K_BACKWARD_BRANCH_HOOK */
+
 
 /* Enable or disable function code emulation */
 #if M68K_EMULATE_FC
@@ -1351,11 +1357,15 @@ INLINE void m68ki_jump_vector(uint vector)
 INLINE void m68ki_branch_8(uint offset)
 {
 	REG_PC += MAKE_INT_8(offset);
+	if(MAKE_INT_8(offset) < 0)
+		m68ki_backward_branch(REG_PPC);
 }
 
 INLINE void m68ki_branch_16(uint offset)
 {
 	REG_PC += MAKE_INT_16(offset);
+	if(MAKE_INT_16(offset) < 0)
+		m68ki_backward_branch(REG_PPC);
 }
 
 INLINE void m68ki_branch_32(uint offset)
@@ -0,0 +1,188 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * PPCFastMem.cpp
+ *
+ * Host-MMU backed PowerPC address space. See PPCFastMem.h.
+ */
+
+#include "PPCFastMem.h"
+
+#ifdef PPC_FASTMEM
+
+#include "Supermodel.h"
+#include "CPU/Bus.h"
+#include "Util/MemoryArena.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/mman.h>
+#include <ucontext.h>
+
+static const size_t WINDOW_SIZE = size_t(1) << 32;
+
+// Window and bus of the active instance, for the fault handler
+static UINT8 *s_windowBase = NULL;
+static IBus *s_bus = NULL;
+static struct sigaction s_prevAction;
+static bool s_handlerInstalled = false;
+
+/*
+ * Decoded form of one of the accessors in PPCFastMem.h. Their operands are
+ * fixed (base RDI, offset RSI, load result EAX, store data EDX), so matching
+ * the opcode bytes is all the decoding needed.
+ */
+struct FastMemAccess
+{
+  UINT8 bytes[4];
+  unsigned length;
+  unsigned size;  // in bits
+  bool isWrite;
+};
+
+static const FastMemAccess s_accesses[] =
+{
+  { { 0x0F, 0xB6, 0x04, 0x37 }, 4, 8,  false },  // movzbl (%rdi,%rsi,1), %eax
+  { { 0x0F, 0xB7, 0x04, 0x37 }, 4, 16, false },  // movzwl (%rdi,%rsi,1), %eax
+  { { 0x8B, 0x04, 0x37 },       3, 32, false },  // movl   (%rdi,%rsi,1), %eax
+  { { 0x88, 0x14, 0x37 },       3, 8,  true  },  // movb   %dl, (%rdi,%rsi,1)
+  { { 0x66, 0x89, 0x14, 0x37 }, 4, 16, true  },  // movw   %dx, (%rdi,%rsi,1)
+  { { 0x89, 0x14, 0x37 },       3, 32, true  }   // movl   %edx, (%rdi,%rsi,1)
+};
+
+static void FaultHandler(int sig, siginfo_t *info, void *context)
+{
+  UINT8 *fault = (UINT8 *) info->si_addr;
+  ucontext_t *uc = (ucontext_t *) context;
+  greg_t *regs = uc->uc_mcontext.gregs;
+  const UINT8 *pc = (const UINT8 *) regs[REG_RIP];
+
+  if (s_windowBase != NULL && fault >= s_windowBase && fault < s_windowBase + WINDOW_SIZE)
+  {
+    UINT32 offset = UINT32(fault - s_windowBase);
+    for (const FastMemAccess &access : s_accesses)
+    {
+      if (memcmp(pc, access.bytes, access.length) != 0)
+        continue;
+
+      // Undo the byte lane swizzle applied by the accessor
+      UINT32 addr = offset ^ (access.size == 8 ? 3 : (access.size == 16 ? 2 : 0));
+      if (access.isWrite)
+      {
+        UINT32 data = UINT32(regs[REG_RDX]);
+        if (access.size == 8)
+          s_bus->Write8(addr, UINT8(data));
+        else if (access.size == 16)
+          s_bus->Write16(addr, UINT16(data));
+        else
+          s_bus->Write32(addr, data);
+      }
+      else
+      {
+        UINT32 data;
+        if (access.size == 8)
+          data = s_bus->Read8(addr);
+        else if (access.size == 16)
+          data = s_bus->Read16(addr);
+        else
+          data = s_bus->Read32(addr);
+        regs[REG_RAX] = greg_t(data);  // 32-bit loads zero the upper half
+      }
+      regs[REG_RIP] += access.length;
+      return;
+    }
+  }
+
+  // Not ours: hand over to whatever was installed before, or crash as usual
+  if (s_prevAction.sa_flags & SA_SIGINFO)
+    s_prevAction.sa_sigaction(sig, info, context);
+  else if (s_prevAction.sa_handler != SIG_DFL && s_prevAction.sa_handler != SIG_IGN)
+    s_prevAction.sa_handler(sig);
+  else
+  {
+    signal(sig, SIG_DFL);
+    raise(sig);
+  }
+}
+
+bool CPPCFastMem::IsSupported(void)
+{
+  return true;
+}
+
+bool CPPCFastMem::Init(IBus *bus, const UINT8 *pool)
+{
+  // The pool's memory file, so that it can be mapped a second time into the window
+  m_fd = Util::MemoryArena::GetFile(pool);
+  if (m_fd < 0)
+    return ErrorLog("PowerPC fastmem: memory pool is not shared.");
+  if (s_windowBase != NULL)
+    return ErrorLog("PowerPC fastmem: only one address space window can be active.");
+
+  void *window = mmap(NULL, WINDOW_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (window == MAP_FAILED)
+    return ErrorLog("PowerPC fastmem: unable to reserve address space window: %s", strerror(errno));
+
+  if (!s_handlerInstalled)
+  {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = FaultHandler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &s_prevAction) != 0)
+    {
+      munmap(window, WINDOW_SIZE);
+      return ErrorLog("PowerPC fastmem: unable to install fault handler: %s", strerror(errno));
+    }
+    s_handlerInstalled = true;
+  }
+
+  m_base = (UINT8 *) window;
+  s_bus = bus;
+  s_windowBase = m_base;
+  return OKAY;
+}
+
+bool CPPCFastMem::Map(UINT32 addr, size_t poolOffset, size_t size, bool writable)
+{
+  if (m_base == NULL)
+    return FAIL;
+  int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+  if (mmap(m_base + addr, size, prot, MAP_SHARED | MAP_FIXED, m_fd, off_t(poolOffset)) == MAP_FAILED)
+    return ErrorLog("PowerPC fastmem: unable to map %08X-%08X: %s", addr, UINT32(addr + size - 1), strerror(errno));
+  for (size_t block = addr >> 24; block <= ((addr + size - 1) >> 24); block++)
+    m_direct[block] = true;
+  return OKAY;
+}
+
+CPPCFastMem::~CPPCFastMem(void)
+{
+  if (m_base != NULL)
+  {
+    s_windowBase = NULL;
+    s_bus = NULL;
+    munmap(m_base, WINDOW_SIZE);
+  }
+}
+
+#endif  // PPC_FASTMEM
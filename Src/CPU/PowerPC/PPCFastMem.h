@@ -0,0 +1,194 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * PPCFastMem.h
+ *
+ * Host-MMU backed PowerPC address space ("fastmem").
+ *
+ * A 4 GB window of host address space stands in for the PowerPC's physical
+ * address space. Plain memory (RAM, CROM) is aliased into it from a shared
+ * memory arena region, so the interpreter reaches it with a single host load or
+ * store. Everything else is left unmapped: an access there faults, and the
+ * SIGSEGV handler decodes the faulting instruction, performs the access
+ * through the IBus handlers and resumes after it.
+ *
+ * A fault costs several thousand cycles, far more than a bus call, so the
+ * window is only used for 16 MB blocks that contain mapped memory (see
+ * IsDirect()). Hardware registers live in other blocks and are accessed
+ * through the bus directly; faults are left for the rare accesses to holes
+ * and read-only memory within a mapped block.
+ *
+ * Memory is kept in the same word-swapped layout the rest of the emulator
+ * uses (each aligned 32-bit word in host order), so byte and half-word
+ * accesses XOR the address with 3 and 2 respectively, exactly as the CModel3
+ * handlers do. Only naturally aligned accesses take the fast path.
+ *
+ * The fault handler can only decode the accessors defined below, whose
+ * instruction encodings are pinned by fixing their registers: base in RDI,
+ * offset in RSI, load result in EAX and store data in EDX.
+ *
+ * Linux on x86-64 only, and not in debugger builds, where all accesses must
+ * be seen by the debugger. Elsewhere IsSupported() is false, the methods are
+ * inert and the accessors do not exist.
+ */
+
+#ifndef INCLUDED_PPCFASTMEM_H
+#define INCLUDED_PPCFASTMEM_H
+
+#include "Types.h"
+#include <cstddef>
+
+#if defined(__linux__) && defined(__x86_64__) && !defined(SUPERMODEL_DEBUGGER)
+#define PPC_FASTMEM
+#endif
+
+class IBus;
+
+class CPPCFastMem
+{
+public:
+  /*
+   * IsSupported(void):
+   *
+   * Returns true if fastmem can be used on this host.
+   */
+  static bool IsSupported(void);
+
+  /*
+   * Init(bus, pool):
+   *
+   * Reserves the 4 GB window and installs the fault handler. Accesses that
+   * fault are passed on to bus. Parts of pool, which must be a SHARED region
+   * of the memory arena (see Util/MemoryArena.h), can then be mapped into the
+   * window. The pool must outlive the window.
+   *
+   * Returns:
+   *    OKAY if successful, FAIL if not (an error is logged).
+   */
+  bool Init(IBus *bus, const UINT8 *pool);
+
+  /*
+   * Map(addr, poolOffset, size, writable):
+   *
+   * Maps size bytes of the pool starting at poolOffset into the window at
+   * PowerPC address addr, replacing whatever was mapped there. All values
+   * must be page aligned. Read-only mappings send writes to the bus. The 16
+   * MB blocks touched become direct (see IsDirect()).
+   */
+  bool Map(UINT32 addr, size_t poolOffset, size_t size, bool writable);
+
+  /*
+   * GetBase(void):
+   *
+   * Returns the host address of PowerPC address 0 (NULL if not initialized).
+   */
+  UINT8 *GetBase(void) const
+  {
+    return m_base;
+  }
+
+  /*
+   * IsDirect(addr):
+   *
+   * Returns true if addr lies in a 16 MB block that has memory mapped into
+   * it, meaning that accesses to it should go through the window.
+   */
+  bool IsDirect(UINT32 addr) const
+  {
+    return m_direct[addr >> 24];
+  }
+
+  ~CPPCFastMem(void);
+
+private:
+  int     m_fd = -1;
+  UINT8   *m_base = NULL;
+  bool    m_direct[256] = {};
+};
+
+#ifndef PPC_FASTMEM
+
+inline bool CPPCFastMem::IsSupported(void)
+{
+  return false;
+}
+
+inline bool CPPCFastMem::Init(IBus *bus, const UINT8 *pool)
+{
+  return FAIL;
+}
+
+inline bool CPPCFastMem::Map(UINT32 addr, size_t poolOffset, size_t size, bool writable)
+{
+  return FAIL;
+}
+
+inline CPPCFastMem::~CPPCFastMem(void)
+{
+}
+
+#else
+
+/*
+ * Accessors. The instruction encodings are relied upon by the fault handler
+ * in PPCFastMem.cpp and must not be changed independently of it.
+ */
+
+static inline UINT8 FastMemRead8(UINT8 *base, UINT32 addr)
+{
+  UINT32 data;
+  __asm__ __volatile__ ("movzbl (%%rdi,%%rsi,1), %%eax" : "=a" (data) : "D" (base), "S" ((UINT64) (addr ^ 3)) : "memory");
+  return (UINT8) data;
+}
+
+static inline UINT16 FastMemRead16(UINT8 *base, UINT32 addr)
+{
+  UINT32 data;
+  __asm__ __volatile__ ("movzwl (%%rdi,%%rsi,1), %%eax" : "=a" (data) : "D" (base), "S" ((UINT64) (addr ^ 2)) : "memory");
+  return (UINT16) data;
+}
+
+static inline UINT32 FastMemRead32(UINT8 *base, UINT32 addr)
+{
+  UINT32 data;
+  __asm__ __volatile__ ("movl (%%rdi,%%rsi,1), %%eax" : "=a" (data) : "D" (base), "S" ((UINT64) addr) : "memory");
+  return data;
+}
+
+static inline void FastMemWrite8(UINT8 *base, UINT32 addr, UINT8 data)
+{
+  __asm__ __volatile__ ("movb %%dl, (%%rdi,%%rsi,1)" : : "D" (base), "S" ((UINT64) (addr ^ 3)), "d" ((UINT32) data) : "memory");
+}
+
+static inline void FastMemWrite16(UINT8 *base, UINT32 addr, UINT16 data)
+{
+  __asm__ __volatile__ ("movw %%dx, (%%rdi,%%rsi,1)" : : "D" (base), "S" ((UINT64) (addr ^ 2)), "d" ((UINT32) data) : "memory");
+}
+
+static inline void FastMemWrite32(UINT8 *base, UINT32 addr, UINT32 data)
+{
+  __asm__ __volatile__ ("movl %%edx, (%%rdi,%%rsi,1)" : : "D" (base), "S" ((UINT64) addr), "d" (data) : "memory");
+}
+
+#endif  // PPC_FASTMEM
+
+#endif  // INCLUDED_PPCFASTMEM_H
@@ -0,0 +1,471 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * PPCLockstep.cpp
+ *
+ * PowerPC lockstep verifier. See PPCLockstep.h.
+ *
+ * The reference handlers mirror CModel3's: RAM below 0x00800000 is stored in
+ * the same byte order, misaligned accesses are split the same way, and CROM
+ * reads see the bank selected at that point of the recorded run. Accesses to
+ * unmapped parts of the RAM and CROM blocks, which fastmem sends straight to
+ * CModel3 rather than to the bus, are passed on without being logged (they
+ * have no side effects).
+ */
+
+#include "PPCLockstep.h"
+#include "Supermodel.h"
+#include "PPCDisasm.h"
+#include <cstring>
+#include <new>
+
+static const UINT32 RAM_SIZE = 0x800000;
+
+/******************************************************************************
+ Reference Memory Handlers
+******************************************************************************/
+
+const UINT8 *CPPCLockstep::Bank(UINT32 addr) const
+{
+  return addr < 0xFF800000 ? m_bank : m_crom;
+}
+
+void CPPCLockstep::WriteRAM(UINT32 addr, unsigned size, UINT32 data)
+{
+  switch (size)
+  {
+  case 1:
+    m_ram[addr ^ 3] = UINT8(data);
+    break;
+  case 2:
+    *(UINT16 *) &m_ram[addr ^ 2] = UINT16(data);
+    break;
+  default:
+    *(UINT32 *) &m_ram[addr] = data;
+    break;
+  }
+}
+
+UINT8 CPPCLockstep::Read8(UINT32 addr)
+{
+  if (addr < RAM_SIZE)
+    return m_ram[addr ^ 3];
+  if (addr >= 0xFF000000)
+    return Bank(addr)[(addr & 0x7FFFFF) ^ 3];
+  if (addr < 0x01000000)
+    return m_model->Read8(addr);
+  return UINT8(DeviceAccess(false, 1, addr, 0));
+}
+
+UINT16 CPPCLockstep::Read16(UINT32 addr)
+{
+  if ((addr & 1))
+    return UINT16((Read8(addr + 0) << 8) | Read8(addr + 1));
+  if (addr < RAM_SIZE)
+    return *(UINT16 *) &m_ram[addr ^ 2];
+  if (addr >= 0xFF000000)
+    return *(const UINT16 *) &Bank(addr)[(addr & 0x7FFFFF) ^ 2];
+  if (addr < 0x01000000)
+    return m_model->Read16(addr);
+  return UINT16(DeviceAccess(false, 2, addr, 0));
+}
+
+UINT32 CPPCLockstep::Read32(UINT32 addr)
+{
+  if ((addr & 3))
+    return (UINT32(Read16(addr + 0)) << 16) | Read16(addr + 2);
+  if (addr < RAM_SIZE)
+    return *(UINT32 *) &m_ram[addr];
+  if (addr >= 0xFF000000)
+    return *(const UINT32 *) &Bank(addr)[addr & 0x7FFFFF];
+  if (addr < 0x01000000)
+    return m_model->Read32(addr);
+  return DeviceAccess(false, 4, addr, 0);
+}
+
+UINT64 CPPCLockstep::Read64(UINT32 addr)
+{
+  UINT64 data = Read32(addr + 0);
+  return (data << 32) | Read32(addr + 4);
+}
+
+void CPPCLockstep::Write8(UINT32 addr, UINT8 data)
+{
+  if (addr < RAM_SIZE)
+    WriteRAM(addr, 1, data);
+  else if (addr >= 0xFF000000 || addr < 0x01000000)
+    m_model->Write8(addr, data);
+  else
+    DeviceAccess(true, 1, addr, data);
+}
+
+void CPPCLockstep::Write16(UINT32 addr, UINT16 data)
+{
+  if ((addr & 1))
+  {
+    Write8(addr + 0, UINT8(data >> 8));
+    Write8(addr + 1, UINT8(data));
+  }
+  else if (addr < RAM_SIZE)
+    WriteRAM(addr, 2, data);
+  else if (addr >= 0xFF000000 || addr < 0x01000000)
+    m_model->Write16(addr, data);
+  else
+    DeviceAccess(true, 2, addr, data);
+}
+
+void CPPCLockstep::Write32(UINT32 addr, UINT32 data)
+{
+  if ((addr & 3))
+  {
+    Write16(addr + 0, UINT16(data >> 16));
+    Write16(addr + 2, UINT16(data));
+  }
+  else if (addr < RAM_SIZE)
+    WriteRAM(addr, 4, data);
+  else if (addr >= 0xFF000000 || addr < 0x01000000)
+    m_model->Write32(addr, data);
+  else
+    DeviceAccess(true, 4, addr, data);
+}
+
+void CPPCLockstep::Write64(UINT32 addr, UINT64 data)
+{
+  Write32(addr + 0, UINT32(data >> 32));
+  Write32(addr + 4, UINT32(data));
+}
+
+/******************************************************************************
+ Device Access Log
+******************************************************************************/
+
+UINT32 CPPCLockstep::DeviceAccess(bool write, unsigned size, UINT32 addr, UINT32 data)
+{
+  if (m_mode == Mode::Record)
+  {
+    Access access;
+    access.write = write;
+    access.size = UINT8(size);
+    access.addr = addr;
+    access.pc = ppc_get_pc();
+    access.firstEvent = m_events.size();
+    switch (size)
+    {
+    case 1:
+      if (write)
+        m_model->Write8(addr, UINT8(data));
+      else
+        data = m_model->Read8(addr);
+      break;
+    case 2:
+      if (write)
+        m_model->Write16(addr, UINT16(data));
+      else
+        data = m_model->Read16(addr);
+      break;
+    default:
+      if (write)
+        m_model->Write32(addr, data);
+      else
+        data = m_model->Read32(addr);
+      break;
+    }
+    access.data = data;
+    access.numEvents = m_events.size() - access.firstEvent;
+    m_bank = *m_cromBank;
+    access.bank = m_bank;
+    m_log.push_back(access);
+    return data;
+  }
+
+  // Replay. Once off the recorded path, the rest of the run is meaningless
+  // and nothing more is checked.
+  if (m_mismatch)
+    return 0;
+  const Access *expected = m_next < m_log.size() ? &m_log[m_next] : NULL;
+  if (expected == NULL || expected->write != write || expected->size != size || expected->addr != addr || (write && expected->data != data))
+  {
+    m_mismatch = true;
+    m_badAccess.write = write;
+    m_badAccess.size = UINT8(size);
+    m_badAccess.addr = addr;
+    m_badAccess.data = data;
+    m_badAccess.pc = ppc_get_pc();
+    return 0;
+  }
+  ++m_next;
+  m_bank = expected->bank;
+  for (size_t i = expected->firstEvent; i < expected->firstEvent + expected->numEvents; i++)
+  {
+    const Event &event = m_events[i];
+    if (event.size == 0)
+      ppc_set_irq_line(int(event.data));
+    else
+      WriteRAM(event.addr, event.size, event.data);
+  }
+  return write ? 0 : expected->data;
+}
+
+void CPPCLockstep::IRQLine(int irqline)
+{
+  if (m_mode == Mode::Record)
+    m_events.push_back({ 0, 0, UINT32(irqline) });
+}
+
+void CPPCLockstep::DeviceWrite(UINT32 addr, unsigned size, UINT32 data)
+{
+  if (m_mode == Mode::Record)
+    m_events.push_back({ UINT8(size), addr, data });
+}
+
+/******************************************************************************
+ Verification
+******************************************************************************/
+
+void CPPCLockstep::GetRegisters(Registers *regs)
+{
+  regs->pc = ppc_get_pc();
+  regs->msr = ppc_read_msr();
+  regs->cr = 0;
+  for (unsigned i = 0; i < 8; i++)
+    regs->cr |= UINT32(ppc_get_cr(i) & 0xF) << (28 - 4 * i);
+  regs->xer = ppc_read_spr(SPR_XER);
+  regs->lr = ppc_get_lr();
+  regs->ctr = ppc_read_spr(SPR_CTR);
+  regs->srr0 = ppc_read_spr(SPR_SRR0);
+  regs->srr1 = ppc_read_spr(SPR_SRR1);
+  regs->dec = ppc_read_spr(SPR603E_DEC);
+  regs->hid0 = ppc_read_spr(SPR603E_HID0);
+  regs->dsisr = ppc_read_spr(SPR603E_DSISR);
+  regs->dar = ppc_read_spr(SPR603E_DAR);
+  for (unsigned i = 0; i < 4; i++)
+    regs->sprg[i] = ppc_read_spr(SPR_SPRG0 + i);
+  for (unsigned i = 0; i < 32; i++)
+  {
+    regs->gpr[i] = ppc_get_gpr(i);
+    double fpr = ppc_get_fpr(i);
+    memcpy(&regs->fpr[i], &fpr, sizeof(fpr));  // bitwise, so that NaNs compare
+  }
+  for (unsigned i = 0; i < 16; i++)
+    regs->sr[i] = ppc_read_sr(i);
+  regs->tb = (UINT64(ppc_read_spr(SPR603E_TBU_W)) << 32) | ppc_read_spr(SPR603E_TBL_W);
+}
+
+bool CPPCLockstep::FetchOpcode(UINT32 addr, UINT32 *op) const
+{
+  if (addr < RAM_SIZE)
+    *op = *(const UINT32 *) &m_refRAM[addr & ~3];
+  else if (addr >= 0xFF000000)
+    *op = *(const UINT32 *) &(addr < 0xFF800000 ? *m_cromBank : m_crom)[addr & 0x7FFFFC];
+  else
+    return false;
+  return true;
+}
+
+void CPPCLockstep::Disassemble(const char *title, UINT32 pc)
+{
+  InfoLog("%s:", title);
+  for (UINT32 addr = pc - 16; addr != pc + 20; addr += 4)
+  {
+    UINT32 op;
+    if (!FetchOpcode(addr, &op))
+      continue;
+    char mnem[16], oprs[48];
+    if (OKAY != DisassemblePowerPC(op, addr, mnem, oprs, true))
+    {
+      strcpy(mnem, "?");
+      oprs[0] = '\0';
+    }
+    InfoLog("  %c %08X: %08X  %-8s%s", addr == pc ? '>' : ' ', addr, op, mnem, oprs);
+  }
+}
+
+void CPPCLockstep::Describe(char *out, const Access &access)
+{
+  sprintf(out, "%s%u %08X=%0*X at PC=%08X", access.write ? "write" : "read", 8 * access.size, access.addr, 2 * access.size, access.data, access.pc);
+}
+
+void CPPCLockstep::Report(int cycles, int refCycles, const Registers &regs, const Registers &ref)
+{
+  ErrorLog("PowerPC lockstep verification failed in block %llu (PC=%08X). The PowerPC has been halted; see the log for details.", (unsigned long long) m_blocks, m_startPC);
+  InfoLog("PowerPC lockstep divergence in block %llu. Values are fast path / reference.", (unsigned long long) m_blocks);
+
+  if (cycles != refCycles)
+    InfoLog("  Cycles executed: %d / %d", cycles, refCycles);
+
+  auto compare = [](const char *name, UINT64 a, UINT64 b)
+  {
+    if (a != b)
+      InfoLog("  %-6s %08llX / %08llX", name, (unsigned long long) a, (unsigned long long) b);
+  };
+  compare("PC", regs.pc, ref.pc);
+  compare("MSR", regs.msr, ref.msr);
+  compare("CR", regs.cr, ref.cr);
+  compare("XER", regs.xer, ref.xer);
+  compare("LR", regs.lr, ref.lr);
+  compare("CTR", regs.ctr, ref.ctr);
+  compare("SRR0", regs.srr0, ref.srr0);
+  compare("SRR1", regs.srr1, ref.srr1);
+  compare("DEC", regs.dec, ref.dec);
+  compare("HID0", regs.hid0, ref.hid0);
+  compare("DSISR", regs.dsisr, ref.dsisr);
+  compare("DAR", regs.dar, ref.dar);
+  compare("TB", regs.tb, ref.tb);
+  char name[8];
+  for (unsigned i = 0; i < 4; i++)
+  {
+    sprintf(name, "SPRG%u", i);
+    compare(name, regs.sprg[i], ref.sprg[i]);
+  }
+  for (unsigned i = 0; i < 32; i++)
+  {
+    sprintf(name, "R%u", i);
+    compare(name, regs.gpr[i], ref.gpr[i]);
+  }
+  for (unsigned i = 0; i < 32; i++)
+  {
+    sprintf(name, "F%u", i);
+    compare(name, regs.fpr[i], ref.fpr[i]);
+  }
+  for (unsigned i = 0; i < 16; i++)
+  {
+    sprintf(name, "SR%u", i);
+    compare(name, regs.sr[i], ref.sr[i]);
+  }
+
+  char recorded[64] = "none", replayed[64] = "none";
+  if (m_next < m_log.size())
+    Describe(recorded, m_log[m_next]);
+  if (m_mismatch)
+    Describe(replayed, m_badAccess);
+  if (m_mismatch || m_next < m_log.size())
+    InfoLog("  Device access %u: %s / %s", unsigned(m_next), recorded, replayed);
+
+  for (UINT32 addr = 0; addr < RAM_SIZE; addr += 4)
+  {
+    if (*(const UINT32 *) &m_modelRAM[addr] != *(const UINT32 *) &m_refRAM[addr])
+    {
+      InfoLog("  RAM first differs at %08X: %08X / %08X", addr, *(const UINT32 *) &m_modelRAM[addr], *(const UINT32 *) &m_refRAM[addr]);
+      break;
+    }
+  }
+
+  Disassemble("Before block", m_startPC);
+  if (m_mismatch)
+  {
+    if (m_next < m_log.size())
+      Disassemble("Recorded device access", m_log[m_next].pc);
+    Disassemble("Replayed device access", m_badAccess.pc);
+  }
+  Disassemble("Fast path end", regs.pc);
+  if (ref.pc != regs.pc)
+    Disassemble("Reference end", ref.pc);
+}
+
+int CPPCLockstep::Execute(int cycles, const CPPCFastMem *fastMem)
+{
+  if (m_diverged)
+    return 0;
+  ++m_blocks;
+
+  ppc_get_context(m_startContext.data());
+  m_startPC = ppc_get_pc();
+  memcpy(m_refRAM, m_modelRAM, RAM_SIZE);
+  UINT8 *startBank = *m_cromBank;
+  m_log.clear();
+  m_events.clear();
+
+  // Run as configured, logging device accesses
+  m_mode = Mode::Record;
+  m_ram = m_modelRAM;
+  m_bank = startBank;
+  ppc_attach_bus(this);
+  int executed = ppc_execute(cycles);
+  Registers regs;
+  GetRegisters(&regs);
+  ppc_get_context(m_endContext.data());
+
+  // Run again from the same state through the reference handlers
+  m_mode = Mode::Replay;
+  m_ram = m_refRAM;
+  m_bank = startBank;
+  m_next = 0;
+  m_mismatch = false;
+  ppc_set_fastmem(NULL);
+  ppc_set_fetch(m_refFetch.data());
+  ppc_set_context(m_startContext.data());
+  int refExecuted = ppc_execute(cycles);
+  Registers ref;
+  GetRegisters(&ref);
+
+  // Continue from the configured run's state
+  m_mode = Mode::Idle;
+  ppc_set_fetch(m_modelFetch);
+  ppc_set_context(m_endContext.data());
+  ppc_set_fastmem(fastMem);
+  ppc_attach_bus(m_model);
+
+  if (executed != refExecuted || memcmp(&regs, &ref, sizeof(regs)) != 0 || m_mismatch || m_next != m_log.size() || memcmp(m_modelRAM, m_refRAM, RAM_SIZE) != 0)
+  {
+    Report(executed, refExecuted, regs, ref);
+    m_diverged = true;
+    return 0;
+  }
+  return executed;
+}
+
+/******************************************************************************
+ Configuration
+******************************************************************************/
+
+bool CPPCLockstep::Init(IBus *model, UINT8 *ram, const UINT8 *crom, UINT8 * const *cromBank, PPC_FETCH_REGION *fetch)
+{
+  m_refRAM = new(std::nothrow) UINT8[RAM_SIZE];
+  if (m_refRAM == NULL)
+    return ErrorLog("Insufficient memory for PowerPC lockstep verification.");
+
+  m_model = model;
+  m_modelRAM = ram;
+  m_crom = crom;
+  m_cromBank = cromBank;
+  m_modelFetch = fetch;
+  m_refFetch.clear();
+  for (const PPC_FETCH_REGION *region = fetch; ; region++)
+  {
+    m_refFetch.push_back(*region);
+    if (region->ptr == NULL)
+      break;
+    if (region->ptr == (UINT32 *) ram)
+      m_refFetch.back().ptr = (UINT32 *) m_refRAM;
+  }
+  m_startContext.resize(ppc_get_context_size());
+  m_endContext.resize(ppc_get_context_size());
+  memset(&m_badAccess, 0, sizeof(m_badAccess));
+  return OKAY;
+}
+
+CPPCLockstep::~CPPCLockstep(void)
+{
+  if (m_blocks != 0)
+    InfoLog("PowerPC lockstep verification: %llu blocks checked%s.", (unsigned long long) m_blocks, m_diverged ? ", stopped at the first divergence" : ", no divergence");
+  delete [] m_refRAM;
+}
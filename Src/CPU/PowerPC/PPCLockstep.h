@@ -0,0 +1,175 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * PPCLockstep.h
+ *
+ * Lockstep verification of the PowerPC memory fast paths. Every block of
+ * cycles handed to ppc_execute() is run twice from the same starting state:
+ *
+ *    1. As configured (fastmem, fetch regions), with the verifier as the bus
+ *       so that it can log every device access and its outcome: data read,
+ *       IRQ line changes, RAM written by device DMA and CROM bank switches.
+ *    2. On a private copy of RAM with fastmem disabled, every access going
+ *       through the verifier's own reference handlers. Device accesses are
+ *       not performed again; they must match the log, which supplies their
+ *       outcome.
+ *
+ * The registers and RAM the two runs end with, and their device access
+ * sequences, must be identical. The first divergence halts the PowerPC and
+ * is logged with a register and disassembly dump.
+ *
+ * Only available in builds with PPC_LOCKSTEP defined ("make PPC_LOCKSTEP=1"),
+ * which also hooks device writes to RAM in CModel3.
+ */
+
+#ifndef INCLUDED_PPCLOCKSTEP_H
+#define INCLUDED_PPCLOCKSTEP_H
+
+#include "CPU/Bus.h"
+#include "ppc.h"
+#include "Types.h"
+#include <vector>
+
+class CPPCLockstep final: public IBus
+{
+public:
+  /*
+   * Init(model, ram, crom, cromBank, fetch):
+   *
+   * Attaches to the Model 3 bus, its 8 MB RAM, fixed CROM and pointer to the
+   * current CROM bank, and copies its fetch regions (terminated by a NULL
+   * pointer), substituting the reference RAM.
+   *
+   * Returns:
+   *    OKAY if successful, FAIL if memory could not be allocated (an error
+   *    is logged).
+   */
+  bool Init(IBus *model, UINT8 *ram, const UINT8 *crom, UINT8 * const *cromBank, PPC_FETCH_REGION *fetch);
+
+  /*
+   * Execute(cycles):
+   *
+   * Replaces ppc_execute(). fastMem is the window the model runs with (may be
+   * NULL).
+   *
+   * Returns:
+   *    Number of cycles executed, 0 once the two runs have diverged.
+   */
+  int Execute(int cycles, const class CPPCFastMem *fastMem);
+
+  /*
+   * IRQLine(irqline):
+   * DeviceWrite(addr, size, data):
+   *
+   * Called by ppc_set_irq_line() and by CModel3 when a device writes RAM.
+   * Logged while recording, ignored otherwise.
+   */
+  void IRQLine(int irqline);
+  void DeviceWrite(UINT32 addr, unsigned size, UINT32 data);
+
+  bool HasDiverged(void) const
+  {
+    return m_diverged;
+  }
+
+  ~CPPCLockstep(void);
+
+  // IBus
+  UINT8 Read8(UINT32 addr);
+  UINT16 Read16(UINT32 addr);
+  UINT32 Read32(UINT32 addr);
+  UINT64 Read64(UINT32 addr);
+  void Write8(UINT32 addr, UINT8 data);
+  void Write16(UINT32 addr, UINT16 data);
+  void Write32(UINT32 addr, UINT32 data);
+  void Write64(UINT32 addr, UINT64 data);
+
+private:
+  enum class Mode
+  {
+    Idle,
+    Record,
+    Replay
+  };
+
+  struct Access
+  {
+    bool    write;
+    UINT8   size;
+    UINT32  addr;
+    UINT32  data;
+    UINT32  pc;
+    size_t  firstEvent;
+    size_t  numEvents;
+    UINT8   *bank;      // CROM bank selected afterwards
+  };
+
+  struct Event
+  {
+    UINT8   size;       // 0 for IRQ line changes
+    UINT32  addr;
+    UINT32  data;       // IRQ line state for IRQ line changes
+  };
+
+  struct Registers
+  {
+    UINT32  pc, msr, cr, xer, lr, ctr, srr0, srr1, dec, hid0, dsisr, dar;
+    UINT32  sprg[4];
+    UINT32  gpr[32];
+    UINT64  fpr[32];
+    UINT32  sr[16];
+    UINT64  tb;
+  };
+
+  const UINT8 *Bank(UINT32 addr) const;
+  UINT32 DeviceAccess(bool write, unsigned size, UINT32 addr, UINT32 data);
+  void WriteRAM(UINT32 addr, unsigned size, UINT32 data);
+  bool FetchOpcode(UINT32 addr, UINT32 *op) const;
+  static void GetRegisters(Registers *regs);
+  void Report(int cycles, int refCycles, const Registers &regs, const Registers &ref);
+  void Disassemble(const char *title, UINT32 pc);
+  static void Describe(char *out, const Access &access);
+
+  IBus          *m_model = NULL;
+  UINT8         *m_modelRAM = NULL;
+  const UINT8   *m_crom = NULL;
+  UINT8 * const *m_cromBank = NULL;
+  UINT8         *m_refRAM = NULL;
+  PPC_FETCH_REGION *m_modelFetch = NULL;
+  std::vector<PPC_FETCH_REGION> m_refFetch;
+  std::vector<UINT8> m_startContext;
+  std::vector<UINT8> m_endContext;
+
+  Mode          m_mode = Mode::Idle;
+  UINT8         *m_ram = NULL;    // RAM the current run accesses
+  UINT8         *m_bank = NULL;   // CROM bank the current run sees
+  std::vector<Access> m_log;
+  std::vector<Event> m_events;
+  size_t        m_next = 0;       // next log entry to replay
+  bool          m_mismatch = false;
+  Access        m_badAccess;      // replayed access that did not match m_log[m_next]
+  UINT32        m_startPC = 0;    // last instruction executed before the block
+  UINT64        m_blocks = 0;
+  bool          m_diverged = false;
+};
+
+#endif  // INCLUDED_PPCLOCKSTEP_H
@@ -0,0 +1,481 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * PPCTrace.cpp
+ *
+ * PowerPC execution trace writer and reader. See PPCTrace.h for the format.
+ */
+
+#include "PPCTrace.h"
+#include "Supermodel.h"
+#include "Util/Format.h"
+#include <chrono>
+#include <cstring>
+#include <zlib.h>
+
+using namespace PPCTrace;
+
+static const char s_magic[4] = { 'S', 'M', 'P', 'T' };
+static const UINT32 s_version = 1;
+
+// Opcode cache shared by the packer and the unpacker: PC in the upper 32 bits
+// of each entry, opcode in the lower. PCs are word aligned, so the initial
+// entries match nothing.
+static const size_t OPCODE_CACHE_SIZE = 0x10000;
+static const UINT64 OPCODE_CACHE_EMPTY = UINT64(1) << 32;
+
+static inline size_t OpcodeCacheIndex(UINT32 pc)
+{
+  return (pc >> 2) & (OPCODE_CACHE_SIZE - 1);
+}
+
+static void PutWord(std::vector<UINT8> *out, UINT32 value)
+{
+  out->push_back(UINT8(value));
+  out->push_back(UINT8(value >> 8));
+  out->push_back(UINT8(value >> 16));
+  out->push_back(UINT8(value >> 24));
+}
+
+static void PutVarint(std::vector<UINT8> *out, UINT32 value)
+{
+  while (value >= 0x80)
+  {
+    out->push_back(UINT8(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(UINT8(value));
+}
+
+bool PPCTrace::ParseFields(UINT32 *fields, const std::string &list)
+{
+  *fields = 0;
+  for (auto &field: Util::Format(list).Split(','))
+  {
+    std::string name = Util::ToLower(Util::TrimWhiteSpace(field));
+    if (name == "ea")
+      *fields |= FIELD_EA;
+    else if (name == "cycles")
+      *fields |= FIELD_CYCLES;
+    else if (!name.empty())
+      return ErrorLog("Unknown PowerPC trace field '%s'. Valid fields are 'ea' and 'cycles'.", name.c_str());
+  }
+  return OKAY;
+}
+
+
+/******************************************************************************
+ Writer
+******************************************************************************/
+
+bool CPPCTraceWriter::Open(const std::string &filename, UINT32 fields)
+{
+  Close();
+
+  m_file = fopen(filename.c_str(), "wb");
+  if (NULL == m_file)
+    return ErrorLog("Unable to create PowerPC trace '%s'.", filename.c_str());
+
+  std::vector<UINT8> header(s_magic, s_magic + sizeof(s_magic));
+  PutWord(&header, s_version);
+  PutWord(&header, fields);
+  z_stream *zs = new z_stream();
+  if (fwrite(header.data(), 1, header.size(), m_file) != header.size() || deflateInit(zs, 1) != Z_OK)
+  {
+    delete zs;
+    fclose(m_file);
+    m_file = NULL;
+    return ErrorLog("Unable to write PowerPC trace '%s'.", filename.c_str());
+  }
+  m_zstream = zs;
+  m_fields = fields;
+  m_error = false;
+
+  // The PowerPC thread fills one buffer while the others are with the writer
+  m_buffers.assign(NUM_BUFFERS, Buffer((BUFFER_RECORDS + SPARE_RECORDS) * WORDS_PER_RECORD));
+  m_free.clear();
+  for (size_t i = 1; i < NUM_BUFFERS; i++)
+    m_free.push_back(&m_buffers[i]);
+  m_full.clear();
+  m_buffer = &m_buffers[0];
+  m_pos = m_buffer->data();
+  m_end = m_pos + BUFFER_RECORDS * WORDS_PER_RECORD;
+  m_limit = m_end + SPARE_RECORDS * WORDS_PER_RECORD;
+  m_current = m_pos;
+
+  m_lastPC = 0;
+  m_lastEA = 0;
+  m_lastCycles = 0;
+  m_opcodeCache.assign(OPCODE_CACHE_SIZE, OPCODE_CACHE_EMPTY);
+  m_records = 0;
+  m_packedBytes = 0;
+  m_fileBytes = header.size();
+  m_stallMs = 0;
+
+  m_quit = false;
+  m_thread = std::thread(&CPPCTraceWriter::WriterThread, this);
+  return OKAY;
+}
+
+void CPPCTraceWriter::Close(void)
+{
+  if (NULL == m_file)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_full.emplace_back(m_buffer, m_pos - m_buffer->data());
+    m_quit = true;
+  }
+  m_cond.notify_all();
+  m_thread.join();
+
+  z_stream *zs = reinterpret_cast<z_stream *>(m_zstream);
+  deflateEnd(zs);
+  delete zs;
+  m_zstream = NULL;
+  if (fclose(m_file) != 0)
+    m_error = true;
+  m_file = NULL;
+
+  if (m_error)
+    ErrorLog("Unable to write PowerPC trace. It is incomplete.");
+  InfoLog("PowerPC trace: %llu records, %1.1f MB packed, %1.1f MB written (%1.2f bytes per record), %1.0f ms stalled.",
+    (unsigned long long) m_records, double(m_packedBytes) / (1024 * 1024), double(m_fileBytes) / (1024 * 1024),
+    m_records ? double(m_fileBytes) / double(m_records) : 0.0, m_stallMs);
+
+  m_buffers.clear();
+  m_free.clear();
+  m_buffer = NULL;
+  m_pos = m_end = m_limit = m_current = NULL;
+}
+
+void CPPCTraceWriter::NextBuffer(void)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_full.emplace_back(m_buffer, m_pos - m_buffer->data());
+  m_cond.notify_all();
+  if (m_free.empty())
+  {
+    // Writer cannot keep up
+    auto start = std::chrono::steady_clock::now();
+    m_cond.wait(lock, [this] { return !m_free.empty(); });
+    m_stallMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+  m_buffer = m_free.back();
+  m_free.pop_back();
+  lock.unlock();
+
+  m_pos = m_buffer->data();
+  m_end = m_pos + BUFFER_RECORDS * WORDS_PER_RECORD;
+  m_limit = m_end + SPARE_RECORDS * WORDS_PER_RECORD;
+  m_current = m_pos;
+}
+
+void CPPCTraceWriter::WriterThread(void)
+{
+  std::vector<UINT8> packed;
+  while (true)
+  {
+    std::pair<Buffer *, size_t> full;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait(lock, [this] { return m_quit || !m_full.empty(); });
+      if (m_full.empty())
+        break;
+      full = m_full.front();
+      m_full.pop_front();
+    }
+
+    packed.clear();
+    Pack(*full.first, full.second, &packed);
+    if (!m_error && Compress(packed.data(), packed.size(), false) != OKAY)
+      m_error = true;
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_free.push_back(full.first);
+    }
+    m_cond.notify_all();
+  }
+
+  if (!m_error && Compress(NULL, 0, true) != OKAY)
+    m_error = true;
+}
+
+void CPPCTraceWriter::Pack(const Buffer &buffer, size_t words, std::vector<UINT8> *out)
+{
+  for (size_t i = 0; i < words; i += WORDS_PER_RECORD)
+  {
+    const UINT32 *record = &buffer[i];
+    UINT32 pc = record[WORD_PC] & ~3;
+    UINT32 cycles = record[WORD_CYCLES] - m_lastCycles;
+    m_lastCycles = record[WORD_CYCLES];
+    UINT8 cyclesTag = ((m_fields & FIELD_CYCLES) && cycles != 1) ? TAG_CYCLES : 0;
+
+    if (record[WORD_PC] & EXCEPTION_BIT)
+    {
+      out->push_back(TAG_EXCEPTION | cyclesTag);
+      PutWord(out, pc);
+      out->push_back(UINT8(record[WORD_OPCODE]));
+      PutWord(out, record[WORD_EA]);
+      m_lastPC = record[WORD_EA] - 4;  // handler follows on from the vector
+    }
+    else
+    {
+      UINT8 tag = cyclesTag;
+      if (pc != m_lastPC + 4)
+        tag |= TAG_PC;
+      UINT64 &cached = m_opcodeCache[OpcodeCacheIndex(pc)];
+      UINT64 entry = (UINT64(pc) << 32) | record[WORD_OPCODE];
+      if (cached != entry)
+      {
+        tag |= TAG_OPCODE;
+        cached = entry;
+      }
+      if ((m_fields & FIELD_EA) && (record[WORD_PC] & EA_BIT))
+        tag |= TAG_EA;
+
+      out->push_back(tag);
+      if (tag & TAG_PC)
+        PutWord(out, pc);
+      if (tag & TAG_OPCODE)
+        PutWord(out, record[WORD_OPCODE]);
+      if (tag & TAG_EA)
+      {
+        INT32 delta = INT32(record[WORD_EA] - m_lastEA);
+        PutVarint(out, (UINT32(delta) << 1) ^ UINT32(delta >> 31));
+        m_lastEA = record[WORD_EA];
+      }
+      m_lastPC = pc;
+    }
+
+    if (cyclesTag)
+      PutVarint(out, cycles);
+  }
+  m_records += words / WORDS_PER_RECORD;
+  m_packedBytes += out->size();
+}
+
+bool CPPCTraceWriter::Compress(const UINT8 *data, size_t size, bool finish)
+{
+  z_stream *zs = reinterpret_cast<z_stream *>(m_zstream);
+  UINT8 out[64 * 1024];
+  zs->next_in = const_cast<Bytef *>(data);
+  zs->avail_in = uInt(size);
+  int ret;
+  do
+  {
+    zs->next_out = out;
+    zs->avail_out = sizeof(out);
+    ret = deflate(zs, finish ? Z_FINISH : Z_NO_FLUSH);
+    if (ret == Z_STREAM_ERROR)
+      return FAIL;
+    size_t have = sizeof(out) - zs->avail_out;
+    if (have != 0 && fwrite(out, 1, have, m_file) != have)
+      return FAIL;
+    m_fileBytes += have;
+  } while (zs->avail_out == 0 || (finish && ret != Z_STREAM_END));
+  return OKAY;
+}
+
+CPPCTraceWriter::~CPPCTraceWriter(void)
+{
+  Close();
+}
+
+
+/******************************************************************************
+ Reader
+******************************************************************************/
+
+bool CPPCTraceReader::Open(const std::string &filename)
+{
+  m_file = fopen(filename.c_str(), "rb");
+  if (NULL == m_file)
+    return ErrorLog("Unable to open PowerPC trace '%s'.", filename.c_str());
+
+  UINT8 header[12];
+  if (fread(header, 1, sizeof(header), m_file) != sizeof(header) || memcmp(header, s_magic, sizeof(s_magic)) != 0)
+    return ErrorLog("'%s' is not a PowerPC trace.", filename.c_str());
+  UINT32 version = header[4] | (header[5] << 8) | (header[6] << 16) | (UINT32(header[7]) << 24);
+  if (version != s_version)
+    return ErrorLog("PowerPC trace '%s' has an unsupported version (%u).", filename.c_str(), version);
+  m_fields = header[8] | (header[9] << 8) | (header[10] << 16) | (UINT32(header[11]) << 24);
+
+  z_stream *zs = new z_stream();
+  if (inflateInit(zs) != Z_OK)
+  {
+    delete zs;
+    return ErrorLog("Unable to decompress PowerPC trace '%s'.", filename.c_str());
+  }
+  m_zstream = zs;
+  m_in.resize(64 * 1024);
+  m_out.resize(256 * 1024);
+  m_outPos = 0;
+  m_outSize = 0;
+  m_eof = false;
+  m_truncated = false;
+  m_lastPC = 0;
+  m_lastEA = 0;
+  m_cycles = 0;
+  m_opcodeCache.assign(OPCODE_CACHE_SIZE, OPCODE_CACHE_EMPTY);
+  return OKAY;
+}
+
+bool CPPCTraceReader::Fill(void)
+{
+  z_stream *zs = reinterpret_cast<z_stream *>(m_zstream);
+  m_outPos = 0;
+  m_outSize = 0;
+  while (m_outSize == 0 && !m_eof)
+  {
+    if (zs->avail_in == 0)
+    {
+      size_t size = fread(m_in.data(), 1, m_in.size(), m_file);
+      if (size == 0)
+      {
+        // File ends before the stream does
+        m_eof = true;
+        m_truncated = true;
+        break;
+      }
+      zs->next_in = m_in.data();
+      zs->avail_in = uInt(size);
+    }
+    zs->next_out = m_out.data();
+    zs->avail_out = uInt(m_out.size());
+    int ret = inflate(zs, Z_NO_FLUSH);
+    m_outSize = m_out.size() - zs->avail_out;
+    if (ret == Z_STREAM_END)
+      m_eof = true;
+    else if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+      m_eof = true;
+      m_truncated = true;
+    }
+  }
+  return m_outSize != 0;
+}
+
+bool CPPCTraceReader::ReadByte(UINT8 *value)
+{
+  if (m_outPos == m_outSize && !Fill())
+    return false;
+  *value = m_out[m_outPos++];
+  return true;
+}
+
+bool CPPCTraceReader::ReadWord(UINT32 *value)
+{
+  UINT8 bytes[4];
+  for (auto &byte: bytes)
+  {
+    if (!ReadByte(&byte))
+      return false;
+  }
+  *value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (UINT32(bytes[3]) << 24);
+  return true;
+}
+
+bool CPPCTraceReader::ReadVarint(UINT32 *value)
+{
+  *value = 0;
+  for (unsigned shift = 0; shift < 35; shift += 7)
+  {
+    UINT8 byte;
+    if (!ReadByte(&byte))
+      return false;
+    *value |= UINT32(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool CPPCTraceReader::Next(Record *record)
+{
+  UINT8 tag;
+  if (NULL == m_zstream || !ReadByte(&tag))
+    return false;
+
+  *record = Record();
+  bool ok = !(tag & ~(TAG_EXCEPTION | TAG_PC | TAG_OPCODE | TAG_EA | TAG_CYCLES));
+  if (ok && (tag & TAG_EXCEPTION))
+  {
+    UINT8 exception = 0;
+    ok = ReadWord(&record->pc) && ReadByte(&exception) && ReadWord(&record->ea);
+    record->opcode = exception;
+    record->exception = true;
+    m_lastPC = record->ea - 4;
+  }
+  else if (ok)
+  {
+    if (tag & TAG_PC)
+      ok = ReadWord(&record->pc);
+    else
+      record->pc = m_lastPC + 4;
+    m_lastPC = record->pc;
+
+    UINT64 &cached = m_opcodeCache[OpcodeCacheIndex(record->pc)];
+    if (ok && (tag & TAG_OPCODE))
+    {
+      ok = ReadWord(&record->opcode);
+      cached = (UINT64(record->pc) << 32) | record->opcode;
+    }
+    else
+      record->opcode = UINT32(cached);
+
+    UINT32 delta;
+    if (ok && (tag & TAG_EA) && (ok = ReadVarint(&delta)))
+    {
+      m_lastEA += (delta >> 1) ^ (0 - (delta & 1));
+      record->ea = m_lastEA;
+      record->hasEA = true;
+    }
+  }
+
+  UINT32 cycles = 1;
+  if (ok && (tag & TAG_CYCLES))
+    ok = ReadVarint(&cycles);
+  m_cycles += cycles;
+  record->cycles = m_cycles;
+
+  if (!ok)
+  {
+    m_truncated = true;
+    return false;
+  }
+  return true;
+}
+
+CPPCTraceReader::~CPPCTraceReader(void)
+{
+  if (m_zstream != NULL)
+  {
+    z_stream *zs = reinterpret_cast<z_stream *>(m_zstream);
+    inflateEnd(zs);
+    delete zs;
+  }
+  if (m_file != NULL)
+    fclose(m_file);
+}
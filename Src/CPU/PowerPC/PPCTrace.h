@@ -0,0 +1,281 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * PPCTrace.h
+ *
+ * PowerPC execution traces: a record of every instruction executed (address
+ * and opcode, optionally the first effective address it accessed and the
+ * cycle count) and of every exception taken.
+ *
+ * The interpreter only hooks into the writer in builds with PPC_TRACE defined
+ * ("make PPC_TRACE=1"). It appends fixed-size records to a buffer; full
+ * buffers are packed and compressed into the trace file by a background
+ * thread. The file is decoded offline with the tracedecode tool, which reads
+ * it back with CPPCTraceReader.
+ *
+ * File format: "SMPT", version (uint32), fields (uint32), followed by a zlib
+ * stream of packed records. Each starts with a tag byte:
+ *
+ *    TAG_EXCEPTION   Exception taken: SRR0 (uint32), exception number
+ *                    (uint8), vector (uint32). Only TAG_CYCLES may go with it.
+ *    TAG_PC          PC is not the previous instruction's + 4: PC (uint32).
+ *    TAG_OPCODE      Opcode differs from the one last seen at this PC (in a
+ *                    64K entry direct-mapped table): opcode (uint32).
+ *    TAG_EA          Instruction accessed memory: zigzag varint of the
+ *                    difference from the previous effective address.
+ *    TAG_CYCLES      Cycle count did not advance by exactly 1: varint of the
+ *                    difference.
+ *
+ * Multi-byte values are little endian. Sequential code that keeps hitting
+ * the same opcodes packs into one byte per instruction.
+ */
+
+#ifndef INCLUDED_PPCTRACE_H
+#define INCLUDED_PPCTRACE_H
+
+#include "Types.h"
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PPCTrace
+{
+  // Optional fields (in addition to PC and opcode)
+  static const UINT32 FIELD_EA      = 1;
+  static const UINT32 FIELD_CYCLES  = 2;
+
+  // Tag byte of a packed record
+  static const UINT8 TAG_EXCEPTION  = 0x01;
+  static const UINT8 TAG_PC         = 0x02;
+  static const UINT8 TAG_OPCODE     = 0x04;
+  static const UINT8 TAG_EA         = 0x08;
+  static const UINT8 TAG_CYCLES     = 0x10;
+
+  struct Record
+  {
+    UINT32 pc;          // SRR0 for exceptions
+    UINT32 opcode;      // exception number for exceptions
+    UINT32 ea;          // vector for exceptions
+    UINT64 cycles;
+    bool exception;
+    bool hasEA;
+  };
+
+  /*
+   * Parses a comma-separated list of optional fields ("ea", "cycles").
+   *
+   * Returns:
+   *    OKAY if successful, FAIL if a field is unknown (an error is logged).
+   */
+  bool ParseFields(UINT32 *fields, const std::string &list);
+}
+
+class CPPCTraceWriter
+{
+public:
+  /*
+   * Open(filename, fields):
+   *
+   * Creates the trace file and starts the background thread.
+   *
+   * Returns:
+   *    OKAY if successful, FAIL if not (an error is logged).
+   */
+  bool Open(const std::string &filename, UINT32 fields);
+
+  /*
+   * Close(void):
+   *
+   * Writes out what is left in the buffers and closes the file.
+   */
+  void Close(void);
+
+  /*
+   * Instruction(pc, opcode, cycles):
+   *
+   * Records an instruction about to be executed.
+   */
+  inline void Instruction(UINT32 pc, UINT32 opcode, UINT64 cycles)
+  {
+    if (m_pos >= m_end)
+      NextBuffer();
+    m_current = m_pos;
+    m_pos[WORD_PC] = pc;
+    m_pos[WORD_OPCODE] = opcode;
+    m_pos[WORD_CYCLES] = UINT32(cycles);
+    m_pos += WORDS_PER_RECORD;
+  }
+
+  /*
+   * EffectiveAddress(ea):
+   *
+   * Records a memory access by the current instruction. Only the first is
+   * kept.
+   */
+  inline void EffectiveAddress(UINT32 ea)
+  {
+    if (!(m_current[WORD_PC] & EA_BIT))
+    {
+      m_current[WORD_PC] |= EA_BIT;
+      m_current[WORD_EA] = ea;
+    }
+  }
+
+  /*
+   * Exception(srr0, exception, vector, cycles):
+   *
+   * Records an exception. The buffer is not handed over here, as the
+   * current instruction's effective address may still be to come; it keeps
+   * room for a few exceptions after the last instruction.
+   */
+  inline void Exception(UINT32 srr0, UINT32 exception, UINT32 vector, UINT64 cycles)
+  {
+    if (m_pos >= m_limit)
+      return;
+    m_pos[WORD_PC] = srr0 | EXCEPTION_BIT;
+    m_pos[WORD_OPCODE] = exception;
+    m_pos[WORD_CYCLES] = UINT32(cycles);
+    m_pos[WORD_EA] = vector;
+    m_pos += WORDS_PER_RECORD;
+  }
+
+  ~CPPCTraceWriter(void);
+
+private:
+  // Raw records as written by the PowerPC thread. The PC is word aligned, so
+  // its low bits are free for flags.
+  static const unsigned WORD_PC = 0, WORD_OPCODE = 1, WORD_CYCLES = 2, WORD_EA = 3, WORDS_PER_RECORD = 4;
+  static const UINT32 EXCEPTION_BIT = 1;
+  static const UINT32 EA_BIT = 2;
+  static const size_t BUFFER_RECORDS = 256 * 1024;
+  static const size_t SPARE_RECORDS = 8;  // for exceptions after the last instruction
+  static const size_t NUM_BUFFERS = 8;
+
+  typedef std::vector<UINT32> Buffer;
+
+  void NextBuffer(void);
+  void WriterThread(void);
+  void Pack(const Buffer &buffer, size_t words, std::vector<UINT8> *out);
+  bool Compress(const UINT8 *data, size_t size, bool finish);
+
+  UINT32    m_fields = 0;
+  FILE      *m_file = NULL;
+  void      *m_zstream = NULL;
+  bool      m_error = false;
+
+  // PowerPC thread
+  UINT32    *m_pos = NULL;
+  UINT32    *m_end = NULL;
+  UINT32    *m_limit = NULL;
+  UINT32    *m_current = NULL;
+  Buffer    *m_buffer = NULL;
+
+  // Buffers handed over to and back from the writer thread
+  std::thread             m_thread;
+  std::mutex              m_mutex;
+  std::condition_variable m_cond;
+  std::deque<std::pair<Buffer *, size_t>> m_full;
+  std::vector<Buffer *>   m_free;
+  std::vector<Buffer>     m_buffers;
+  bool                    m_quit = false;
+
+  // Packing state (writer thread)
+  UINT32    m_lastPC = 0;
+  UINT32    m_lastEA = 0;
+  UINT32    m_lastCycles = 0;
+  std::vector<UINT64> m_opcodeCache;
+
+  // Statistics
+  UINT64    m_records = 0;
+  UINT64    m_packedBytes = 0;
+  UINT64    m_fileBytes = 0;
+  double    m_stallMs = 0;
+};
+
+class CPPCTraceReader
+{
+public:
+  /*
+   * Open(filename):
+   *
+   * Returns:
+   *    OKAY if successful, FAIL if the file could not be opened or is not a
+   *    trace (an error is logged).
+   */
+  bool Open(const std::string &filename);
+
+  /*
+   * Next(record):
+   *
+   * Reads the next record. Cycle counts are only meaningful if the trace has
+   * FIELD_CYCLES, and effective addresses if it has FIELD_EA.
+   *
+   * Returns:
+   *    True if a record was read, false at the end of the trace.
+   */
+  bool Next(PPCTrace::Record *record);
+
+  UINT32 GetFields(void) const
+  {
+    return m_fields;
+  }
+
+  /*
+   * IsTruncated(void):
+   *
+   * Returns true if the trace ended in the middle of a record, as it does if
+   * the emulator did not exit normally.
+   */
+  bool IsTruncated(void) const
+  {
+    return m_truncated;
+  }
+
+  ~CPPCTraceReader(void);
+
+private:
+  bool Fill(void);
+  bool ReadByte(UINT8 *value);
+  bool ReadWord(UINT32 *value);
+  bool ReadVarint(UINT32 *value);
+
+  UINT32    m_fields = 0;
+  FILE      *m_file = NULL;
+  void      *m_zstream = NULL;
+  bool      m_eof = false;
+  bool      m_truncated = false;
+  std::vector<UINT8> m_in;
+  std::vector<UINT8> m_out;
+  size_t    m_outPos = 0;
+  size_t    m_outSize = 0;
+
+  UINT32    m_lastPC = 0;
+  UINT32    m_lastEA = 0;
+  UINT64    m_cycles = 0;
+  std::vector<UINT64> m_opcodeCache;
+};
+
+#endif  // INCLUDED_PPCTRACE_H
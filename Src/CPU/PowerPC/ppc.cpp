@@ -33,6 +33,13 @@
 #include <cstring>	// memset()
 #include "Supermodel.h"
 #include "CPU/Bus.h"
+#include "PPCFastMem.h"
+#ifdef PPC_TRACE
+#include "PPCTrace.h"
+#endif
+#ifdef PPC_LOCKSTEP
+#include "PPCLockstep.h"
+#endif
 
 // Typedefs that Supermodel no longer provides
 typedef unsigned int	UINT;
@@ -40,6 +47,21 @@ typedef unsigned int	UINT;
 // Model 3 context provides read/write handlers
 static class IBus	*Bus = NULL;	// pointer to Model 3 bus object (for access handlers)
 
+#ifdef PPC_FASTMEM
+// Fastmem window (NULL if all accesses go through Bus)
+static const CPPCFastMem	*FastMem = NULL;
+#endif
+
+#ifdef PPC_LOCKSTEP
+// Lockstep verifier that IRQ line changes are reported to (NULL if none)
+static CPPCLockstep	*Lockstep = NULL;
+#endif
+
+#ifdef PPC_TRACE
+// Execution trace being recorded (if any)
+static CPPCTraceWriter	*Trace = NULL;
+#endif
+
 #ifdef SUPERMODEL_DEBUGGER
 // Pointer to current PPC debugger (if any)
 static class Debugger::CPPCDebug *PPCDebug = NULL;
@@ -315,43 +337,127 @@ static void ppc_change_pc(UINT32 newpc)
 	ppc.fatalError = true;
 }
 
+/*
+ * With fastmem, aligned accesses to blocks containing memory are plain host
+ * loads and stores into the window; those that land outside mapped memory
+ * fault and are completed by the handler in PPCFastMem.cpp. Misaligned
+ * accesses, which the bus splits up, always go through the bus.
+ */
+
 static inline UINT8 READ8(UINT32 address)
 {
+#ifdef PPC_TRACE
+	if (Trace != NULL)
+		Trace->EffectiveAddress(address);
+#endif
+#ifdef PPC_FASTMEM
+	if (FastMem != NULL && FastMem->IsDirect(address))
+		return FastMemRead8(FastMem->GetBase(), address);
+#endif
 	return Bus->Read8(address);
 }
 
 static inline UINT16 READ16(UINT32 address)
 {
+#ifdef PPC_TRACE
+	if (Trace != NULL)
+		Trace->EffectiveAddress(address);
+#endif
+#ifdef PPC_FASTMEM
+	if (FastMem != NULL && FastMem->IsDirect(address) && !(address & 1))
+		return FastMemRead16(FastMem->GetBase(), address);
+#endif
 	return Bus->Read16(address);
 }
 
 static inline UINT32 READ32(UINT32 address)
 {
+#ifdef PPC_TRACE
+	if (Trace != NULL)
+		Trace->EffectiveAddress(address);
+#endif
+#ifdef PPC_FASTMEM
+	if (FastMem != NULL && FastMem->IsDirect(address) && !(address & 3))
+		return FastMemRead32(FastMem->GetBase(), address);
+#endif
 	return Bus->Read32(address);
 }
 
 static inline UINT64 READ64(UINT32 address)
 {
+#ifdef PPC_TRACE
+	if (Trace != NULL)
+		Trace->EffectiveAddress(address);
+#endif
+#ifdef PPC_FASTMEM
+	if (FastMem != NULL && FastMem->IsDirect(address) && !(address & 3))
+		return ((UINT64) FastMemRead32(FastMem->GetBase(), address) << 32) | FastMemRead32(FastMem->GetBase(), address + 4);
+#endif
 	return Bus->Read64(address);
 }
 
 static inline void WRITE8(UINT32 address, UINT8 data)
 {
+#ifdef PPC_TRACE
+	if (Trace != NULL)
+		Trace->EffectiveAddress(address);
+#endif
+#ifdef PPC_FASTMEM
+	if (FastMem != NULL && FastMem->IsDirect(address))
+	{
+		FastMemWrite8(FastMem->GetBase(), address, data);
+		return;
+	}
+#endif
 	Bus->Write8(address,data);
 }
 
 static inline void WRITE16(UINT32 address, UINT16 data)
 {
+#ifdef PPC_TRACE
+	if (Trace != NULL)
+		Trace->EffectiveAddress(address);
+#endif
+#ifdef PPC_FASTMEM
+	if (FastMem != NULL && FastMem->IsDirect(address) && !(address & 1))
+	{
+		FastMemWrite16(FastMem->GetBase(), address, data);
+		return;
+	}
+#endif
 	Bus->Write16(address,data);
 }
 
 static inline void WRITE32(UINT32 address, UINT32 data)
 {
+#ifdef PPC_TRACE
+	if (Trace != NULL)
+		Trace->EffectiveAddress(address);
+#endif
+#ifdef PPC_FASTMEM
+	if (FastMem != NULL && FastMem->IsDirect(address) && !(address & 3))
+	{
+		FastMemWrite32(FastMem->GetBase(), address, data);
+		return;
+	}
+#endif
 	Bus->Write32(address,data);
 }
 
 static inline void WRITE64(UINT32 address, UINT64 data)
 {
+#ifdef PPC_TRACE
+	if (Trace != NULL)
+		Trace->EffectiveAddress(address);
+#endif
+#ifdef PPC_FASTMEM
+	if (FastMem != NULL && FastMem->IsDirect(address) && !(address & 3))
+	{
+		FastMemWrite32(FastMem->GetBase(), address, (UINT32) (data >> 32));
+		FastMemWrite32(FastMem->GetBase(), address + 4, (UINT32) data);
+		return;
+	}
+#endif
 	Bus->Write64(address,data);
 }
 
@@ -864,6 +970,10 @@ void ppc_shutdown(void)
 
 void ppc_set_irq_line(int irqline)
 {
+#ifdef PPC_LOCKSTEP
+	if (Lockstep != NULL)
+		Lockstep->IRQLine(irqline);
+#endif
 	if (irqline)
 	{
 		ppc.interrupt_pending |= 0x1;
@@ -919,6 +1029,50 @@ void ppc_attach_bus(IBus *BusPtr)
 	Bus = BusPtr;
 }
 
+void ppc_set_fastmem(const CPPCFastMem *fastMem)
+{
+#ifdef PPC_FASTMEM
+	FastMem = (fastMem != NULL && fastMem->GetBase() != NULL) ? fastMem : NULL;
+#endif
+}
+
+#ifdef PPC_TRACE
+void ppc_attach_trace(CPPCTraceWriter *trace)
+{
+	Trace = trace;
+}
+#endif
+
+#ifdef PPC_LOCKSTEP
+void ppc_attach_lockstep(CPPCLockstep *lockstep)
+{
+	Lockstep = lockstep;
+}
+#endif
+
+size_t ppc_get_context_size(void)
+{
+	return sizeof(ppc);
+}
+
+void ppc_get_context(void *context)
+{
+	memcpy(context, &ppc, sizeof(ppc));
+}
+
+void ppc_set_context(const void *context)
+{
+	// Keep the current fetch regions. The cached one may point into memory
+	// the context was not saved with, so it is looked up again on the next
+	// ppc_execute().
+	PPC_FETCH_REGION *fetch = ppc.fetch;
+	memcpy(&ppc, context, sizeof(ppc));
+	ppc.fetch = fetch;
+	ppc.cur_fetch.start = 0xFFFFFFFF;
+	ppc.cur_fetch.end = 0;
+	ppc.cur_fetch.ptr = NULL;
+}
+
 void ppc_save_state(CBlockFile *SaveState)
 {
 	SaveState->NewBlock("PowerPC", __FILE__);
@@ -363,6 +363,7 @@ extern void ppc_set_timer_ratio(int ratio);
 
 // These have been added to support the new Supermodel
 extern void ppc_attach_bus(class IBus *BusPtr);		// must be called first!
+extern void ppc_set_fastmem(const class CPPCFastMem *fastMem);	// fastmem window or NULL to use the bus only
 extern void ppc_save_state(class CBlockFile *SaveState);
 extern void ppc_load_state(class CBlockFile *SaveState);
 extern UINT32 ppc_get_gpr(unsigned num);
@@ -371,6 +372,16 @@ extern UINT32 ppc_get_lr(void);
 extern UINT32 ppc_read_spr(unsigned spr);
 extern UINT32 ppc_read_sr(unsigned num);
 
+#ifdef PPC_TRACE
+extern void ppc_attach_trace(class CPPCTraceWriter *trace);	// execution trace to record to or NULL
+#endif
+#ifdef PPC_LOCKSTEP
+extern void ppc_attach_lockstep(class CPPCLockstep *lockstep);	// lockstep verifier to report IRQ line changes to or NULL
+#endif
+extern size_t ppc_get_context_size(void);
+extern void ppc_get_context(void *context);			// copies out the complete CPU state
+extern void ppc_set_context(const void *context);	// restores it (fetch regions are kept)
+
 #ifdef SUPERMODEL_DEBUGGER
 // These have been added to support the Supermodel debugger
 extern void ppc_attach_debugger(class Debugger::CPPCDebug *PPCDebugPtr);
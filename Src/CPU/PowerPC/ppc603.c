@@ -31,6 +31,9 @@ void ppc603_exception(int exception)
 		if (PPCDebug != NULL)
 			PPCDebug->CPUException(exception);
 #endif
+#ifdef PPC_TRACE
+	UINT32 oldNPC = ppc.npc;
+#endif
 
 	switch( exception )
 	{
@@ -204,6 +207,12 @@ void ppc603_exception(int exception)
 			ppc.fatalError = true;
 			break;
 	}
+
+#ifdef PPC_TRACE
+	// Only exceptions that were taken (masked ones leave the PC alone)
+	if (Trace != NULL && ppc.npc != oldNPC)
+		Trace->Exception(SRR0, exception, ppc.npc, ppc_total_cycles());
+#endif
 }
 
 static void ppc603_check_interrupts(void)
@@ -306,6 +315,11 @@ int ppc_execute(int cycles)
 		}
 #endif // SUPERMODEL_DEBUGGER
 
+#ifdef PPC_TRACE
+		if (Trace != NULL)
+			Trace->Instruction(ppc.pc, opcode, ppc_total_cycles());
+#endif
+
 		switch(opcode >> 26)
 		{
 			case 19:	optable19[(opcode >> 1) & 0x3ff](opcode); break;
@@ -46,10 +46,10 @@
 #define GetBYTE_mm(a) ( Bus->Read8(((a)--)&0xFFFF) )
 #define mm_GetBYTE(a) ( Bus->Read8((--(a))&0xFFFF) )
 
-#define PutBYTE(a,v)  Bus->Write8((a)&0xFFFF,v)
-#define PutBYTE_pp(a,v) Bus->Write8(((a)++)&0xFFFF,v)
-#define PutBYTE_mm(a,v) Bus->Write8(((a)--)&0xFFFF,v)
-#define mm_PutBYTE(a,v) Bus->Write8((--(a))&0xFFFF,v)
+#define PutBYTE(a,v)  ( ++idleEvents, Bus->Write8((a)&0xFFFF,v) )
+#define PutBYTE_pp(a,v) ( ++idleEvents, Bus->Write8(((a)++)&0xFFFF,v) )
+#define PutBYTE_mm(a,v) ( ++idleEvents, Bus->Write8(((a)--)&0xFFFF,v) )
+#define mm_PutBYTE(a,v) ( ++idleEvents, Bus->Write8((--(a))&0xFFFF,v) )
 
 #define GetWORD(a)    (Bus->Read8((a)&0xFFFF) | (Bus->Read8(((a)+1)&0xFFFF)<<8))
 
@@ -60,7 +60,7 @@
     PutBYTE((a)+1,((v)>>8));  \
   } while (0)
 
-#define OUTPUT(a,v)   Bus->IOWrite8((a)&0xFF,v)
+#define OUTPUT(a,v)   ( ++idleEvents, Bus->IOWrite8((a)&0xFF,v) )
 #define INPUT(a)    ( Bus->IORead8((a)&0xFF) )
 
 // Flags
@@ -215,8 +215,66 @@ static const unsigned char cycleTables[5][256] = {
     mm_PutBYTE(SP,(x)&0xFF);  \
   } while (0)
 
+// Idle loop detection, performed on backward jumps (see CZ80::SetIdleSkip()).
+// The jump's own cycles have already been charged, so the comparison is made
+// against the count from before the jump; this lands on exactly the iteration
+// in which normal execution would have run out of cycles.
+#define IDLE_CHECK(from)                                              \
+  do                                                                  \
+  {                                                                   \
+    if (skipIdle)                                                     \
+    {                                                                 \
+      int before = cycles + cycleTables[0][op];                       \
+      if ((from) == idlePC && idleEvents == idleLastEvents &&         \
+          AF == idleRegs[0] && BC == idleRegs[1] && DE == idleRegs[2] && \
+          HL == idleRegs[3] && IX == idleRegs[4] && IY == idleRegs[5] && \
+          SP == idleRegs[6] && iff == idleRegs[7] &&                  \
+          regs_sel == (int) idleRegs[8] && af_sel == (int) idleRegs[9] && \
+          idleCycles > before)                                        \
+      {                                                               \
+        /* skip whole iterations */                                   \
+        before = (before - 1) % (idleCycles - before) + 1;            \
+        cycles = before - cycleTables[0][op];                         \
+      }                                                               \
+      idlePC = (from);                                                \
+      idleLastEvents = idleEvents;                                    \
+      idleCycles = before;                                            \
+      idleRegs[0] = AF; idleRegs[1] = BC; idleRegs[2] = DE;           \
+      idleRegs[3] = HL; idleRegs[4] = IX; idleRegs[5] = IY;           \
+      idleRegs[6] = SP; idleRegs[7] = iff;                            \
+      idleRegs[8] = regs_sel; idleRegs[9] = af_sel;                   \
+    }                                                                 \
+  } while (0)
+
 // Branching
-#define Jpc(cond) pc = cond ? GetWORD(pc) : pc+2
+#define Jpc(cond)                                     \
+  do                                                  \
+  {                                                   \
+    if (cond)                                         \
+    {                                                 \
+      unsigned int from = (pc - 1) & 0xFFFF;          \
+      pc = GetWORD(pc);                               \
+      if (pc <= from)                                 \
+        IDLE_CHECK(from);                             \
+    }                                                 \
+    else                                              \
+      pc += 2;                                        \
+  } while (0)
+
+#define JRc(cond)                                     \
+  do                                                  \
+  {                                                   \
+    if (cond)                                         \
+    {                                                 \
+      unsigned int from = (pc - 1) & 0xFFFF;          \
+      int disp = (signed char) GetBYTE(pc);           \
+      pc += disp + 1;                                 \
+      if (disp < -1)                                  \
+        IDLE_CHECK(from);                             \
+    }                                                 \
+    else                                              \
+      pc += 1;                                        \
+  } while (0)
 
 #define CALLC(cond)                     \
   {                                     \
@@ -264,11 +322,14 @@ int CZ80::Run(int numCycles)
   unsigned int adr = 0;
 
   int cycles = numCycles;
+  bool skipIdle = idleSkip;
+  idlePC = 0x10000; // no loop seen yet in this slice
 #ifdef SUPERMODEL_DEBUGGER
   if (Debug != NULL)
   {
     Debug->CPUActive();
     lastCycles += numCycles;
+    skipIdle = false;
   }
 #endif // SUPERMODEL_DEBUGGER
 
@@ -426,7 +487,7 @@ int CZ80::Run(int numCycles)
     break;
   case 0x18:      /* JR dd */
     cycles -= cycleTables[0][0x18];
-    pc += (1) ? (signed char) GetBYTE(pc) + 1 : 1;
+    JRc(1);
     break;
   case 0x19:      /* ADD HL,DE */
     cycles -= cycleTables[0][0x19];
@@ -477,7 +538,7 @@ int CZ80::Run(int numCycles)
     break;
   case 0x20:      /* JR NZ,dd */
     cycles -= cycleTables[0][0x20];
-    pc += (!TSTFLAG(Z)) ? (signed char) GetBYTE(pc) + 1 : 1;
+    JRc(!TSTFLAG(Z));
     break;
   case 0x21:      /* LD HL,nnnn */
     cycles -= cycleTables[0][0x21];
@@ -547,7 +608,7 @@ int CZ80::Run(int numCycles)
     break;
   case 0x28:      /* JR Z,dd */
     cycles -= cycleTables[0][0x28];
-    pc += (TSTFLAG(Z)) ? (signed char) GetBYTE(pc) + 1 : 1;
+    JRc(TSTFLAG(Z));
     break;
   case 0x29:      /* ADD HL,HL */
     cycles -= cycleTables[0][0x29];
@@ -596,7 +657,7 @@ int CZ80::Run(int numCycles)
     break;
   case 0x30:      /* JR NC,dd */
     cycles -= cycleTables[0][0x30];
-    pc += (!TSTFLAG(C)) ? (signed char) GetBYTE(pc) + 1 : 1;
+    JRc(!TSTFLAG(C));
     break;
   case 0x31:      /* LD SP,nnnn */
     cycles -= cycleTables[0][0x31];
@@ -641,7 +702,7 @@ int CZ80::Run(int numCycles)
     break;
   case 0x38:      /* JR C,dd */
     cycles -= cycleTables[0][0x38];
-    pc += (TSTFLAG(C)) ? (signed char) GetBYTE(pc) + 1 : 1;
+    JRc(TSTFLAG(C));
     break;
   case 0x39:      /* ADD HL,SP */
     cycles -= cycleTables[0][0x39];
@@ -3796,11 +3857,18 @@ HALTExit:
 void CZ80::TriggerNMI(void)
 {
   nmiTrigger = true;
+  ++idleEvents;
 }
 
 void CZ80::SetINT(bool state)
 {
   intLine = state;
+  ++idleEvents;
+}
+
+void CZ80::SetIdleSkip(bool enable)
+{
+  idleSkip = enable;
 }
 
 UINT16 CZ80::GetPC(void)
@@ -4002,6 +4070,11 @@ CZ80::CZ80(void)
 {
   INTCallback = NULL; // so we can later check to see if one has been installed
   Bus = NULL;
+  idleSkip = false;
+  idleEvents = 0;
+  idleLastEvents = 0;
+  idlePC = 0x10000;
+  idleCycles = 0;
 #ifdef SUPERMODEL_DEBUGGER
   Debug = NULL;
 #endif //SUPERMODEL_DEBUGGER
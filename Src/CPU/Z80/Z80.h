@@ -148,6 +148,23 @@ public:
    *          this deasserts /INT (INT line high, no interrupt pending).
    */
   void SetINT(bool state);
+  
+  /*
+   * SetIdleSkip(enable):
+   *
+   * Enables or disables idle loop skipping. When enabled, a backward jump
+   * that is taken again with the same register state as on the
+   * previous pass, and with no memory or IO writes and no interrupt line
+   * changes in between, is treated as an idle loop: all whole iterations
+   * that fit in the remaining cycles are skipped at once. The cycle count
+   * returned by Run() is unchanged. This relies on memory and IO reads
+   * having no side effects other than through SetINT() while Run() is
+   * executing.
+   *
+   * Parameters:
+   *    enable  If TRUE, idle loops are skipped. Disabled by default.
+   */
+  void SetIdleSkip(bool enable);
 
   /*
    * GetPC(void):
@@ -329,6 +346,14 @@ private:
   bool  nmiTrigger;
   bool  intLine;
   int   (*INTCallback)(CZ80 *Z80);
+  
+  // Idle loop detection (see SetIdleSkip())
+  bool          idleSkip;
+  UINT32        idleEvents;     // bumped on writes and interrupt line changes
+  UINT32        idleLastEvents; // value at last backward jump
+  UINT32        idlePC;         // address of last backward jump (>0xFFFF if none)
+  int           idleCycles;     // cycles remaining at last backward jump
+  unsigned int  idleRegs[10];   // register state at last backward jump
 
 #ifdef SUPERMODEL_DEBUGGER
   int   lastCycles;
@@ -7,6 +7,8 @@
 #include <algorithm>
 #include <cctype>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 
 bool GameLoader::LoadZipArchive(ZipArchive *zip, const std::string &zipfilename) const
@@ -514,7 +516,11 @@ bool GameLoader::ParseXML(const Util::Config::Node &xml)
 {
   if (LoadGamesFromXML(xml))
     return true;
+  return ResolveParents();
+}
 
+bool GameLoader::ResolveParents()
+{
   // More than one level of parents not allowed
   bool error = false;
   std::set<std::string> parents_with_parents;
@@ -540,16 +546,383 @@ bool GameLoader::ParseXML(const Util::Config::Node &xml)
   return error;
 }
 
+/*
+ * Compiled game definitions
+ *
+ * Parsing the XML file is by far the most expensive part of starting up, so
+ * the parsed definitions (before children are merged with their parents) are
+ * written out next to it in a flat binary form the first time they are loaded.
+ * The file holds fixed-size records for games, regions, files and patches that
+ * refer to each other by index and to strings by offset into a single table
+ * of interned, null-terminated strings:
+ *
+ *  header
+ *  games[num_games], regions[num_regions], files[num_files], patches[num_patches]
+ *  strings[strings_size]
+ *
+ * It is read in one go and used only if the size and modification time of the
+ * XML file match the ones it was compiled from. Otherwise, the XML file is
+ * parsed and the compiled file rewritten.
+ */
+namespace
+{
+  const char s_compiled_magic[4] = { 'S', 'M', 'G', 'D' };
+  const uint32_t s_compiled_version = 1;
+
+  struct CompiledHeader
+  {
+    char magic[4];
+    uint32_t version;
+    uint64_t xml_size;
+    int64_t xml_mtime;
+    uint32_t num_games;
+    uint32_t num_regions;
+    uint32_t num_files;
+    uint32_t num_patches;
+    uint32_t strings_size;
+    uint32_t reserved;
+  };
+
+  struct CompiledGame
+  {
+    uint32_t name, parent, title, version, manufacturer, stepping, mpeg_board, pci_bridge;  // strings
+    uint32_t year;
+    uint32_t audio;
+    uint32_t real3d_pci_id;
+    float real3d_status_bit_set_percent_of_frame;
+    uint32_t encryption_key;
+    uint32_t inputs;
+    uint32_t driveboard_type;
+    uint32_t netboard_present;
+    uint32_t first_region, num_regions;
+    uint32_t first_patch, num_patches;
+  };
+
+  struct CompiledRegion
+  {
+    uint32_t name, byte_layout;  // strings
+    uint32_t stride;
+    uint32_t chunk_size;
+    uint32_t required;
+    uint32_t first_file, num_files;
+  };
+
+  struct CompiledFile
+  {
+    uint32_t filename;  // string
+    uint32_t offset;
+    uint32_t crc32;
+    uint32_t has_crc32;
+  };
+
+  struct CompiledPatch
+  {
+    uint32_t region;    // string
+    uint32_t bits;
+    uint32_t offset;
+    uint32_t reserved;
+    uint64_t value;
+  };
+
+  // Interns strings into a single null-terminated table
+  class StringTable
+  {
+  public:
+    uint32_t Add(const std::string &str)
+    {
+      auto it = m_offsets.find(str);
+      if (it != m_offsets.end())
+        return it->second;
+      uint32_t offset = uint32_t(m_table.size());
+      m_table.insert(m_table.end(), str.begin(), str.end());
+      m_table.push_back('\0');
+      m_offsets[str] = offset;
+      return offset;
+    }
+
+    const std::vector<char> &Table() const
+    {
+      return m_table;
+    }
+
+  private:
+    std::map<std::string, uint32_t> m_offsets;
+    std::vector<char> m_table;
+  };
+
+  bool GetXMLFileStamp(uint64_t *size, int64_t *mtime, const std::string &xml_filename)
+  {
+    std::error_code ec;
+    *size = std::filesystem::file_size(xml_filename, ec);
+    if (ec)
+      return false;
+    *mtime = int64_t(std::filesystem::last_write_time(xml_filename, ec).time_since_epoch().count());
+    return !ec;
+  }
+
+  template <typename T>
+  void ReadRecords(std::vector<T> *records, const uint8_t **ptr, size_t count)
+  {
+    records->resize(count);
+    if (count)
+      memcpy(records->data(), *ptr, count * sizeof(T));
+    *ptr += count * sizeof(T);
+  }
+}
+
+std::string GameLoader::CompiledDefinitionFilename(const std::string &xml_filename)
+{
+  return std::filesystem::path(xml_filename).replace_extension(".bin").string();
+}
+
+bool GameLoader::LoadCompiledDefinitions(const std::string &filename, const std::string &xml_filename)
+{
+  uint64_t xml_size;
+  int64_t xml_mtime;
+  if (!GetXMLFileStamp(&xml_size, &xml_mtime, xml_filename))
+    return true;
+
+  // Read the whole file in one go
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file)
+    return true;
+  std::vector<uint8_t> data(size_t(file.tellg()));
+  file.seekg(0);
+  if (data.size() < sizeof(CompiledHeader) || !file.read(reinterpret_cast<char *>(data.data()), data.size()))
+    return true;
+
+  CompiledHeader header;
+  memcpy(&header, data.data(), sizeof(header));
+  if (memcmp(header.magic, s_compiled_magic, sizeof(header.magic)) != 0 || header.version != s_compiled_version)
+    return true;
+  if (header.xml_size != xml_size || header.xml_mtime != xml_mtime)
+    return true;  // XML file has changed since
+  size_t expected_size = sizeof(header) +
+    header.num_games * sizeof(CompiledGame) +
+    header.num_regions * sizeof(CompiledRegion) +
+    header.num_files * sizeof(CompiledFile) +
+    header.num_patches * sizeof(CompiledPatch) +
+    header.strings_size;
+  if (data.size() != expected_size || header.strings_size == 0 || data.back() != '\0')
+    return true;
+
+  const uint8_t *ptr = data.data() + sizeof(header);
+  std::vector<CompiledGame> games;
+  std::vector<CompiledRegion> regions;
+  std::vector<CompiledFile> files;
+  std::vector<CompiledPatch> patches;
+  ReadRecords(&games, &ptr, header.num_games);
+  ReadRecords(&regions, &ptr, header.num_regions);
+  ReadRecords(&files, &ptr, header.num_files);
+  ReadRecords(&patches, &ptr, header.num_patches);
+  const char *strings = reinterpret_cast<const char *>(ptr);
+  bool error = false;
+  auto str = [&](uint32_t offset) -> std::string
+  {
+    if (offset >= header.strings_size)
+    {
+      error = true;
+      return std::string();
+    }
+    return std::string(strings + offset);
+  };
+
+  // Rebuild the definitions as LoadGamesFromXML() leaves them
+  std::map<std::string, Game> game_info_by_game;
+  std::map<std::string, RegionsByName_t> regions_by_game;
+  std::map<std::string, PatchesByRegion_t> patches_by_game;
+  for (auto &g: games)
+  {
+    if (uint64_t(g.first_region) + g.num_regions > regions.size() || uint64_t(g.first_patch) + g.num_patches > patches.size())
+      return true;
+
+    std::string game_name = str(g.name);
+    Game &game = game_info_by_game[game_name];
+    game.name = game_name;
+    game.parent = str(g.parent);
+    game.title = str(g.title);
+    game.version = str(g.version);
+    game.manufacturer = str(g.manufacturer);
+    game.year = g.year;
+    game.stepping = str(g.stepping);
+    game.mpeg_board = str(g.mpeg_board);
+    game.audio = Game::AudioTypes(g.audio);
+    game.pci_bridge = str(g.pci_bridge);
+    game.real3d_pci_id = g.real3d_pci_id;
+    game.real3d_status_bit_set_percent_of_frame = g.real3d_status_bit_set_percent_of_frame;
+    game.encryption_key = g.encryption_key;
+    game.netboard_present = g.netboard_present != 0;
+    game.inputs = g.inputs;
+    game.driveboard_type = Game::DriveBoardType(g.driveboard_type);
+
+    RegionsByName_t &regions_by_name = regions_by_game[game_name];
+    for (uint32_t i = g.first_region; i < g.first_region + g.num_regions; i++)
+    {
+      const CompiledRegion &r = regions[i];
+      if (uint64_t(r.first_file) + r.num_files > files.size())
+        return true;
+      Region::ptr_t region = std::make_shared<Region>();
+      region->region_name = str(r.name);
+      region->stride = r.stride;
+      region->chunk_size = r.chunk_size;
+      region->byte_layout = str(r.byte_layout);
+      region->required = r.required != 0;
+      for (uint32_t j = r.first_file; j < r.first_file + r.num_files; j++)
+      {
+        File::ptr_t file = std::make_shared<File>();
+        file->filename = str(files[j].filename);
+        file->offset = files[j].offset;
+        file->crc32 = files[j].crc32;
+        file->has_crc32 = files[j].has_crc32 != 0;
+        region->files.push_back(file);
+      }
+      regions_by_name[region->region_name] = region;
+    }
+
+    PatchesByRegion_t &patches_by_region = patches_by_game[game_name];
+    for (uint32_t i = g.first_patch; i < g.first_patch + g.num_patches; i++)
+    {
+      const CompiledPatch &p = patches[i];
+      patches_by_region[str(p.region)].push_back(ROM::BigEndianPatch(p.offset, p.value, p.bits));
+    }
+  }
+  if (error || game_info_by_game.empty())
+    return true;
+
+  m_game_info_by_game = std::move(game_info_by_game);
+  m_regions_by_game = std::move(regions_by_game);
+  m_patches_by_game = std::move(patches_by_game);
+  return false;
+}
+
+void GameLoader::SaveCompiledDefinitions(const std::string &filename, const std::string &xml_filename) const
+{
+  CompiledHeader header = {};
+  memcpy(header.magic, s_compiled_magic, sizeof(header.magic));
+  header.version = s_compiled_version;
+  if (!GetXMLFileStamp(&header.xml_size, &header.xml_mtime, xml_filename))
+    return;
+
+  StringTable strings;
+  std::vector<CompiledGame> games;
+  std::vector<CompiledRegion> regions;
+  std::vector<CompiledFile> files;
+  std::vector<CompiledPatch> patches;
+  for (auto &v: m_game_info_by_game)
+  {
+    const Game &game = v.second;
+    CompiledGame g = {};
+    g.name = strings.Add(game.name);
+    g.parent = strings.Add(game.parent);
+    g.title = strings.Add(game.title);
+    g.version = strings.Add(game.version);
+    g.manufacturer = strings.Add(game.manufacturer);
+    g.stepping = strings.Add(game.stepping);
+    g.mpeg_board = strings.Add(game.mpeg_board);
+    g.pci_bridge = strings.Add(game.pci_bridge);
+    g.year = game.year;
+    g.audio = uint32_t(game.audio);
+    g.real3d_pci_id = game.real3d_pci_id;
+    g.real3d_status_bit_set_percent_of_frame = game.real3d_status_bit_set_percent_of_frame;
+    g.encryption_key = game.encryption_key;
+    g.inputs = game.inputs;
+    g.driveboard_type = uint32_t(game.driveboard_type);
+    g.netboard_present = game.netboard_present;
+
+    g.first_region = uint32_t(regions.size());
+    auto regions_it = m_regions_by_game.find(v.first);
+    if (regions_it != m_regions_by_game.end())
+    {
+      for (auto &v2: regions_it->second)
+      {
+        const Region &region = *v2.second;
+        CompiledRegion r = {};
+        r.name = strings.Add(region.region_name);
+        r.byte_layout = strings.Add(region.byte_layout);
+        r.stride = uint32_t(region.stride);
+        r.chunk_size = uint32_t(region.chunk_size);
+        r.required = region.required;
+        r.first_file = uint32_t(files.size());
+        for (auto &file: region.files)
+        {
+          CompiledFile f = {};
+          f.filename = strings.Add(file->filename);
+          f.offset = file->offset;
+          f.crc32 = file->crc32;
+          f.has_crc32 = file->has_crc32;
+          files.push_back(f);
+        }
+        r.num_files = uint32_t(files.size()) - r.first_file;
+        regions.push_back(r);
+      }
+    }
+    g.num_regions = uint32_t(regions.size()) - g.first_region;
+
+    g.first_patch = uint32_t(patches.size());
+    auto patches_it = m_patches_by_game.find(v.first);
+    if (patches_it != m_patches_by_game.end())
+    {
+      for (auto &v2: patches_it->second)
+      {
+        for (auto &patch: v2.second)
+        {
+          CompiledPatch p = {};
+          p.region = strings.Add(v2.first);
+          p.bits = patch.bits;
+          p.offset = patch.offset;
+          p.value = patch.value;
+          patches.push_back(p);
+        }
+      }
+    }
+    g.num_patches = uint32_t(patches.size()) - g.first_patch;
+    games.push_back(g);
+  }
+
+  header.num_games = uint32_t(games.size());
+  header.num_regions = uint32_t(regions.size());
+  header.num_files = uint32_t(files.size());
+  header.num_patches = uint32_t(patches.size());
+  header.strings_size = uint32_t(strings.Table().size());
+
+  std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+  if (!file)
+  {
+    InfoLog("Unable to write compiled game definitions to '%s'.", filename.c_str());
+    return;
+  }
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(games.data()), games.size() * sizeof(CompiledGame));
+  file.write(reinterpret_cast<const char *>(regions.data()), regions.size() * sizeof(CompiledRegion));
+  file.write(reinterpret_cast<const char *>(files.data()), files.size() * sizeof(CompiledFile));
+  file.write(reinterpret_cast<const char *>(patches.data()), patches.size() * sizeof(CompiledPatch));
+  file.write(strings.Table().data(), strings.Table().size());
+  if (!file)
+    InfoLog("Unable to write compiled game definitions to '%s'.", filename.c_str());
+}
+
 bool GameLoader::LoadDefinitionXML(const std::string &filename)
 {
   m_xml_filename = filename;
+
+  // Use the compiled definitions if they are up to date
+  std::string compiled_filename = CompiledDefinitionFilename(filename);
+  if (!LoadCompiledDefinitions(compiled_filename, filename))
+  {
+    InfoLog("Loaded game definitions from '%s'.", compiled_filename.c_str());
+    return ResolveParents();
+  }
+
   Util::Config::Node xml("xml");
   if (Util::Config::FromXMLFile(&xml, filename))
   {
     ErrorLog("Game and ROM set definitions could not be loaded! ROMs will not be detected.");
     return true;
   }
-  return ParseXML(xml);
+  bool error = ParseXML(xml);
+  if (!error)
+    SaveCompiledDefinitions(compiled_filename, filename);
+  return error;
 }
 
 void GameLoader::FindEquivalentFiles(std::set<File::ptr_t> *equivalent_files, const std::set<File::ptr_t> &a, const std::set<File::ptr_t> &b)
@@ -1005,6 +1378,38 @@ bool GameLoader::Load(Game *game, ROMSet *rom_set, const std::string &zipfilenam
   return error;
 }
 
+void GameLoader::IdentifyGames(std::map<std::string, std::string> *game_by_zipfilename, const ROMIndex &index) const
+{
+  game_by_zipfilename->clear();
+
+  // Identify the game in each archive from its indexed contents, without
+  // opening it. Only the file list is needed to choose a game.
+  for (auto &v: index.GetArchives())
+  {
+    const std::string &zipfilename = v.first;
+    const ROMIndex::Archive &archive = v.second;
+    if (!archive.valid)
+      continue;
+
+    ZipArchive zip;
+    zip.zipfilenames.push_back(zipfilename);
+    for (auto &entry: archive.entries)
+    {
+      ZippedFile &zipped_file = zip.files_by_crc[entry.crc32];
+      zipped_file.zipfilename = zipfilename;
+      zipped_file.filename = entry.filename;
+      zipped_file.uncompressed_size = entry.uncompressed_size;
+      zipped_file.crc32 = entry.crc32;
+    }
+
+    std::string chosen_game;
+    bool missing_parent_roms = false;
+    ChooseGameInZipArchive(&chosen_game, &missing_parent_roms, zip, zipfilename);
+    if (!chosen_game.empty())
+      (*game_by_zipfilename)[zipfilename] = chosen_game;
+  }
+}
+
 GameLoader::GameLoader(const std::string &xml_file)
 {
   LoadDefinitionXML(xml_file);
@@ -5,6 +5,7 @@
 #include "Pkgs/unzip.h"
 #include "Game.h"
 #include "ROMSet.h"
+#include "ROMIndex.h"
 #include <map>
 #include <set>
 
@@ -88,6 +89,10 @@ private:
   bool MergeChildrenWithParents();
   void LogROMDefinition(const std::string &game_name, const RegionsByName_t &regions_by_name) const;
   bool ParseXML(const Util::Config::Node &xml);
+  bool ResolveParents();
+  static std::string CompiledDefinitionFilename(const std::string &xml_filename);
+  bool LoadCompiledDefinitions(const std::string &filename, const std::string &xml_filename);
+  void SaveCompiledDefinitions(const std::string &filename, const std::string &xml_filename) const;
   bool LoadDefinitionXML(const std::string &filename);
   static void FindEquivalentFiles(std::set<File::ptr_t> *equivalent_files, const std::set<File::ptr_t> &a, const std::set<File::ptr_t> &b);
   void IdentifyGamesInZipArchive(
@@ -105,6 +110,7 @@ private:
 public:
   GameLoader(const std::string &xml_file);
   bool Load(Game *game, ROMSet *rom_set, const std::string &zipfilename) const;
+  void IdentifyGames(std::map<std::string, std::string> *game_by_zipfilename, const ROMIndex &index) const;
   const std::map<std::string, Game> &GetGames() const
   {
     return m_game_info_by_game;
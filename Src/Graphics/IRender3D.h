@@ -3,6 +3,18 @@
 
 #include <cstdint>
 
+/*
+ * Render3DStats:
+ *
+ * Statistics for the most recently rendered frame, for benchmarking.
+ */
+struct Render3DStats
+{
+  double    sceneBuildMs; // CPU time spent traversing the scene database and building models
+  uint32_t  drawCalls;    // number of draw calls issued for scene geometry
+  uint32_t  vertices;     // number of vertices submitted by those draw calls
+};
+
 /*
  * IRender3D:
  *
@@ -21,6 +33,7 @@ public:
   virtual void SetSunClamp(bool enable) = 0;
   virtual void SetSignedShade(bool enable) = 0;
   virtual float GetLosValue(int layer) = 0;
+  virtual void GetFrameStats(Render3DStats *stats) = 0;
 
   virtual ~IRender3D()
   {
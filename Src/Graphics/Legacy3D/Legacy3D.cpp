@@ -164,6 +164,7 @@
 #include "Util/BitCast.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 
@@ -1014,13 +1015,18 @@ void CLegacy3D::RenderFrame(void)
     ClearModelCache(&VROMCache);
 #endif
   ClearModelCache(&PolyCache);
+  m_stats.sceneBuildMs = 0.0;
+  m_stats.drawCalls = 0;
+  m_stats.vertices = 0;
   for (int pri = 0; pri <= 3; pri++)
   {
     glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
     //ClearModelCache(&PolyCache);
     ClearDisplayList(&PolyCache);
     ClearDisplayList(&VROMCache);
+    auto buildStart = std::chrono::steady_clock::now();
     RenderViewport(0x800000,pri,wideScreen);
+    m_stats.sceneBuildMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
     DrawDisplayList(&VROMCache, POLY_STATE_NORMAL);
     DrawDisplayList(&PolyCache, POLY_STATE_NORMAL);
     DrawDisplayList(&VROMCache, POLY_STATE_ALPHA);
@@ -1319,6 +1325,11 @@ float CLegacy3D::GetLosValue(int layer)
 	return 0.0f;
 }
 
+void CLegacy3D::GetFrameStats(Render3DStats *stats)
+{
+  *stats = m_stats;
+}
+
 CLegacy3D::CLegacy3D(const Util::Config::Node &config)
   : m_config(config),
     m_aaTarget(0)
@@ -360,6 +360,16 @@ public:
 	*/
 	float GetLosValue(int layer);
 
+	/*
+	* GetFrameStats(Render3DStats *stats);
+	*
+	* Gets statistics for the most recently rendered frame
+	*
+	* Parameters:
+	*		stats	Filled in with scene build time, draw calls and vertices
+	*/
+	void GetFrameStats(Render3DStats *stats);
+
 	/*
 	 * CLegacy3D(void):
 	 * ~CLegacy3D(void):
@@ -522,6 +532,9 @@ private:
 	// Model caching
 	ModelCache	VROMCache;	// VROM (static) models
 	ModelCache	PolyCache;	// polygon RAM (dynamic) models
+
+	// Statistics for the last frame, for benchmarking
+	Render3DStats	m_stats = {};
 	
 	/*
  	 * Texture Decode Buffer
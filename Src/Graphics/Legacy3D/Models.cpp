@@ -307,6 +307,8 @@ void CLegacy3D::DrawDisplayList(ModelCache *Cache, POLY_STATE state)
       if (modelViewMatrixLoc != -1)
         glUniformMatrix4fv(modelViewMatrixLoc, 1, GL_FALSE, Model.modelViewMatrix);
       glDrawArrays(GL_TRIANGLES, Model.index, Model.numVerts);
+      m_stats.drawCalls++;
+      m_stats.vertices += Model.numVerts;
       if (Model.frontFace == -GL_CW)
         glEnable(GL_CULL_FACE);
     }
@@ -5,6 +5,7 @@
 #include <limits>
 #include <cstring>
 #include <unordered_map>
+#include <chrono>
 #include "R3DFloat.h"
 #include "Util/BitCast.h"
 
@@ -319,6 +320,8 @@ bool CNew3D::RenderScene(int priority, bool renderOverlay, Layer layer)
 				
 				m_r3dShader.SetMeshUniforms(&mesh);
 				glDrawArrays(m_primType, mesh.vboOffset, mesh.vertexCount);
+				m_stats.drawCalls++;
+				m_stats.vertices += mesh.vertexCount;
 			}
 		}
 	}
@@ -326,6 +329,26 @@ bool CNew3D::RenderScene(int priority, bool renderOverlay, Layer layer)
 	return hasOverlay;
 }
 
+bool CNew3D::HasMeshes(int priority, bool renderOverlay, Layer layer)
+{
+	for (const auto &n : m_nodes) {
+
+		if (n.viewport.priority != priority) {
+			continue;
+		}
+
+		for (const auto &m : n.models) {
+			for (auto &mesh : *m.meshes) {
+				if (mesh.highPriority == renderOverlay && mesh.Render(layer, m.alpha)) {
+					return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
 bool CNew3D::SkipLayer(int layer)
 {
 	for (const auto &n : m_nodes) {
@@ -385,7 +408,12 @@ void CNew3D::RenderFrame(void)
 	m_modelMat.Release();			// would hope we wouldn't need this but no harm in checking
 	m_nodeAttribs.Reset();
 
+	m_stats.drawCalls = 0;
+	m_stats.vertices = 0;
+	m_r3dShader.BeginFrame();
+	auto buildStart = std::chrono::steady_clock::now();
 	RenderViewport(0x800000);						// build model structure
+	m_stats.sceneBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
 	
 	m_vbo.Bind(true);
 	m_vbo.BufferSubData(MAX_ROM_VERTS*sizeof(FVertex), m_polyBufferRam.size()*sizeof(FVertex), m_polyBufferRam.data());	// upload all the dynamic data to GPU in one go
@@ -444,15 +472,25 @@ void CNew3D::RenderFrame(void)
 
 			m_r3dShader.DiscardAlpha(false);
 
-			m_r3dFrameBuffers.StoreDepth();
-			m_r3dShader.SetLayer(Layer::trans1);
-			m_r3dFrameBuffers.SetFBO(Layer::trans1);
-			RenderScene(pri, renderOverlay, Layer::trans1);
+			// each trans layer is depth tested against the opaque pass only, so trans2 needs its own copy of the depth buffer if trans1 is drawn first
+			bool hasTrans1 = HasMeshes(pri, renderOverlay, Layer::trans1);
+			bool hasTrans2 = HasMeshes(pri, renderOverlay, Layer::trans2);
 
-			m_r3dFrameBuffers.RestoreDepth();
-			m_r3dShader.SetLayer(Layer::trans2);
-			m_r3dFrameBuffers.SetFBO(Layer::trans2);
-			RenderScene(pri, renderOverlay, Layer::trans2);
+			if (hasTrans1 && hasTrans2) {
+				m_r3dFrameBuffers.StoreDepth();
+			}
+
+			if (hasTrans1) {
+				m_r3dShader.SetLayer(Layer::trans1);
+				m_r3dFrameBuffers.SetFBO(Layer::trans1);
+				RenderScene(pri, renderOverlay, Layer::trans1);
+			}
+
+			if (hasTrans2) {
+				m_r3dShader.SetLayer(Layer::trans2);
+				m_r3dFrameBuffers.SetFBO(Layer::trans2);
+				RenderScene(pri, renderOverlay, Layer::trans2);
+			}
 						
 			DisableRenderStates();
 
@@ -1610,6 +1648,11 @@ float CNew3D::GetLosValue(int layer)
 	return m_losFront->value[layer];
 }
 
+void CNew3D::GetFrameStats(Render3DStats *stats)
+{
+	*stats = m_stats;
+}
+
 void CNew3D::TranslateLosPosition(int inX, int inY, int& outX, int& outY)
 {
 	// remap real3d 496x384 to our new viewport
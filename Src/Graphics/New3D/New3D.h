@@ -173,6 +173,16 @@ public:
 	*/
 	float GetLosValue(int layer);
 
+	/*
+	* GetFrameStats(Render3DStats *stats);
+	*
+	* Gets statistics for the most recently rendered frame
+	*
+	* Parameters:
+	*		stats	Filled in with scene build time, draw calls and vertices
+	*/
+	void GetFrameStats(Render3DStats *stats);
+
 	/*
 	* CRender3D(config):
 	* ~CRender3D(void):
@@ -219,6 +229,7 @@ private:
 	void DrawScrollFog();
 	void DrawAmbientFog();
 	bool SkipLayer(int layer);
+	bool HasMeshes(int priority, bool renderOverlay, Layer layer);	// returns if RenderScene() would draw anything
 	void SetRenderStates();
 	void DisableRenderStates();
 	void TranslateLosPosition(int inX, int inY, int& outX, int& outY);
@@ -274,6 +285,8 @@ private:
 	LOS* m_losBack = &m_los[1];
 	std::mutex m_losMutex;
 
+	Render3DStats	m_stats = {};			// statistics for the last frame, for benchmarking
+
 	Vertex			m_prev[4];				// these are class variables because sega bass fishing starts meshes with shared vertices from the previous one
 	UINT16			m_prevTexCoords[4][2];	// basically relying on undefined behavour
 
@@ -17,6 +17,7 @@ R3DFrameBuffers::R3DFrameBuffers()
 	}
 
 	m_lastLayer = Layer::none;
+	m_depthStored = false;
 
 	AllocShaderTrans();
 	AllocShaderBase();
@@ -78,32 +79,36 @@ bool R3DFrameBuffers::CreateFBODepthCopy(int width, int height)
 	glGenFramebuffers(1, &m_frameBufferIDCopy);
 	glBindFramebuffer(GL_FRAMEBUFFER, m_frameBufferIDCopy);
 
+	// trans layer2 renders here against the copied depth, so it needs its colour buffer too
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, m_texIDs[2], 0);
+
 	glGenRenderbuffers(1, &m_renderBufferIDCopy);
 	glBindRenderbuffer(GL_RENDERBUFFER, m_renderBufferIDCopy);
 	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH32F_STENCIL8, width, height);
 	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_renderBufferIDCopy);
 	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_renderBufferIDCopy);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
 	// check setup was successful
 	auto fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
 	return (fboStatus == GL_FRAMEBUFFER_COMPLETE);
 }
 
 void R3DFrameBuffers::StoreDepth()
 {
+	// trans2 is drawn against the copy, so the original never has to be restored after trans1
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_frameBufferID);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_frameBufferIDCopy);
 	glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
-}
 
-void R3DFrameBuffers::RestoreDepth()
-{
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_frameBufferIDCopy);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_frameBufferID);
-	glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	// rebind whatever was bound before
+	Layer layer = m_lastLayer;
+	m_lastLayer = Layer::all;
+	SetFBO(layer);
+
+	m_depthStored = true;
 }
 
 void R3DFrameBuffers::DestroyFBO()
@@ -154,6 +159,10 @@ void R3DFrameBuffers::BindTexture(Layer layer)
 
 void R3DFrameBuffers::SetFBO(Layer layer)
 {
+	if (layer == Layer::colour) {
+		m_depthStored = false;	// a new opaque pass, trans2 goes back to the main depth buffer
+	}
+
 	if (m_lastLayer == layer) {
 		return;
 	}
@@ -176,7 +185,7 @@ void R3DFrameBuffers::SetFBO(Layer layer)
 	}
 	case Layer::trans2:
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, m_frameBufferID);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_depthStored ? m_frameBufferIDCopy : m_frameBufferID);
 		GLenum buffers[] = { GL_NONE, GL_NONE, GL_COLOR_ATTACHMENT2 };
 		glDrawBuffers((GLsizei)std::size(buffers), buffers);
 		break;
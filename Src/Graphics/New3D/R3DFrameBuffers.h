@@ -21,8 +21,7 @@ public:
 
 	void	BindTexture(Layer layer);
 	void	SetFBO(Layer layer);
-	void	StoreDepth();
-	void	RestoreDepth();
+	void	StoreDepth();			// copy depth/stencil for trans2 to render against, leaving the original to trans1
 
 private:
 
@@ -40,6 +39,7 @@ private:
 	GLuint m_frameBufferIDCopy;
 	GLuint m_renderBufferIDCopy;
 	Layer m_lastLayer;
+	bool m_depthStored;
 	int m_width;
 	int m_height;
 
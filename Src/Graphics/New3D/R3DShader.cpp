@@ -8,13 +8,33 @@
 
 namespace New3D {
 
+static const int MAX_COMPILES_PER_FRAME = 2;		// variants to start compiling per frame, spreads the cost out when a new scene appears
+
+// inserts defines after the #version line, which must come first
+static std::string InsertDefines(const char* source, const std::string& defines)
+{
+	std::string s = source;
+
+	size_t pos = s.find("#version");
+	if (pos != std::string::npos) {
+		pos = s.find('\n', pos);
+		s.insert(pos == std::string::npos ? s.size() : pos + 1, defines);
+	}
+
+	return s;
+}
+
 R3DShader::R3DShader(const Util::Config::Node &config)
 	: m_config(config)
 {
-	m_shaderProgram		= 0;
-	m_vertexShader		= 0;
-	m_geoShader			= 0;
-	m_fragmentShader	= 0;
+	m_program			= &m_uberShader;
+	m_parallelCompile	= false;
+	m_frame				= 0;
+	m_compilesStarted	= 0;
+	m_viewport			= nullptr;
+	m_model				= nullptr;
+	m_layer				= Layer::colour;
+	m_discardAlpha		= false;
 
 	Start();	// reset attributes
 }
@@ -58,6 +78,25 @@ void R3DShader::Start()
 }
 
 bool R3DShader::LoadShader(const char* vertexShader, const char* fragmentShader)
+{
+	m_parallelCompile = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+
+	if (GLEW_KHR_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);		// as many as the driver likes
+	}
+	else if (GLEW_ARB_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+	}
+
+	CompileProgram(m_uberShader, "");
+	FinishProgram(m_uberShader);
+
+	m_program = &m_uberShader;
+
+	return true;
+}
+
+void R3DShader::CompileProgram(Program& program, const std::string& defines)
 {
 	bool quads = m_config["QuadRendering"].ValueAs<bool>();
 
@@ -71,112 +110,276 @@ bool R3DShader::LoadShader(const char* vertexShader, const char* fragmentShader)
 		fShader = fragmentShaderR3DQuads;
 	}
 
-	m_shaderProgram		= glCreateProgram();
-	m_vertexShader		= glCreateShader(GL_VERTEX_SHADER);
-	m_fragmentShader	= glCreateShader(GL_FRAGMENT_SHADER);
+	std::string vSource = InsertDefines(vShader, defines);
+	std::string gSource = InsertDefines(gShader, defines);
+	std::string fSource = InsertDefines(fShader, defines);
+
+	program.shaderProgram	= glCreateProgram();
+	program.vertexShader	= glCreateShader(GL_VERTEX_SHADER);
+	program.fragmentShader	= glCreateShader(GL_FRAGMENT_SHADER);
 
-	const char* shaderArray[] = { fShader, fragmentShaderR3DCommon };
+	const char* vertexArray[]	= { vSource.c_str() };
+	const char* shaderArray[]	= { fSource.c_str(), fragmentShaderR3DCommon };
 
-	glShaderSource(m_vertexShader, 1, (const GLchar **)&vShader, nullptr);
-	glShaderSource(m_fragmentShader, (GLsizei)std::size(shaderArray), shaderArray, nullptr);
+	glShaderSource(program.vertexShader, 1, (const GLchar **)vertexArray, nullptr);
+	glShaderSource(program.fragmentShader, (GLsizei)std::size(shaderArray), shaderArray, nullptr);
 
-	glCompileShader(m_vertexShader);
-	glCompileShader(m_fragmentShader);
+	glCompileShader(program.vertexShader);
+	glCompileShader(program.fragmentShader);
 
 	if (quads) {
-		m_geoShader = glCreateShader(GL_GEOMETRY_SHADER);
-		glShaderSource(m_geoShader, 1, (const GLchar **)&gShader, nullptr);
-		glCompileShader(m_geoShader);
-		glAttachShader(m_shaderProgram, m_geoShader);
-		PrintShaderResult(m_geoShader);
-	}
-
-	PrintShaderResult(m_vertexShader);
-	PrintShaderResult(m_fragmentShader);
-
-	glAttachShader(m_shaderProgram, m_vertexShader);
-	glAttachShader(m_shaderProgram, m_fragmentShader);
-	glLinkProgram(m_shaderProgram);
-
-	PrintProgramResult(m_shaderProgram);
-
-	m_locTexture1			= glGetUniformLocation(m_shaderProgram, "tex1");
-	m_locTexture1Enabled	= glGetUniformLocation(m_shaderProgram, "textureEnabled");
-	m_locTexture2Enabled	= glGetUniformLocation(m_shaderProgram, "microTexture");
-	m_locTextureAlpha		= glGetUniformLocation(m_shaderProgram, "textureAlpha");
-	m_locAlphaTest			= glGetUniformLocation(m_shaderProgram, "alphaTest");
-	m_locMicroTexScale		= glGetUniformLocation(m_shaderProgram, "microTextureScale");
-	m_locMicroTexID			= glGetUniformLocation(m_shaderProgram, "microTextureID");
-	m_locBaseTexInfo		= glGetUniformLocation(m_shaderProgram, "baseTexInfo");
-	m_locBaseTexType		= glGetUniformLocation(m_shaderProgram, "baseTexType");
-	m_locTextureInverted	= glGetUniformLocation(m_shaderProgram, "textureInverted");
-	m_locTexWrapMode		= glGetUniformLocation(m_shaderProgram, "textureWrapMode");
-	m_locColourLayer		= glGetUniformLocation(m_shaderProgram, "colourLayer");
-	m_locPolyAlpha			= glGetUniformLocation(m_shaderProgram, "polyAlpha");
-
-	m_locFogIntensity		= glGetUniformLocation(m_shaderProgram, "fogIntensity");
-	m_locFogDensity			= glGetUniformLocation(m_shaderProgram, "fogDensity");
-	m_locFogStart			= glGetUniformLocation(m_shaderProgram, "fogStart");
-	m_locFogColour			= glGetUniformLocation(m_shaderProgram, "fogColour");
-	m_locFogAttenuation		= glGetUniformLocation(m_shaderProgram, "fogAttenuation");
-	m_locFogAmbient			= glGetUniformLocation(m_shaderProgram, "fogAmbient");
-
-	m_locLighting			= glGetUniformLocation(m_shaderProgram, "lighting");
-	m_locLightEnabled		= glGetUniformLocation(m_shaderProgram, "lightEnabled");
-	m_locSunClamp			= glGetUniformLocation(m_shaderProgram, "sunClamp");
-	m_locIntensityClamp		= glGetUniformLocation(m_shaderProgram, "intensityClamp");
-	m_locShininess			= glGetUniformLocation(m_shaderProgram, "shininess");
-	m_locSpecularValue		= glGetUniformLocation(m_shaderProgram, "specularValue");
-	m_locSpecularEnabled	= glGetUniformLocation(m_shaderProgram, "specularEnabled");
-	m_locFixedShading		= glGetUniformLocation(m_shaderProgram, "fixedShading");
-	m_locTranslatorMap		= glGetUniformLocation(m_shaderProgram, "translatorMap");
-
-	m_locSpotEllipse		= glGetUniformLocation(m_shaderProgram, "spotEllipse");
-	m_locSpotRange			= glGetUniformLocation(m_shaderProgram, "spotRange");
-	m_locSpotColor			= glGetUniformLocation(m_shaderProgram, "spotColor");
-	m_locSpotFogColor		= glGetUniformLocation(m_shaderProgram, "spotFogColor");
-	m_locModelScale			= glGetUniformLocation(m_shaderProgram, "modelScale");
-	m_locNodeAlpha			= glGetUniformLocation(m_shaderProgram, "nodeAlpha");
-
-	m_locProjMat			= glGetUniformLocation(m_shaderProgram, "projMat");
-	m_locModelMat			= glGetUniformLocation(m_shaderProgram, "modelMat");
-
-	m_locHardwareStep		= glGetUniformLocation(m_shaderProgram, "hardwareStep");
-	m_locDiscardAlpha		= glGetUniformLocation(m_shaderProgram, "discardAlpha");
+		const char* geometryArray[] = { gSource.c_str() };
+		program.geoShader = glCreateShader(GL_GEOMETRY_SHADER);
+		glShaderSource(program.geoShader, 1, (const GLchar **)geometryArray, nullptr);
+		glCompileShader(program.geoShader);
+		glAttachShader(program.shaderProgram, program.geoShader);
+	}
+
+	glAttachShader(program.shaderProgram, program.vertexShader);
+	glAttachShader(program.shaderProgram, program.fragmentShader);
+
+	// variants share the vertex array object set up for the uber-shader, so need the same attribute locations
+	for (const auto& attrib : m_vertexLocCache) {
+		if (attrib.second >= 0) {
+			glBindAttribLocation(program.shaderProgram, attrib.second, attrib.first.c_str());
+		}
+	}
+
+	glLinkProgram(program.shaderProgram);
+}
+
+bool R3DShader::FinishProgram(Program& program)
+{
+	PrintShaderResult(program.vertexShader);
+	PrintShaderResult(program.fragmentShader);
+
+	if (program.geoShader) {
+		PrintShaderResult(program.geoShader);
+	}
+
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program.shaderProgram, GL_LINK_STATUS, &linked);
+
+	if (linked == GL_FALSE) {
+		PrintProgramResult(program.shaderProgram);
+		program.failed = true;
+		return false;
+	}
+
+	program.locTexture1			= glGetUniformLocation(program.shaderProgram, "tex1");
+	program.locTexture1Enabled	= glGetUniformLocation(program.shaderProgram, "textureEnabled");
+	program.locTexture2Enabled	= glGetUniformLocation(program.shaderProgram, "microTexture");
+	program.locTextureAlpha		= glGetUniformLocation(program.shaderProgram, "textureAlpha");
+	program.locAlphaTest			= glGetUniformLocation(program.shaderProgram, "alphaTest");
+	program.locMicroTexScale		= glGetUniformLocation(program.shaderProgram, "microTextureScale");
+	program.locMicroTexID			= glGetUniformLocation(program.shaderProgram, "microTextureID");
+	program.locBaseTexInfo		= glGetUniformLocation(program.shaderProgram, "baseTexInfo");
+	program.locBaseTexType		= glGetUniformLocation(program.shaderProgram, "baseTexType");
+	program.locTextureInverted	= glGetUniformLocation(program.shaderProgram, "textureInverted");
+	program.locTexWrapMode		= glGetUniformLocation(program.shaderProgram, "textureWrapMode");
+	program.locColourLayer		= glGetUniformLocation(program.shaderProgram, "colourLayer");
+	program.locPolyAlpha			= glGetUniformLocation(program.shaderProgram, "polyAlpha");
+
+	program.locFogIntensity		= glGetUniformLocation(program.shaderProgram, "fogIntensity");
+	program.locFogDensity			= glGetUniformLocation(program.shaderProgram, "fogDensity");
+	program.locFogStart			= glGetUniformLocation(program.shaderProgram, "fogStart");
+	program.locFogColour			= glGetUniformLocation(program.shaderProgram, "fogColour");
+	program.locFogAttenuation		= glGetUniformLocation(program.shaderProgram, "fogAttenuation");
+	program.locFogAmbient			= glGetUniformLocation(program.shaderProgram, "fogAmbient");
+
+	program.locLighting			= glGetUniformLocation(program.shaderProgram, "lighting");
+	program.locLightEnabled		= glGetUniformLocation(program.shaderProgram, "lightEnabled");
+	program.locSunClamp			= glGetUniformLocation(program.shaderProgram, "sunClamp");
+	program.locIntensityClamp		= glGetUniformLocation(program.shaderProgram, "intensityClamp");
+	program.locShininess			= glGetUniformLocation(program.shaderProgram, "shininess");
+	program.locSpecularValue		= glGetUniformLocation(program.shaderProgram, "specularValue");
+	program.locSpecularEnabled	= glGetUniformLocation(program.shaderProgram, "specularEnabled");
+	program.locFixedShading		= glGetUniformLocation(program.shaderProgram, "fixedShading");
+	program.locTranslatorMap		= glGetUniformLocation(program.shaderProgram, "translatorMap");
+
+	program.locSpotEllipse		= glGetUniformLocation(program.shaderProgram, "spotEllipse");
+	program.locSpotRange			= glGetUniformLocation(program.shaderProgram, "spotRange");
+	program.locSpotColor			= glGetUniformLocation(program.shaderProgram, "spotColor");
+	program.locSpotFogColor		= glGetUniformLocation(program.shaderProgram, "spotFogColor");
+	program.locModelScale			= glGetUniformLocation(program.shaderProgram, "modelScale");
+	program.locNodeAlpha			= glGetUniformLocation(program.shaderProgram, "nodeAlpha");
+
+	program.locProjMat			= glGetUniformLocation(program.shaderProgram, "projMat");
+	program.locModelMat			= glGetUniformLocation(program.shaderProgram, "modelMat");
+
+	program.locHardwareStep		= glGetUniformLocation(program.shaderProgram, "hardwareStep");
+	program.locDiscardAlpha		= glGetUniformLocation(program.shaderProgram, "discardAlpha");
+
+	program.ready = true;
 
 	return true;
 }
 
+void R3DShader::DeleteProgram(Program& program)
+{
+	if (program.vertexShader) {
+		glDeleteShader(program.vertexShader);
+		program.vertexShader = 0;
+	}
+
+	if (program.geoShader) {
+		glDeleteShader(program.geoShader);
+		program.geoShader = 0;
+	}
+
+	if (program.fragmentShader) {
+		glDeleteShader(program.fragmentShader);
+		program.fragmentShader = 0;
+	}
+
+	if (program.shaderProgram) {
+		glDeleteProgram(program.shaderProgram);
+		program.shaderProgram = 0;
+	}
+
+	program.ready = false;
+}
+
 void R3DShader::UnloadShader()
 {
 	// make sure no shader is bound
 	glUseProgram(0);
 
-	if (m_vertexShader) {
-		glDeleteShader(m_vertexShader);
-		m_vertexShader = 0;
+	for (auto& variant : m_variants) {
+		DeleteProgram(variant.second);
+	}
+
+	m_variants.clear();
+
+	DeleteProgram(m_uberShader);
+
+	m_program = &m_uberShader;
+}
+
+void R3DShader::BeginFrame()
+{
+	m_frame++;
+	m_compilesStarted = 0;
+}
+
+UINT32 R3DShader::VariantKey(const Mesh* m)
+{
+	// state that doesn't matter for the mesh is left out so that equivalent meshes share a variant,
+	// ie the texture state of untextured meshes and specular for luminous ones
+	UINT32 key = 0;
+
+	if (m->textured) {
+		key |= VARIANT_TEXTURED;
+		if (m->microTexture)	key |= VARIANT_MICROTEXTURE;
+		if (m->alphaTest)		key |= VARIANT_ALPHATEST;
+		key |= (m->format & 0xF) << VARIANT_FORMAT_SHIFT;
+	}
+
+	if (m->lighting) {
+		key |= VARIANT_LIGHTING;
+		if (m->specular)		key |= VARIANT_SPECULAR;
+	}
+
+	if (m->fixedShading)		key |= VARIANT_FIXEDSHADING;	// also used by luminous polys on step 1.5
+	if (m->translatorMap)		key |= VARIANT_TRANSLATORMAP;
+
+	return key;
+}
+
+std::string R3DShader::VariantDefines(UINT32 key)
+{
+	auto constBool = [key](const char* name, UINT32 bit) {
+		return std::string("const bool ") + name + ((key & bit) ? " = true;\n" : " = false;\n");
+	};
+
+	std::string defines = "#define SPECIALISED\n";
+
+	defines += constBool("textureEnabled",	VARIANT_TEXTURED);
+	defines += constBool("microTexture",	VARIANT_MICROTEXTURE);
+	defines += constBool("alphaTest",		VARIANT_ALPHATEST);
+	defines += constBool("lightEnabled",	VARIANT_LIGHTING);
+	defines += constBool("specularEnabled",	VARIANT_SPECULAR);
+	defines += constBool("fixedShading",	VARIANT_FIXEDSHADING);
+	defines += constBool("translatorMap",	VARIANT_TRANSLATORMAP);
+	defines += "const int baseTexType = " + std::to_string(key >> VARIANT_FORMAT_SHIFT) + ";\n";
+
+	return defines;
+}
+
+R3DShader::Program* R3DShader::GetVariant(const Mesh* m)
+{
+	UINT32 key = VariantKey(m);
+
+	auto it = m_variants.find(key);
+
+	if (it == m_variants.end()) {
+
+		if (m_compilesStarted >= MAX_COMPILES_PER_FRAME) {
+			return nullptr;
+		}
+
+		m_compilesStarted++;
+
+		Program& program = m_variants[key];
+		program.frame = m_frame;
+		CompileProgram(program, VariantDefines(key));
+		return nullptr;
 	}
 
-	if (m_geoShader) {
-		glDeleteShader(m_geoShader);
-		m_geoShader = 0;
+	Program& program = it->second;
+
+	if (program.ready) {
+		return &program;
 	}
 
-	if (m_fragmentShader) {
-		glDeleteShader(m_fragmentShader);
-		m_fragmentShader = 0;
+	if (program.failed) {
+		return nullptr;
 	}
 
-	if (m_shaderProgram) {
-		glDeleteProgram(m_shaderProgram);
-		m_shaderProgram = 0;
+	// don't wait for the compile to finish
+	if (m_parallelCompile) {
+		GLint complete = GL_FALSE;
+		glGetProgramiv(program.shaderProgram, GL_COMPLETION_STATUS_ARB, &complete);
+		if (complete == GL_FALSE) {
+			return nullptr;
+		}
+	}
+	else if (program.frame == m_frame) {
+		return nullptr;		// querying the link status would block, give drivers that compile on a thread of their own a frame
+	}
+
+	return FinishProgram(program) ? &program : nullptr;
+}
+
+void R3DShader::UseProgram(Program* program)
+{
+	if (program == m_program) {
+		return;
+	}
+
+	glUseProgram(program->shaderProgram);
+	m_program = program;
+
+	// uniform values are per program, so everything needs sending again
+	m_dirtyMesh		= true;
+	m_dirtyModel	= true;
+
+	glUniform1i(m_program->locDiscardAlpha, m_discardAlpha);
+	glUniform1i(m_program->locColourLayer, (GLint)m_layer);
+
+	if (m_viewport) {
+		SetViewportUniforms(m_viewport);
+	}
+
+	if (m_model) {
+		SetModelStates(m_model);
 	}
 }
 
 GLint R3DShader::GetVertexAttribPos(const std::string& attrib)
 {
 	if (m_vertexLocCache.count(attrib)==0) {
-		auto pos = glGetAttribLocation(m_shaderProgram, attrib.c_str());
+		auto pos = glGetAttribLocation(m_uberShader.shaderProgram, attrib.c_str());
 		m_vertexLocCache[attrib] = pos;
 	}
 
@@ -186,12 +389,16 @@ GLint R3DShader::GetVertexAttribPos(const std::string& attrib)
 void R3DShader::SetShader(bool enable)
 {
 	if (enable) {
-		glUseProgram(m_shaderProgram);
+		glUseProgram(m_uberShader.shaderProgram);
+		m_program	= &m_uberShader;
+		m_viewport	= nullptr;
+		m_model		= nullptr;
 		Start();
 		DiscardAlpha(false);	// need some default
 	}
 	else {
 		glUseProgram(0);
+		m_program	= &m_uberShader;
 	}
 }
 
@@ -201,27 +408,30 @@ void R3DShader::SetMeshUniforms(const Mesh* m)
 		return;			// sanity check
 	}
 
+	Program* variant = GetVariant(m);
+	UseProgram(variant ? variant : &m_uberShader);
+
 	if (m_dirtyMesh) {
-		glUniform1i(m_locTexture1, 0);
+		glUniform1i(m_program->locTexture1, 0);
 	}
 
 	if (m_dirtyMesh || m->textured != m_textured1) {
-		glUniform1i(m_locTexture1Enabled, m->textured);
+		glUniform1i(m_program->locTexture1Enabled, m->textured);
 		m_textured1 = m->textured;
 	}
 
 	if (m_dirtyMesh || m->microTexture != m_textured2) {
-		glUniform1i(m_locTexture2Enabled, m->microTexture);
+		glUniform1i(m_program->locTexture2Enabled, m->microTexture);
 		m_textured2 = m->microTexture;
 	}
 
 	if (m_dirtyMesh || m->microTextureScale != m_microTexScale) {
-		glUniform1f(m_locMicroTexScale, m->microTextureScale);
+		glUniform1f(m_program->locMicroTexScale, m->microTextureScale);
 		m_microTexScale = m->microTextureScale;
 	}
 
 	if (m_dirtyMesh || m->microTextureID != m_microTexID) {
-		glUniform1i(m_locMicroTexID, m->microTextureID);
+		glUniform1i(m_program->locMicroTexID, m->microTextureID);
 		m_microTexID = m->microTextureID;
 	}
 
@@ -235,73 +445,73 @@ void R3DShader::SetMeshUniforms(const Mesh* m)
 		int translatedX, translatedY;
 		CalcTexOffset(m_transX, m_transY, m_transPage, m->x, m->y, translatedX, translatedY);	// need to apply model translation
 
-		glUniform4i(m_locBaseTexInfo, translatedX, translatedY, m->width, m->height);
+		glUniform4i(m_program->locBaseTexInfo, translatedX, translatedY, m->width, m->height);
 	}
 
 	if (m_dirtyMesh || m_baseTexType != m->format) {
 		m_baseTexType = m->format;
-		glUniform1i(m_locBaseTexType,  m_baseTexType);
+		glUniform1i(m_program->locBaseTexType,  m_baseTexType);
 	}
 
 	if (m_dirtyMesh || m->inverted != m_textureInverted) {
-		glUniform1i(m_locTextureInverted, m->inverted);
+		glUniform1i(m_program->locTextureInverted, m->inverted);
 		m_textureInverted = m->inverted;
 	}
 
 	if (m_dirtyMesh || m->alphaTest != m_alphaTest) {
-		glUniform1i(m_locAlphaTest, m->alphaTest);
+		glUniform1i(m_program->locAlphaTest, m->alphaTest);
 		m_alphaTest = m->alphaTest;
 	}
 
 	if (m_dirtyMesh || m->textureAlpha != m_textureAlpha) {
-		glUniform1i(m_locTextureAlpha, m->textureAlpha);
+		glUniform1i(m_program->locTextureAlpha, m->textureAlpha);
 		m_textureAlpha = m->textureAlpha;
 	}
 
 	if (m_dirtyMesh || m->fogIntensity != m_fogIntensity) {
-		glUniform1f(m_locFogIntensity, m->fogIntensity);
+		glUniform1f(m_program->locFogIntensity, m->fogIntensity);
 		m_fogIntensity = m->fogIntensity;
 	}
 
 	if (m_dirtyMesh || m->lighting != m_lightEnabled) {
-		glUniform1i(m_locLightEnabled, m->lighting);
+		glUniform1i(m_program->locLightEnabled, m->lighting);
 		m_lightEnabled = m->lighting;
 	}
 
 	if (m_dirtyMesh || m->shininess != m_shininess) {
-		glUniform1f(m_locShininess, m->shininess);
+		glUniform1f(m_program->locShininess, m->shininess);
 		m_shininess = m->shininess;
 	}
 
 	if (m_dirtyMesh || m->specular != m_specularEnabled) {
-		glUniform1i(m_locSpecularEnabled, m->specular);
+		glUniform1i(m_program->locSpecularEnabled, m->specular);
 		m_specularEnabled = m->specular;
 	}
 
 	if (m_dirtyMesh || m->specularValue != m_specularValue) {
-		glUniform1f(m_locSpecularValue, m->specularValue);
+		glUniform1f(m_program->locSpecularValue, m->specularValue);
 		m_specularValue = m->specularValue;
 	}
 
 	if (m_dirtyMesh || m->fixedShading != m_fixedShading) {
-		glUniform1i(m_locFixedShading, m->fixedShading);
+		glUniform1i(m_program->locFixedShading, m->fixedShading);
 		m_fixedShading = m->fixedShading;
 	}
 
 	if (m_dirtyMesh || m->translatorMap != m_translatorMap) {
-		glUniform1i(m_locTranslatorMap, m->translatorMap);
+		glUniform1i(m_program->locTranslatorMap, m->translatorMap);
 		m_translatorMap = m->translatorMap;
 	}
 
 	if (m_dirtyMesh || m->polyAlpha != m_polyAlpha) {
-		glUniform1i(m_locPolyAlpha, m->polyAlpha);
+		glUniform1i(m_program->locPolyAlpha, m->polyAlpha);
 		m_polyAlpha = m->polyAlpha;
 	}
 
 	if (m_dirtyMesh || m->wrapModeU != m_texWrapMode[0] || m->wrapModeV != m_texWrapMode[1]) {
 		m_texWrapMode[0] = m->wrapModeU;
 		m_texWrapMode[1] = m->wrapModeV;
-		glUniform2iv(m_locTexWrapMode, 1, m_texWrapMode);
+		glUniform2iv(m_program->locTexWrapMode, 1, m_texWrapMode);
 	}
 
 	if (m_dirtyMesh || m->noLosReturn != m_noLosReturn) {
@@ -331,35 +541,39 @@ void R3DShader::SetMeshUniforms(const Mesh* m)
 
 void R3DShader::SetViewportUniforms(const Viewport *vp)
 {
+	m_viewport = vp;
+
 	//didn't bother caching these, they don't get frequently called anyway
-	glUniform1f(m_locFogDensity, vp->fogParams[3]);
-	glUniform1f(m_locFogStart, vp->fogParams[4]);
-	glUniform3fv(m_locFogColour, 1, vp->fogParams);
-	glUniform1f(m_locFogAttenuation, vp->fogParams[5]);
-	glUniform1f(m_locFogAmbient, vp->fogParams[6]);
-
-	glUniform3fv(m_locLighting, 2, vp->lightingParams);
-	glUniform1i(m_locSunClamp, vp->sunClamp);
-	glUniform1i(m_locIntensityClamp, vp->intensityClamp);
-	glUniform4fv(m_locSpotEllipse, 1, vp->spotEllipse);
-	glUniform2fv(m_locSpotRange, 1, vp->spotRange);
-	glUniform3fv(m_locSpotColor, 1, vp->spotColor);
-	glUniform3fv(m_locSpotFogColor, 1, vp->spotFogColor);
-
-	glUniformMatrix4fv(m_locProjMat, 1, GL_FALSE, vp->projectionMatrix);
-
-	glUniform1i(m_locHardwareStep, vp->hardwareStep);
+	glUniform1f(m_program->locFogDensity, vp->fogParams[3]);
+	glUniform1f(m_program->locFogStart, vp->fogParams[4]);
+	glUniform3fv(m_program->locFogColour, 1, vp->fogParams);
+	glUniform1f(m_program->locFogAttenuation, vp->fogParams[5]);
+	glUniform1f(m_program->locFogAmbient, vp->fogParams[6]);
+
+	glUniform3fv(m_program->locLighting, 2, vp->lightingParams);
+	glUniform1i(m_program->locSunClamp, vp->sunClamp);
+	glUniform1i(m_program->locIntensityClamp, vp->intensityClamp);
+	glUniform4fv(m_program->locSpotEllipse, 1, vp->spotEllipse);
+	glUniform2fv(m_program->locSpotRange, 1, vp->spotRange);
+	glUniform3fv(m_program->locSpotColor, 1, vp->spotColor);
+	glUniform3fv(m_program->locSpotFogColor, 1, vp->spotFogColor);
+
+	glUniformMatrix4fv(m_program->locProjMat, 1, GL_FALSE, vp->projectionMatrix);
+
+	glUniform1i(m_program->locHardwareStep, vp->hardwareStep);
 }
 
 void R3DShader::SetModelStates(const Model* model)
 {
+	m_model = model;
+
 	if (m_dirtyModel || model->scale != m_modelScale) {
-		glUniform1f(m_locModelScale, model->scale);
+		glUniform1f(m_program->locModelScale, model->scale);
 		m_modelScale = model->scale;
 	}
 
 	if (m_dirtyModel || model->alpha != m_nodeAlpha) {
-		glUniform1f(m_locNodeAlpha, model->alpha);
+		glUniform1f(m_program->locNodeAlpha, model->alpha);
 		m_nodeAlpha = model->alpha;
 	}
 
@@ -370,19 +584,21 @@ void R3DShader::SetModelStates(const Model* model)
 	// reset texture values
 	for (auto& i : m_baseTexInfo) { i = -1; }
 
-	glUniformMatrix4fv(m_locModelMat, 1, GL_FALSE, model->modelMat);
+	glUniformMatrix4fv(m_program->locModelMat, 1, GL_FALSE, model->modelMat);
 
 	m_dirtyModel = false;
 }
 
 void R3DShader::DiscardAlpha(bool discard)
 {
-	glUniform1i(m_locDiscardAlpha, discard);
+	m_discardAlpha = discard;
+	glUniform1i(m_program->locDiscardAlpha, discard);
 }
 
 void R3DShader::SetLayer(Layer layer)
 {
-	glUniform1i(m_locColourLayer, (GLint)layer);
+	m_layer = layer;
+	glUniform1i(m_program->locColourLayer, (GLint)layer);
 }
 
 void R3DShader::PrintShaderResult(GLuint shader)
@@ -6,6 +6,7 @@
 #include "Model.h"
 #include <map>
 #include <string>
+#include <unordered_map>
 
 namespace New3D {
 
@@ -24,9 +25,97 @@ public:
 	GLint	GetVertexAttribPos	(const std::string& attrib);
 	void	DiscardAlpha		(bool discard);				// use to remove alpha from texture alpha only polys for 1st pass
 	void	SetLayer			(Layer layer);
+	void	BeginFrame			();							// limits how many shader variants start compiling per frame
 
 private:
 
+	// A program is either the generic uber-shader, which branches per fragment on the mesh state uniforms,
+	// or a variant with that state compiled in as constants. Variants are keyed by the mesh state bits
+	// (see VariantKey) and compiled on demand. Until a variant has finished compiling, meshes that need
+	// it are drawn with the uber-shader.
+	struct Program
+	{
+		// shader IDs
+		GLuint	shaderProgram	= 0;
+		GLuint	vertexShader	= 0;
+		GLuint	geoShader		= 0;
+		GLuint	fragmentShader	= 0;
+
+		bool	ready			= false;	// linked, uniform locations known
+		bool	failed			= false;
+		UINT32	frame			= 0;		// frame the compile was started in
+
+		// mesh uniform locations
+		GLint locTexture1;
+		GLint locTexture1Enabled;
+		GLint locTexture2Enabled;
+		GLint locTextureAlpha;
+		GLint locAlphaTest;
+		GLint locMicroTexScale;
+		GLint locMicroTexID;
+		GLint locBaseTexInfo;
+		GLint locBaseTexType;
+		GLint locTextureInverted;
+		GLint locTexWrapMode;
+		GLint locTranslatorMap;
+		GLint locColourLayer;
+		GLint locPolyAlpha;
+
+		// viewport uniform locations
+		GLint locFogIntensity;
+		GLint locFogDensity;
+		GLint locFogStart;
+		GLint locFogColour;
+		GLint locFogAttenuation;
+		GLint locFogAmbient;
+		GLint locProjMat;
+
+		// lighting / other
+		GLint locLighting;
+		GLint locLightEnabled;
+		GLint locSunClamp;
+		GLint locIntensityClamp;
+		GLint locShininess;
+		GLint locSpecularValue;
+		GLint locSpecularEnabled;
+		GLint locFixedShading;
+
+		GLint locSpotEllipse;
+		GLint locSpotRange;
+		GLint locSpotColor;
+		GLint locSpotFogColor;
+
+		// model uniforms
+		GLint locModelScale;
+		GLint locNodeAlpha;
+		GLint locModelMat;
+
+		// global uniforms
+		GLint locHardwareStep;
+		GLint locDiscardAlpha;
+	};
+
+	enum VariantBits : UINT32
+	{
+		VARIANT_TEXTURED		= 1 << 0,
+		VARIANT_MICROTEXTURE	= 1 << 1,
+		VARIANT_ALPHATEST		= 1 << 2,
+		VARIANT_LIGHTING		= 1 << 3,
+		VARIANT_SPECULAR		= 1 << 4,
+		VARIANT_FIXEDSHADING	= 1 << 5,
+		VARIANT_TRANSLATORMAP	= 1 << 6,
+		VARIANT_FORMAT_SHIFT	= 8				// base texture format, 4 bits
+	};
+
+	void		CompileProgram		(Program& program, const std::string& defines);	// starts compiling and linking
+	bool		FinishProgram		(Program& program);		// checks the result and fetches uniform locations
+	void		DeleteProgram		(Program& program);
+	Program*	GetVariant			(const Mesh* m);		// ready variant for the mesh, or null
+	void		UseProgram			(Program* program);
+
+	static UINT32		VariantKey		(const Mesh* m);
+	static std::string	VariantDefines	(UINT32 key);
+
 	void PrintShaderResult(GLuint shader);
 	void PrintProgramResult(GLuint program);
 
@@ -35,27 +124,19 @@ private:
 	// run-time config
 	const Util::Config::Node &m_config;
 
-	// shader IDs
-	GLuint m_shaderProgram;
-	GLuint m_vertexShader;
-	GLuint m_geoShader;
-	GLuint m_fragmentShader;
-
-	// mesh uniform locations
-	GLint m_locTexture1;
-	GLint m_locTexture1Enabled;
-	GLint m_locTexture2Enabled;
-	GLint m_locTextureAlpha;
-	GLint m_locAlphaTest;
-	GLint m_locMicroTexScale;
-	GLint m_locMicroTexID;
-	GLint m_locBaseTexInfo;
-	GLint m_locBaseTexType;
-	GLint m_locTextureInverted;
-	GLint m_locTexWrapMode;
-	GLint m_locTranslatorMap;
-	GLint m_locColourLayer;
-	GLint m_locPolyAlpha;
+	// programs
+	Program		m_uberShader;
+	std::unordered_map<UINT32, Program> m_variants;
+	Program*	m_program;				// bound program
+	bool		m_parallelCompile;		// driver compiles in the background (ARB/KHR_parallel_shader_compile)
+	UINT32		m_frame;
+	int			m_compilesStarted;		// this frame
+
+	// state to reapply when switching programs
+	const Viewport*	m_viewport;
+	const Model*	m_model;
+	Layer		m_layer;
+	bool		m_discardAlpha;
 
 	// cached mesh values
 	bool	m_textured1;
@@ -91,39 +172,6 @@ private:
 	bool	m_dirtyMesh;
 	bool	m_dirtyModel;
 
-	// viewport uniform locations
-	GLint m_locFogIntensity;
-	GLint m_locFogDensity;
-	GLint m_locFogStart;
-	GLint m_locFogColour;
-	GLint m_locFogAttenuation;
-	GLint m_locFogAmbient;
-	GLint m_locProjMat;
-
-	// lighting / other
-	GLint m_locLighting;
-	GLint m_locLightEnabled;
-	GLint m_locSunClamp;
-	GLint m_locIntensityClamp;
-	GLint m_locShininess;
-	GLint m_locSpecularValue;
-	GLint m_locSpecularEnabled;
-	GLint m_locFixedShading;
-
-	GLint m_locSpotEllipse;
-	GLint m_locSpotRange;
-	GLint m_locSpotColor;
-	GLint m_locSpotFogColor;
-
-	// model uniforms
-	GLint m_locModelScale;
-	GLint m_locNodeAlpha;
-	GLint m_locModelMat;
-
-	// global uniforms
-	GLint m_locHardwareStep;
-	GLint m_locDiscardAlpha;
-
 	// vertex attribute position cache
 	std::map<std::string, GLint> m_vertexLocCache;
 
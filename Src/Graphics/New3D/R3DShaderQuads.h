@@ -10,7 +10,11 @@ uniform float	modelScale;
 uniform float	nodeAlpha;
 uniform mat4	modelMat;
 uniform mat4	projMat;
+
+// mesh state, compile time constants in specialised variants (see R3DShader)
+#ifndef SPECIALISED
 uniform bool	translatorMap;
+#endif
 
 // attributes
 in vec4		inVertex;
@@ -177,16 +181,23 @@ static const char *fragmentShaderR3DQuads = R"glsl(
 
 uniform usampler2D tex1;			// entire texture sheet
 
-// texturing
+// mesh state, compile time constants in specialised variants (see R3DShader)
+#ifndef SPECIALISED
 uniform bool	textureEnabled;
 uniform bool	microTexture;
+uniform int		baseTexType;
+uniform bool	alphaTest;
+uniform bool	lightEnabled;		// lighting enabled (1.0) or luminous (0.0), drawn at full intensity
+uniform bool	specularEnabled;	// specular enabled
+uniform bool	fixedShading;
+#endif
+
+// texturing
 uniform float	microTextureScale;
 uniform int		microTextureID;
 uniform ivec4	baseTexInfo;		// x/y are x,y positions in the texture sheet. z/w are with and height
-uniform int		baseTexType;
 uniform bool	textureInverted;
 uniform bool	textureAlpha;
-uniform bool	alphaTest;
 uniform bool	discardAlpha;
 uniform ivec2	textureWrapMode;
 
@@ -197,10 +208,8 @@ uniform vec2	spotRange;			// spotlight Z range: .x=start (viewspace coordinates)
 uniform vec3	spotColor;			// spotlight RGB color
 uniform vec3	spotFogColor;		// spotlight RGB color on fog
 uniform vec3	lighting[2];		// lighting state (lighting[0] = sun direction, lighting[1].x,y = diffuse, ambient intensities from 0-1.0)
-uniform bool	lightEnabled;		// lighting enabled (1.0) or luminous (0.0), drawn at full intensity
 uniform bool	sunClamp;			// not used by daytona and la machine guns
 uniform bool	intensityClamp;		// some games such as daytona and 
-uniform bool	specularEnabled;	// specular enabled
 uniform float	specularValue;		// specular coefficient
 uniform float	shininess;			// specular shininess
 uniform float	fogIntensity;
@@ -208,7 +217,6 @@ uniform float	fogDensity;
 uniform float	fogStart;
 uniform float	fogAttenuation;
 uniform float	fogAmbient;
-uniform bool	fixedShading;
 uniform int		hardwareStep;
 uniform int		colourLayer;
 uniform bool	polyAlpha;
@@ -290,6 +290,7 @@
 #include "Supermodel.h"
 #include "Shader.h"
 #include "Shaders2D.h" // fragment and vertex shaders
+#include "Util/Format.h"
 
 #include <cstring>
 #include <GL/glew.h>
@@ -370,11 +371,57 @@ void CRender2D::BeginFrame(void)
 {
 }
 
+// Replaces the contents of a surface with pixels drawn by CSoftRender2D
+void CRender2D::UploadSurface(FBO &fbo, const std::vector<uint32_t> &pixels)
+{
+	glBindTexture(GL_TEXTURE_2D, fbo.GetTextureID());
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 496, 384, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Compares a surface drawn by the shader with the pixels drawn by
+// CSoftRender2D. Only the first differing frame is logged in detail.
+bool CRender2D::VerifySurface(FBO &fbo, const std::vector<uint32_t> &pixels, const char *name)
+{
+	m_readBack.resize(pixels.size());
+	glBindTexture(GL_TEXTURE_2D, fbo.GetTextureID());
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_readBack.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	size_t differing = 0;
+	size_t first = 0;
+	for (size_t i = 0; i < pixels.size(); i++)
+	{
+		if (m_readBack[i] != pixels[i] && differing++ == 0)
+			first = i;
+	}
+	if (differing == 0)
+		return true;
+	if (m_verifyMismatches == 0)
+	{
+		ErrorLog("CPU tile generator renderer differs from the shader in frame %u: %u pixels of the %s surface, first at (%u,%u): GPU %08X, CPU %08X.",
+			m_verifyFrames, unsigned(differing), name, unsigned(first % 496), unsigned(first / 496), m_readBack[first], pixels[first]);
+	}
+	return false;
+}
+
 void CRender2D::PreRenderFrame(void)
 {
 	glDisable(GL_SCISSOR_TEST);
 	glViewport(0, 0, 496, 384);
 
+	if (m_tileGenRenderer != TileGenRenderer::GPU)
+	{
+		m_softRender2D.Render(m_vram, m_regs, m_softBottom.data(), m_softTop.data());
+	}
+
+	if (m_tileGenRenderer == TileGenRenderer::CPU)
+	{
+		UploadSurface(m_fboBottom, m_softBottom);
+		UploadSurface(m_fboTop, m_softTop);
+		return;
+	}
+
 	m_shaderTileGen.EnableShader();
 
 	glActiveTexture(GL_TEXTURE0); // texture unit 0
@@ -434,6 +481,15 @@ void CRender2D::PreRenderFrame(void)
 	m_fboBottom.Disable();
 
 	glDisable(GL_BLEND);
+
+	if (m_tileGenRenderer == TileGenRenderer::Verify)
+	{
+		bool bottomOK = VerifySurface(m_fboBottom, m_softBottom, "bottom");
+		bool topOK = VerifySurface(m_fboTop, m_softTop, "top");
+		if (!bottomOK || !topOK)
+			m_verifyMismatches++;
+		m_verifyFrames++;
+	}
 }
 
 void CRender2D::RenderFrameBottom(void)
@@ -561,6 +617,20 @@ CRender2D::CRender2D(const Util::Config::Node& config)
 
 	m_fboBottom.Create(496, 384);
 	m_fboTop.Create(496, 384);
+
+	std::string tileGenRenderer = Util::ToLower(config["TileGenRenderer"].ValueAsDefault<std::string>("gpu"));
+	if (tileGenRenderer == "cpu")
+		m_tileGenRenderer = TileGenRenderer::CPU;
+	else if (tileGenRenderer == "verify")
+		m_tileGenRenderer = TileGenRenderer::Verify;
+	else if (tileGenRenderer != "gpu")
+		ErrorLog("Unknown tile generator renderer '%s'. Using the shader.", tileGenRenderer.c_str());
+	if (m_tileGenRenderer != TileGenRenderer::GPU)
+	{
+		m_softBottom.resize(CSoftRender2D::WIDTH * CSoftRender2D::HEIGHT);
+		m_softTop.resize(CSoftRender2D::WIDTH * CSoftRender2D::HEIGHT);
+		m_softRender2D.Init(config["TileGenThreads"].ValueAsDefault<unsigned>(0));
+	}
 }
 
 CRender2D::~CRender2D(void)
@@ -588,6 +658,9 @@ CRender2D::~CRender2D(void)
 
 	m_vram = nullptr;
 
+	if (m_tileGenRenderer == TileGenRenderer::Verify)
+		InfoLog("CPU tile generator renderer differed from the shader in %u of %u frames.", m_verifyMismatches, m_verifyFrames);
+
 	DebugLog("Destroyed Render2D\n");
 }
 
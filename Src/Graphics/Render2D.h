@@ -32,6 +32,8 @@
 #include "Util/NewConfig.h"
 #include "New3D/GLSLShader.h"
 #include "FBO.h"
+#include "SoftRender2D.h"
+#include <vector>
 
   /*
    * CRender2D:
@@ -57,6 +59,11 @@ public:
 	 *
 	 * Draws the all top layers (above 3D graphics) and bottom layers (below 3D
 	 * graphics) but does not yet display them. May send data to the GPU.
+	 *
+	 * Depending on the TileGenRenderer setting, the layers are drawn by the
+	 * tile generator shader ("gpu"), by CSoftRender2D and uploaded ("cpu"),
+	 * or by both, the shader's output being checked against CSoftRender2D's
+	 * ("verify").
 	 */
 	void PreRenderFrame(void);
 
@@ -178,6 +185,8 @@ private:
 	bool	Above3D		(int layerNumber);
 	void	Setup2D		(bool isBottom);
 	void	DrawSurface	(GLuint textureID);
+	void	UploadSurface	(FBO &fbo, const std::vector<uint32_t> &pixels);
+	bool	VerifySurface	(FBO &fbo, const std::vector<uint32_t> &pixels, const char *name);
 
 	float	LineToPercentStart	(int lineNumber);		// vertical line numbers are from 0-383
 	float	LineToPercentEnd	(int lineNumber);		// vertical line numbers are from 0-383
@@ -210,6 +219,21 @@ private:
 	FBO m_fboBottom;
 	FBO m_fboTop;
 
+	// CPU tile generator renderer
+	enum class TileGenRenderer
+	{
+		GPU,
+		CPU,
+		Verify
+	};
+	TileGenRenderer m_tileGenRenderer = TileGenRenderer::GPU;
+	CSoftRender2D m_softRender2D;
+	std::vector<uint32_t> m_softBottom;
+	std::vector<uint32_t> m_softTop;
+	std::vector<uint32_t> m_readBack;	// shader output, when verifying
+	unsigned m_verifyFrames = 0;
+	unsigned m_verifyMismatches = 0;	// frames in which a surface differed
+
 };
 
 
@@ -0,0 +1,340 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2012 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * SoftRender2D.cpp
+ *
+ * Implementation of the CSoftRender2D class: tile generator layers drawn on
+ * the CPU. The memory layout and register formats are described in
+ * Render2D.cpp; this follows s_fragmentShaderTileGen in Shaders2D.h step by
+ * step, and any change to one must be made to the other.
+ *
+ * The shader draws layers 3 to 0 into a cleared frame buffer with alpha
+ * blending. Pixels are either opaque (alpha 1) or transparent or masked off
+ * (alpha 0), so blending reduces to a select: the last opaque pixel drawn
+ * wins. Each layer is decoded into a line buffer a tile row at a time, with
+ * transparent pixels left at 0, and then merged into the surface four
+ * pixels at a time with SSE2 (or a pixel at a time without it).
+ *
+ * Colour components are converted exactly as the shader and the frame
+ * buffer do: c / 31 plus the signed colour offset, clamped, then rounded to
+ * 8 bits. This is done for the whole palette when a frame starts, once with
+ * the A/A' offsets and once with the B/B' ones, so that drawing a pixel is
+ * two table lookups.
+ */
+
+#include "SoftRender2D.h"
+
+#include "Supermodel.h"
+#include "OSD/Thread.h"
+#include "Util/Format.h"
+
+#include <algorithm>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFTRENDER2D_SSE2
+#endif
+
+
+/******************************************************************************
+ Drawing
+******************************************************************************/
+
+// Int8ToFloat() in the shader
+static float ColourOffset(uint32_t c)
+{
+	if (c & 0x80)
+		return float(int(c | 0xFFFFFF00)) / 128.0f;
+	return float(c) / 127.0f;
+}
+
+#ifdef SOFTRENDER2D_SSE2
+static inline __m128i ColourComponent(__m128i c, __m128 offset)
+{
+	__m128 f = _mm_add_ps(_mm_div_ps(_mm_cvtepi32_ps(c), _mm_set1_ps(31.0f)), offset);
+	f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+}
+#endif
+
+static inline uint32_t ColourComponent(uint32_t c, float offset)
+{
+	float f = std::min(std::max(float(c) / 31.0f + offset, 0.0f), 1.0f);
+	return uint32_t(f * 255.0f + 0.5f);
+}
+
+void CSoftRender2D::ConvertPalette(void)
+{
+	const uint32_t *palette = &m_vram[0x40000];
+	for (int pair = 0; pair < 2; pair++)
+	{
+		uint32_t offsetReg = m_regs[0x40 / 4 + pair];
+		float r = ColourOffset((offsetReg >> 0) & 0xFF);
+		float g = ColourOffset((offsetReg >> 8) & 0xFF);
+		float b = ColourOffset((offsetReg >> 16) & 0xFF);
+		uint32_t *out = &m_colours[pair * 0x8000];
+		unsigned i = 0;
+#ifdef SOFTRENDER2D_SSE2
+		__m128 offsetR = _mm_set1_ps(r);
+		__m128 offsetG = _mm_set1_ps(g);
+		__m128 offsetB = _mm_set1_ps(b);
+		__m128i mask = _mm_set1_epi32(0x1F);
+		for (; i < 0x8000; i += 4)
+		{
+			__m128i c = _mm_loadu_si128((const __m128i *) &palette[i]);
+			__m128i rgba = _mm_or_si128(ColourComponent(_mm_and_si128(c, mask), offsetR), _mm_set1_epi32(0xFF000000));
+			rgba = _mm_or_si128(rgba, _mm_slli_epi32(ColourComponent(_mm_and_si128(_mm_srli_epi32(c, 5), mask), offsetG), 8));
+			rgba = _mm_or_si128(rgba, _mm_slli_epi32(ColourComponent(_mm_and_si128(_mm_srli_epi32(c, 10), mask), offsetB), 16));
+			__m128i transparent = _mm_srai_epi32(_mm_slli_epi32(c, 16), 31);
+			_mm_storeu_si128((__m128i *) &out[i], _mm_andnot_si128(transparent, rgba));
+		}
+#else
+		uint32_t red[32], green[32], blue[32];
+		for (uint32_t c = 0; c < 32; c++)
+		{
+			red[c] = ColourComponent(c, r) | 0xFF000000;
+			green[c] = ColourComponent(c, g) << 8;
+			blue[c] = ColourComponent(c, b) << 16;
+		}
+		for (; i < 0x8000; i++)
+		{
+			uint32_t c = palette[i];
+			out[i] = (c & 0x8000) ? 0 : (red[c & 0x1F] | green[(c >> 5) & 0x1F] | blue[(c >> 10) & 0x1F]);
+		}
+#endif
+	}
+}
+
+// Decodes one line of a layer into line[], leaving transparent and masked
+// off pixels at 0
+void CSoftRender2D::DrawLayerLine(int layerNumber, unsigned y, uint32_t *line)
+{
+	// Stencil mask: one bit per 32 pixels, inverted for the alternate layers
+	uint32_t mask = (m_vram[0xF7000 / 4 + y] >> (layerNumber < 2 ? 16 : 0)) & 0xFFFF;
+	if (layerNumber & 1)
+		mask ^= 0xFFFF;
+	if (mask == 0)
+		return;
+
+	uint32_t scrollReg = m_regs[0x60 / 4 + layerNumber];
+	unsigned scrollX;
+	if (scrollReg & 0x8000)
+		scrollX = (m_vram[(0xF6000 + layerNumber * 0x400) / 4 + y / 2] >> ((1 - (y & 1)) * 16)) & 0xFFFF;
+	else
+		scrollX = scrollReg & 0x3FF;
+	unsigned lineY = y + ((scrollReg >> 16) & 0x1FF);
+	unsigned vFine = lineY & 7;
+
+	const uint32_t *nameTable = &m_vram[(0xF8000 + layerNumber * 0x2000) / 4 + ((lineY / 8) & 0x3F) * 32];
+	const uint32_t *colours = &m_colours[(layerNumber / 2) * 0x8000];
+	bool is4Bit = (m_regs[0x20 / 4] & (1 << (12 + layerNumber))) != 0;
+
+	unsigned x = 0;
+	while (x < WIDTH)
+	{
+		// Run of pixels within one tile and one mask bit
+		unsigned lineX = x + scrollX;
+		unsigned hFine = lineX & 7;
+		unsigned n = std::min(8 - hFine, 32 - (x & 31));
+		if (x + n > WIDTH)
+			n = WIDTH - x;
+		if (mask & (0x8000 >> (x / 32)))
+		{
+			unsigned tileNumber = (lineX / 8) & 0x3F;
+			uint32_t tileData = (nameTable[tileNumber / 2] >> ((1 - (tileNumber & 1)) * 16)) & 0xFFFF;
+			uint32_t *out = &line[x];
+			if (is4Bit)
+			{
+				uint32_t pattern = m_vram[((((tileData & 0x3FFF) << 1) | ((tileData >> 15) & 1)) * 32) / 4 + vFine];
+				uint32_t paletteIndex = tileData & 0x7FF0;
+				for (unsigned h = hFine; h < hFine + n; h++)
+				{
+					*out++ = colours[paletteIndex | ((pattern >> ((7 - h) * 4)) & 0xF)];
+				}
+			}
+			else
+			{
+				const uint32_t *pattern = &m_vram[((tileData & 0x3FFF) * 64) / 4 + vFine * 2];
+				uint32_t paletteIndex = tileData & 0x7F00;
+				for (unsigned h = hFine; h < hFine + n; h++)
+				{
+					*out++ = colours[paletteIndex | ((pattern[h / 4] >> ((3 - (h % 4)) * 8)) & 0xFF)];
+				}
+			}
+		}
+		x += n;
+	}
+}
+
+// Opaque pixels of src replace those of dst
+static void MergeLine(uint32_t *dst, const uint32_t *src)
+{
+	unsigned x = 0;
+#ifdef SOFTRENDER2D_SSE2
+	for (; x + 4 <= CSoftRender2D::WIDTH; x += 4)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *) &src[x]);
+		__m128i d = _mm_loadu_si128((const __m128i *) &dst[x]);
+		__m128i opaque = _mm_srai_epi32(s, 31);	// alpha is 0 or 255
+		_mm_storeu_si128((__m128i *) &dst[x], _mm_or_si128(_mm_and_si128(opaque, s), _mm_andnot_si128(opaque, d)));
+	}
+#endif
+	for (; x < CSoftRender2D::WIDTH; x++)
+	{
+		if (src[x] & 0xFF000000)
+			dst[x] = src[x];
+	}
+}
+
+void CSoftRender2D::RenderBand(unsigned firstLine, unsigned endLine)
+{
+	uint32_t layerLine[WIDTH];
+
+	// Layers that are enabled, in drawing order, for each surface
+	int layers[2][4];
+	int numLayers[2] = { 0, 0 };
+	for (int i = 4; i-- > 0;)
+	{
+		if (m_regs[0x60 / 4 + i] & 0x80000000)
+		{
+			int surface = (m_regs[0x20 / 4] >> (8 + i)) & 1;
+			layers[surface][numLayers[surface]++] = i;
+		}
+	}
+
+	for (int surface = 0; surface < 2; surface++)
+	{
+		for (unsigned y = firstLine; y < endLine; y++)
+		{
+			uint32_t *line = &m_surface[surface][y * WIDTH];
+			memset(line, 0, WIDTH * sizeof(uint32_t));
+			for (int i = 0; i < numLayers[surface]; i++)
+			{
+				memset(layerLine, 0, sizeof(layerLine));
+				DrawLayerLine(layers[surface][i], y, layerLine);
+				MergeLine(line, layerLine);
+			}
+		}
+	}
+}
+
+void CSoftRender2D::Render(const uint32_t *vram, const uint32_t *regs, uint32_t *bottom, uint32_t *top)
+{
+	m_vram = vram;
+	m_regs = regs;
+	m_surface[0] = bottom;
+	m_surface[1] = top;
+	ConvertPalette();
+
+	unsigned numBands = unsigned(m_workers.size()) + 1;
+	if (numBands > 1)
+	{
+		m_done->Reset(numBands - 1);
+		for (Worker &worker: m_workers)
+			worker.start->Set();
+	}
+	RenderBand(0, HEIGHT / numBands);
+	if (numBands > 1)
+		m_done->Wait();
+}
+
+
+/******************************************************************************
+ Worker Threads
+******************************************************************************/
+
+int CSoftRender2D::WorkerThread(void *param)
+{
+	Worker *worker = (Worker *) param;
+	CSoftRender2D *self = worker->self;
+	unsigned numBands = unsigned(self->m_workers.size()) + 1;
+	unsigned firstLine = HEIGHT * worker->band / numBands;
+	unsigned endLine = HEIGHT * (worker->band + 1) / numBands;
+	for (;;)
+	{
+		worker->start->Wait();
+		if (self->m_quit)
+			return 0;
+		self->RenderBand(firstLine, endLine);
+		self->m_done->Arrive();
+	}
+}
+
+void CSoftRender2D::StopThreads(void)
+{
+	m_quit = true;
+	for (Worker &worker: m_workers)
+	{
+		if (worker.thread != NULL)
+		{
+			worker.start->Set();
+			worker.thread->Wait();
+			delete worker.thread;
+		}
+		delete worker.start;
+	}
+	m_workers.clear();
+	delete m_done;
+	m_done = nullptr;
+	m_quit = false;
+}
+
+bool CSoftRender2D::Init(unsigned numThreads)
+{
+	StopThreads();
+	if (numThreads == 0)
+		return OKAY;
+
+	// Bands are fixed once the threads start, so the vector must not grow
+	// after the first one reads it
+	m_done = CThread::CreateBarrier(100);
+	m_workers.resize(numThreads);
+	bool ok = (m_done != NULL);
+	for (unsigned i = 0; i < numThreads; i++)
+	{
+		m_workers[i].self = this;
+		m_workers[i].band = i + 1;
+		m_workers[i].start = CThread::CreateEvent(0);
+		m_workers[i].thread = NULL;
+		ok = ok && m_workers[i].start != NULL;
+	}
+	for (unsigned i = 0; ok && i < numThreads; i++)
+	{
+		m_workers[i].thread = CThread::CreateThread(Util::Format() << "TileGen" << i, WorkerThread, &m_workers[i]);
+		ok = (m_workers[i].thread != NULL);
+	}
+	if (ok)
+		return OKAY;
+	ErrorLog("Unable to create tile generator worker threads: %s", CThread::GetLastError());
+	StopThreads();
+	return FAIL;
+}
+
+CSoftRender2D::CSoftRender2D(void)
+	: m_colours(2 * 0x8000)
+{
+}
+
+CSoftRender2D::~CSoftRender2D(void)
+{
+	StopThreads();
+}
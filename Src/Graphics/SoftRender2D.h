@@ -0,0 +1,114 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2012 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * SoftRender2D.h
+ *
+ * Header file defining the CSoftRender2D class: tile generator layers drawn
+ * on the CPU. Needs no GL context.
+ */
+
+#ifndef INCLUDED_SOFTRENDER2D_H
+#define INCLUDED_SOFTRENDER2D_H
+
+#include "Types.h"
+#include <cstdint>
+#include <vector>
+
+class CThread;
+class CEvent;
+class CBarrier;
+
+/*
+ * CSoftRender2D:
+ *
+ * Draws the four tile generator layers into a bottom (below 3D) and a top
+ * (above 3D) surface, producing exactly what the tile generator shader in
+ * CRender2D renders into its frame buffers. Lines are split into bands that
+ * are drawn in parallel by worker threads.
+ */
+class CSoftRender2D
+{
+public:
+	static const unsigned WIDTH = 496;
+	static const unsigned HEIGHT = 384;
+
+	/*
+	 * Render(vram, regs, bottom, top):
+	 *
+	 * Draws both surfaces.
+	 *
+	 * Parameters:
+	 *    vram    Tile generator RAM (0x120000 bytes, little endian words),
+	 *            palette included.
+	 *    regs    Tile generator registers (at least 32).
+	 *    bottom  WIDTH x HEIGHT pixels, written top line first. Each pixel
+	 *            is R, G, B and A bytes in memory order (GL_RGBA and
+	 *            GL_UNSIGNED_BYTE), A being 0 or 255.
+	 *    top     Same for the layers above 3D.
+	 */
+	void Render(const uint32_t *vram, const uint32_t *regs, uint32_t *bottom, uint32_t *top);
+
+	/*
+	 * Init(numThreads):
+	 *
+	 * Starts the worker threads. With 0, everything is drawn by the thread
+	 * calling Render().
+	 *
+	 * Returns:
+	 *    OKAY if successful, FAIL if the threads could not be created (an
+	 *    error is logged and Render() draws everything itself).
+	 */
+	bool Init(unsigned numThreads);
+
+	CSoftRender2D(void);
+	~CSoftRender2D(void);
+
+private:
+	void	StopThreads(void);
+	void	ConvertPalette(void);
+	void	RenderBand(unsigned firstLine, unsigned endLine);
+	void	DrawLayerLine(int layerNumber, unsigned y, uint32_t *line);
+	static int WorkerThread(void *param);
+
+	// Frame being drawn
+	const uint32_t	*m_vram = nullptr;
+	const uint32_t	*m_regs = nullptr;
+	uint32_t		*m_surface[2] = { nullptr, nullptr };	// bottom, top
+
+	// Palette converted to RGBA (0 if transparent) with the A/A' colour
+	// offsets, followed by the same with the B/B' ones
+	std::vector<uint32_t>	m_colours;
+
+	// Worker threads (band i+1 is drawn by worker i)
+	struct Worker
+	{
+		CSoftRender2D	*self;
+		unsigned		band;
+		CEvent			*start;
+		CThread			*thread;
+	};
+	std::vector<Worker>	m_workers;
+	CBarrier		*m_done = nullptr;
+	bool			m_quit = false;
+};
+
+#endif	// INCLUDED_SOFTRENDER2D_H
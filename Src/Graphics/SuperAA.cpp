@@ -1,11 +1,33 @@
 #include "SuperAA.h"
+#include <algorithm>
+#include <cmath>
 #include <string>
 
+// dynamic resolution controller
+static const int	WINDOW			= 30;		// frames averaged per decision
+static const int	RAISE_WINDOWS	= 3;		// windows with head room before the scale goes up
+static const float	HIGH_LOAD		= 0.90f;	// fraction of the frame budget above which the scale goes down
+static const float	TARGET_LOAD		= 0.75f;	// ... to what is expected to bring the load back to this
+static const float	LOW_LOAD		= 0.60f;	// fraction below which the scale may go up
+static const float	STEP			= 0.25f;	// scale granularity
+
 SuperAA::SuperAA(int aaValue) :
 	m_aa(aaValue),
 	m_vao(0),
 	m_width(0),
-	m_height(0)
+	m_height(0),
+	m_scale(float(aaValue)),
+	m_minScale(float(aaValue)),
+	m_frameMs(0),
+	m_dynamic(false),
+	m_queries{},
+	m_pending{},
+	m_nextQuery(0),
+	m_timing(false),
+	m_gpuMs(0),
+	m_samples(0),
+	m_lowWindows(0),
+	m_settle(0)
 {
 	if (aaValue > 1) {
 
@@ -43,31 +65,41 @@ SuperAA::SuperAA(int aaValue) :
 
 		// inputs
 		uniform sampler2D tex1;			// base tex
+		uniform vec2 scale;				// render pixels per output pixel, aa unless the resolution is dynamic
 		in vec2 fsTexCoord;
 
 		// outputs
 		out vec4 fragColor;
 
-		vec4 GetTextureValue(sampler2D s, vec2 texCoord)
+		vec4 GetTextureValue(sampler2D s)
 		{
-			vec2 size		= vec2(textureSize(s,0));        // want the values as floats
-			ivec2 texPos	= ivec2(size * texCoord);
+			// footprint of this output pixel in the render target
+			vec2 lo			= floor(gl_FragCoord.xy) * scale;
+			vec2 hi			= lo + scale;
+			ivec2 texPos	= ivec2(lo);
 			vec4 texColour	= vec4(0.0);
+			float total		= 0.0;
+
+			// a fractional footprint can straddle one more sample than aa, which gets zero weight for whole scales
+			for(int i=0; i <= aa; i++) {
+				for(int j=0; j <= aa; j++) {
+					vec2 samplePos	= vec2(texPos + ivec2(i,j));
+					vec2 coverage	= clamp(min(hi, samplePos + 1.0) - max(lo, samplePos), 0.0, 1.0);
+					float weight	= coverage.x * coverage.y;
 
-			for(int i=0; i < aa; i++) {
-				for(int j=0; j < aa; j++) {
-					texColour += texelFetch(s,ivec2(texPos.x+i,texPos.y+j),0);
+					if (weight > 0.0) {
+						texColour += weight * texelFetch(s,ivec2(texPos.x+i,texPos.y+j),0);
+						total += weight;
+					}
 				}
 			}
 
-			texColour /= float(aa * aa);
-
-			return texColour;
+			return texColour / total;
 		}
 
 		void main()
 		{
-			fragColor = GetTextureValue(tex1, fsTexCoord);
+			fragColor = GetTextureValue(tex1);
 		}
 
 		)glsl";
@@ -77,10 +109,12 @@ SuperAA::SuperAA(int aaValue) :
 		// load shaders
 		m_shader.LoadShaders(vertexShader, fragmentShaderString.c_str());
 		m_shader.GetUniformLocationMap("tex1");
+		m_shader.GetUniformLocationMap("scale");
 
 		// setup uniform memory
 		m_shader.EnableShader();
-		glUniform1i(m_shader.attribLocMap["tex1"], 0);		// texture will be bound to unit zero
+		glUniform1i(m_shader.uniformLocMap["tex1"], 0);		// texture will be bound to unit zero
+		glUniform2f(m_shader.uniformLocMap["scale"], float(aaValue), float(aaValue));
 		m_shader.DisableShader();
 
 		glGenVertexArrays(1, &m_vao);
@@ -100,6 +134,10 @@ SuperAA::~SuperAA()
 		glDeleteVertexArrays(1, &m_vao);
 		m_vao = 0;
 	}
+
+	if (m_dynamic) {
+		glDeleteQueries(NUM_QUERIES * 2, &m_queries[0][0]);
+	}
 }
 
 void SuperAA::Init(int width, int height)
@@ -125,13 +163,130 @@ void SuperAA::Draw()
 		glBindVertexArray(m_vao);
 		glViewport(0, 0, m_width, m_height);
 		m_shader.EnableShader();
+		if (m_dynamic) {
+			glUniform2f(m_shader.uniformLocMap["scale"], float(Scale(m_width)) / m_width, float(Scale(m_height)) / m_height);
+		}
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		m_shader.DisableShader();
 		glBindVertexArray(0);
 	}
+
+	if (m_timing) {
+		glQueryCounter(m_queries[m_nextQuery][1], GL_TIMESTAMP);
+		m_pending[m_nextQuery] = true;
+		m_nextQuery = (m_nextQuery + 1) % NUM_QUERIES;
+		m_timing = false;
+	}
 }
 
 GLuint SuperAA::GetTargetID()
 {
 	return m_fbo.GetFBOID();	// will return 0 if no render target which will be our default frame buffer (back buffer)
 }
+
+void SuperAA::EnableDynamicScale(float minScale, float frameMs)
+{
+	if (m_aa > 1 && !m_dynamic) {
+		m_minScale	= std::max(1.0f, std::min(float(m_aa), minScale));
+		m_frameMs	= frameMs;
+		m_dynamic	= true;
+
+		glGenQueries(NUM_QUERIES * 2, &m_queries[0][0]);
+	}
+}
+
+void SuperAA::BeginFrame()
+{
+	// if the GPU is so far behind that the oldest query is still in flight, this frame goes untimed
+	if (m_dynamic && !m_pending[m_nextQuery]) {
+		glQueryCounter(m_queries[m_nextQuery][0], GL_TIMESTAMP);
+		m_timing = true;
+	}
+}
+
+bool SuperAA::UpdateScale()
+{
+	if (!m_dynamic) {
+		return false;
+	}
+
+	// collect the frames the GPU has finished, oldest first, without waiting on the rest
+	for (int i = 0; i < NUM_QUERIES; i++) {
+
+		int q = (m_nextQuery + i) % NUM_QUERIES;
+
+		if (!m_pending[q]) {
+			continue;
+		}
+
+		GLint available = 0;
+		glGetQueryObjectiv(m_queries[q][1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			break;
+		}
+
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(m_queries[q][0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(m_queries[q][1], GL_QUERY_RESULT, &end);
+		m_pending[q] = false;
+
+		m_gpuMs += double(end - start) / 1e6;
+		m_samples++;
+	}
+
+	if (m_samples < WINDOW) {
+		return false;
+	}
+
+	float load = float(m_gpuMs / m_samples) / m_frameMs;
+	m_gpuMs = 0;
+	m_samples = 0;
+
+	// the first window after a change is partly at the old scale
+	if (m_settle > 0) {
+		m_settle--;
+		return false;
+	}
+
+	float scale = m_scale;
+
+	if (load > HIGH_LOAD) {
+		// GPU time goes with the number of pixels, so the square of the scale. Drop straight to the scale
+		// expected to bring the load down to the target, and by at least one step.
+		scale = std::min(std::floor(m_scale * std::sqrt(TARGET_LOAD / load) / STEP) * STEP, m_scale - STEP);
+		m_lowWindows = 0;
+	}
+	else if (load < LOW_LOAD) {
+		// go up one step at a time, and only if the estimated load stays clear of the threshold to go back down
+		if (++m_lowWindows >= RAISE_WINDOWS) {
+			float up = m_scale + STEP;
+			if (load * (up * up) / (m_scale * m_scale) < HIGH_LOAD) {
+				scale = up;
+			}
+			m_lowWindows = 0;
+		}
+	}
+	else {
+		m_lowWindows = 0;
+	}
+
+	scale = std::max(m_minScale, std::min(float(m_aa), scale));
+
+	if (scale == m_scale) {
+		return false;
+	}
+
+	m_scale = scale;
+	m_settle = 1;
+	return true;
+}
+
+float SuperAA::GetScale() const
+{
+	return m_scale;
+}
+
+unsigned SuperAA::Scale(unsigned value) const
+{
+	return unsigned(value * m_scale + 0.5f);
+}
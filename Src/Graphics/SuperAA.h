@@ -9,6 +9,11 @@
 // values such as 3 are also possible, that works out 9 samples per pixel
 // The algorithm is super simple, just add up all samples and divide by the number
 
+// With dynamic resolution the scale becomes fractional. The render target stays allocated at the full aa size,
+// the renderers draw into the bottom left corner of it at the current scale, and each output pixel averages the
+// samples under its footprint weighted by coverage. The GPU time of each frame is measured with timestamp queries
+// and the scale is lowered when the GPU can't keep up with the refresh rate, and raised again when it has head room.
+
 class SuperAA
 {
 public:
@@ -20,12 +25,33 @@ public:
 
 	GLuint GetTargetID();
 
+	void EnableDynamicScale(float minScale, float frameMs);	// let the scale follow the GPU load, frameMs is the time budget of one frame
+	void BeginFrame();						// call before rendering, starts the GPU timer
+	bool UpdateScale();						// call between frames, returns true if the scale changed and the renderers need resizing
+	float GetScale() const;
+	unsigned Scale(unsigned value) const;	// window pixels to render pixels at the current scale
+
 private:
+	static const int NUM_QUERIES = 4;		// frames the GPU can be behind before timing is skipped
+
 	FBO m_fbo;
 	GLSLShader m_shader;
 	const int m_aa;
 	GLuint m_vao;
 	int m_width;
 	int m_height;
-};
 
+	// dynamic resolution
+	float m_scale;
+	float m_minScale;
+	float m_frameMs;
+	bool m_dynamic;
+	GLuint m_queries[NUM_QUERIES][2];		// start and end timestamps
+	bool m_pending[NUM_QUERIES];
+	int m_nextQuery;
+	bool m_timing;							// timing the frame being rendered
+	double m_gpuMs;							// sum over the current window
+	int m_samples;
+	int m_lowWindows;						// consecutive windows with head room
+	int m_settle;							// windows to ignore after a change
+};
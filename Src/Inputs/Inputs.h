@@ -92,6 +92,7 @@ public:
   CSwitchInput  *uiSaveState;
   CSwitchInput  *uiChangeSlot;
   CSwitchInput  *uiLoadState;
+  CSwitchInput  *uiRewind;
   CSwitchInput  *uiMusicVolUp;
   CSwitchInput  *uiMusicVolDown;
   CSwitchInput  *uiSoundVolUp;
@@ -57,6 +57,9 @@ public:
 	void SetAddressHigh(uint16_t data);
 	void SetSubKey(uint16_t data);
 
+	// Stateless 315-5881 block cipher, one 16-bit word at a time
+	static uint16_t block_decrypt(uint32_t game_key, uint16_t sequence_key, uint16_t counter, uint16_t data);
+
 	std::function<uint16_t(uint32_t)> m_read;
 
 	/*
@@ -108,8 +111,7 @@ private:
 
 	static const uint8_t trees[9][2][32];
 
-	int feistel_function(int input, const struct sbox *sboxes, uint32_t subkeys);
-	uint16_t block_decrypt(uint32_t game_key, uint16_t sequence_key, uint16_t counter, uint16_t data);
+	static int feistel_function(int input, const struct sbox *sboxes, uint32_t subkeys);
 
 	uint16_t get_decrypted_16();
 	int get_compressed_bit();
@@ -40,7 +40,7 @@
 #include "DSB.h"
 
 #include "Supermodel.h"
-#include "Sound/MPEG/MpegAudio.h"
+#include "Util/MemoryArena.h"
 #include <algorithm>
 
 /******************************************************************************
@@ -208,7 +208,7 @@ void CDSB1::IOWrite8(UINT32 addr, UINT8 data)
 
 		if (data == 0)	// stop
 		{
-			MpegDec::Stop();
+			mpegDec.Stop();
 			return;
 		}
 
@@ -221,7 +221,7 @@ void CDSB1::IOWrite8(UINT32 addr, UINT8 data)
 			usingMPEGStart	= mpegStart;
 			usingMPEGEnd	= mpegEnd;
 
-			MpegDec::SetMemory(&mpegROM[mpegStart], mpegEnd - mpegStart, false);
+			mpegDec.SetMemory(&mpegROM[mpegStart], mpegEnd - mpegStart, false);
 			return;
 		}
 
@@ -233,7 +233,7 @@ void CDSB1::IOWrite8(UINT32 addr, UINT8 data)
 			usingMPEGStart	= mpegStart;
 			usingMPEGEnd	= mpegEnd;
 
-			MpegDec::SetMemory(&mpegROM[mpegStart], mpegEnd - mpegStart, false);		// assume not looped for now
+			mpegDec.SetMemory(&mpegROM[mpegStart], mpegEnd - mpegStart, false);		// assume not looped for now
 			return;
 		}
 		break;
@@ -266,13 +266,13 @@ void CDSB1::IOWrite8(UINT32 addr, UINT8 data)
 			{
 				usingLoopStart	= loopStart;
 				usingLoopEnd	= mpegEnd-loopStart;
-				MpegDec::UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
+				mpegDec.UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
 			}
 			else
 			{
 				usingLoopStart	= loopStart;
 				usingLoopEnd	= loopEnd-loopStart;
-				MpegDec::UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
+				mpegDec.UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
 			}
 		}
 
@@ -302,7 +302,7 @@ void CDSB1::IOWrite8(UINT32 addr, UINT8 data)
 			loopEnd			= endLatch;
 			usingLoopStart	= loopStart;
 			usingLoopEnd	= loopEnd-loopStart;
-			MpegDec::UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
+			mpegDec.UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
 			//printf("loopEnd = %08X\n", loopEnd);
 		}
 		break;
@@ -332,17 +332,17 @@ UINT8 CDSB1::IORead8(UINT32 addr)
 	switch ((addr&0xFF))
 	{
 	case 0xE2:	// MPEG position, high byte
-		progress = MpegDec::GetPosition();
+		progress = mpegDec.GetPosition();
 		progress += mpegStart;	// byte address currently playing
 		return (progress>>16)&0xFF;
 
 	case 0xE3:	// MPEG position, middle byte
-		progress = MpegDec::GetPosition();
+		progress = mpegDec.GetPosition();
 		progress += mpegStart;
 		return (progress>>8)&0xFF;
 
 	case 0xE4:	// MPEG position, low byte
-		progress = MpegDec::GetPosition();
+		progress = mpegDec.GetPosition();
 		progress += mpegStart;
 		return progress&0xFF;
 
@@ -430,13 +430,13 @@ void CDSB1::RunFrame(float *audioL, float *audioR)
 	UINT8 v = (UINT8) ((float) volume * (float)(255.0/127.0));
 
 	// Decode MPEG for this frame
-	MpegDec::DecodeAudio(&mpegL[retainedSamples], &mpegR[retainedSamples], 32000 / 60 - retainedSamples + 2);
+	mpegDec.DecodeAudio(&mpegL[retainedSamples], &mpegR[retainedSamples], 32000 / 60 - retainedSamples + 2);
 	retainedSamples = Resampler.UpSampleAndMix(audioL, audioR, mpegL, mpegR, v, v, NUM_SAMPLES_PER_FRAME, 32000/60+2, 44100, 32000);
 }
 
 void CDSB1::Reset(void)
 {
-	MpegDec::Stop();
+	mpegDec.Stop();
 	Resampler.Reset();
 	retainedSamples = 0;
 
@@ -461,8 +461,8 @@ void CDSB1::SaveState(CBlockFile *StateFile)
 	StateFile->NewBlock("DSB1", __FILE__);
 
 	// MPEG playback state
-	isPlaying	= (UINT8)MpegDec::IsLoaded();
-	playOffset	= (UINT32)MpegDec::GetPosition();
+	isPlaying	= (UINT8)mpegDec.IsLoaded();
+	playOffset	= (UINT32)mpegDec.GetPosition();
 	endOffset	= 0;
 
 	StateFile->Write(&isPlaying, sizeof(isPlaying));
@@ -529,16 +529,16 @@ void CDSB1::LoadState(CBlockFile *StateFile)
 	// Restart MPEG audio at the appropriate position
 	if (isPlaying)
 	{
-		MpegDec::SetMemory(&mpegROM[usingMPEGStart], usingMPEGEnd - usingMPEGStart, false);
+		mpegDec.SetMemory(&mpegROM[usingMPEGStart], usingMPEGEnd - usingMPEGStart, false);
 
 		if (usingLoopEnd != 0) {	// only if looping was actually enabled
-			MpegDec::UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
+			mpegDec.UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
 		}
 
-		MpegDec::SetPosition(playOffset);
+		mpegDec.SetPosition(playOffset);
 	}
 	else {
-		MpegDec::Stop();
+		mpegDec.Stop();
 	}
 }
 
@@ -557,10 +557,9 @@ bool CDSB1::Init(const UINT8 *progROMPtr, const UINT8 *mpegROMPtr)
 	mpegROM = mpegROMPtr;
 
 	// Allocate memory pool
-	memoryPool = new(std::nothrow) UINT8[DSB1_MEMORY_POOL_SIZE];
+	memoryPool = Util::MemoryArena::Allocate("DSB1", DSB1_MEMORY_POOL_SIZE);	// zero filled
 	if (NULL == memoryPool)
 		return ErrorLog("Insufficient memory for DSB1 board (needs %1.1f MB).", memSizeMB);
-	memset(memoryPool, 0, DSB1_MEMORY_POOL_SIZE);
 
 	// Set up memory pointers
 	ram = &memoryPool[DSB1_OFFSET_RAM];
@@ -569,6 +568,7 @@ bool CDSB1::Init(const UINT8 *progROMPtr, const UINT8 *mpegROMPtr)
 
 	// Initialize Z80 CPU
 	Z80.Init(this, Z80IRQCallback);
+	Z80.SetIdleSkip(m_config["SoundIdleSkip"].ValueAsDefault<bool>(true));
 
 	retainedSamples = 0;
 
@@ -605,7 +605,7 @@ CDSB1::~CDSB1(void)
 {
 	if (memoryPool != NULL)
 	{
-		delete [] memoryPool;
+		Util::MemoryArena::Free(memoryPool);
 		memoryPool = NULL;
 	}
 
@@ -691,14 +691,14 @@ void CDSB2::WriteMPEGFIFO(UINT8 byte)
 				usingMPEGEnd	= mpegEnd;
 				playing			= 1;
 
-				MpegDec::SetMemory(&mpegROM[mpegStart], mpegEnd - mpegStart, false);
+				mpegDec.SetMemory(&mpegROM[mpegStart], mpegEnd - mpegStart, false);
 
 				mpegState = ST_IDLE;
 			}
 
 			else if (byte == 0x84 || byte == 0x85)
 			{
-				MpegDec::Stop();
+				mpegDec.Stop();
 				playing = 0;
 			}
 
@@ -737,7 +737,7 @@ void CDSB2::WriteMPEGFIFO(UINT8 byte)
 			{
 				usingLoopStart	= mpegStart;
 				usingLoopEnd	= mpegEnd - mpegStart;
-				MpegDec::UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
+				mpegDec.UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
 			}
 
 			break;
@@ -773,7 +773,7 @@ void CDSB2::WriteMPEGFIFO(UINT8 byte)
 				usingMPEGStart	= mpegStart;
 				usingMPEGEnd	= mpegEnd;
 				playing			= 1;
-				MpegDec::SetMemory(&mpegROM[mpegStart], mpegEnd - mpegStart, false);
+				mpegDec.SetMemory(&mpegROM[mpegStart], mpegEnd - mpegStart, false);
 			}
 			break;
 		case ST_GOTA5:
@@ -787,7 +787,7 @@ void CDSB2::WriteMPEGFIFO(UINT8 byte)
 			mpegState = ST_IDLE;
 			if (byte == 0x96)
 			{
-				MpegDec::Stop();
+				mpegDec.Stop();
 				playing = 0;
 			}
 			break;
@@ -1017,7 +1017,7 @@ void CDSB2::RunFrame(float *audioL, float *audioR)
   M68KGetContext(&M68K);
 
   // Decode MPEG for this frame
-  MpegDec::DecodeAudio(&mpegL[retainedSamples], &mpegR[retainedSamples], 32000 / 60 - retainedSamples + 2);
+  mpegDec.DecodeAudio(&mpegL[retainedSamples], &mpegR[retainedSamples], 32000 / 60 - retainedSamples + 2);
 
   INT16 *leftChannelSource = nullptr;
   INT16 *rightChannelSource = nullptr;
@@ -1051,7 +1051,7 @@ void CDSB2::RunFrame(float *audioL, float *audioR)
 
 void CDSB2::Reset(void)
 {
-	MpegDec::Stop();
+	mpegDec.Stop();
 	Resampler.Reset();
 	retainedSamples = 0;
 
@@ -1086,8 +1086,8 @@ void CDSB2::SaveState(CBlockFile *StateFile)
 	StateFile->NewBlock("DSB2", __FILE__);
 
 	// MPEG playback state
-	isPlaying	= (UINT8)MpegDec::IsLoaded();
-	playOffset	= (UINT32)MpegDec::GetPosition();
+	isPlaying	= (UINT8)mpegDec.IsLoaded();
+	playOffset	= (UINT32)mpegDec.GetPosition();
 	endOffset	= 0;
 
 	StateFile->Write(&isPlaying, sizeof(isPlaying));
@@ -1165,16 +1165,16 @@ void CDSB2::LoadState(CBlockFile *StateFile)
 	// Restart MPEG audio at the appropriate position
 	if (isPlaying)
 	{
-		MpegDec::SetMemory(&mpegROM[usingMPEGStart], usingMPEGEnd - usingMPEGStart, false);
+		mpegDec.SetMemory(&mpegROM[usingMPEGStart], usingMPEGEnd - usingMPEGStart, false);
 
 		if (usingLoopEnd != 0) {		// only if looping was actually enabled
-			MpegDec::UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
+			mpegDec.UpdateMemory(&mpegROM[usingLoopStart], usingLoopEnd, true);
 		}
 
-		MpegDec::SetPosition(playOffset);
+		mpegDec.SetPosition(playOffset);
 	}
 	else {
-		MpegDec::Stop();
+		mpegDec.Stop();
 	}
 
 	//DEBUG
@@ -1200,20 +1200,30 @@ bool CDSB2::Init(const UINT8 *progROMPtr, const UINT8 *mpegROMPtr)
 	mpegROM = mpegROMPtr;
 
 	// Allocate memory pool
-	memoryPool = new(std::nothrow) UINT8[DSB2_MEMORY_POOL_SIZE];
+	memoryPool = Util::MemoryArena::Allocate("DSB2", DSB2_MEMORY_POOL_SIZE);	// zero filled
 	if (NULL == memoryPool)
 		return ErrorLog("Insufficient memory for DSB2 board (needs %1.1f MB).", memSizeMB);
-	memset(memoryPool, 0, DSB2_MEMORY_POOL_SIZE);
 
 	// Set up memory pointers
 	ram = &memoryPool[DSB2_OFFSET_RAM];
 	mpegL = (INT16 *) &memoryPool[DSB2_OFFSET_MPEG_LEFT];
 	mpegR = (INT16 *) &memoryPool[DSB2_OFFSET_MPEG_RIGHT];
 
+	// Direct-access pages: program ROM (000000-01FFFF) and RAM (F00000-F1FFFF).
+	// Byte reads from F10000-F1FFFF return 0 in Read8(), so that page is only
+	// mapped for writes.
+	memMap.read[0x00] = &progROM[0x00000];
+	memMap.read[0x01] = &progROM[0x10000];
+	memMap.read[0xF0] = &ram[0x00000];
+	memMap.write[0xF0] = &ram[0x00000];
+	memMap.write[0xF1] = &ram[0x10000];
+
 	// Initialize 68K CPU
 	M68KSetContext(&M68K);
 	M68KInit();
 	M68KAttachBus(this);
+	M68KAttachMemoryMap(&memMap);
+	M68KSetIdleSkip(m_config["SoundIdleSkip"].ValueAsDefault<bool>(true));
 	M68KSetIRQCallback(NULL);	// use default behavior (autovector, clear interrupt)
 	M68KGetContext(&M68K);
 
@@ -1251,7 +1261,7 @@ CDSB2::~CDSB2(void)
 {
 	if (memoryPool != NULL)
 	{
-		delete [] memoryPool;
+		Util::MemoryArena::Free(memoryPool);
 		memoryPool = NULL;
 	}
 
@@ -37,6 +37,7 @@
 #include "CPU/68K/68K.h"
 #include "CPU/Z80/Z80.h"
 #include "Util/NewConfig.h"
+#include "Sound/MPEG/MpegAudio.h"
 
 #define FIFO_STACK_SIZE			0x100
 #define FIFO_STACK_SIZE_MASK	(FIFO_STACK_SIZE - 1)
@@ -209,6 +210,7 @@ private:
 
   // MPEG decode buffers (48KHz, 1/60th second + 2 extra padding samples)
 	INT16	*mpegL, *mpegR;
+	MpegDec::CDecoder	mpegDec;	// MPEG stream decoder (decodes ahead on its own thread)
 
 	// DSB memory
 	const UINT8	*progROM;		// Z80 program ROM (passed in from parent object)
@@ -289,6 +291,7 @@ private:
 
 	// MPEG decode buffers (48KHz, 1/60th second + 2 extra padding samples)
 	INT16	*mpegL, *mpegR;
+	MpegDec::CDecoder	mpegDec;	// MPEG stream decoder (decodes ahead on its own thread)
 
 	// Stereo mode (do not change values because they are used in save states!)
 	enum class StereoMode: uint8_t
@@ -324,6 +327,7 @@ private:
 
 	// M68K CPU
 	M68KCtx	M68K;
+	M68KMemoryMap	memMap;	// direct-access pages for program ROM and RAM
 	static constexpr int k_framePeriod = 11000000/60;
 	static constexpr int k_timerPeriod = 11000000/1000; // 1KHz timer
 	int m_cyclesElapsedThisFrame;
@@ -104,6 +104,15 @@ public:
    */
   virtual void RunFrame(void) = 0;
 
+  /*
+   * SkipFrame(void):
+   *
+   * Runs one video frame like RunFrame() but does not render it. Used for
+   * frame skipping when the host cannot keep up; all devices other than the
+   * renderers run exactly as they would in RunFrame().
+   */
+  virtual void SkipFrame(void) = 0;
+
   /*
    * RenderFrame(void):
    *
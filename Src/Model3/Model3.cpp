@@ -234,10 +234,13 @@
 #include "OSD/Video.h"
 #include "Util/Format.h"
 #include "Util/ByteSwap.h"
+#include "Util/MemoryArena.h"
 #include <functional>
 #include <set>
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 
 /******************************************************************************
  Model 3 Inputs
@@ -865,6 +868,8 @@ void CModel3::SetCROMBank(unsigned idx)
   cromBankReg = idx;
   idx = (~idx) & 0xF;
   cromBank = &crom[0x800000 + (idx*0x800000)];
+  if (fastMem.GetBase() != NULL)
+    fastMem.Map(0xFF000000, cromBank - memoryPool, 0x800000, false);
   DebugLog("CROM bank setting: %d (%02X), PC=%08X, LR=%08X\n", idx, cromBankReg, ppc_get_pc(), ppc_get_lr());
 }
 
@@ -1393,6 +1398,10 @@ void CModel3::Write8(UINT32 addr, UINT8 data)
   if (addr < 0x00800000)
   {
     ram[addr^3] = data;
+#ifdef PPC_LOCKSTEP
+    if (ppcLockstep != NULL)  // device DMA (PowerPC accesses don't come through here while it is recording)
+      ppcLockstep->DeviceWrite(addr, 1, data);
+#endif
     return;
   }
 
@@ -1534,6 +1543,10 @@ void CModel3::Write16(UINT32 addr, UINT16 data)
   if (addr < 0x00800000)
   {
     *(UINT16 *) &ram[addr^2] = data;
+#ifdef PPC_LOCKSTEP
+    if (ppcLockstep != NULL)
+      ppcLockstep->DeviceWrite(addr, 2, data);
+#endif
     return;
   }
 
@@ -1627,6 +1640,10 @@ void CModel3::Write32(UINT32 addr, UINT32 data)
   if (addr<0x00800000)
   {
     *(UINT32 *) &ram[addr] = data;
+#ifdef PPC_LOCKSTEP
+    if (ppcLockstep != NULL)
+      ppcLockstep->DeviceWrite(addr, 4, data);
+#endif
     return;
   }
 
@@ -1961,8 +1978,46 @@ void CModel3::ClearNVRAM(void)
 }
 
 void CModel3::RunFrame(void)
+{
+#ifdef NET_BOARD
+  if (m_rollbackFrames > 0)
+  {
+    RunFrameWithRollback(true);
+    return;
+  }
+#endif
+  EmulateFrame(true);
+}
+
+void CModel3::SkipFrame(void)
+{
+#ifdef NET_BOARD
+  if (m_rollbackFrames > 0)
+  {
+    RunFrameWithRollback(false);
+    return;
+  }
+#endif
+  EmulateFrame(false);
+}
+
+void CModel3::EmulateFrame(bool render)
 {
   UINT32 start = CThread::GetTicks();
+  auto frameStart = std::chrono::steady_clock::now();
+
+  // When skipping, neither the snapshots nor the render-side copy of the
+  // command port flag and texture upload queue are synced; everything stays
+  // marked dirty/queued until the next rendered frame picks it up. The GPUs
+  // must have been synced once for VBlank to be emulated, though.
+  if (!render && !gpusReady)
+    render = true;
+  if (!render)
+  {
+    timings.syncSize = 0;
+    timings.syncTicks = 0;
+    timings.renderTicks = 0;
+  }
 
   // See if currently running multi-threaded
   if (m_multiThreaded)
@@ -1971,45 +2026,51 @@ void CModel3::RunFrame(void)
     if (!StartThreads())
       goto ThreadError;
 
+    // If multi-threading GPU, the sync at the end of the previous frame was
+    // for this one. If it was skipped, do it now while the PPC main board
+    // thread is still waiting; its state is the same as it was back then.
+    if (m_gpuMultiThreaded && render && gpusSyncPending)
+    {
+      SyncGPUs();
+      gpusSyncPending = false;
+    }
+
+    // Arm the frame barrier for the boards about to run, before any of them can arrive
+    if (!frameDoneSync->Reset(unsigned(m_gpuMultiThreaded) + unsigned(syncSndBrdThread) + unsigned(DriveBoard->IsAttached())))
+      goto ThreadError;
+
     // Wake threads for PPC main board (if multi-threading GPU), sound board (if sync'd) and drive board (if attached) so they can process a frame
-    if ((m_gpuMultiThreaded       && !ppcBrdThreadSync->Post()) ||
-        (syncSndBrdThread         && !sndBrdThreadSync->Post()) ||
-        (DriveBoard->IsAttached()  && !drvBrdThreadSync->Post()))
+    if ((m_gpuMultiThreaded       && !ppcBrdThreadSync->Set()) ||
+        (syncSndBrdThread         && !sndBrdThreadSync->Set()) ||
+        (DriveBoard->IsAttached()  && !drvBrdThreadSync->Set()))
       goto ThreadError;
 
     // If not multi-threading GPU, then run PPC main board for a frame and sync GPUs now in this thread
     if (!m_gpuMultiThreaded)
     {
       RunMainBoardFrame();
-      SyncGPUs();
+      if (render)
+        SyncGPUs();
     }
 
     // Render frame
-    RenderFrame();
-
-    // Enter notify wait critical section
-    if (!notifyLock->Lock())
-      goto ThreadError;
+    if (render)
+      RenderFrame();
 
     // Wait for PPC main board, sound board and drive board threads to finish their work (if they are running and haven't finished already)
-    while ((m_gpuMultiThreaded      && !ppcBrdThreadDone) ||
-           (syncSndBrdThread        && !sndBrdThreadDone) ||
-           (DriveBoard->IsAttached() && !drvBrdThreadDone))
-    {
-      if (!notifySync->Wait(notifyLock))
-        goto ThreadError;
-    }
-    ppcBrdThreadDone = false;
-    sndBrdThreadDone = false;
-    drvBrdThreadDone = false;
-
-    // Leave notify wait critical section
-    if (!notifyLock->Unlock())
+    auto waitStart = std::chrono::steady_clock::now();
+    if (!frameDoneSync->Wait())
       goto ThreadError;
+    timings.waitMicros = UINT32(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - waitStart).count());
 
     // If multi-threading GPU, then sync GPUs last while PPC main board thread is waiting
     if (m_gpuMultiThreaded)
-      SyncGPUs();
+    {
+      if (render)
+        SyncGPUs();
+      else
+        gpusSyncPending = true;
+    }
 
 #ifdef NET_BOARD
     if (NetBoard->IsRunning() && m_config["SimulateNet"].ValueAs<bool>())
@@ -2019,9 +2080,13 @@ void CModel3::RunFrame(void)
   else
   {
     // If not multi-threaded, then just process and render a single frame for PPC main board, sound board and drive board in turn in this thread
+    timings.waitMicros = 0;
     RunMainBoardFrame();
-    SyncGPUs();
-    RenderFrame();
+    if (render)
+    {
+      SyncGPUs();
+      RenderFrame();
+    }
     RunSoundBoardFrame();
     if (DriveBoard->IsAttached())
       RunDriveBoardFrame();
@@ -2032,12 +2097,13 @@ void CModel3::RunFrame(void)
   }
 
   timings.frameTicks = CThread::GetTicks() - start;
+  UpdateFrameJitter(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - frameStart).count());
   // Frame counter
   timings.frameId++;
   return;
 
 ThreadError:
-  ErrorLog("Threading error in CModel3::RunFrame: %s\nSwitching back to single-threaded mode.\n", CThread::GetLastError());
+  ErrorLog("Threading error in CModel3::EmulateFrame: %s\nSwitching back to single-threaded mode.\n", CThread::GetLastError());
   m_multiThreaded = false;
 }
 
@@ -2062,6 +2128,22 @@ static unsigned GetCPUClockFrequencyInHz(const Game &game, Util::Config::Node &c
   return mhz * 1000000;
 }
 
+void CModel3::UpdateFrameJitter(double frameMicros)
+{
+  // Exponentially weighted mean and variance over roughly the last 64 frames
+  const double alpha = 1.0 / 64.0;
+  if (timings.frameId == 0)
+  {
+    frameMicrosMean = frameMicros;
+    frameMicrosVar = 0.0;
+  }
+  double delta = frameMicros - frameMicrosMean;
+  frameMicrosMean += alpha * delta;
+  frameMicrosVar = (1.0 - alpha) * (frameMicrosVar + alpha * delta * delta);
+  timings.frameMicros = UINT32(frameMicros);
+  timings.jitterMicros = UINT32(std::sqrt(frameMicrosVar));
+}
+
 void CModel3::RunMainBoardFrame(void)
 {
 	UINT32 start = CThread::GetTicks();
@@ -2100,7 +2182,7 @@ void CModel3::RunMainBoardFrame(void)
 		TileGen.BeginVBlank();
 		GPU.BeginVBlank(statusCycles);	// Games poll the ping_pong at startup. Values aren't 100% accurate so we stretch the frame a bit to ensure writes happen in the correct frame
 
-		ppc_execute(offsetCycles);
+		ExecutePPC(offsetCycles);
 		IRQ.Assert(0x02);								// start at 33% of the frame
 
 		// keep running cycles until IRQ2 is acknowledged
@@ -2108,7 +2190,7 @@ void CModel3::RunMainBoardFrame(void)
 		// and miss MIDI interrupts pending before the next IRQ2
 		while (IRQ.ReadIRQEnable() & 0x2 && IRQ.ReadIRQState() & 0x2 && dispCycles > 1000)
 		{
-			ppc_execute(1000);
+			ExecutePPC(1000);
 			dispCycles -= 1000;
 		}
 
@@ -2133,9 +2215,9 @@ void CModel3::RunMainBoardFrame(void)
 
 			// Process MIDI interrupt
 			IRQ.Assert(0x40);
-			ppc_execute(200); // give PowerPC time to acknowledge IR
+			ExecutePPC(200); // give PowerPC time to acknowledge IR
 			IRQ.Deassert(0x40);
-			ppc_execute(200); // acknowledge that IRQ was deasserted (TODO: is this really needed?)
+			ExecutePPC(200); // acknowledge that IRQ was deasserted (TODO: is this really needed?)
 			dispCycles -= 400;
 
 			++irqCount;
@@ -2153,11 +2235,20 @@ void CModel3::RunMainBoardFrame(void)
 	}
 
 	// Run the PowerPC for the active display part of the frame
-	ppc_execute(dispCycles);
+	ExecutePPC(dispCycles);
 
 	timings.ppcTicks = CThread::GetTicks() - start;
 }
 
+int CModel3::ExecutePPC(int cycles)
+{
+#ifdef PPC_LOCKSTEP
+	if (ppcLockstep != NULL)
+		return ppcLockstep->Execute(cycles, &fastMem);
+#endif
+	return ppc_execute(cycles);
+}
+
 void CModel3::SyncGPUs(void)
 {
   UINT32 start = CThread::GetTicks();
@@ -2176,6 +2267,7 @@ void CModel3::RenderFrame(void)
   if (BeginFrameVideo() && gpusReady)
   {
     // Render frame
+    m_superAA->BeginFrame();
     TileGen.BeginFrame();
     GPU.BeginFrame();
     TileGen.PreRenderFrame();
@@ -2212,6 +2304,186 @@ void CModel3::RunNetBoardFrame(void)
 {
   NetBoard->RunFrame();
 }
+
+/*
+ * Net board rollback
+ *
+ * When the simulated net board is allowed to run ahead of the other machines
+ * (NetRollback), it hands the main board predicted comm data for the frames
+ * whose remote segments haven't arrived yet. The whole machine is snapshotted
+ * into memory before each of those frames. Once the real data turns up and
+ * differs from the prediction, the snapshot of the first wrong frame is loaded
+ * at the start of the next host frame. The frames up to where emulation had
+ * got to are then run again without rendering, at most
+ * ROLLBACK_RERUNS_PER_FRAME of them per host frame ahead of the one that is
+ * rendered, so a long rollback is spread over several host frames instead of
+ * stalling one of them.
+ *
+ * A snapshot is the whole save state, about 30 MB. Taking one costs a copy of
+ * that, a few ms, and so does loading one. The snapshot and restore times and
+ * the most time a host frame spent rolling back are logged on exit.
+ *
+ * The input values each frame is first run with are recorded for as far back
+ * as a rollback can go, and a frame that is run again gets them back, with
+ * its audio muted as it was output the first time. The net board drops the
+ * link if a frame run again still sends something different from the first
+ * time, as the other machines can't be made to roll back over it.
+ */
+
+const static unsigned ROLLBACK_RERUNS_PER_FRAME = 2;
+
+static double ElapsedMs(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void CModel3::SaveRollbackSnapshot(UINT32 netFrame)
+{
+  // A snapshot taken again for the same frame replaces the later ones
+  while (!m_rollbackSnapshots.empty() && m_rollbackSnapshots.back().first >= netFrame)
+  {
+    m_rollbackBuffers.push_back(std::move(m_rollbackSnapshots.back().second));
+    m_rollbackSnapshots.pop_back();
+  }
+
+  // Reuse the buffer of the oldest snapshot once there are enough of them, or
+  // one of a dropped snapshot. Filling a new buffer is several times slower,
+  // as each of its pages faults in.
+  std::vector<uint8_t> buffer;
+  if (m_rollbackSnapshots.size() > m_rollbackFrames)
+  {
+    buffer.swap(m_rollbackSnapshots.front().second);
+    m_rollbackSnapshots.pop_front();
+  }
+  else if (!m_rollbackBuffers.empty())
+  {
+    buffer.swap(m_rollbackBuffers.back());
+    m_rollbackBuffers.pop_back();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  PauseThreads();
+  CBlockFile state;
+  state.Create(&buffer, "Supermodel Rollback State", "Supermodel Version " SUPERMODEL_VERSION);
+  SaveState(&state);
+  NetBoard->SaveState(&state);
+  state.Close();
+  ResumeThreads();
+  double ms = ElapsedMs(start);
+  ++m_rollbackSnapshotCount;
+  m_rollbackSnapshotMs += ms;
+  m_rollbackSnapshotMaxMs = std::max(m_rollbackSnapshotMaxMs, ms);
+
+  m_rollbackSnapshots.emplace_back(netFrame, std::move(buffer));
+}
+
+bool CModel3::LoadRollbackSnapshot(UINT32 netFrame)
+{
+  auto it = m_rollbackSnapshots.rbegin();
+  while (it != m_rollbackSnapshots.rend() && it->first > netFrame)
+    ++it;
+  if (it == m_rollbackSnapshots.rend())
+    return FAIL;
+
+  auto start = std::chrono::steady_clock::now();
+  CBlockFile state;
+  if (OKAY != state.Load(it->second.data(), it->second.size()) || OKAY != state.FindBlock("Supermodel Rollback State"))
+    return FAIL;
+  PauseThreads();
+  LoadState(&state);
+  NetBoard->LoadState(&state);
+  ResumeThreads();
+  state.Close();
+  m_rollbackLoadMaxMs = std::max(m_rollbackLoadMaxMs, ElapsedMs(start));
+
+  // Later snapshots are retaken as the frames are run again
+  for (auto later = it.base(); later != m_rollbackSnapshots.end(); ++later)
+    m_rollbackBuffers.push_back(std::move(later->second));
+  m_rollbackSnapshots.erase(it.base(), m_rollbackSnapshots.end());
+  return OKAY;
+}
+
+void CModel3::RunPredictedFrame(bool render)
+{
+  UINT32 netFrame = NetBoard->GetFrameNumber();
+  if (NetBoard->IsPredicting())
+    SaveRollbackSnapshot(netFrame);
+
+  unsigned numInputs = Inputs->Count();
+  if (m_rollbackInputs.empty() || netFrame > m_rollbackInputs.back().first)
+  {
+    // First run: record the inputs
+    if (!m_rollbackInputs.empty() && netFrame != m_rollbackInputs.back().first + 1)
+      m_rollbackInputs.clear();
+    std::vector<UINT16> values(numInputs);
+    if (m_rollbackInputs.size() > m_rollbackFrames)
+    {
+      values.swap(m_rollbackInputs.front().second);
+      m_rollbackInputs.pop_front();
+    }
+    for (unsigned i = 0; i < numInputs; i++)
+      values[i] = (*Inputs)[i]->value;
+    m_rollbackInputs.emplace_back(netFrame, std::move(values));
+    EmulateFrame(render);
+  }
+  else
+  {
+    // Run again: replay the recorded inputs and don't output the audio twice
+    std::vector<UINT16> live(numInputs);
+    for (unsigned i = 0; i < numInputs; i++)
+      live[i] = (*Inputs)[i]->value;
+    if (netFrame >= m_rollbackInputs.front().first)
+    {
+      const std::vector<UINT16> &values = m_rollbackInputs[netFrame - m_rollbackInputs.front().first].second;
+      for (unsigned i = 0; i < numInputs; i++)
+        (*Inputs)[i]->value = values[i];
+    }
+    SoundBoard.SetMute(true);
+    EmulateFrame(render);
+    SoundBoard.SetMute(false);
+    for (unsigned i = 0; i < numInputs; i++)
+      (*Inputs)[i]->value = live[i];
+  }
+
+  // Net board not linked (yet or any more): nothing to roll back
+  if (NetBoard->GetFrameNumber() == netFrame)
+  {
+    m_rollbackInputs.clear();
+    m_rollbackTarget = 0;
+  }
+}
+
+void CModel3::RunFrameWithRollback(bool render)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  UINT32 netFrame;
+  while (NetBoard->GetRollbackFrame(&netFrame))
+  {
+    UINT32 present = std::max(m_rollbackTarget, NetBoard->GetFrameNumber());
+    if (OKAY != LoadRollbackSnapshot(netFrame))
+    {
+      ErrorLog("No snapshot to roll back to net board frame %u. Dropping the link.", netFrame);
+      NetBoard->AbortRollback();
+      m_rollbackSnapshots.clear();
+      m_rollbackInputs.clear();
+      m_rollbackTarget = 0;
+      break;
+    }
+    ++m_rollbacks;
+    m_rollbackTarget = present;
+  }
+
+  // Catch up on the frames rolled back over, a few per host frame
+  for (unsigned i = 0; i < ROLLBACK_RERUNS_PER_FRAME && NetBoard->GetFrameNumber() < m_rollbackTarget; i++)
+  {
+    RunPredictedFrame(false);
+    ++m_rollbackReruns;
+  }
+  m_rollbackFrameMaxMs = std::max(m_rollbackFrameMaxMs, ElapsedMs(start));
+
+  RunPredictedFrame(render);
+}
 #endif
 
 bool CModel3::StartThreads(void)
@@ -2220,13 +2492,15 @@ bool CModel3::StartThreads(void)
     return true;
 
   // Create synchronization objects
+  unsigned wakeSpin = m_config["ThreadWakeSpin"].ValueAsDefault<unsigned>(50);
+  unsigned syncSpin = m_config["ThreadSyncSpin"].ValueAsDefault<unsigned>(200);
   if (m_gpuMultiThreaded)
   {
-    ppcBrdThreadSync = CThread::CreateSemaphore(0);
+    ppcBrdThreadSync = CThread::CreateEvent(wakeSpin);
     if (ppcBrdThreadSync == NULL)
       goto ThreadError;
   }
-  sndBrdThreadSync = CThread::CreateSemaphore(0);
+  sndBrdThreadSync = CThread::CreateEvent(wakeSpin);
   if (sndBrdThreadSync == NULL)
     goto ThreadError;
   sndBrdNotifyLock = CThread::CreateMutex();
@@ -2237,10 +2511,13 @@ bool CModel3::StartThreads(void)
     goto ThreadError;
   if (DriveBoard->IsAttached())
   {
-    drvBrdThreadSync = CThread::CreateSemaphore(0);
+    drvBrdThreadSync = CThread::CreateEvent(wakeSpin);
     if (drvBrdThreadSync == NULL)
       goto ThreadError;
   }
+  frameDoneSync = CThread::CreateBarrier(syncSpin);
+  if (frameDoneSync == NULL)
+    goto ThreadError;
   notifyLock = CThread::CreateMutex();
   if (notifyLock == NULL)
     goto ThreadError;
@@ -2248,6 +2525,10 @@ bool CModel3::StartThreads(void)
   if (notifySync == NULL)
     goto ThreadError;
 
+  // Decide where each thread runs and place this (render) thread; the others place themselves when they start
+  PlanThreadPlacement();
+  PlaceThread("Render", renderCPUs, threadPriority);
+
   // Reset thread flags
   pauseThreads = false;
   stopThreads = false;
@@ -2292,6 +2573,90 @@ ThreadError:
   return false;
 }
 
+static std::string FormatCPUList(const std::vector<unsigned> &cpus)
+{
+  std::string list;
+  for (unsigned cpu : cpus)
+    list += (list.empty() ? "" : ",") + std::to_string(cpu);
+  return list;
+}
+
+void CModel3::PlanThreadPlacement(void)
+{
+  renderCPUs.clear();
+  ppcBrdCPUs.clear();
+  sndBrdCPUs.clear();
+  drvBrdCPUs.clear();
+
+  // Automatic placement: render and PPC main board threads each get a
+  // physical core (with its SMT siblings) to themselves, and the lighter
+  // sound and drive board threads go on the next cores, or share the render
+  // thread's core if there are only two.
+  std::string affinity = m_config["ThreadAffinity"].ValueAsDefault<std::string>("none");
+  if (affinity == "auto")
+  {
+    std::vector<std::vector<unsigned>> cores = CThread::GetPhysicalCores();
+    if (cores.size() >= 2)
+    {
+      renderCPUs = cores[0];
+      ppcBrdCPUs = cores[1];
+      sndBrdCPUs = cores[cores.size() > 2 ? 2 : 0];
+      drvBrdCPUs = cores[cores.size() > 3 ? 3 : (cores.size() > 2 ? 2 : 0)];
+    }
+    else
+      InfoLog("ThreadAffinity=auto: fewer than two physical cores available, threads will not be pinned.");
+  }
+  else if (affinity != "none")
+    ErrorLog("Invalid ThreadAffinity setting '%s', must be 'none' or 'auto'.", affinity.c_str());
+
+  // Explicit CPU lists override automatic placement
+  struct { const char *key; std::vector<unsigned> *cpus; } lists[] =
+  {
+    { "RenderThreadCPUs",     &renderCPUs },
+    { "MainBoardThreadCPUs",  &ppcBrdCPUs },
+    { "SoundBoardThreadCPUs", &sndBrdCPUs },
+    { "DriveBoardThreadCPUs", &drvBrdCPUs }
+  };
+  for (auto &list : lists)
+  {
+    std::string value = m_config[list.key].ValueAsDefault<std::string>("");
+    if (value.empty())
+      continue;
+    std::vector<unsigned> cpus;
+    if (CThread::ParseCPUList(value, &cpus) && !cpus.empty())
+      *list.cpus = cpus;
+    else
+      ErrorLog("Invalid %s setting '%s', must be a list of CPUs such as '0,2-3'.", list.key, value.c_str());
+  }
+
+  std::string priority = m_config["ThreadPriority"].ValueAsDefault<std::string>("normal");
+  if (priority == "low")
+    threadPriority = CThread::PRIORITY_LOW;
+  else if (priority == "high")
+    threadPriority = CThread::PRIORITY_HIGH;
+  else
+  {
+    if (priority != "normal")
+      ErrorLog("Invalid ThreadPriority setting '%s', must be 'low', 'normal' or 'high'.", priority.c_str());
+    threadPriority = CThread::PRIORITY_NORMAL;
+  }
+  sndBrdPriority = m_config["SoundThreadRealtime"].ValueAsDefault<bool>(false) ? CThread::PRIORITY_REALTIME : threadPriority;
+}
+
+void CModel3::PlaceThread(const char *name, const std::vector<unsigned> &cpus, CThread::Priority priority)
+{
+  // Failures are not fatal: the thread simply keeps running where the OS puts it
+  if (!cpus.empty())
+  {
+    if (CThread::SetAffinity(cpus))
+      InfoLog("%s thread pinned to CPU(s) %s.", name, FormatCPUList(cpus).c_str());
+    else
+      InfoLog("Unable to pin %s thread to CPU(s) %s: %s", name, FormatCPUList(cpus).c_str(), CThread::GetLastError());
+  }
+  if (priority != CThread::PRIORITY_NORMAL && !CThread::SetPriority(priority))
+    InfoLog("Unable to change priority of %s thread: %s", name, CThread::GetLastError());
+}
+
 bool CModel3::PauseThreads(void)
 {
   if (!startedThreads)
@@ -2374,14 +2739,14 @@ bool CModel3::StopThreads(void)
   // Resume each thread in turn and wait for them to exit
   if (ppcBrdThread != NULL)
   {
-    if (ppcBrdThreadSync->Post())
+    if (ppcBrdThreadSync->Set())
       ppcBrdThread->Wait();
   }
   if (sndBrdThread != NULL)
   {
     if (syncSndBrdThread)
     {
-      if (sndBrdThreadSync->Post())
+      if (sndBrdThreadSync->Set())
         sndBrdThread->Wait();
     }
     else
@@ -2392,7 +2757,7 @@ bool CModel3::StopThreads(void)
   }
   if (drvBrdThread != NULL)
   {
-    if (drvBrdThreadSync->Post())
+    if (drvBrdThreadSync->Set())
       drvBrdThread->Wait();
   }
 
@@ -2443,6 +2808,11 @@ void CModel3::DeleteThreadObjects(void)
     delete drvBrdThreadSync;
     drvBrdThreadSync = NULL;
   }
+  if (frameDoneSync != NULL)
+  {
+    delete frameDoneSync;
+    frameDoneSync = NULL;
+  }
 
 
   if (sndBrdNotifyLock != NULL)
@@ -2469,14 +2839,15 @@ void CModel3::DeleteThreadObjects(void)
 
 void CModel3::DumpTimings(void)
 {
-  printf("PPC:%3ums%c render:%3ums%c sync:%4uK%c%3ums%c snd:%3ums%c drv:%3ums%c frame:%3ums%c\n",
+  printf("PPC:%3ums%c render:%3ums%c sync:%4uK%c%3ums%c snd:%3ums%c drv:%3ums%c frame:%3ums%c wait:%5uus jitter:%5uus\n",
     timings.ppcTicks, (timings.ppcTicks > timings.renderTicks ? '!' : ','),
     timings.renderTicks, (timings.renderTicks > timings.ppcTicks ? '!' : ','),
     timings.syncSize / 1024, (timings.syncSize / 1024 > 128 ? '!' : ','),
     timings.syncTicks, (timings.syncTicks > 1 ? '!' : ','),
     timings.sndTicks, (timings.sndTicks > 10 ? '!' : ','),
     timings.drvTicks, (timings.drvTicks > 10 ? '!' : ','),
-    timings.frameTicks, (timings.frameTicks > 16 ? '!' : ' '));
+    timings.frameTicks, (timings.frameTicks > 16 ? '!' : ' '),
+    timings.waitMicros, timings.jitterMicros);
 }
 
 FrameTimings CModel3::GetTimings(void)
@@ -2514,6 +2885,7 @@ int CModel3::StartDriveBoardThread(void *data)
 
 int CModel3::RunMainBoardThread(void)
 {
+  PlaceThread("MainBoard", ppcBrdCPUs, threadPriority);
   for (;;)
   {
     bool wait = true;
@@ -2551,15 +2923,18 @@ int CModel3::RunMainBoardThread(void)
     if (!notifyLock->Lock())
       goto ThreadError;
 
-    // Let other threads know processing has finished
+    // Let a pending pause or stop know processing has finished
     ppcBrdThreadRunning = false;
-    ppcBrdThreadDone = true;
-    if (!notifySync->SignalAll())
+    if (pauseThreads && !notifySync->SignalAll())
       goto ThreadError;
 
     // Leave notify critical section
     if (!notifyLock->Unlock())
       goto ThreadError;
+
+    // Count this board in for the frame
+    if (!frameDoneSync->Arrive())
+      goto ThreadError;
   }
 
 ThreadError:
@@ -2615,6 +2990,7 @@ ThreadError:
 
 int CModel3::RunSoundBoardThread(void)
 {
+  PlaceThread("SoundBoard", sndBrdCPUs, sndBrdPriority);
   for (;;)
   {
     bool wait = true;
@@ -2680,10 +3056,9 @@ int CModel3::RunSoundBoardThread(void)
     if (!notifyLock->Lock())
       goto ThreadError;
 
-    // Let other threads know processing has finished
+    // Let a pending pause or stop know processing has finished
     sndBrdThreadRunning = false;
-    sndBrdThreadDone = true;
-    if (!notifySync->SignalAll())
+    if (pauseThreads && !notifySync->SignalAll())
       goto ThreadError;
 
     // Leave main notify critical section
@@ -2699,6 +3074,7 @@ ThreadError:
 
 int CModel3::RunSoundBoardThreadSyncd(void)
 {
+  PlaceThread("SoundBoard", sndBrdCPUs, sndBrdPriority);
   for (;;)
   {
     bool wait = true;
@@ -2736,15 +3112,18 @@ int CModel3::RunSoundBoardThreadSyncd(void)
     if (!notifyLock->Lock())
       goto ThreadError;
 
-    // Let other threads know processing has finished
+    // Let a pending pause or stop know processing has finished
     sndBrdThreadRunning = false;
-    sndBrdThreadDone = true;
-    if (!notifySync->SignalAll())
+    if (pauseThreads && !notifySync->SignalAll())
       goto ThreadError;
 
     // Leave notify critical section
     if (!notifyLock->Unlock())
       goto ThreadError;
+
+    // Count this board in for the frame
+    if (!frameDoneSync->Arrive())
+      goto ThreadError;
   }
 
 ThreadError:
@@ -2755,6 +3134,7 @@ ThreadError:
 
 int CModel3::RunDriveBoardThread(void)
 {
+  PlaceThread("DriveBoard", drvBrdCPUs, threadPriority);
   for (;;)
   {
     bool wait = true;
@@ -2792,15 +3172,18 @@ int CModel3::RunDriveBoardThread(void)
     if (!notifyLock->Lock())
       goto ThreadError;
 
-    // Let other threads know processing has finished
+    // Let a pending pause or stop know processing has finished
     drvBrdThreadRunning = false;
-    drvBrdThreadDone = true;
-    if (!notifySync->SignalAll())
+    if (pauseThreads && !notifySync->SignalAll())
       goto ThreadError;
 
     // Leave notify critical section
     if (!notifyLock->Unlock())
       goto ThreadError;
+
+    // Count this board in for the frame
+    if (!frameDoneSync->Arrive())
+      goto ThreadError;
   }
 
 ThreadError:
@@ -2849,6 +3232,7 @@ void CModel3::Reset(void)
   m_cryptoDevice.Reset();
 
   gpusReady = false;
+  gpusSyncPending = false;
 
   timings.ppcTicks = 0;
   timings.syncSize = 0;
@@ -2859,6 +3243,9 @@ void CModel3::Reset(void)
 #ifdef NET_BOARD
   timings.netTicks = 0;
   NetBoard->Reset();
+  m_rollbackSnapshots.clear();
+  m_rollbackInputs.clear();
+  m_rollbackTarget = 0;
 #endif
   timings.frameTicks = 0;
   timings.frameId = 0;
@@ -2967,6 +3354,18 @@ bool CModel3::LoadGame(const Game &game, const ROMSet &rom_set)
   // Initialize CPU
   ppc_init(&ppc_config);
   ppc_attach_bus(this);
+  ppc_set_fastmem(&fastMem);
+#ifdef PPC_TRACE
+  std::string traceFile = m_config["PowerPCTrace"].ValueAsDefault<std::string>("");
+  if (!traceFile.empty())
+  {
+    UINT32 traceFields;
+    ppc_attach_trace(NULL);
+    if (OKAY == PPCTrace::ParseFields(&traceFields, m_config["PowerPCTraceFields"].ValueAsDefault<std::string>("")) &&
+        OKAY == ppcTrace.Open(traceFile, traceFields))
+      ppc_attach_trace(&ppcTrace);
+  }
+#endif
   PPCFetchRegions[0].start = 0;
   PPCFetchRegions[0].end = 0x007FFFFF;
   PPCFetchRegions[0].ptr = (UINT32 *) ram;
@@ -2977,6 +3376,28 @@ bool CModel3::LoadGame(const Game &game, const ROMSet &rom_set)
   PPCFetchRegions[2].end = 0;
   PPCFetchRegions[2].ptr = NULL;
   ppc_set_fetch(PPCFetchRegions);
+#ifdef PPC_LOCKSTEP
+  ppc_attach_lockstep(NULL);
+  delete ppcLockstep;
+  ppcLockstep = NULL;
+  if (m_config["VerifyPowerPC"].ValueAsDefault<bool>(false))
+  {
+    ppcLockstep = new CPPCLockstep();
+    if (OKAY == ppcLockstep->Init(this, ram, crom, &cromBank, PPCFetchRegions))
+    {
+      ppc_attach_lockstep(ppcLockstep);
+#ifdef PPC_TRACE
+      ppc_attach_trace(NULL); // would record both runs of every block
+#endif
+      InfoLog("PowerPC lockstep verification enabled.");
+    }
+    else
+    {
+      delete ppcLockstep;
+      ppcLockstep = NULL;
+    }
+  }
+#endif
 
   // Initialize Real3D
   int stepping = ((game.stepping[0] - '0') << 4) | (game.stepping[2] - '0');
@@ -3080,6 +3501,10 @@ bool CModel3::LoadGame(const Game &game, const ROMSet &rom_set)
   }
 
   m_runNetBoard = m_game.stepping != "1.0" && NetBoard->IsAttached();
+  m_rollbackFrames = m_config["SimulateNet"].ValueAs<bool>() ? m_config["NetRollback"].ValueAsDefault<unsigned>(0) : 0;
+  m_rollbackSnapshots.clear();
+  m_rollbackInputs.clear();
+  m_rollbackTarget = 0;
 #endif
   return OKAY;
 }
@@ -3154,11 +3579,21 @@ bool CModel3::Init(void)
 {
   float memSizeMB = (float)MEM_POOL_SIZE / (float)0x100000;
 
+  // Huge pages for all emulated memory, this board's and the others'
+  std::string hugePages = m_config["HugePages"].ValueAsDefault<std::string>("transparent");
+  if (OKAY != Util::MemoryArena::SetHugePages(hugePages))
+    ErrorLog("Invalid HugePages setting '%s', must be 'off', 'transparent' or 'explicit'.", hugePages.c_str());
+
   // Allocate all memory for ROMs and PPC RAM
-  memoryPool = new(std::nothrow) UINT8[MEM_POOL_SIZE];
+  bool useFastMem = m_config["PowerPCFastMem"].ValueAsDefault<bool>(false);
+  if (useFastMem && !CPPCFastMem::IsSupported())
+  {
+    InfoLog("PowerPC fastmem is not supported on this platform.");
+    useFastMem = false;
+  }
+  memoryPool = Util::MemoryArena::Allocate("Model 3", MEM_POOL_SIZE, useFastMem ? Util::MemoryArena::SHARED : 0);  // zero filled
   if (NULL == memoryPool)
     return ErrorLog("Insufficient memory for Model 3 object (needs %1.1f MB).", memSizeMB);
-  memset(memoryPool, 0, MEM_POOL_SIZE);
 
   // Set up pointers
   ram = &memoryPool[RAM_OFFSET];
@@ -3174,6 +3609,20 @@ bool CModel3::Init(void)
   netRAM = &memoryPool[NETRAM_OFFSET];
   netBuffer = &memoryPool[NETBUFFER_OFFSET];
 
+  /*
+   * Map RAM and CROM into the fastmem window (the banked CROM is mapped by
+   * SetCROMBank()). Backup RAM shares its block with the I/O registers and is
+   * left to the bus, as is everything else.
+   */
+  if (useFastMem)
+  {
+    if (OKAY != fastMem.Init(this, memoryPool) ||
+        OKAY != fastMem.Map(0x00000000, RAM_OFFSET, RAM_SIZE, true) ||
+        OKAY != fastMem.Map(0xFF800000, CROM_OFFSET, CROM_SIZE, false))
+      return FAIL;
+    InfoLog("PowerPC fastmem enabled.");
+  }
+
   SetCROMBank(0xFF);
 
   // Initialize other devices (PowerPC, DSB, and security board initialized after ROMs loaded)
@@ -3256,13 +3705,26 @@ CModel3::CModel3(Util::Config::Node &config)
 
   DSB = NULL;
   DriveBoard = NULL;
+#ifdef PPC_LOCKSTEP
+  ppcLockstep = NULL;
+#endif
 
 #ifdef NET_BOARD
   NetBoard = NULL;
+  m_rollbackFrames = 0;
+  m_rollbackTarget = 0;
+  m_rollbacks = 0;
+  m_rollbackReruns = 0;
+  m_rollbackSnapshotCount = 0;
+  m_rollbackSnapshotMs = 0;
+  m_rollbackSnapshotMaxMs = 0;
+  m_rollbackLoadMaxMs = 0;
+  m_rollbackFrameMaxMs = 0;
 #endif
 
   securityPtr = 0;
 
+  gpusSyncPending = false;
   startedThreads = false;
   pauseThreads = false;
   stopThreads = false;
@@ -3271,20 +3733,25 @@ CModel3::CModel3(Util::Config::Node &config)
   drvBrdThread = NULL;
 
   ppcBrdThreadRunning = false;
-  ppcBrdThreadDone = false;
   sndBrdThreadRunning = false;
-  sndBrdThreadDone = false;
   drvBrdThreadRunning = false;
-  drvBrdThreadDone = false;
 
   syncSndBrdThread = false;
   ppcBrdThreadSync = NULL;
   sndBrdThreadSync = NULL;
   drvBrdThreadSync = NULL;
+  frameDoneSync = NULL;
 
   notifyLock = NULL;
   notifySync = NULL;
 
+  threadPriority = CThread::PRIORITY_NORMAL;
+  sndBrdPriority = CThread::PRIORITY_NORMAL;
+
+  memset(&timings, 0, sizeof(timings));
+  frameMicrosMean = 0.0;
+  frameMicrosVar = 0.0;
+
   DebugLog("Built Model 3\n");
 }
 
@@ -3321,19 +3788,30 @@ CModel3::~CModel3(void)
   // Stop all threads
   StopThreads();
 
-  // Free memory
-  if (memoryPool != NULL)
-  {
-    delete [] memoryPool;
-    memoryPool = NULL;
-  }
-
+  // Free memory (DSB first: its MPEG decoder thread reads the MPEG ROM)
   if (DSB != NULL)
   {
     delete DSB;
     DSB = NULL;
   }
 
+  if (fastMem.GetBase() != NULL)
+    ppc_set_fastmem(NULL);
+#ifdef PPC_TRACE
+  ppc_attach_trace(NULL);
+  ppcTrace.Close();
+#endif
+#ifdef PPC_LOCKSTEP
+  ppc_attach_lockstep(NULL);
+  delete ppcLockstep;
+  ppcLockstep = NULL;
+#endif
+  if (memoryPool != NULL)
+  {
+    Util::MemoryArena::Free(memoryPool);  // the fastmem window keeps its mappings until it is destroyed
+    memoryPool = NULL;
+  }
+
   if (DriveBoard != NULL)
   {
       delete DriveBoard;
@@ -3341,6 +3819,14 @@ CModel3::~CModel3(void)
   }
 
 #ifdef NET_BOARD
+  if (m_rollbackSnapshotCount > 0)
+  {
+    InfoLog("Net board rollback: %u rollbacks, %u frames run again, at most %1.2f ms of a host frame spent rolling back.",
+      m_rollbacks, m_rollbackReruns, m_rollbackFrameMaxMs);
+    InfoLog("Net board rollback: %u snapshots, %1.2f ms each (%1.2f ms at most), restores %1.2f ms at most.",
+      m_rollbackSnapshotCount, m_rollbackSnapshotMs / m_rollbackSnapshotCount, m_rollbackSnapshotMaxMs, m_rollbackLoadMaxMs);
+  }
+
   if (NetBoard != NULL)
   {
       delete NetBoard;
@@ -41,8 +41,16 @@
 #include "TileGen.h"
 #include "DriveBoard/DriveBoard.h"
 #include "CPU/PowerPC/ppc.h"
+#include "CPU/PowerPC/PPCFastMem.h"
+#ifdef PPC_TRACE
+#include "CPU/PowerPC/PPCTrace.h"
+#endif
+#ifdef PPC_LOCKSTEP
+#include "CPU/PowerPC/PPCLockstep.h"
+#endif
 #ifdef NET_BOARD
 #include "Network/INetBoard.h"
+#include <deque>
 #endif // NET_BOARD
 #include "Util/NewConfig.h"
 #include "Graphics/SuperAA.h"
@@ -65,6 +73,9 @@ struct FrameTimings
   UINT32 netTicks;
 #endif
   UINT32 frameTicks;
+  UINT32 frameMicros;   // frame time at microsecond resolution
+  UINT32 jitterMicros;  // running standard deviation of frameMicros
+  UINT32 waitMicros;    // time spent waiting for the board threads to finish the frame
   UINT64 frameId;
 };
 
@@ -91,6 +102,7 @@ public:
   void LoadNVRAM(CBlockFile *NVRAM);
   void ClearNVRAM(void);
   void RunFrame(void);
+  void SkipFrame(void);
   void RenderFrame(void);
   void Reset(void);
   const Game &GetGame(void) const;
@@ -207,12 +219,21 @@ private:
   UINT8     ReadSystemRegister(unsigned reg);
   void      WriteSystemRegister(unsigned reg, UINT8 data);
 
+  void EmulateFrame(bool render);                     // Runs all boards for a frame, optionally rendering it
+  void UpdateFrameJitter(double frameMicros);         // Folds a frame time into the running jitter estimate
+  void PlanThreadPlacement(void);                     // Works out the CPUs and priority of each thread from the config
+  void PlaceThread(const char *name, const std::vector<unsigned> &cpus, CThread::Priority priority); // Applies placement to the calling thread
   void RunMainBoardFrame(void);                       // Runs PPC main board for a frame
+  int ExecutePPC(int cycles);                         // Runs the PPC (through the lockstep verifier, if enabled)
   void SyncGPUs(void);                                // Sync's up GPUs in preparation for rendering - must be called when PPC is not running
   bool RunSoundBoardFrame(void);                      // Runs sound board for a frame
   void RunDriveBoardFrame(void);                      // Runs drive board for a frame
 #ifdef NET_BOARD
   void RunNetBoardFrame(void);						  // Runs net board for a frame
+  void RunFrameWithRollback(bool render);             // Runs a frame, snapshotting before predicted comm data and rolling back on a misprediction
+  void RunPredictedFrame(bool render);                // Runs a frame, snapshotting first if its comm data is predicted, or runs one again
+  void SaveRollbackSnapshot(UINT32 netFrame);         // Snapshots the machine and net board into memory
+  bool LoadRollbackSnapshot(UINT32 netFrame);         // Restores the newest snapshot taken at or before a net board frame
 #endif
 
   bool    StartThreads(void);                         // Starts all threads
@@ -255,6 +276,13 @@ private:
 
   // Emulated core Model 3 memory regions
   UINT8   *memoryPool;  // single allocated region for all ROM and system RAM
+  CPPCFastMem fastMem;  // PowerPC fastmem window (owns memoryPool when enabled)
+#ifdef PPC_TRACE
+  CPPCTraceWriter ppcTrace; // PowerPC execution trace (PowerPCTrace option)
+#endif
+#ifdef PPC_LOCKSTEP
+  CPPCLockstep *ppcLockstep;  // PowerPC lockstep verifier (VerifyPowerPC option) or NULL
+#endif
   UINT8   *ram;         // 8 MB PowerPC RAM
   UINT8   *crom;        // 8+128 MB CROM (fixed CROM first, then 64MB of banked CROMs -- Daytona2 might need extra?)
   UINT8   *vrom;        // 64 MB VROM (video ROM, visible only to Real3D)
@@ -282,6 +310,7 @@ private:
 
   // Multiple threading
   bool        gpusReady;           // True if GPUs are ready to render
+  bool        gpusSyncPending;     // True if a skipped frame deferred syncing GPUs (multi-threaded GPU only)
   bool        startedThreads;      // True if threads have been created and started
   bool        pauseThreads;        // True if threads should pause
   bool        stopThreads;         // True if threads should stop
@@ -290,24 +319,34 @@ private:
   CThread     *sndBrdThread;       // Sound board thread
   CThread     *drvBrdThread;       // Drive board thread
   bool        ppcBrdThreadRunning; // Flag to indicate PPC main board thread is currently processing
-  bool        ppcBrdThreadDone;    // Flag to indicate PPC main board thread has finished processing
   bool        sndBrdThreadRunning; // Flag to indicate sound board thread is currently processing
-  bool        sndBrdThreadDone;    // Flag to indicate sound board thread has finished processing
   bool        sndBrdWakeNotify;    // Flag to indicate that sound board thread has been woken by audio callback (when not sync'd with render thread)
   bool        drvBrdThreadRunning; // Flag to indicate drive board thread is currently processing
-  bool        drvBrdThreadDone;    // Flag to indicate drive board thread has finished processing
 
-  // Thread synchronization objects
-  CSemaphore  *ppcBrdThreadSync;
-  CSemaphore  *sndBrdThreadSync;
+  // Thread synchronization objects. The per-frame handoff (wake events and
+  // the frame barrier) spins before blocking; pausing and stopping go through
+  // notifyLock/notifySync.
+  CEvent      *ppcBrdThreadSync;
+  CEvent      *sndBrdThreadSync;
   CMutex      *sndBrdNotifyLock;
   CCondVar    *sndBrdNotifySync;
-  CSemaphore  *drvBrdThreadSync;
+  CEvent      *drvBrdThreadSync;
+  CBarrier    *frameDoneSync;
   CMutex      *notifyLock;
   CCondVar    *notifySync;
 
+  // Thread placement (empty CPU list if a thread is left to the OS scheduler)
+  std::vector<unsigned> renderCPUs;
+  std::vector<unsigned> ppcBrdCPUs;
+  std::vector<unsigned> sndBrdCPUs;
+  std::vector<unsigned> drvBrdCPUs;
+  CThread::Priority threadPriority;   // Priority of the emulation threads
+  CThread::Priority sndBrdPriority;   // Priority of the sound board thread (may be real-time)
+
   // Frame timings
   FrameTimings timings;
+  double      frameMicrosMean;     // Running mean and variance of frame time, for jitter
+  double      frameMicrosVar;
 
   // Other devices
   CIRQ        IRQ;            // Model 3 IRQ controller
@@ -327,6 +366,20 @@ private:
 #ifdef NET_BOARD
   INetBoard   *NetBoard;      // Net board
   bool		m_runNetBoard;
+
+  // Rollback snapshots (net board frame, in-memory save state), oldest first
+  std::deque<std::pair<UINT32, std::vector<uint8_t>>> m_rollbackSnapshots;
+  std::vector<std::vector<uint8_t>> m_rollbackBuffers;  // Buffers of dropped snapshots, kept for reuse
+  std::deque<std::pair<UINT32, std::vector<UINT16>>> m_rollbackInputs;  // Input values of the recent frames (net board frame, values), oldest first
+  unsigned    m_rollbackFrames;   // Net board may run this many frames ahead of the remote data (0 = lockstep)
+  UINT32      m_rollbackTarget;   // Net board frame that was reached before the last rollback
+  UINT32      m_rollbacks;        // Number of rollbacks and frames run again, for the log
+  UINT32      m_rollbackReruns;
+  UINT32      m_rollbackSnapshotCount;  // Snapshot and restore timings, for the log
+  double      m_rollbackSnapshotMs;
+  double      m_rollbackSnapshotMaxMs;
+  double      m_rollbackLoadMaxMs;
+  double      m_rollbackFrameMaxMs;     // Most time a host frame spent on rollback, excluding the frame itself
 #endif
 };
 
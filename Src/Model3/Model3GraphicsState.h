@@ -40,6 +40,7 @@
 #include "OSD/Logger.h"
 #include "OSD/Video.h"
 #include "Util/NewConfig.h"
+#include "Graphics/SuperAA.h"
 
 /*
  * CModel3GraphicsState:
@@ -76,28 +77,52 @@ public:
     RenderFrame();
   }
 
+  void SkipFrame(void) override
+  {
+  }
+
   void RenderFrame(void) override
   {
     BeginFrameVideo();
+    if (m_superAA)
+      m_superAA->BeginFrame();
     m_tileGen.BeginFrame();
     m_real3D.BeginFrame();
     m_real3D.RenderFrame();
     m_real3D.EndFrame();
     m_tileGen.EndFrame();
+    if (m_superAA)
+      m_superAA->Draw();
     EndFrameVideo();
   }
 
   void Reset(void) override
   {
-    // Load state
+    // Load state (if no file was given, one is expected to be set later)
+    if (!m_stateFilePath.empty())
+      LoadStateFile(m_stateFilePath);
+  }
+
+  /*
+   * LoadStateFile(filePath):
+   *
+   * Loads graphics state from a different save state file.
+   *
+   * Parameters:
+   *    filePath  Save state file.
+   *
+   * Returns:
+   *    OKAY if successful, FAIL otherwise. Prints errors.
+   */
+  bool LoadStateFile(const std::string &filePath)
+  {
     CBlockFile SaveState;
-    if (OKAY != SaveState.Load(m_stateFilePath.c_str()))
-      ErrorLog("Unable to load state from '%s'.", m_stateFilePath.c_str());
-    else
-    {
-      LoadState(&SaveState);
-      SaveState.Close();
-    }
+    if (OKAY != SaveState.Load(filePath.c_str()))
+      return ErrorLog("Unable to load state from '%s'.", filePath.c_str());
+    m_stateFilePath = filePath;
+    LoadState(&SaveState);
+    SaveState.Close();
+    return OKAY;
   }
 
   const Game &GetGame(void) const override
@@ -120,10 +145,11 @@ public:
     return OKAY;
   }
 
-  void AttachRenderers(CRender2D *render2D, IRender3D *render3D) override
+  void AttachRenderers(CRender2D *render2D, IRender3D *render3D, SuperAA *superAA) override
   {
     m_tileGen.AttachRenderer(render2D);
     m_real3D.AttachRenderer(render3D);
+    m_superAA = superAA;
   }
 
   void AttachInputs(CInputs *InputsPtr) override
@@ -157,6 +183,7 @@ public:
 
   CModel3GraphicsState(const Util::Config::Node &config, const std::string &filePath)
     : m_stateFilePath(filePath),
+      m_superAA(nullptr),
       m_tileGen(config),
       m_real3D(config)
   {
@@ -167,7 +194,8 @@ public:
   }
 
 private:
-  const std::string         m_stateFilePath;
+  std::string               m_stateFilePath;
+  SuperAA                   *m_superAA;
   std::shared_ptr<uint8_t>  m_vrom;
   Game                      m_game;
   CIRQ                      m_irq;
@@ -46,7 +46,11 @@
 #include "Supermodel.h"
 #include "JTAG.h"
 #include "CPU/PowerPC/ppc.h"
+#include "OSD/Thread.h"
 #include "Util/BMPFile.h"
+#include "Util/Format.h"
+#include "Util/MemoryArena.h"
+#include "Util/WriteWatch.h"
 #include <cstring>
 #include <algorithm>
 
@@ -84,6 +88,7 @@ static void UpdateRenderConfig(IRender3D *Render3D, uint64_t internalRenderConfi
 
 void CReal3D::SaveState(CBlockFile *SaveState)
 {
+  WaitForTextureJobs();
   SaveState->NewBlock("Real3D", __FILE__);
 
   SaveState->Write(memoryPool, MEM_POOL_SIZE_RW); // Don't write out read-only snapshots or dirty page arrays
@@ -119,12 +124,15 @@ void CReal3D::LoadState(CBlockFile *SaveState)
     return;
   }
 
+  WaitForTextureJobs();
+  m_writeWatch.Unprotect(); // the whole snapshot is copied below
   SaveState->Read(memoryPool, MEM_POOL_SIZE_RW);
 
   // If multi-threaded, update read-only snapshots too
   if (m_gpuMultiThreaded)
     UpdateSnapshots(true);
   Render3D->UploadTextures(0, 0, 0, 2048, 2048);
+  ClearTextureResidency();
   SaveState->Read(&fifoIdx, sizeof(fifoIdx));
   SaveState->Read(&m_vromTextureFIFO, sizeof(m_vromTextureFIFO));
 
@@ -182,8 +190,17 @@ uint32_t CReal3D::SyncSnapshots(void)
   commandPortWrittenRO = commandPortWritten;
   commandPortWritten = false;
 
+  // Texture uploads handed to the worker threads must be in texture RAM first
+  WaitForTextureJobs();
+
   if (!m_gpuMultiThreaded)
+  {
+    // Only uploads done by the worker threads are queued here
+    for (const auto &it : queuedUploadTextures)
+      Render3D->UploadTextures(it.level, it.x, it.y, it.width, it.height);
+    queuedUploadTextures.clear();
     return 0;
+  }
 
   // Update read-only queue
   queuedUploadTexturesRO = queuedUploadTextures;
@@ -242,6 +259,7 @@ uint32_t CReal3D::UpdateSnapshot(bool copyWhole, uint8_t *src, uint8_t *dst, uns
 uint32_t CReal3D::UpdateSnapshots(bool copyWhole)
 {
   // Update all memory region snapshots
+  m_writeWatch.Update();
   uint32_t cullLoCopied  = UpdateSnapshot(copyWhole, (uint8_t*)cullingRAMLo, (uint8_t*)cullingRAMLoRO, 0x400000, cullingRAMLoDirty);
   uint32_t cullHiCopied  = UpdateSnapshot(copyWhole, (uint8_t*)cullingRAMHi, (uint8_t*)cullingRAMHiRO, 0x100000, cullingRAMHiDirty);
   uint32_t polyCopied    = UpdateSnapshot(copyWhole, (uint8_t*)polyRAM,      (uint8_t*)polyRAMRO,      0x400000, polyRAMDirty);
@@ -338,7 +356,7 @@ static const unsigned decode8x1[8] =
   6
 };
 
-void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigned width, unsigned height, const uint16_t *texData, bool sixteenBit, bool writeLSB, bool writeMSB, uint32_t &texDataOffset)
+void CReal3D::StoreTexture(unsigned xPos, unsigned yPos, unsigned width, unsigned height, const uint16_t *texData, bool sixteenBit, bool writeLSB, bool writeMSB, bool markDirty, uint32_t &texDataOffset)
 {
   uint32_t tileX = (std::min)(8u, width);
   uint32_t tileY = (std::min)(8u, height);
@@ -358,7 +376,7 @@ void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigne
         {
           for (uint32_t xx = 0; xx < tileX; xx++)
           {
-            if (m_gpuMultiThreaded)
+            if (markDirty)
               MARK_DIRTY(textureRAMDirty, destOffset * 2);
             if (tileX == 1) texData -= tileY;
             if (tileY == 1) texData -= tileX;
@@ -404,7 +422,7 @@ void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigne
           for (uint32_t xx = 0; xx < tileX; xx++)
           {
             if (writeLSB | writeMSB) {
-              if (m_gpuMultiThreaded)
+              if (markDirty)
                 MARK_DIRTY(textureRAMDirty, destOffset * 2);
               textureRAM[destOffset] &= byteMask[byteSelect];
               const uint8_t shift = (8 * ((xx & 1) ^ 1));
@@ -433,7 +451,10 @@ void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigne
       }
     }
   }
+}
 
+void CReal3D::SignalTextureUpload(unsigned level, unsigned xPos, unsigned yPos, unsigned width, unsigned height)
+{
   // Signal to renderer that textures have changed
   // TO-DO: mipmaps? What if a game writes non-mipmap textures to mipmap area?
   if (m_gpuMultiThreaded)
@@ -468,51 +489,354 @@ xxxxxxxx -------- -------- -------- Texture type:
                                       0x80 = possibly gamma table
 */
 
-// Texture data will be in little endian format
-void CReal3D::UploadTexture(uint32_t header, const uint16_t *texData)
+// Calls func(level, x, y, width, height) for each mipmap level written by a
+// texture upload, in the order their texels appear in the texture data
+template <typename Func>
+static void ForEachTextureLevel(uint32_t header, Func func)
 {
   // Position: texture RAM is arranged as 2 2048x1024 texel sheets
-  uint32_t x              = 32 * (header & 0x3F);
-  uint32_t y              = 32 * ((header >> 7) & 0x1F);
-  uint32_t page           = (header >> 20) & 1;
-  uint32_t width          = 32 << ((header >> 14) & 7);
-  uint32_t height         = 32 << ((header >> 17) & 7);
-  uint32_t type           = (header >> 24) & 0xFF;
-  bool     sixteenBit     = (header >> 23) & 0x1;
-  bool     writeUpperByte = (header >> 22) & 0x1;
-  bool     writeLowerByte = (header >> 21) & 0x1;
-  uint32_t offset         = 0;
-
-  switch (type)
+  unsigned x      = 32 * (header & 0x3F);
+  unsigned y      = 32 * ((header >> 7) & 0x1F);
+  unsigned page   = (header >> 20) & 1;
+  unsigned width  = 32 << ((header >> 14) & 7);
+  unsigned height = 32 << ((header >> 17) & 7);
+  unsigned type   = (header >> 24) & 0xFF;
+
+  if (type == 0x00 || type == 0x01)   // texture w/ or w/out mipmaps
+    func(0, x, y + page * 1024, width, height);
+  if (type == 0x00 || type == 0x02)   // mipmaps
   {
-  case 0x00:  // texture w/ mipmaps
-  case 0x01:  // texture w/out mipmaps
-    StoreTexture(0, x, y + (page * 1024), width, height, texData, sixteenBit, writeLowerByte, writeUpperByte, offset);
-    texData += offset;
-    if (type == 0x01) {
-      break;
+    for (int i = 1; width > 0 && height > 0; i++)
+    {
+      width /= 2;
+      height /= 2;
+      func(i, mipXBase[i] + x / mipDivisor[i], mipYBase[i] + y / mipDivisor[i] + page * 1024, width, height);
     }
-  case 0x02:  // mipmaps only
+  }
+}
+
+// Number of 32-bit words of texture data read by an upload
+static uint32_t TextureDataWords(uint32_t header)
+{
+  bool sixteenBit = (header >> 23) & 0x1;
+  uint32_t count = 0; // 16-bit words
+  ForEachTextureLevel(header, [&](unsigned level, unsigned x, unsigned y, unsigned width, unsigned height)
   {
-    for (int i = 1; width > 0 && height > 0; i++) {
+    if (width == 0 || height == 0)
+      return;
+    unsigned tileX = (std::min)(8u, width);
+    unsigned tileY = (std::min)(8u, height);
+    count += sixteenBit ? width * height : (width / tileX) * (height / tileY) * (std::max)(1u, (tileX * tileY) / 2);
+  });
+  return (count + 1) / 2;
+}
+
+/*
+ * VROM texture residency
+ *
+ * Games upload the same VROM textures to the same place over and over again.
+ * The texels an upload writes depend only on its header and source data, and
+ * VROM never changes, so an upload from VROM whose texels have not been
+ * touched by any other upload since it was last done would write exactly what
+ * is already there. Such uploads are skipped, saving both the un-swizzling
+ * here and the texture upload on the render side.
+ *
+ * Each resident texture keeps the texture RAM rectangles (all mipmap levels)
+ * and byte lanes it wrote. Any other upload evicts the resident textures it
+ * overlaps. A 64x64 texel grid of the resident textures touching each cell
+ * keeps this from having to look at all of them.
+ */
 
-      int xPos = mipXBase[i] + (x / mipDivisor[i]);
-      int yPos = mipYBase[i] + (y / mipDivisor[i]);
+static const unsigned TEXTURE_CELL_SHIFT = 6;
+static const unsigned TEXTURE_CELLS_PER_ROW = 2048 >> TEXTURE_CELL_SHIFT;
 
-      width /= 2;
-      height /= 2;
+static uint64_t VROMTextureKey(uint32_t addr, uint32_t header)
+{
+  return (uint64_t((addr & 0xFFFFFF) + 1) << 32) | header;  // never 0, which means "not from VROM"
+}
+
+static void GetTextureRects(std::vector<TextureRect> *rects, uint8_t *lanes, uint32_t header)
+{
+  rects->clear();
+  if ((header >> 23) & 1)
+    *lanes = 3;
+  else
+    *lanes = ((header >> 21) & 1) | (((header >> 22) & 1) << 1);
+  if (*lanes == 0)
+    return;
+
+  ForEachTextureLevel(header, [&](unsigned level, unsigned x, unsigned y, unsigned width, unsigned height)
+  {
+    if (width > 0 && height > 0)
+      rects->push_back({ x, y, width, height });
+  });
+}
+
+static bool RectsOverlap(const TextureRect &a, const TextureRect &b)
+{
+  return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
 
-      StoreTexture(i, xPos, yPos + (page * 1024), width, height, texData, sixteenBit, writeLowerByte, writeUpperByte, offset);
-      texData += offset;
+template <typename Func>
+static void ForEachTextureCell(const std::vector<TextureRect> &rects, Func func)
+{
+  for (auto &rect: rects)
+  {
+    if (rect.x > 2047 || rect.y > 2047)
+      continue;
+    unsigned x1 = (std::min)(rect.x + rect.width - 1, 2047u) >> TEXTURE_CELL_SHIFT;
+    unsigned y1 = (std::min)(rect.y + rect.height - 1, 2047u) >> TEXTURE_CELL_SHIFT;
+    for (unsigned cy = rect.y >> TEXTURE_CELL_SHIFT; cy <= y1; cy++)
+    {
+      for (unsigned cx = rect.x >> TEXTURE_CELL_SHIFT; cx <= x1; cx++)
+        func(cy * TEXTURE_CELLS_PER_ROW + cx);
     }
-    break;
   }
-  case 0x80:  // MAME thinks these might be a gamma table (vf3 uploads this as the first texture)
-    break;
-  default:  // unknown
+}
+
+void CReal3D::TrackTextureUpload(uint32_t header, uint64_t vromKey)
+{
+  std::vector<TextureRect> rects;
+  uint8_t lanes;
+  GetTextureRects(&rects, &lanes, header);
+
+  // Evict the resident textures this upload overwrites
+  std::vector<uint64_t> evicted;
+  ForEachTextureCell(rects, [&](unsigned cell)
+  {
+    for (uint64_t key: m_residentTextureCells[cell])
+    {
+      const ResidentTexture &resident = m_residentTextures[key];
+      if (!(resident.lanes & lanes) || std::find(evicted.begin(), evicted.end(), key) != evicted.end())
+        continue;
+      for (auto &a: resident.rects)
+      {
+        if (std::any_of(rects.begin(), rects.end(), [&](const TextureRect &b) { return RectsOverlap(a, b); }))
+        {
+          evicted.push_back(key);
+          break;
+        }
+      }
+    }
+  });
+  for (uint64_t key: evicted)
+  {
+    ForEachTextureCell(m_residentTextures[key].rects, [&](unsigned cell)
+    {
+      auto &keys = m_residentTextureCells[cell];
+      keys.erase(std::remove(keys.begin(), keys.end(), key), keys.end());
+    });
+    m_residentTextures.erase(key);
+  }
+
+  // Textures from VROM become resident
+  if (vromKey)
+  {
+    ForEachTextureCell(rects, [&](unsigned cell)
+    {
+      auto &keys = m_residentTextureCells[cell];
+      if (keys.empty() || keys.back() != vromKey)
+        keys.push_back(vromKey);
+    });
+    ResidentTexture &resident = m_residentTextures[vromKey];
+    resident.rects = std::move(rects);
+    resident.lanes = lanes;
+  }
+}
+
+void CReal3D::ClearTextureResidency(void)
+{
+  m_residentTextures.clear();
+  for (auto &keys: m_residentTextureCells)
+    keys.clear();
+  m_fifoVROMSources.clear();
+}
+
+// Writes all mipmap levels of a texture upload to texture RAM. If sync is
+// set, this is the PPC thread, which also marks the pages dirty and signals
+// the renderer.
+void CReal3D::StoreTextureLevels(uint32_t header, const uint16_t *texData, bool sync)
+{
+  bool sixteenBit     = (header >> 23) & 0x1;
+  bool writeUpperByte = (header >> 22) & 0x1;
+  bool writeLowerByte = (header >> 21) & 0x1;
+
+  ForEachTextureLevel(header, [&](unsigned level, unsigned x, unsigned y, unsigned width, unsigned height)
+  {
+    uint32_t offset = 0;
+    StoreTexture(x, y, width, height, texData, sixteenBit, writeLowerByte, writeUpperByte, sync && m_markDirty, offset);
+    texData += offset;
+    if (sync)
+      SignalTextureUpload(level, x, y, width, height);
+  });
+}
+
+// Texture data will be in little endian format. vromKey identifies textures
+// uploaded straight from VROM, 0 otherwise. Data in the texture FIFO must be
+// passed in a copy (buffer) when the worker threads are running.
+void CReal3D::UploadTexture(uint32_t header, const uint16_t *texData, uint64_t vromKey, const TextureBuffer &buffer)
+{
+  if (vromKey && m_residentTextures.count(vromKey))
+    return; // already in texture RAM, unchanged
+  TrackTextureUpload(header, vromKey);
+
+  uint32_t type = (header >> 24) & 0xFF;
+  if (type == 0x80)       // MAME thinks these might be a gamma table (vf3 uploads this as the first texture)
+    return;
+  else if (type > 0x02)   // unknown
+  {
     DebugLog("Unknown texture format %02X\n", type);
-    break;
+    return;
+  }
+
+  if (m_textureWorkers.empty())
+    StoreTextureLevels(header, texData, true);
+  else
+    QueueTextureJob(header, texData, buffer);
+}
+
+
+/******************************************************************************
+ Texture Worker Threads
+
+ Texture uploads can be un-swizzled into texture RAM by a pool of worker
+ threads instead of the PPC thread. The PPC thread marks the pages dirty and
+ queues the renderer upload up front; nothing reads texture RAM before
+ SyncSnapshots(), save states and reset, which wait for the jobs to finish.
+ Overlapping uploads are written in order.
+******************************************************************************/
+
+bool CReal3D::StartTextureWorkers(unsigned numThreads)
+{
+  m_textureWorkersQuit = false;
+  m_textureJobLock = CThread::CreateMutex();
+  m_textureJobReady = CThread::CreateCondVar();
+  m_textureJobsDone = CThread::CreateCondVar();
+  if (m_textureJobLock && m_textureJobReady && m_textureJobsDone)
+  {
+    for (unsigned i = 0; i < numThreads; i++)
+    {
+      CThread *thread = CThread::CreateThread(Util::Format() << "Texture" << i, TextureWorkerThread, this);
+      if (!thread)
+        break;
+      m_textureWorkers.push_back(thread);
+    }
+  }
+  if (m_textureWorkers.size() == numThreads)
+    return OKAY;
+  ErrorLog("Unable to create texture worker threads: %s", CThread::GetLastError());
+  StopTextureWorkers();
+  return FAIL;
+}
+
+void CReal3D::StopTextureWorkers(void)
+{
+  if (!m_textureWorkers.empty())
+  {
+    WaitForTextureJobs();
+    m_textureJobLock->Lock();
+    m_textureWorkersQuit = true;
+    m_textureJobReady->SignalAll();
+    m_textureJobLock->Unlock();
+    for (CThread *thread: m_textureWorkers)
+    {
+      thread->Wait();
+      delete thread;
+    }
+    m_textureWorkers.clear();
+  }
+  delete m_textureJobLock;
+  delete m_textureJobReady;
+  delete m_textureJobsDone;
+  m_textureJobLock = NULL;
+  m_textureJobReady = NULL;
+  m_textureJobsDone = NULL;
+  m_textureJobs.clear();
+}
+
+void CReal3D::QueueTextureJob(uint32_t header, const uint16_t *texData, const TextureBuffer &buffer)
+{
+  TextureJob job;
+  job.header = header;
+  job.texData = texData;
+  job.buffer = buffer;
+  job.running = false;
+
+  // Texture RAM pages are one 2048-texel row each
+  ForEachTextureLevel(header, [&](unsigned level, unsigned x, unsigned y, unsigned width, unsigned height)
+  {
+    if (m_gpuMultiThreaded)
+    {
+      for (unsigned row = y; row < (std::min)(y + height, 2048u); row++)
+        MARK_DIRTY(textureRAMDirty, row * 2048 * 2);
+    }
+    queuedUploadTextures.push_back({ level, x, y, width, height });
+    if (width > 0 && height > 0)
+      job.rects.push_back({ x, y, width, height });
+  });
+
+  m_textureJobLock->Lock();
+  m_textureJobs.push_back(std::move(job));
+  m_textureJobReady->Signal();
+  m_textureJobLock->Unlock();
+}
+
+void CReal3D::WaitForTextureJobs(void)
+{
+  if (m_textureWorkers.empty())
+    return;
+  m_textureJobLock->Lock();
+  while (!m_textureJobs.empty())
+    m_textureJobsDone->Wait(m_textureJobLock);
+  m_textureJobLock->Unlock();
+}
+
+int CReal3D::TextureWorkerThread(void *param)
+{
+  CReal3D *self = (CReal3D *) param;
+  auto &jobs = self->m_textureJobs;
+
+  self->m_textureJobLock->Lock();
+  while (!self->m_textureWorkersQuit)
+  {
+    // Find the first job that doesn't overlap any job ahead of it
+    auto job = jobs.begin();
+    for (; job != jobs.end(); ++job)
+    {
+      if (job->running)
+        continue;
+      bool blocked = std::any_of(jobs.begin(), job, [&](const TextureJob &ahead)
+      {
+        for (auto &a: ahead.rects)
+        {
+          if (std::any_of(job->rects.begin(), job->rects.end(), [&](const TextureRect &b) { return RectsOverlap(a, b); }))
+            return true;
+        }
+        return false;
+      });
+      if (!blocked)
+        break;
+    }
+    if (job == jobs.end())
+    {
+      self->m_textureJobReady->Wait(self->m_textureJobLock);
+      continue;
+    }
+
+    job->running = true;
+    self->m_textureJobLock->Unlock();
+    self->StoreTextureLevels(job->header, job->texData, false);
+    self->m_textureJobLock->Lock();
+    jobs.erase(job);
+
+    // This may have unblocked other jobs
+    if (jobs.empty())
+      self->m_textureJobsDone->SignalAll();
+    else
+      self->m_textureJobReady->SignalAll();
   }
+  self->m_textureJobLock->Unlock();
+  return 0;
 }
 
 
@@ -659,12 +983,36 @@ void CReal3D::Flush(void)
   // Upload textures (if any)
   if (fifoIdx > 2) // If the texture header/data aren't present, discard the texture (prevents garbage textures in Ski Champ)
   {
+    // Worker threads need a copy: the FIFO is refilled as soon as this
+    // returns. A texture may read past the data written for it, so copy as
+    // far as the largest one reaches.
+    TextureBuffer buffer;
+    const uint32_t *fifo = textureFIFO;
+    if (!m_textureWorkers.empty())
+    {
+      size_t words = fifoIdx;
+      for (uint32_t i = 0, size; i < fifoIdx - 2 && (size = (2+textureFIFO[i+0]/2) / 4) != 0; i += size)
+        words = (std::max)(words, size_t(i + 2 + TextureDataWords(textureFIFO[i+1])));
+      auto copy = std::make_shared<std::vector<uint32_t>>(words, 0);
+      memcpy(copy->data(), textureFIFO, (std::min)(words, size_t(0x100000/4)) * sizeof(uint32_t));
+      buffer = copy;
+      fifo = copy->data();
+    }
+
+    size_t source = 0;
     for (uint32_t i = 0; i < fifoIdx - 2; )
     {
       uint32_t size = 2+textureFIFO[i+0]/2;
       size /= 4;
       uint32_t header = textureFIFO[i+1]; // texture information header
 
+      // Was it copied in from VROM?
+      uint64_t vromKey = 0;
+      while (source < m_fifoVROMSources.size() && m_fifoVROMSources[source].first < i)
+        source++;
+      if (source < m_fifoVROMSources.size() && m_fifoVROMSources[source].first == i)
+        vromKey = VROMTextureKey(m_fifoVROMSources[source].second, header);
+
       // Spikeout seems to be uploading 0 length textures
       if (0 == size)
       {
@@ -672,7 +1020,7 @@ void CReal3D::Flush(void)
         break;
       }
 
-      UploadTexture(header,(uint16_t *)&textureFIFO[i+2]);
+      UploadTexture(header, (const uint16_t *) &fifo[i+2], vromKey, buffer);
       DebugLog("Real3D: Texture upload completed: %X bytes (%X)\n", size*4, textureFIFO[i+0]);
 
       i += size;
@@ -681,6 +1029,7 @@ void CReal3D::Flush(void)
 
   // Reset texture FIFO
   fifoIdx = 0;
+  m_fifoVROMSources.clear();
 }
 
 void CReal3D::WriteTextureFIFO(uint32_t data)
@@ -706,6 +1055,14 @@ void CReal3D::WriteTexturePort(unsigned reg, uint32_t data)
       DebugLog("Real3D: 0-length VROM texture upload @ PC=%08X (%08X)\n", ppc_get_pc(), data);
       return;
     }
+
+    // With nothing queued ahead of it, a resident texture needn't even be
+    // copied into the FIFO
+    uint64_t vromKey = VROMTextureKey(addr, vrom[(addr + 1) & 0xFFFFFF]);
+    if (fifoIdx == 0 && m_residentTextures.count(vromKey))
+      return;
+
+    m_fifoVROMSources.emplace_back(fifoIdx, addr);
     for (uint32_t i = 0; i < num_words; i++)
       WriteTextureFIFO(vrom[(addr + i) & 0xFFFFFF]);
   }
@@ -715,7 +1072,7 @@ void CReal3D::WriteTexturePort(unsigned reg, uint32_t data)
     {
       uint32_t addr = m_vromTextureFIFO[0];
       uint32_t header = m_vromTextureFIFO[1];
-      UploadTexture(header, (const uint16_t *) &vrom[addr & 0xFFFFFF]);
+      UploadTexture(header, (const uint16_t *) &vrom[addr & 0xFFFFFF], VROMTextureKey(addr, header));
       m_vromTextureFIFOIdx = 0;
     }
     else
@@ -725,21 +1082,21 @@ void CReal3D::WriteTexturePort(unsigned reg, uint32_t data)
 
 void CReal3D::WriteLowCullingRAM(uint32_t addr, uint32_t data)
 {
-  if (m_gpuMultiThreaded)
+  if (m_markDirty)
     MARK_DIRTY(cullingRAMLoDirty, addr);
   cullingRAMLo[addr/4] = data;
 }
 
 void CReal3D::WriteHighCullingRAM(uint32_t addr, uint32_t data)
 {
-  if (m_gpuMultiThreaded)
+  if (m_markDirty)
     MARK_DIRTY(cullingRAMHiDirty, addr);
   cullingRAMHi[addr/4] = data;
 }
 
 void CReal3D::WritePolygonRAM(uint32_t addr, uint32_t data)
 {
-  if (m_gpuMultiThreaded)
+  if (m_markDirty)
     MARK_DIRTY(polyRAMDirty, addr);
   polyRAM[addr/4] = data;
 }
@@ -862,6 +1219,7 @@ void CReal3D::WritePCIConfigSpace(unsigned device, unsigned reg, unsigned bits,
 
 void CReal3D::Reset(void)
 {
+  WaitForTextureJobs();
   error = false;
 
   m_pingPong = 0;
@@ -873,6 +1231,7 @@ void CReal3D::Reset(void)
 
   fifoIdx = 0;
   m_vromTextureFIFOIdx = 0;
+  ClearTextureResidency();
 
   dmaSrc = 0;
   dmaDest = 0;
@@ -883,7 +1242,9 @@ void CReal3D::Reset(void)
   dmaConfig = 0;
 
   unsigned memSize = (m_gpuMultiThreaded ? MEMORY_POOL_SIZE : MEM_POOL_SIZE_RW);
+  m_writeWatch.Unprotect(); // snapshots and dirty pages are cleared too
   memset(memoryPool, 0, memSize);
+  m_writeWatch.Update();
   memset(m_vromTextureFIFO, 0, sizeof(m_vromTextureFIFO));
   memset(m_internalRenderConfig, 0, sizeof(m_internalRenderConfig));
 
@@ -980,9 +1341,10 @@ bool CReal3D::Init(const uint8_t *vromPtr, IBus *BusObjectPtr, CIRQ *IRQObjectPt
   Bus = BusObjectPtr;
   IRQ = IRQObjectPtr;
   dmaIRQ = dmaIRQBit;
+  m_residentTextureCells.resize(TEXTURE_CELLS_PER_ROW * TEXTURE_CELLS_PER_ROW);
 
-  // Allocate all Real3D RAM regions
-  memoryPool = new(std::nothrow) uint8_t[memSize];
+  // Allocate all Real3D RAM regions (in small pages if they are to be write protected)
+  memoryPool = Util::MemoryArena::Allocate("Real3D", memSize, m_writeProtect ? Util::MemoryArena::SMALL_PAGES : 0);
   if (NULL == memoryPool)
     return ErrorLog("Insufficient memory for Real3D object (needs %1.1f MB).", memSizeMB);
 
@@ -1006,6 +1368,29 @@ bool CReal3D::Init(const uint8_t *vromPtr, IBus *BusObjectPtr, CIRQ *IRQObjectPt
     textureRAMDirty = (uint8_t *) &memoryPool[OFFSET_TEXRAM_DIRTY];
   }
 
+  // Texture uploads are un-swizzled by worker threads if requested (falls
+  // back to the PPC thread if they can't be created)
+  if (m_textureThreads > 0 && OKAY == StartTextureWorkers(m_textureThreads))
+    InfoLog("Un-swizzling textures with %u worker threads.", m_textureThreads);
+
+  // Track dirty pages by write protection instead of on every write. Texture
+  // RAM written by the worker threads is marked dirty when uploads are queued.
+  m_markDirty = m_gpuMultiThreaded;
+  if (m_writeProtect)
+  {
+    if (OKAY == m_writeWatch.Watch((uint8_t *) cullingRAMLo, 0x400000, cullingRAMLoDirty, PAGE_WIDTH) &&
+        OKAY == m_writeWatch.Watch((uint8_t *) cullingRAMHi, 0x100000, cullingRAMHiDirty, PAGE_WIDTH) &&
+        OKAY == m_writeWatch.Watch((uint8_t *) polyRAM,      0x400000, polyRAMDirty,      PAGE_WIDTH) &&
+        (!m_textureWorkers.empty() ||
+         OKAY == m_writeWatch.Watch((uint8_t *) textureRAM,  0x800000, textureRAMDirty,   PAGE_WIDTH)))
+    {
+      m_markDirty = false;
+      InfoLog("Tracking Real3D memory writes with %s.", Util::WriteWatch::GetMethod());
+    }
+    else
+      m_writeWatch.Unwatch();
+  }
+
   // VROM pointer passed to us
   vrom = (uint32_t *) vromPtr;
 
@@ -1015,7 +1400,14 @@ bool CReal3D::Init(const uint8_t *vromPtr, IBus *BusObjectPtr, CIRQ *IRQObjectPt
 
 CReal3D::CReal3D(const Util::Config::Node &config)
   : m_config(config),
-    m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>())
+    m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>()),
+    m_writeProtect(m_gpuMultiThreaded && Util::WriteWatch::IsSupported() && config["GPUDirtyTracking"].ValueAsDefault<std::string>("software") == "hardware"),
+    m_textureThreads(config["TextureThreads"].ValueAsDefault<unsigned>(0)),
+    m_markDirty(m_gpuMultiThreaded),
+    m_textureJobLock(NULL),
+    m_textureJobReady(NULL),
+    m_textureJobsDone(NULL),
+    m_textureWorkersQuit(false)
 {
   Render3D = NULL;
   memoryPool = NULL;
@@ -1042,6 +1434,8 @@ CReal3D::CReal3D(const Util::Config::Node &config)
  */
 CReal3D::~CReal3D(void)
 {
+  StopTextureWorkers();
+
   // Dump memory
 #if 0
   FILE  *fp;
@@ -1115,9 +1509,10 @@ CReal3D::~CReal3D(void)
   }
 
   Render3D = NULL;
+  m_writeWatch.Unwatch();
   if (memoryPool != NULL)
   {
-    delete [] memoryPool;
+    Util::MemoryArena::Free(memoryPool);
     memoryPool = NULL;
   }
   cullingRAMLo = NULL;
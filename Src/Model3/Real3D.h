@@ -34,9 +34,18 @@
 #include "CPU/Bus.h"
 #include "Graphics/IRender3D.h"
 #include "Util/NewConfig.h"
+#include "Util/WriteWatch.h"
 
 #include <cstdint>
+#include <list>
+#include <memory>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+class CThread;
+class CMutex;
+class CCondVar;
 
 /* 
  * QueuedUploadTextures:
@@ -54,6 +63,20 @@ struct QueuedUploadTextures
   unsigned height;
 };
 
+/*
+ * TextureRect:
+ *
+ * Rectangle of texels in texture RAM (2048x2048, the second page starting at
+ * y = 1024).
+ */
+struct TextureRect
+{
+  unsigned x;
+  unsigned y;
+  unsigned width;
+  unsigned height;
+};
+
 /*
  * CReal3D:
  *
@@ -427,15 +450,29 @@ public:
 private:
   // Private member functions
   void      DMACopy(void);
-  void      StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigned width, unsigned height, const uint16_t *texData, bool sixteenBit, bool writeLSB, bool writeMSB, uint32_t &texDataOffset);
+  typedef std::shared_ptr<const std::vector<uint32_t>> TextureBuffer;
 
-  void      UploadTexture(uint32_t header, const uint16_t *texData);
+  void      StoreTexture(unsigned xPos, unsigned yPos, unsigned width, unsigned height, const uint16_t *texData, bool sixteenBit, bool writeLSB, bool writeMSB, bool markDirty, uint32_t &texDataOffset);
+  void      StoreTextureLevels(uint32_t header, const uint16_t *texData, bool sync);
+  void      SignalTextureUpload(unsigned level, unsigned xPos, unsigned yPos, unsigned width, unsigned height);
+  void      UploadTexture(uint32_t header, const uint16_t *texData, uint64_t vromKey = 0, const TextureBuffer &buffer = TextureBuffer());
+  bool      StartTextureWorkers(unsigned numThreads);
+  void      StopTextureWorkers(void);
+  void      QueueTextureJob(uint32_t header, const uint16_t *texData, const TextureBuffer &buffer);
+  void      WaitForTextureJobs(void);
+  static int TextureWorkerThread(void *param);
+  void      TrackTextureUpload(uint32_t header, uint64_t vromKey);
+  void      ClearTextureResidency(void);
   uint32_t  UpdateSnapshots(bool copyWhole);
   uint32_t  UpdateSnapshot(bool copyWhole, uint8_t *src, uint8_t *dst, unsigned size, uint8_t *dirty);
 
   // Config 
   const Util::Config::Node &m_config;
   const bool                m_gpuMultiThreaded;
+  const bool                m_writeProtect;   // track dirty pages with m_writeWatch (GPUDirtyTracking=hardware)
+  const unsigned            m_textureThreads; // worker threads un-swizzling texture uploads (0 = done in the PPC thread)
+  bool                      m_markDirty;      // mark dirty pages on each write
+  Util::WriteWatch          m_writeWatch;
 
   // Renderer attached to the Real3D
   IRender3D *Render3D;
@@ -458,6 +495,36 @@ private:
   uint32_t  fifoIdx;            // index into texture FIFO
   uint32_t  m_vromTextureFIFO[2];
   uint32_t  m_vromTextureFIFOIdx;
+
+  // VROM texture residency: textures uploaded from VROM, keyed by VROM address
+  // and header, whose texels have not been overwritten since. Uploading one of
+  // them again changes nothing and is skipped.
+  struct ResidentTexture
+  {
+    std::vector<TextureRect> rects;
+    uint8_t lanes;                                          // bytes of each texel written (bit 0 = LSB, bit 1 = MSB)
+  };
+  std::unordered_map<uint64_t, ResidentTexture> m_residentTextures;
+  std::vector<std::vector<uint64_t>> m_residentTextureCells;   // resident textures touching each 64x64 texel cell
+  std::vector<std::pair<uint32_t, uint32_t>> m_fifoVROMSources; // FIFO index and VROM address of textures copied in from VROM (Step 1.0)
+
+  // Texture uploads waiting for or being written to texture RAM by the worker
+  // threads, in the order the PPC made them. A job is only started once no
+  // earlier job overlaps it.
+  struct TextureJob
+  {
+    uint32_t header;
+    const uint16_t *texData;
+    TextureBuffer buffer;                                   // copy of the texture FIFO texData points into (null for VROM)
+    std::vector<TextureRect> rects;
+    bool running;
+  };
+  std::vector<CThread *> m_textureWorkers;
+  CMutex    *m_textureJobLock;
+  CCondVar  *m_textureJobReady;
+  CCondVar  *m_textureJobsDone;
+  std::list<TextureJob> m_textureJobs;
+  bool      m_textureWorkersQuit;
   
   // Read-only snapshots
   uint32_t  *cullingRAMLoRO;    // 4MB of culling RAM at 8C000000 [read-only snapshot]
@@ -59,6 +59,7 @@
 #include "Supermodel.h"
 #include "OSD/Audio.h"
 #include "Sound/SCSP.h"
+#include "Util/MemoryArena.h"
 
 // DEBUG
 //#define SUPERMODEL_LOG_AUDIO	// define this to log all audio to sound.bin
@@ -89,6 +90,10 @@ void CSoundBoard::UpdateROMBanks(void)
 		sampleBank = &sampleROM[0x800000];
 	else
 		sampleBank = &sampleROM[0x000000];
+		
+	// Sample ROM bank: 800000-FFFFFF
+	for (int page = 0x80; page <= 0xFF; page++)
+		memMap.read[page] = &sampleBank[(page<<16)&0x7FFFFF];
 }
 
 UINT8 CSoundBoard::Read8(UINT32 a)
@@ -339,6 +344,18 @@ int SCSP68KRunCallback(int numCycles)
 	return M68KRun(numCycles) - numCycles;
 }
 
+// SCSP callback for determining how far into its timeslice the 68K is
+int SCSP68KCyclesCallback(void)
+{
+	return M68KGetCyclesRun();
+}
+
+// SCSP callback for ending the 68K timeslice early
+void SCSP68KEndCallback(void)
+{
+	M68KEndTimeslice();
+}
+
 
 /******************************************************************************
  Sound Board Interface
@@ -405,8 +422,8 @@ bool CSoundBoard::RunFrame(void)
 			DSB->RunFrame(audioRL, audioRR);
 	}
 
-	// Output the audio buffers
-	bool bufferFull = OutputAudio(NUM_SAMPLES_PER_FRAME, audioFL, audioFR, audioRL, audioRR, m_config["FlipStereo"].ValueAs<bool>());
+	// Output the audio buffers (a muted frame counts as filling them)
+	bool bufferFull = m_mute || OutputAudio(NUM_SAMPLES_PER_FRAME, audioFL, audioFR, audioRL, audioRR, m_config["FlipStereo"].ValueAs<bool>());
 
 #ifdef SUPERMODEL_LOG_AUDIO
 	// Output to binary file
@@ -506,10 +523,9 @@ bool CSoundBoard::Init(const UINT8 *soundROMPtr, const UINT8 *sampleROMPtr)
 	UpdateROMBanks();
 
 	// Allocate all memory for RAM
-	memoryPool = new(std::nothrow) UINT8[MEMORY_POOL_SIZE];
+	memoryPool = Util::MemoryArena::Allocate("Sound board", MEMORY_POOL_SIZE);	// zero filled
 	if (NULL == memoryPool)
 		return ErrorLog("Insufficient memory for sound board (needs %1.1f MB).", memSizeMB);
-	memset(memoryPool, 0, MEMORY_POOL_SIZE);
 	
 	// Set up memory pointers
 	ram1 = &memoryPool[OFFSET_RAM1];
@@ -518,17 +534,33 @@ bool CSoundBoard::Init(const UINT8 *soundROMPtr, const UINT8 *sampleROMPtr)
 	audioFR = (float*)&memoryPool[OFFSET_AUDIO_FRONTRIGHT];
 	audioRL = (float*)&memoryPool[OFFSET_AUDIO_REARLEFT];
 	audioRR = (float*)&memoryPool[OFFSET_AUDIO_REARRIGHT];
+	
+	// Direct-access pages (mirrors must match the Read/Write handlers above)
+	for (int page = 0x00; page <= 0x0F; page++)	// SCSP RAM 1: 000000-0FFFFF
+	{
+		memMap.read[page] = &ram1[page<<16];
+		memMap.write[page] = &ram1[page<<16];
+	}
+	for (int page = 0x20; page <= 0x2F; page++)	// SCSP RAM 2: 200000-2FFFFF
+	{
+		memMap.read[page] = &ram2[(page<<16)&0x0FFFFF];
+		memMap.write[page] = &ram2[(page<<16)&0x0FFFFF];
+	}
+	for (int page = 0x60; page <= 0x6F; page++)	// program ROM: 600000-6FFFFF (mirrored)
+		memMap.read[page] = &soundROM[(page<<16)&0x07FFFF];
 
 	// Initialize 68K core
 	M68KSetContext(&M68K);
 	M68KInit();
 	M68KAttachBus(this);
+	M68KAttachMemoryMap(&memMap);
+	M68KSetIdleSkip(m_config["SoundIdleSkip"].ValueAsDefault<bool>(true));
 	M68KSetIRQCallback(IRQAck);
 	M68KGetContext(&M68K);
 		
 	// Initialize SCSPs
 	SCSP_SetBuffers(audioFL, audioFR, audioRL, audioRR, NUM_SAMPLES_PER_FRAME);
-	SCSP_SetCB(SCSP68KRunCallback, SCSP68KIRQCallback);
+	SCSP_SetCB(SCSP68KRunCallback, SCSP68KIRQCallback, SCSP68KCyclesCallback, SCSP68KEndCallback);
 	if (OKAY != SCSP_Init(m_config, 2))
 		return FAIL;
 	SCSP_SetRAM(0, ram1);
@@ -554,6 +586,11 @@ CDSB *CSoundBoard::GetDSB(void)
 	return DSB;
 }
 
+void CSoundBoard::SetMute(bool mute)
+{
+	m_mute = mute;
+}
+
 CSoundBoard::CSoundBoard(const Util::Config::Node &config)
   : m_config(config)
 {
@@ -567,6 +604,7 @@ CSoundBoard::CSoundBoard(const Util::Config::Node &config)
 	audioRR = NULL;
 	soundROM = NULL;
 	sampleROM = NULL;
+	m_mute = false;
 	
 	DebugLog("Built Sound Board\n");
 }
@@ -584,7 +622,7 @@ CSoundBoard::~CSoundBoard(void)
 	
 	if (memoryPool != NULL)
 	{
-		delete [] memoryPool;
+		Util::MemoryArena::Free(memoryPool);
 		memoryPool = NULL;
 	}
 	ram1 = NULL;
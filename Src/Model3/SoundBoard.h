@@ -111,6 +111,17 @@ public:
 	 * Runs the sound board for one frame, updating sound in the process.
 	 */
 	bool RunFrame(void);
+
+	/*
+	 * SetMute(mute):
+	 *
+	 * Stops RunFrame() from outputting audio, for frames that are being run
+	 * a second time. The sound board is emulated as usual.
+	 *
+	 * Parameters:
+	 *		mute	True to discard the audio generated.
+	 */
+	void SetMute(bool mute);
 	
 	/*
 	 * Reset(void):
@@ -191,6 +202,7 @@ private:
 	
 	// 68K context
 	M68KCtx		M68K;
+	M68KMemoryMap	memMap;		// direct-access pages for RAM and ROM
 	
 	// Sound board memory
 	const UINT8	*soundROM;		// 68K program ROM (passed in from parent object)
@@ -205,6 +217,7 @@ private:
 	// Audio
 	float* audioFL, * audioFR;	// left and right front audio channels (1/60th second, 44.1 KHz)
 	float* audioRL, * audioRR;	// left and right rear audio channels (1/60th second, 44.1 KHz)
+	bool	m_mute;				// audio is generated but not output
 };
 
 
@@ -55,6 +55,8 @@
 
 #include <cstring>
 #include "Supermodel.h"
+#include "Util/MemoryArena.h"
+#include "Util/WriteWatch.h"
 
 // Macros that divide memory regions into pages and mark them as dirty when they are written to
 #define PAGE_WIDTH 10
@@ -101,6 +103,7 @@ void CTileGen::LoadState(CBlockFile *SaveState)
 	}
 	
 	// Load memory one word at a time
+	m_writeWatch.Unprotect();	// the whole snapshot is copied below
 	for (int i = 0; i < 0x120000; i += 4)
 	{
 		UINT32 data;
@@ -199,6 +202,7 @@ UINT32 CTileGen::UpdateSnapshot(bool copyWhole, UINT8 *src, UINT8 *dst, unsigned
 UINT32 CTileGen::UpdateSnapshots(bool copyWhole)
 {
 	// Update all memory region snapshots
+	m_writeWatch.Update();
 	UINT32 palACopied  = UpdateSnapshot(copyWhole, (UINT8*)pal[0],  (UINT8*)palRO[0],  0x020000, palDirty[0]);
 	UINT32 palBCopied  = UpdateSnapshot(copyWhole, (UINT8*)pal[1],  (UINT8*)palRO[1],  0x020000, palDirty[1]);
 	UINT32 vramCopied = UpdateSnapshot(copyWhole, (UINT8*)vram, (UINT8*)vramRO, 0x120000, vramDirty);
@@ -248,7 +252,7 @@ UINT32 CTileGen::ReadRAM32(unsigned addr)
 
 void CTileGen::WriteRAM32(unsigned addr, UINT32 data)
 {
-	if (m_gpuMultiThreaded)
+	if (m_markDirty)
 		MARK_DIRTY(vramDirty, addr);
 	*(UINT32 *) &vram[addr] = data;
 }
@@ -327,7 +331,9 @@ void CTileGen::WriteRegister(unsigned reg, UINT32 data)
 void CTileGen::Reset(void)
 {
 	unsigned memSize = (m_gpuMultiThreaded ? MEMORY_POOL_SIZE : MEM_POOL_SIZE_RW);
+	m_writeWatch.Unprotect();	// snapshots and dirty pages are cleared too
 	memset(memoryPool, 0, memSize);
+	m_writeWatch.Update();
 	memset(regs, 0, sizeof(regs));
 	memset(regsRO, 0, sizeof(regsRO));
 
@@ -366,8 +372,8 @@ bool CTileGen::Init(CIRQ *IRQObjectPtr)
 	unsigned memSize   = (m_gpuMultiThreaded ? MEMORY_POOL_SIZE : MEM_POOL_SIZE_RW);
 	float	 memSizeMB = (float)memSize/(float)0x100000;
 	
-	// Allocate all memory for all TileGen RAM regions
-	memoryPool = new(std::nothrow) UINT8[memSize];
+	// Allocate all memory for all TileGen RAM regions (in small pages if they are to be write protected)
+	memoryPool = Util::MemoryArena::Allocate("Tile generator", memSize, m_writeProtect ? Util::MemoryArena::SMALL_PAGES : 0);
 	if (NULL == memoryPool)
 		return ErrorLog("Insufficient memory for tile generator object (needs %1.1f MB).", memSizeMB);
 	
@@ -387,6 +393,12 @@ bool CTileGen::Init(CIRQ *IRQObjectPtr)
 		palDirty[1] = (UINT8 *) &memoryPool[OFFSET_PAL_B_DIRTY];
 	}
 
+	// Track dirty VRAM pages by write protection instead of on every write.
+	// The palettes are not written.
+	m_markDirty = m_gpuMultiThreaded;
+	if (m_writeProtect && OKAY == m_writeWatch.Watch(vram, 0x120000, vramDirty, PAGE_WIDTH))
+		m_markDirty = false;
+
 	// Hook up the IRQ controller
 	IRQ = IRQObjectPtr;
 	
@@ -396,7 +408,9 @@ bool CTileGen::Init(CIRQ *IRQObjectPtr)
 
 CTileGen::CTileGen(const Util::Config::Node &config)
   : m_config(config),
-    m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>())
+    m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>()),
+    m_writeProtect(m_gpuMultiThreaded && Util::WriteWatch::IsSupported() && config["GPUDirtyTracking"].ValueAsDefault<std::string>("software") == "hardware"),
+    m_markDirty(m_gpuMultiThreaded)
 {
 	IRQ = NULL;
 	memoryPool = NULL;
@@ -420,9 +434,10 @@ CTileGen::~CTileGen(void)
 #endif
 		
 	IRQ = NULL;
+	m_writeWatch.Unwatch();
 	if (memoryPool != NULL)
 	{
-		delete [] memoryPool;
+		Util::MemoryArena::Free(memoryPool);
 		memoryPool = NULL;
 	}
 	DebugLog("Destroyed Tile Generator\n");
@@ -30,6 +30,7 @@
 
 #include "IRQ.h"
 #include "Graphics/Render2D.h"
+#include "Util/WriteWatch.h"
 
 /*
  * CTileGen:
@@ -259,6 +260,9 @@ private:
 
   const Util::Config::Node &m_config;
   const bool m_gpuMultiThreaded;
+  const bool m_writeProtect;  // track dirty pages with m_writeWatch (GPUDirtyTracking=hardware)
+  bool m_markDirty;           // mark dirty pages on each write
+  Util::WriteWatch m_writeWatch;
 
 	CIRQ		*IRQ;		// IRQ controller the tile generator is attached to
 	CRender2D	*Render2D;	// 2D renderer the tile generator is attached to
@@ -57,6 +57,12 @@ public:
 
 	virtual UINT16 ReadIORegister(unsigned reg) = 0;
 	virtual void WriteIORegister(unsigned reg, UINT16 data) = 0;
+
+	// rollback support, for boards that can run ahead of the remote data
+	virtual bool IsPredicting(void) { return false; }					// next frame runs on predicted data
+	virtual bool GetRollbackFrame(UINT32* frame) { return false; }	// first frame that was mispredicted
+	virtual void AbortRollback(void) {}								// mispredicted frames can't be run again
+	virtual UINT32 GetFrameNumber(void) { return 0; }
 };
 
 #endif
\ No newline at end of file
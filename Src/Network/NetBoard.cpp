@@ -1150,6 +1150,9 @@ bool CNetBoard::Init(UINT8 * netRAMPtr, UINT8 *netBufferPtr)
 	M68KSetContext(&M68K);
 	M68KInit();
 	M68KAttachBus(this);
+	memMap.read[0x00] = RAM;	// RAM: 000000-00FFFF (out-of-range accesses still go through the handlers)
+	memMap.write[0x00] = RAM;
+	M68KAttachMemoryMap(&memMap);
 	M68KSetIRQCallback(NetIRQAck);
 	//M68KSetIRQCallback(NULL);
 	M68KGetContext(&M68K);
@@ -81,6 +81,7 @@ private:
 	const Util::Config::Node &m_config;
 	// 68K CPU
 	M68KCtx		M68K;
+	M68KMemoryMap	memMap;	// direct-access page for RAM
 
 	// Sound board memory
 	UINT8		*netRAM;		// 64Kb RAM (passed in from parent object)
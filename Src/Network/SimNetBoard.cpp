@@ -20,6 +20,7 @@
  ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
+#include <algorithm>
 #include <chrono>
 #include <thread>
 #include "Supermodel.h"
@@ -31,6 +32,9 @@
 
 static const uint64_t netGUID = 0x5bf177da34872;
 
+// rollback packets: frame number, hop count, segment
+static const size_t rollbackHeaderSize = sizeof(uint32_t) + 1;
+
 inline bool CSimNetBoard::IsGame(const char* gameName)
 {
 	return (m_gameInfo.name == gameName) || (m_gameInfo.parent == gameName);
@@ -48,14 +52,39 @@ CSimNetBoard::~CSimNetBoard(void)
 		m_connectThread.join();
 }
 
+// Only used for rollback snapshots; the link itself can't be restored from a save state
 void CSimNetBoard::SaveState(CBlockFile* SaveState)
 {
-	
+	SaveState->NewBlock("SimNetBoard", __FILE__);
+	SaveState->Write(RAM, 0x10000);
+	SaveState->Write(Buffer, 0x20000);
+	SaveState->Write(&m_counter, sizeof(m_counter));
+	SaveState->Write(&m_IRQ2ack, sizeof(m_IRQ2ack));
+	SaveState->Write(&m_status0, sizeof(m_status0));
+	SaveState->Write(&m_status1, sizeof(m_status1));
+	SaveState->Write(m_commbank);
+	SaveState->Write(&m_frame, sizeof(m_frame));
 }
 
 void CSimNetBoard::LoadState(CBlockFile* SaveState)
 {
+	if (OKAY != SaveState->FindBlock("SimNetBoard"))
+	{
+		ErrorLog("Unable to load net board state. Save state file is corrupt.");
+		return;
+	}
 
+	SaveState->Read(RAM, 0x10000);
+	SaveState->Read(Buffer, 0x20000);
+	SaveState->Read(&m_counter, sizeof(m_counter));
+	SaveState->Read(&m_IRQ2ack, sizeof(m_IRQ2ack));
+	SaveState->Read(&m_status0, sizeof(m_status0));
+	SaveState->Read(&m_status1, sizeof(m_status1));
+	SaveState->Read(&m_commbank);
+	SaveState->Read(&m_frame, sizeof(m_frame));
+
+	CommRAM = m_commbank ? Buffer + 0x10000 : Buffer;
+	externalCommRAM = m_commbank ? Buffer : Buffer + 0x10000;
 }
 
 bool CSimNetBoard::Init(uint8_t* netRAMPtr, uint8_t* netBufferPtr)
@@ -85,6 +114,8 @@ bool CSimNetBoard::Init(uint8_t* netRAMPtr, uint8_t* netBufferPtr)
 	port_in = m_config["PortIn"].ValueAs<unsigned>();
 	port_out = m_config["PortOut"].ValueAs<unsigned>();
 	addr_out = m_config["AddressOut"].ValueAs<std::string>();
+	m_rollbackFrames = m_config["NetRollback"].ValueAsDefault<unsigned>(0);
+	m_delayMs = m_config["NetDelay"].ValueAsDefault<unsigned>(0);
 
 	nets = std::make_unique<TCPSend>(addr_out, port_out);
 	netr = std::make_unique<TCPReceive>(port_in);
@@ -258,6 +289,7 @@ void CSimNetBoard::RunFrame(void)
 			CommRAM16[0xc] = FLIPENDIAN16(0x100);
 			CommRAM16[0xe] = FLIPENDIAN16(RAM16[0x402] - m_segmentSize + 0x200);
 
+			ResetRollback();
 			m_state = State::ready;
 		}
 		else
@@ -449,59 +481,340 @@ void CSimNetBoard::RunFrame(void)
 			CommRAM16[0xc] = FLIPENDIAN16(0x100);
 			CommRAM16[0xe] = FLIPENDIAN16(RAM16[0x206] + 0x80);
 
+			ResetRollback();
 			m_state = State::ready;
 		}
 		break;
 
 	case State::ready:
-		m_counter++;
-		CommRAM16[0x6] = FLIPENDIAN16(m_counter);
-		
-		// we only send what we need to; helps cut down on bandwidth
-		// each machine has to receive back its own data (TODO: copy this data manually?)
-		for (int i = 0; i < m_numMachines; i++)
+		if (m_rollbackFrames > 0)
+			RunReadyRollback();
+		else
+			RunReadyLockstep();
+		break;
+
+	case State::error:
+		// do nothing
+		break;
+	}
+}
+
+void CSimNetBoard::RunReadyLockstep(void)
+{
+	m_counter++;
+	CommRAM16[0x6] = FLIPENDIAN16(m_counter);
+
+	// we only send what we need to; helps cut down on bandwidth
+	// each machine has to receive back its own data (TODO: copy this data manually?)
+	for (int i = 0; i < m_numMachines; i++)
+	{
+		Send(CommRAM + 0x100 + i * m_segmentSize, m_segmentSize);
+		auto& recv_data = Receive();
+		if (recv_data.size() == 0)
 		{
-			nets->Send(CommRAM + 0x100 + i * m_segmentSize, m_segmentSize);
-			auto& recv_data = netr->Receive();
-			if (recv_data.size() == 0)
+			LinkBroken();
+			break;
+		}
+		memcpy(CommRAM + 0x100 + (i + 1) * m_segmentSize, recv_data.data(), recv_data.size());
+	}
+
+	m_frame++;
+	m_head = m_frame;
+	SwapBanks();
+}
+
+/*
+ * Rollback
+ *
+ * In lockstep, a frame can't finish until the segments of all the other
+ * machines have made their way round the ring, so the link latency stalls
+ * emulation. With rollback, each machine sends its own segment tagged with the
+ * frame number and passes the others' on as they arrive. A frame whose remote
+ * segments are still missing runs with the newest segment seen from each of
+ * those machines instead. IsPredicting() lets the main board snapshot itself
+ * before such a frame and GetRollbackFrame() reports the first frame whose
+ * prediction turned out wrong, so that it can go back and run the frames
+ * again. Segments are only sent the first time a frame is run and each
+ * machine gets back its own segment as sent. The other machines can't take
+ * a segment back, so a frame that puts a different one in comm RAM when it
+ * is run again has diverged from what they saw, and the link is dropped
+ * instead. Rollback thus only recovers mispredictions that don't change what
+ * this machine sends. It has to be given the same inputs each time a frame
+ * is run, which is up to the main board.
+ *
+ * Enabled with NetRollback = <frames> in supermodel.ini (-net-rollback). It can
+ * be tried out on one computer by running two or three instances linked over
+ * 127.0.0.1 as described in NetBoard.cpp, with NetDelay = <ms> (-net-delay) to
+ * hold back everything each instance sends.
+ */
+
+void CSimNetBoard::ResetRollback(void)
+{
+	m_frame = 0;
+	m_head = 0;
+	m_steps.clear();
+	m_prediction.assign(size_t(m_numMachines - 1) * m_segmentSize, 0);
+	m_rollbackPending = false;
+}
+
+CSimNetBoard::Step& CSimNetBoard::GetStep(uint32_t frame)
+{
+	if (m_steps.empty())
+	{
+		m_steps.emplace_back();
+		m_steps.back().frame = std::min(frame, m_frame);
+		m_steps.back().remote.assign(m_prediction.size(), 0);
+		m_steps.back().used.assign(m_prediction.size(), 0);
+	}
+	while (m_steps.back().frame < frame)
+	{
+		uint32_t next = m_steps.back().frame + 1;
+		m_steps.emplace_back();
+		m_steps.back().frame = next;
+		m_steps.back().remote.assign(m_prediction.size(), 0);
+		m_steps.back().used.assign(m_prediction.size(), 0);
+	}
+	return m_steps[frame - m_steps.front().frame];
+}
+
+bool CSimNetBoard::IsComplete(const Step& step) const
+{
+	return step.confirmed == (1u << (m_numMachines - 1)) - 1;
+}
+
+// Takes in every packet that has arrived, passing on the ones that still have
+// machines to visit. Returns false if the link is broken.
+bool CSimNetBoard::PollRemote(void)
+{
+	while (netr->CheckDataAvailable())
+	{
+		auto& recv_data = netr->Receive();
+		if (recv_data.size() != rollbackHeaderSize + m_segmentSize)
+			return false;
+
+		uint32_t frame;
+		memcpy(&frame, recv_data.data(), sizeof(frame));
+		unsigned hops = uint8_t(recv_data[sizeof(frame)]);
+		if (hops == 0 || hops >= m_numMachines)
+			continue;		// our own segment, which we already have
+
+		if (hops + 1 < m_numMachines)
+		{
+			recv_data[sizeof(frame)] = char(hops + 1);
+			Send(recv_data.data(), int(recv_data.size()));
+		}
+
+		// frames before the oldest step have all their segments already
+		if (!m_steps.empty() && frame < m_steps.front().frame)
+			continue;
+
+		unsigned slot = hops - 1;
+		const uint8_t* segment = (const uint8_t*)recv_data.data() + rollbackHeaderSize;
+		Step& step = GetStep(frame);
+		memcpy(step.remote.data() + slot * m_segmentSize, segment, m_segmentSize);
+		memcpy(m_prediction.data() + slot * m_segmentSize, segment, m_segmentSize);
+		step.confirmed |= 1u << slot;
+
+		// already run with something else?
+		if (frame < m_head && memcmp(step.used.data() + slot * m_segmentSize, segment, m_segmentSize) != 0)
+		{
+			if (!m_rollbackPending || frame < m_rollbackFrame)
+				m_rollbackFrame = frame;
+			m_rollbackPending = true;
+		}
+	}
+
+	return true;
+}
+
+// Waits while running a new frame would put us more than m_rollbackFrames
+// ahead of the remote data. Returns false if the link is broken.
+bool CSimNetBoard::WaitForRemote(void)
+{
+	while (true)
+	{
+		FlushSends();
+		if (!PollRemote())
+			return false;
+
+		uint32_t oldest = m_head;
+		for (const Step& step : m_steps)
+		{
+			if (step.frame >= m_head)
+				break;
+			if (!IsComplete(step))
 			{
-				// link broken - send an "empty" packet to alert other machines
-				nets->Send(nullptr, 0);
-				m_state = State::error;
-				if (m_gameType == GameType::one)
-					m_status1 = 0x40;			// send "link broken" message to mainboard
+				oldest = step.frame;
 				break;
 			}
-			memcpy(CommRAM + 0x100 + (i + 1) * m_segmentSize, recv_data.data(), recv_data.size());
 		}
+		if (m_head - oldest < m_rollbackFrames)
+			return true;
 
-		// swap CommRAM banks
-		if (m_commbank)
-		{
-			m_commbank = false;
-			CommRAM = Buffer;
-			externalCommRAM = Buffer + 0x10000;
-		}
-		else
+		if (!netr->CheckDataAvailable(1) && !netr->Connected())
+			return false;
+	}
+}
+
+void CSimNetBoard::RunReadyRollback(void)
+{
+	m_counter++;
+	CommRAM16[0x6] = FLIPENDIAN16(m_counter);
+
+	uint8_t* segments = CommRAM + 0x100;
+	uint32_t frame = m_frame;
+
+	if (frame == m_head)
+	{
+		if (!WaitForRemote())
 		{
-			m_commbank = true;
-			CommRAM = Buffer + 0x10000;
-			externalCommRAM = Buffer;
+			LinkBroken();
+			return;
 		}
-		
-		break;
 
-	case State::error:
-		// do nothing
-		break;
+		std::vector<uint8_t> packet(rollbackHeaderSize + m_segmentSize);
+		memcpy(packet.data(), &frame, sizeof(frame));
+		packet[sizeof(frame)] = 1;
+		memcpy(packet.data() + rollbackHeaderSize, segments, m_segmentSize);
+		Send(packet.data(), int(packet.size()));
+
+		GetStep(frame).own.assign(segments, segments + m_segmentSize);
+		m_head++;
+	}
+	else if (m_steps.empty() || frame < m_steps.front().frame || memcmp(GetStep(frame).own.data(), segments, m_segmentSize) != 0)
+	{
+		ErrorLog("net board frame %u came out differently when run again. Dropping the link.", frame);
+		LinkBroken();
+		return;
+	}
+
+	// remote segments that have arrived, predictions for the rest
+	Step& step = GetStep(frame);
+	for (unsigned slot = 0; slot + 1 < m_numMachines; slot++)
+	{
+		size_t offset = slot * m_segmentSize;
+		const uint8_t* segment = (step.confirmed & (1u << slot)) ? &step.remote[offset] : &m_prediction[offset];
+		memcpy(&step.used[offset], segment, m_segmentSize);
+	}
+	memcpy(segments + m_segmentSize, step.used.data(), step.used.size());
+
+	// each machine gets back its own data as the others saw it
+	memcpy(segments + m_numMachines * m_segmentSize, step.own.data(), m_segmentSize);
+
+	m_frame++;
+
+	// drop the steps that can no longer be rolled back to
+	while (!m_steps.empty() && m_steps.front().frame < m_frame && IsComplete(m_steps.front()) &&
+		!(m_rollbackPending && m_steps.front().frame >= m_rollbackFrame))
+		m_steps.pop_front();
+
+	SwapBanks();
+}
+
+bool CSimNetBoard::IsPredicting(void)
+{
+	if (m_rollbackFrames == 0 || m_state != State::ready || !IsRunning())
+		return false;
+
+	if (m_frame == m_head && !WaitForRemote())
+	{
+		LinkBroken();
+		return false;
+	}
+
+	return !IsComplete(GetStep(m_frame));
+}
+
+bool CSimNetBoard::GetRollbackFrame(uint32_t* frame)
+{
+	// once the link is broken, a snapshot would only hide that from the game
+	if (!m_rollbackPending || m_state != State::ready)
+		return false;
+
+	m_rollbackPending = false;
+	*frame = m_rollbackFrame;
+	return true;
+}
+
+void CSimNetBoard::AbortRollback(void)
+{
+	if (m_state == State::ready)
+		LinkBroken();
+}
+
+uint32_t CSimNetBoard::GetFrameNumber(void)
+{
+	return m_frame;
+}
+
+void CSimNetBoard::SwapBanks(void)
+{
+	if (m_commbank)
+	{
+		m_commbank = false;
+		CommRAM = Buffer;
+		externalCommRAM = Buffer + 0x10000;
+	}
+	else
+	{
+		m_commbank = true;
+		CommRAM = Buffer + 0x10000;
+		externalCommRAM = Buffer;
 	}
 }
 
+void CSimNetBoard::LinkBroken(void)
+{
+	// send an "empty" packet to alert other machines
+	m_sendQueue.clear();
+	nets->Send(nullptr, 0);
+	m_state = State::error;
+	if (m_gameType == GameType::one)
+		m_status1 = 0x40;			// send "link broken" message to mainboard
+}
+
+// Sends go through a queue when NetDelay is set, to try out rollback over a
+// local link as if it were a slow one
+void CSimNetBoard::Send(const void* data, int length)
+{
+	if (m_delayMs == 0 && m_sendQueue.empty())
+	{
+		nets->Send(data, length);
+		return;
+	}
+
+	const uint8_t* bytes = (const uint8_t*)data;
+	auto due = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_delayMs);
+	m_sendQueue.emplace_back(due, std::vector<uint8_t>(bytes, bytes + length));
+	FlushSends();
+}
+
+void CSimNetBoard::FlushSends(void)
+{
+	auto now = std::chrono::steady_clock::now();
+	while (!m_sendQueue.empty() && m_sendQueue.front().first <= now)
+	{
+		auto& data = m_sendQueue.front().second;
+		nets->Send(data.data(), int(data.size()));
+		m_sendQueue.pop_front();
+	}
+}
+
+// Blocking receive that keeps the delayed sends going out, otherwise two
+// machines could end up waiting on each other's queued data forever
+std::vector<char>& CSimNetBoard::Receive(void)
+{
+	while (!m_sendQueue.empty() && netr->Connected() && !netr->CheckDataAvailable(1))
+		FlushSends();
+	return netr->Receive();
+}
+
 void CSimNetBoard::Reset(void)
 {
 	// if netboard was active, send an "empty" packet so the other machines don't get stuck waiting for data
 	if (m_state == State::ready)
 	{
+		m_sendQueue.clear();
 		nets->Send(nullptr, 0);
 		netr->Receive();
 	}
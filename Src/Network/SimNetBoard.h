@@ -23,7 +23,10 @@
 #ifndef INCLUDED_SIMNETBOARD_H
 #define INCLUDED_SIMNETBOARD_H
 
+#include <chrono>
 #include <cstdint>
+#include <deque>
+#include <vector>
 #include "TCPSend.h"
 #include "TCPReceive.h"
 #include "INetBoard.h"
@@ -73,6 +76,11 @@ public:
 	uint16_t ReadIORegister(unsigned reg);
 	void WriteIORegister(unsigned reg, uint16_t data);
 
+	bool IsPredicting(void);
+	bool GetRollbackFrame(uint32_t* frame);
+	void AbortRollback(void);
+	uint32_t GetFrameNumber(void);
+
 private:
 	// Config
 	const Util::Config::Node& m_config;
@@ -110,8 +118,40 @@ private:
 	uint16_t m_status1 = 0;	// ioreg 0x8a
 	bool m_commbank = false;
 
+	// rollback: comm data of a frame, kept until every remote segment has arrived
+	struct Step
+	{
+		uint32_t frame = 0;
+		std::vector<uint8_t> own;		// our segment, as sent
+		std::vector<uint8_t> remote;	// remote segments that have arrived, by hop count
+		std::vector<uint8_t> used;		// remote segments last handed to the game
+		uint32_t confirmed = 0;			// one bit per remote segment that has arrived
+	};
+
+	unsigned m_rollbackFrames = 0;		// frames we may run ahead of the remote data (0 = lockstep)
+	unsigned m_delayMs = 0;				// artificial send delay, for testing
+	uint32_t m_frame = 0;				// next frame of comm data (saved, goes back on rollback)
+	uint32_t m_head = 0;				// next frame that has not been run yet
+	std::deque<Step> m_steps;			// consecutive frames from the oldest one still needed
+	std::vector<uint8_t> m_prediction;	// newest arrived segment of each remote machine
+	bool m_rollbackPending = false;
+	uint32_t m_rollbackFrame = 0;
+	std::deque<std::pair<std::chrono::steady_clock::time_point, std::vector<uint8_t>>> m_sendQueue;
+
 	inline bool IsGame(const char* gameName);
 	void ConnectProc(void);
+	void LinkBroken(void);
+	void ResetRollback(void);
+	void Send(const void* data, int length);
+	void FlushSends(void);
+	std::vector<char>& Receive(void);
+	Step& GetStep(uint32_t frame);
+	bool IsComplete(const Step& step) const;
+	bool PollRemote(void);
+	bool WaitForRemote(void);
+	void RunReadyLockstep(void);
+	void RunReadyRollback(void);
+	void SwapBanks(void);
 };
 
 #endif
\ No newline at end of file
@@ -74,6 +74,7 @@
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <filesystem>
 #include <GL/glew.h>
 
 #ifdef SUPERMODEL_WIN32
@@ -87,6 +88,7 @@
 #include "Util/ConfigBuilders.h"
 #include "OSD/FileSystemPath.h"
 #include "GameLoader.h"
+#include "Rewind.h"
 #include "SDLInputSystem.h"
 #include "SDLIncludes.h"
 #include "Debugger/SupermodelDebugger.h"
@@ -100,6 +102,7 @@
 
 #include <iostream>
 #include "Util/BMPFile.h"
+#include "Util/MemoryArena.h"
 
 #include "Crosshair.h"
 
@@ -184,18 +187,34 @@ static bool SetGLGeometry(unsigned *xOffsetPtr, unsigned *yOffsetPtr, unsigned *
   *xResPtr = (unsigned) xRes;
   *yResPtr = (unsigned) yRes;
 
-  UINT32 correction = (UINT32)(((yRes / 384.f) * 2.f) + 0.5f);
-
   glEnable(GL_SCISSOR_TEST);
+  return OKAY;
+}
+
+/*
+ * InitRenderers():
+ *
+ * Sizes the renderers for the current geometry at the render scale of the
+ * supersampling target, which changes at run time with dynamic resolution,
+ * and sets the scissor box to clip the visible area.
+ */
+static bool InitRenderers(CRender2D *Render2D, IRender3D *Render3D, SuperAA *superAA)
+{
+  if (OKAY != Render2D->Init(superAA->Scale(xOffset), superAA->Scale(yOffset), superAA->Scale(xRes), superAA->Scale(yRes), superAA->Scale(totalXRes), superAA->Scale(totalYRes), superAA->GetTargetID()))
+    return FAIL;
+  if (OKAY != Render3D->Init(superAA->Scale(xOffset), superAA->Scale(yOffset), superAA->Scale(xRes), superAA->Scale(yRes), superAA->Scale(totalXRes), superAA->Scale(totalYRes), superAA->GetTargetID()))
+    return FAIL;
+
+  UINT32 correction = (UINT32)(((yRes / 384.f) * 2.f) + 0.5f);
 
   // Scissor box (to clip visible area)
   if (s_runtime_config["WideScreen"].ValueAsDefault<bool>(false))
   {
-    glScissor(0* aaValue, correction* aaValue, *totalXResPtr * aaValue, (*totalYResPtr - (correction * 2)) * aaValue);
+    glScissor(0, superAA->Scale(correction), superAA->Scale(totalXRes), superAA->Scale(totalYRes - (correction * 2)));
   }
   else
   {
-      glScissor((*xOffsetPtr + correction) * aaValue, (*yOffsetPtr + correction) * aaValue, (*xResPtr - (correction * 2)) * aaValue, (*yResPtr - (correction * 2)) * aaValue);
+      glScissor(superAA->Scale(xOffset + correction), superAA->Scale(yOffset + correction), superAA->Scale(xRes - (correction * 2)), superAA->Scale(yRes - (correction * 2)));
   }
   return OKAY;
 }
@@ -568,8 +587,17 @@ void Screenshot()
 #include "Model3/Model3GraphicsState.h"
 #include "OSD/SDL/PolyAnalysis.h"
 #include <fstream>
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <sstream>
 
 static std::string s_gfxStatePath;
+static std::string s_gfxBenchPath;
+static std::string s_gfxBenchRefFile;
+static unsigned s_gfxBenchFrames = 100;
+static bool s_gfxBenchHashFrame = false;  // set to have EndFrameVideo() hash the next frame
+static uint64_t s_gfxBenchFrameHash = 0;
 static const std::string k_gfxAnalysisPath = "GraphicsAnalysis/";
 
 static std::string GetFileBaseName(const std::string &file)
@@ -668,6 +696,141 @@ static void TestPolygonHeaderBits(IEmulator *Emu)
   }
 }
 
+// FNV-1a hash of the back buffer, for detecting changes in rendered output.
+// Must be called before the buffers are swapped.
+static uint64_t HashFrameBuffer()
+{
+  std::vector<uint8_t> pixels(totalXRes * totalYRes * 4);
+  glReadPixels(0, 0, totalXRes, totalYRes, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (uint8_t b : pixels)
+  {
+    hash ^= b;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/*
+ * Renders every save state in a directory a number of times with the current
+ * 3D engine and prints per-state timings, draw call and vertex counts, and a
+ * hash of the rendered frame. If a previous report is given as a reference,
+ * states whose hash has changed are flagged.
+ */
+static void RunGraphicsBenchmark(CModel3GraphicsState *Emu, IRender3D *Render3D)
+{
+  // Collect state files, sorted so that reports from different runs line up
+  std::vector<std::string> files;
+  std::error_code ec;
+  for (const auto &entry : std::filesystem::directory_iterator(s_gfxBenchPath, ec))
+  {
+    if (entry.is_regular_file())
+      files.push_back(entry.path().string());
+  }
+  if (ec)
+  {
+    ErrorLog("Unable to read graphics benchmark directory '%s'.", s_gfxBenchPath.c_str());
+    return;
+  }
+  std::sort(files.begin(), files.end());
+
+  // Reference hashes: first and seventh fields of each state line of a
+  // previous report, which may be followed by a "(new)" or "(CHANGED)" flag
+  std::map<std::string, std::string> refHashes;
+  if (!s_gfxBenchRefFile.empty())
+  {
+    std::ifstream ref(s_gfxBenchRefFile);
+    if (!ref.good())
+      ErrorLog("Unable to open graphics benchmark reference '%s'.", s_gfxBenchRefFile.c_str());
+    std::string line;
+    unsigned lineNum = 0;
+    while (std::getline(ref, line))
+    {
+      lineNum++;
+      std::istringstream is(line);
+      std::vector<std::string> fields{ std::istream_iterator<std::string>(is), std::istream_iterator<std::string>() };
+      if (fields.empty() || fields[0] == "state" || line.find("states rendered differently") != std::string::npos)
+        continue;
+      bool flagged = fields.size() == 8 && (fields[7] == "(new)" || fields[7] == "(CHANGED)");
+      if ((fields.size() == 7 || flagged) && fields[6].compare(0, 2, "0x") == 0)
+        refHashes[fields[0]] = fields[6];
+      else
+        ErrorLog("Graphics benchmark reference '%s', line %u, not understood: %s", s_gfxBenchRefFile.c_str(), lineNum, line.c_str());
+    }
+  }
+
+  // Presenting must not wait for vertical refresh or it will be timed too
+  SDL_GL_SetSwapInterval(0);
+  GLint readBuffer;
+  glGetIntegerv(GL_READ_BUFFER, &readBuffer);
+  glReadBuffer(GL_BACK);
+  GLuint queries[2];
+  glGenQueries(2, queries);
+
+  printf("%-32s %10s %10s %10s %8s %10s %18s\n", "state", "build(ms)", "cpu(ms)", "gpu(ms)", "draws", "vertices", "hash");
+  unsigned numChanged = 0;
+  for (const std::string &file : files)
+  {
+    if (OKAY != Emu->LoadStateFile(file))
+      continue;
+
+    // First frame uploads textures and caches ROM models, so it is not timed
+    Emu->RenderFrame();
+
+    // GPU times are collected a frame late so as not to stall the pipeline
+    Render3DStats stats = {};
+    double buildMs = 0.0, cpuMs = 0.0, gpuMs = 0.0;
+    for (unsigned i = 0; i < s_gfxBenchFrames; i++)
+    {
+      glBeginQuery(GL_TIME_ELAPSED, queries[i & 1]);
+      auto start = std::chrono::steady_clock::now();
+      Emu->RenderFrame();
+      cpuMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      glEndQuery(GL_TIME_ELAPSED);
+      if (i > 0)
+      {
+        GLuint64 gpuNs = 0;
+        glGetQueryObjectui64v(queries[(i - 1) & 1], GL_QUERY_RESULT, &gpuNs);
+        gpuMs += double(gpuNs) / 1e6;
+      }
+      Render3D->GetFrameStats(&stats);
+      buildMs += stats.sceneBuildMs;
+    }
+    if (s_gfxBenchFrames > 0)
+    {
+      GLuint64 gpuNs = 0;
+      glGetQueryObjectui64v(queries[(s_gfxBenchFrames - 1) & 1], GL_QUERY_RESULT, &gpuNs);
+      gpuMs += double(gpuNs) / 1e6;
+    }
+
+    // One more, untimed frame to hash
+    s_gfxBenchHashFrame = true;
+    Emu->RenderFrame();
+
+    std::string name = GetFileBaseName(file);
+    std::string hash = Util::Hex(s_gfxBenchFrameHash, 16);
+    const char *status = "";
+    auto it = refHashes.find(name);
+    if (!refHashes.empty())
+    {
+      if (it == refHashes.end())
+        status = " (new)";
+      else if (it->second != hash)
+      {
+        status = " (CHANGED)";
+        numChanged++;
+      }
+    }
+    double n = s_gfxBenchFrames ? double(s_gfxBenchFrames) : 1.0;
+    printf("%-32s %10.3f %10.3f %10.3f %8u %10u %18s%s\n", name.c_str(), buildMs / n, cpuMs / n, gpuMs / n, stats.drawCalls, stats.vertices, hash.c_str(), status);
+  }
+
+  glDeleteQueries(2, queries);
+  glReadBuffer(readBuffer);
+  if (!refHashes.empty())
+    printf("%u of %u states rendered differently from the reference.\n", numChanged, unsigned(files.size()));
+}
+
 #endif
 
 
@@ -748,6 +911,22 @@ static void LoadState(IEmulator *Model3, std::string file_path = std::string())
   DebugLog("Loaded state from '%s'.\n", file_path.c_str());
 }
 
+static void RewindState(CRewind *rewind)
+{
+  uint64_t start = SDL_GetPerformanceCounter();
+  if (OKAY != rewind->Rewind())
+  {
+    puts("Nothing to rewind to yet.");
+    return;
+  }
+
+  CRewind::Stats stats;
+  rewind->GetStats(&stats);
+  double ms = double(SDL_GetPerformanceCounter() - start) * 1000.0 / double(SDL_GetPerformanceFrequency());
+  printf("Rewound in %1.1f ms (%u snapshots covering %u frames left).\n", ms, stats.snapshots, stats.frames);
+  DebugLog("Rewound in %1.1f ms.\n", ms);
+}
+
 static void SaveNVRAM(IEmulator *Model3)
 {
   CBlockFile  NVRAM;
@@ -837,6 +1016,15 @@ bool BeginFrameVideo()
 
 void EndFrameVideo()
 {
+#ifdef DEBUG
+  // Graphics benchmark: hash the frame before it is presented
+  if (s_gfxBenchHashFrame)
+  {
+    s_gfxBenchFrameHash = HashFrameBuffer();
+    s_gfxBenchHashFrame = false;
+  }
+#endif
+
   // Show crosshairs for light gun games
   if (videoInputs)
     s_crosshair->Update(currentInputs, videoInputs, xOffset, yOffset, xRes, yRes);
@@ -906,10 +1094,14 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
   std::string initialState = s_runtime_config["InitStateFile"].ValueAs<std::string>();
   uint64_t    prevFPSTicks;
   unsigned    fpsFramesElapsed;
+  unsigned    fpsFramesSkipped;
+  unsigned    framesSkipped = 0;  // consecutive frames skipped so far
+  bool        skipFrame = false;
   bool        gameHasLightguns = false;
   bool        quit = false;
   bool        paused = false;
   bool        dumpTimings = false;
+  std::unique_ptr<CRewind> rewind;
 
   // Initialize and load ROMs
   if (OKAY != Model3->Init())
@@ -983,9 +1175,17 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
   CRender2D *Render2D = new CRender2D(s_runtime_config);
   IRender3D *Render3D = s_runtime_config["New3DEngine"].ValueAs<bool>() ? ((IRender3D *) new New3D::CNew3D(s_runtime_config, Model3->GetGame().name)) : ((IRender3D *) new Legacy3D::CLegacy3D(s_runtime_config));
 
-  if (OKAY != Render2D->Init(xOffset*aaValue, yOffset*aaValue, xRes*aaValue, yRes*aaValue, totalXRes*aaValue, totalYRes*aaValue, superAA->GetTargetID()))
-    goto QuitError;
-  if (OKAY != Render3D->Init(xOffset*aaValue, yOffset*aaValue, xRes*aaValue, yRes*aaValue, totalXRes*aaValue, totalYRes*aaValue, superAA->GetTargetID()))
+  // Dynamic resolution resizes the renderers between frames, which only the
+  // new 3D engine supports
+  if (s_runtime_config["DynamicResolution"].ValueAs<bool>())
+  {
+    if (aaValue < 2 || !s_runtime_config["New3DEngine"].ValueAs<bool>())
+      InfoLog("Dynamic resolution requires supersampling and the new 3D engine. Disabled.");
+    else
+      superAA->EnableDynamicScale(s_runtime_config["DynamicResolutionMin"].ValueAs<float>(), 1000000.0f / GetDesiredRefreshRateMilliHz());
+  }
+
+  if (OKAY != InitRenderers(Render2D, Render3D, superAA))
     goto QuitError;
  
   Model3->AttachRenderers(Render2D,Render3D, superAA);
@@ -997,6 +1197,10 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
   if (initialState.length() > 0)
     LoadState(Model3, initialState);
 
+  // Keep a rewind history if requested
+  if (s_runtime_config["Rewind"].ValueAs<bool>())
+    rewind.reset(new CRewind(Model3, s_runtime_config["RewindInterval"].ValueAs<unsigned>(), size_t(s_runtime_config["RewindMemory"].ValueAs<unsigned>()) << 20));
+
 #ifdef SUPERMODEL_DEBUGGER
   // If debugger was supplied, set it as logger and attach it to system
   oldLogger = GetLogger();
@@ -1009,24 +1213,49 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
 
   // Emulate!
   fpsFramesElapsed = 0;
+  fpsFramesSkipped = 0;
   prevFPSTicks = SDL_GetPerformanceCounter();
   quit = false;
   paused = false;
   dumpTimings = false;
 #ifdef DEBUG
-  if (dynamic_cast<CModel3GraphicsState *>(Model3))
+  if (CModel3GraphicsState *GraphicsState = dynamic_cast<CModel3GraphicsState *>(Model3))
   {
-    TestPolygonHeaderBits(Model3);
+    if (!s_gfxBenchPath.empty())
+      RunGraphicsBenchmark(GraphicsState, Render3D);
+    else
+      TestPolygonHeaderBits(Model3);
     quit = true;
   }
 #endif
   while (!quit)
   {
-    // Render if paused, otherwise run a frame
+    // Render if paused, otherwise run a frame (without rendering it if behind)
     if (paused)
       Model3->RenderFrame();
+    else if (skipFrame)
+    {
+      Model3->SkipFrame();
+      ++framesSkipped;
+      ++fpsFramesSkipped;
+    }
     else
+    {
       Model3->RunFrame();
+      framesSkipped = 0;
+    }
+
+    // Snapshot the machine every few frames for rewinding
+    if (rewind && !paused && rewind->FrameDone())
+    {
+      Model3->PauseThreads();
+      rewind->Capture();
+      Model3->ResumeThreads();
+    }
+
+    // Dynamic resolution: resize the renderers when the GPU load calls for it
+    if (superAA->UpdateScale() && OKAY != InitRenderers(Render2D, Render3D, superAA))
+      goto QuitError;
 
     // Poll the inputs
     if (!Inputs->Poll(&game, xOffset, yOffset, xRes, yRes))
@@ -1131,9 +1360,7 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
       superAA->Init(totalXRes, totalYRes);
       Render2D = new CRender2D(s_runtime_config);
       Render3D = s_runtime_config["New3DEngine"].ValueAs<bool>() ? ((IRender3D *) new New3D::CNew3D(s_runtime_config, Model3->GetGame().name)) : ((IRender3D *) new Legacy3D::CLegacy3D(s_runtime_config));
-      if (OKAY != Render2D->Init(xOffset * aaValue, yOffset * aaValue, xRes * aaValue, yRes * aaValue, totalXRes * aaValue, totalYRes * aaValue, superAA->GetTargetID()))
-        goto QuitError;
-      if (OKAY != Render3D->Init(xOffset * aaValue, yOffset * aaValue, xRes * aaValue, yRes * aaValue, totalXRes * aaValue, totalYRes * aaValue, superAA->GetTargetID()))
+      if (OKAY != InitRenderers(Render2D, Render3D, superAA))
         goto QuitError;
 
       Model3->AttachRenderers(Render2D, Render3D, superAA);
@@ -1189,6 +1416,34 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
         SetAudioEnabled(true);
       }
     }
+    else if (Inputs->uiRewind->Pressed())
+    {
+      if (!rewind)
+        puts("Rewind is disabled (enable it with -rewind).");
+      else
+      {
+        if (!paused)
+        {
+          Model3->PauseThreads();
+          SetAudioEnabled(false);
+        }
+
+        // Step back through the rewind history
+        RewindState(rewind.get());
+
+#ifdef SUPERMODEL_DEBUGGER
+        // If debugger was supplied, reset it after loading state
+        if (Debugger != NULL)
+          Debugger->Reset();
+#endif // SUPERMODEL_DEBUGGER
+
+        if (!paused)
+        {
+          Model3->ResumeThreads();
+          SetAudioEnabled(true);
+        }
+      }
+    }
     else if (Inputs->uiMusicVolUp->Pressed())
     {
       // Increase music volume by 10%
@@ -1293,7 +1548,21 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
 #endif // SUPERMODEL_DEBUGGER
 
     // Refresh rate (frame limiting)
-    if (paused || s_runtime_config["Throttle"].ValueAs<bool>())
+    unsigned maxFrameSkip = s_runtime_config["MaxFrameSkip"].ValueAs<unsigned>();
+    skipFrame = false;
+    if (!paused && maxFrameSkip > 0 && s_runtime_config["Throttle"].ValueAs<bool>())
+    {
+        // Frame skipping: keep to a fixed schedule so that time lost on slow
+        // frames is made up by not rendering the following ones. If too far
+        // behind to ever catch up, start a new schedule from now.
+        uint64_t now = SDL_GetPerformanceCounter();
+        if (nextTime == 0 || now > nextTime + perfCountPerFrame * (maxFrameSkip + 1))
+          nextTime = now;
+        skipFrame = now > nextTime && framesSkipped < maxFrameSkip;
+        SuperSleepUntil(nextTime);
+        nextTime += perfCountPerFrame;
+    }
+    else if (paused || s_runtime_config["Throttle"].ValueAs<bool>())
     {
         SuperSleepUntil(nextTime);
         nextTime = SDL_GetPerformanceCounter() + perfCountPerFrame;
@@ -1308,10 +1577,17 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
       if (measurementTicks >= s_perfCounterFrequency) // update FPS every 1 second (s_perfCounterFrequency is how many perf ticks in one second)
       {
         float fps = float(fpsFramesElapsed) / (float(measurementTicks) / float(s_perfCounterFrequency));
-        sprintf(titleStr, "%s - %1.3f FPS%s", baseTitleStr, fps, paused ? " (Paused)" : "");
+        char scaleStr[32] = "";
+        if (s_runtime_config["DynamicResolution"].ValueAs<bool>())
+          sprintf(scaleStr, " (%1.2fx)", superAA->GetScale());
+        if (fpsFramesSkipped > 0)
+          sprintf(titleStr, "%s - %1.3f FPS (%u skipped)%s%s", baseTitleStr, fps, fpsFramesSkipped, scaleStr, paused ? " (Paused)" : "");
+        else
+          sprintf(titleStr, "%s - %1.3f FPS%s%s", baseTitleStr, fps, scaleStr, paused ? " (Paused)" : "");
         SDL_SetWindowTitle(s_window, titleStr);
         prevFPSTicks = currentFPSTicks;   // reset tick count
         fpsFramesElapsed = 0;             // reset frame count
+        fpsFramesSkipped = 0;             // reset skipped frame count
       }
     }
 
@@ -1326,6 +1602,10 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
   // Make sure all threads are paused before shutting down
   Model3->PauseThreads();
 
+  // Report what keeping the rewind history cost
+  if (rewind)
+    rewind->LogStats();
+
 #ifdef SUPERMODEL_DEBUGGER
   // If debugger was supplied, detach it from system and restore old logger
   if (Debugger != NULL)
@@ -1338,6 +1618,9 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
   // Save NVRAM
   SaveNVRAM(Model3);
 
+  // Record how much emulated memory was used
+  Util::MemoryArena::LogMap();
+
   // Close audio
   CloseAudio();
 
@@ -1365,6 +1648,7 @@ QuitError:
 static const std::string s_analysisPath = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Analysis);
 static const std::string s_configFilePath = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Config) << "Supermodel.ini";
 static const std::string s_gameXMLFilePath = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Config) << "Games.xml";
+static const std::string s_romIndexFilePath = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Config) << "ROMIndex.bin";
 static const std::string s_logFilePath = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Log) << "Supermodel.log";
 
 // Create and configure inputs
@@ -1440,6 +1724,37 @@ static void PrintGameList(const std::string &xml_file, const std::map<std::strin
   }
 }
 
+// Scan a ROM directory and print the game found in each zip archive
+static void PrintROMLibrary(const std::string &directory, const GameLoader &loader)
+{
+  ROMIndex index;
+  index.Load(s_romIndexFilePath);
+  ROMIndex::Stats stats;
+  if (index.Scan(&stats, directory))
+    return;
+  index.Save(s_romIndexFilePath);
+  InfoLog("ROM index: %u archives in '%s', %u opened, %u removed.", unsigned(stats.archives), directory.c_str(), unsigned(stats.scanned), unsigned(stats.removed));
+
+  std::map<std::string, std::string> game_by_zipfilename;
+  loader.IdentifyGames(&game_by_zipfilename, index);
+  const std::map<std::string, Game> &games = loader.GetGames();
+  printf("Games found in %s:\n", directory.c_str());
+  puts("");
+  puts("    ROM Set         Title                                     File");
+  puts("    -------         -----                                     ----");
+  std::filesystem::path dir = std::filesystem::path(directory).lexically_normal();
+  if (!dir.has_filename())
+    dir = dir.parent_path();
+  for (auto &v: game_by_zipfilename)
+  {
+    if (std::filesystem::path(v.first).parent_path() != dir)
+      continue;   // indexed from another directory
+    const Game &game = games.find(v.second)->second;
+    std::string title = game.version.empty() ? game.title : game.title + " (" + game.version + ")";
+    printf("    %-9s       %-40s  %s\n", game.name.c_str(), title.c_str(), std::filesystem::path(v.first).filename().string().c_str());
+  }
+}
+
 static void LogConfig(const Util::Config::Node &config)
 {
   InfoLog("Runtime configuration:");
@@ -1458,9 +1773,28 @@ static Util::Config::Node DefaultConfig()
   Util::Config::Node config("Global");
   config.Set("GameXMLFile", s_gameXMLFilePath);
   config.Set("InitStateFile", "");
+  config.Set("Rewind", false);
+  config.Set("RewindInterval", 30);
+  config.Set("RewindMemory", 256);
   // CModel3
   config.Set("MultiThreaded", true);
   config.Set("GPUMultiThreaded", true);
+  config.Set("GPUDirtyTracking", "software");
+  config.Set("TextureThreads", 0);
+  config.Set("ThreadWakeSpin", 50);   // microseconds
+  config.Set("ThreadSyncSpin", 200);  // microseconds
+  config.Set("ThreadAffinity", "none");
+  config.SetEmpty("RenderThreadCPUs");
+  config.SetEmpty("MainBoardThreadCPUs");
+  config.SetEmpty("SoundBoardThreadCPUs");
+  config.SetEmpty("DriveBoardThreadCPUs");
+  config.Set("ThreadPriority", "normal");
+  config.Set("SoundThreadRealtime", false);
+  config.Set("PowerPCFastMem", false);
+#ifdef PPC_LOCKSTEP
+  config.Set("VerifyPowerPC", false);
+#endif
+  config.Set("HugePages", "transparent");
   // 2D and 3D graphics engines
   config.Set("MultiTexture", false);
   config.Set("VertexShader", "");
@@ -1469,6 +1803,8 @@ static Util::Config::Node DefaultConfig()
   config.Set("FragmentShaderFog", "");
   config.Set("VertexShader2D", "");
   config.Set("FragmentShader2D", "");
+  config.Set("TileGenRenderer", "gpu");
+  config.Set("TileGenThreads", 0);
   // CSoundBoard
   config.Set("EmulateSound", true);
   config.Set("Balance", "0.0");
@@ -1481,6 +1817,7 @@ static Util::Config::Node DefaultConfig()
   config.Set("SoundVolume", "100");
   config.Set("MusicVolume", "100");
   // Other sound options
+  config.Set("SoundIdleSkip", true);
   config.Set("LegacySoundDSP", false); // New config option for games that do not play correctly with MAME's SCSP sound core.
   // CDriveBoard
   config.Set("ForceFeedback", false);
@@ -1494,6 +1831,8 @@ static Util::Config::Node DefaultConfig()
   config.Set("FullScreen", false);
   config.Set("BorderlessWindow", true);
   config.Set("Supersampling", 1);
+  config.Set("DynamicResolution", false);
+  config.Set("DynamicResolutionMin", 1.0f);
   config.Set("WideScreen", false);
   config.Set("Stretch", false);
   config.Set("WideBackground", false);
@@ -1501,6 +1840,7 @@ static Util::Config::Node DefaultConfig()
   config.Set("Throttle", true);
   config.Set("RefreshRate", 60.0f);
   config.Set("ShowFrameRate", false);
+  config.Set("MaxFrameSkip", int(0));
   config.Set("Crosshairs", int(0));
   config.Set("CrosshairStyle", "vector");
   config.Set("FlipStereo", false);
@@ -1530,6 +1870,13 @@ static Util::Config::Node DefaultConfig()
   config.Set("PortIn", unsigned(1970));
   config.Set("PortOut", unsigned(1971));
   config.Set("AddressOut", "127.0.0.1");
+  config.Set("NetRollback", unsigned(0));
+  config.Set("NetDelay", unsigned(0));
+#endif
+#ifdef PPC_TRACE
+  // PowerPC execution trace
+  config.SetEmpty("PowerPCTrace");
+  config.SetEmpty("PowerPCTraceFields");
 #endif
 #else
   config.Set("InputSystem", "sdl");
@@ -1562,20 +1909,36 @@ static void Help(void)
   puts("General Options:");
   puts("  -?, -h, -help, --help   Print this help text");
   puts("  -print-games            List supported games and quit");
+  puts("  -scan-roms=<dir>        List the games in a ROM directory and quit");
   printf("  -game-xml-file=<file>   ROM set definition file [Default: %s]\n", s_gameXMLFilePath.c_str());
   printf("  -log-output=<outputs>   Log output destination(s) [Default: %s]\n", s_logFilePath.c_str());
   puts("  -log-level=<level>      Logging threshold [Default: info]");
   puts("");
   puts("Core Options:");
   puts("  -ppc-frequency=<mhz>    PowerPC frequency (default varies by stepping)");
+  puts("  -ppc-fastmem            Map PowerPC memory through the host MMU (Linux x86-64)");
+  puts("  -huge-pages=<mode>      Huge pages for emulated memory: off, transparent [Default],");
+  puts("                          explicit");
   puts("  -no-threads             Disable multi-threading entirely");
   puts("  -gpu-multi-threaded     Run graphics rendering in separate thread [Default]");
   puts("  -no-gpu-thread          Run graphics rendering in main thread");
+  puts("  -gpu-dirty-tracking=<m> Track graphics memory writes: software [Default], hardware");
+  puts("  -texture-threads=<n>    Threads decoding texture uploads [Default: 0, PowerPC thread]");
+  puts("  -thread-wake-spin=<us>  Time board threads spin waiting for a frame [Default: 50]");
+  puts("  -thread-sync-spin=<us>  Time main thread spins waiting for the boards [Default: 200]");
+  puts("  -thread-affinity=<mode> Pin threads to CPU cores: none [Default], auto");
+  puts("  -thread-priority=<p>    Emulation thread priority: low, normal [Default], high");
+  puts("  -sound-thread-realtime  Run sound board thread with real-time priority");
   puts("  -load-state=<file>      Load save state after starting");
+  puts("  -rewind                 Keep a history to step back through with Backspace");
+  puts("  -rewind-interval=<n>    Frames between rewind snapshots [Default: 30]");
+  puts("  -rewind-memory=<mb>     Memory for the rewind history in MB [Default: 256]");
   puts("");
   puts("Video Options:");
   puts("  -res=<x>,<y>            Resolution [Default: 496,384]");
   puts("  -ss=<n>                 Supersampling (range 1-8)");
+  puts("  -dynamic-res            Lower the supersampling scale when the GPU can't keep up");
+  puts("  -dynamic-res-min=<s>    Lowest supersampling scale for -dynamic-res [Default: 1.0]");
   puts("  -window-pos=<x>,<y>     Window position [Default: centered]");
   puts("  -window                 Windowed mode [Default]");
   puts("  -borderless             Windowed mode with no border");
@@ -1585,6 +1948,8 @@ static void Help(void)
   puts("                          background layer to screen width");
   puts("  -stretch                Fit viewport to resolution, ignoring aspect ratio");
   puts("  -no-throttle            Disable frame rate lock");
+  puts("  -frameskip=<n>          Skip rendering of up to <n> consecutive frames when");
+  puts("                          running too slowly [Default: 0 (disabled)]");
   puts("  -vsync                  Lock to vertical refresh rate [Default]");
   puts("  -no-vsync               Do not lock to vertical refresh rate");
   puts("  -true-hz                Use true Model 3 refresh rate of 57.524 Hz");
@@ -1603,6 +1968,9 @@ static void Help(void)
   puts("  -frag-shader-fog=<file> Load Real3D scroll fog fragment shader (new engine)");
   puts("  -vert-shader-2d=<file>  Load tile map vertex shader");
   puts("  -frag-shader-2d=<file>  Load tile map fragment shader");
+  puts("  -tilegen-renderer=<r>   Draw tile maps with: gpu [Default], cpu, verify (both,");
+  puts("                          logging differences)");
+  puts("  -tilegen-threads=<n>    Threads drawing tile maps with the CPU [Default: 0]");
   puts("  -print-gl-info          Print OpenGL driver information and quit");
   puts("");
   puts("Audio Options:");
@@ -1614,6 +1982,7 @@ static void Help(void)
   puts("  -flip-stereo            Swap left and right audio channels");
   puts("  -no-sound               Disable sound board emulation (sound effects)");
   puts("  -no-dsb                 Disable Digital Sound Board (MPEG music)");
+  puts("  -no-sound-idle-skip     Do not skip idle loops on the sound CPUs");
   puts("  -new-scsp               New SCSP engine based on MAME [Default]");
   puts("  -legacy-scsp            Legacy SCSP engine by ElSemi");
   puts("");
@@ -1623,6 +1992,9 @@ static void Help(void)
   puts("  -net                    Enable net board");
   puts("  -simulate-netboard      Simulate the net board [Default]");
   puts("  -emulate-netboard       Emulate the net board (requires -no-threads)");
+  puts("  -net-rollback=<n>       Run up to n frames ahead of the other machines,");
+  puts("                          rolling back on mispredictions [Default: 0]");
+  puts("  -net-delay=<ms>         Delay sent net data, for testing rollback [Default: 0]");
   puts("");
 #endif
   puts("Input Options:");
@@ -1640,10 +2012,24 @@ static void Help(void)
   puts("  -disable-debugger       Completely disable debugger functionality");
   puts("  -enter-debugger         Enter debugger at start of emulation");
 #endif // SUPERMODEL_DEBUGGER
+#ifdef PPC_TRACE
+  puts("  -ppc-trace=<file>       Record every PowerPC instruction executed to <file>");
+  puts("                          (decode it with tracedecode)");
+  puts("  -ppc-trace-fields=<f>   Also record: ea (first address accessed), cycles");
+#endif
+#ifdef PPC_LOCKSTEP
+  puts("  -verify-ppc             Check every PowerPC block against reference memory");
+  puts("                          handlers and halt at the first divergence (slow)");
+#endif
 #ifdef DEBUG
   puts("  -gfx-state=<file>       Produce graphics analysis for save state (works only");
   puts("                          with the legacy 3D engine and requires a");
   puts("                          GraphicsAnalysis directory to exist)");
+  puts("  -gfx-bench=<dir>        Benchmark the 3D engine on every save state in <dir>");
+  puts("                          and print timings and frame hashes");
+  puts("  -gfx-bench-frames=<n>   Frames to render per state [Default: 100]");
+  puts("  -gfx-bench-ref=<file>   Flag states whose frame hash differs from a report");
+  puts("                          saved from a previous -gfx-bench run");
 #endif
   puts("");
 }
@@ -1655,6 +2041,7 @@ struct ParsedCommandLine
   bool error = false;
   bool print_help = false;
   bool print_games = false;
+  std::string scan_roms;
   bool print_gl_info = false;
   bool config_inputs = false;
   bool print_inputs = false;
@@ -1662,6 +2049,9 @@ struct ParsedCommandLine
   bool enter_debugger = false;
 #ifdef DEBUG
   std::string gfx_state;
+  std::string gfx_bench;
+  std::string gfx_bench_ref;
+  unsigned gfx_bench_frames = 100;
 #endif
 
   ParsedCommandLine()
@@ -1682,6 +2072,25 @@ static ParsedCommandLine ParseCommandLine(const std::vector<std::string>& argv)
     { "-game-xml-file",         "GameXMLFile"             },
     { "-load-state",            "InitStateFile"           },
     { "-ppc-frequency",         "PowerPCFrequency"        },
+    { "-thread-wake-spin",      "ThreadWakeSpin"          },
+    { "-thread-sync-spin",      "ThreadSyncSpin"          },
+    { "-thread-affinity",       "ThreadAffinity"          },
+    { "-gpu-dirty-tracking",    "GPUDirtyTracking"        },
+    { "-texture-threads",       "TextureThreads"          },
+    { "-huge-pages",            "HugePages"               },
+    { "-thread-priority",       "ThreadPriority"          },
+    { "-frameskip",             "MaxFrameSkip"            },
+    { "-dynamic-res-min",       "DynamicResolutionMin"    },
+    { "-rewind-interval",       "RewindInterval"          },
+    { "-rewind-memory",         "RewindMemory"            },
+#ifdef NET_BOARD
+    { "-net-rollback",          "NetRollback"             },
+    { "-net-delay",             "NetDelay"                },
+#endif
+#ifdef PPC_TRACE
+    { "-ppc-trace",             "PowerPCTrace"            },
+    { "-ppc-trace-fields",      "PowerPCTraceFields"      },
+#endif
     { "-crosshairs",            "Crosshairs"              },
     { "-crosshair-style",       "CrosshairStyle"          },
     { "-vert-shader",           "VertexShader"            },
@@ -1690,6 +2099,8 @@ static ParsedCommandLine ParseCommandLine(const std::vector<std::string>& argv)
     { "-frag-shader-fog",       "FragmentShaderFog"       },
     { "-vert-shader-2d",        "VertexShader2D"          },
     { "-frag-shader-2d",        "FragmentShader2D"        },
+    { "-tilegen-renderer",      "TileGenRenderer"         },
+    { "-tilegen-threads",       "TileGenThreads"          },
     { "-sound-volume",          "SoundVolume"             },
     { "-music-volume",          "MusicVolume"             },
     { "-balance",               "Balance"                 },
@@ -1703,6 +2114,10 @@ static ParsedCommandLine ParseCommandLine(const std::vector<std::string>& argv)
   const std::map<std::string, std::pair<std::string, bool>> bool_options
   { // -option
     { "-threads",             { "MultiThreaded",    true } },
+    { "-ppc-fastmem",         { "PowerPCFastMem",   true } },
+#ifdef PPC_LOCKSTEP
+    { "-verify-ppc",          { "VerifyPowerPC",    true } },
+#endif
     { "-no-threads",          { "MultiThreaded",    false } },
     { "-gpu-multi-threaded",  { "GPUMultiThreaded", true } },
     { "-no-gpu-thread",       { "GPUMultiThreaded", false } },
@@ -1722,6 +2137,10 @@ static ParsedCommandLine ParseCommandLine(const std::vector<std::string>& argv)
     { "-vsync",               { "VSync",            true } },
     { "-no-vsync",            { "VSync",            false } },
     { "-show-fps",            { "ShowFrameRate",    true } },
+    { "-dynamic-res",         { "DynamicResolution", true } },
+    { "-no-dynamic-res",      { "DynamicResolution", false } },
+    { "-rewind",              { "Rewind", true } },
+    { "-no-rewind",           { "Rewind", false } },
     { "-no-fps",              { "ShowFrameRate",    false } },
     { "-new3d",               { "New3DEngine",      true } },
     { "-quad-rendering",      { "QuadRendering",    true } },
@@ -1732,6 +2151,9 @@ static ParsedCommandLine ParseCommandLine(const std::vector<std::string>& argv)
     { "-no-sound",            { "EmulateSound",     false } },
     { "-dsb",                 { "EmulateDSB",       true } },
     { "-no-dsb",              { "EmulateDSB",       false } },
+    { "-sound-idle-skip",     { "SoundIdleSkip",    true } },
+    { "-no-sound-idle-skip",  { "SoundIdleSkip",    false } },
+    { "-sound-thread-realtime", { "SoundThreadRealtime", true } },
     { "-legacy-scsp",         { "LegacySoundDSP",   true } },
     { "-new-scsp",            { "LegacySoundDSP",   false } },
 #ifdef NET_BOARD
@@ -1791,6 +2213,17 @@ static ParsedCommandLine ParseCommandLine(const std::vector<std::string>& argv)
         cmd_line.print_help = true;
       else if (arg == "-print-games")
         cmd_line.print_games = true;
+      else if (arg == "-scan-roms" || arg.find("-scan-roms=") == 0)
+      {
+        std::vector<std::string> parts = Util::Format(arg).Split('=');
+        if (parts.size() != 2)
+        {
+          ErrorLog("'-scan-roms' requires a directory name.");
+          cmd_line.error = true;
+        }
+        else
+          cmd_line.scan_roms = parts[1];
+      }
       else if (arg == "-res" || arg.find("-res=") == 0)
       {
         std::vector<std::string> parts = Util::Format(arg).Split('=');
@@ -1887,6 +2320,39 @@ static ParsedCommandLine ParseCommandLine(const std::vector<std::string>& argv)
         else
           cmd_line.gfx_state = parts[1];
       }
+      else if (arg == "-gfx-bench" || arg.find("-gfx-bench=") == 0)
+      {
+        std::vector<std::string> parts = Util::Format(arg).Split('=');
+        if (parts.size() != 2)
+        {
+          ErrorLog("'-gfx-bench' requires a directory name.");
+          cmd_line.error = true;
+        }
+        else
+          cmd_line.gfx_bench = parts[1];
+      }
+      else if (arg == "-gfx-bench-ref" || arg.find("-gfx-bench-ref=") == 0)
+      {
+        std::vector<std::string> parts = Util::Format(arg).Split('=');
+        if (parts.size() != 2)
+        {
+          ErrorLog("'-gfx-bench-ref' requires a file name.");
+          cmd_line.error = true;
+        }
+        else
+          cmd_line.gfx_bench_ref = parts[1];
+      }
+      else if (arg == "-gfx-bench-frames" || arg.find("-gfx-bench-frames=") == 0)
+      {
+        std::vector<std::string> parts = Util::Format(arg).Split('=');
+        if (parts.size() != 2 || atoi(parts[1].c_str()) <= 0)
+        {
+          ErrorLog("'-gfx-bench-frames' requires a number of frames.");
+          cmd_line.error = true;
+        }
+        else
+          cmd_line.gfx_bench_frames = atoi(parts[1].c_str());
+      }
 #endif
       else
       {
@@ -1959,8 +2425,11 @@ int main(int argc, char **argv)
   }
 #ifdef DEBUG
   s_gfxStatePath.assign(cmd_line.gfx_state);
+  s_gfxBenchPath.assign(cmd_line.gfx_bench);
+  s_gfxBenchRefFile.assign(cmd_line.gfx_bench_ref);
+  s_gfxBenchFrames = cmd_line.gfx_bench_frames;
 #endif
-  bool print_games = cmd_line.print_games;
+  bool print_games = cmd_line.print_games || !cmd_line.scan_roms.empty();
   bool rom_specified = !cmd_line.rom_files.empty();
   if (!rom_specified && !print_games && !cmd_line.config_inputs && !cmd_line.print_inputs)
   {
@@ -1983,6 +2452,11 @@ int main(int argc, char **argv)
     {
       std::string xml_file = config3["GameXMLFile"].ValueAs<std::string>();
       GameLoader loader(xml_file);
+      if (!cmd_line.scan_roms.empty())
+      {
+        PrintROMLibrary(cmd_line.scan_roms, loader);
+        return 0;
+      }
       if (print_games)
       {
         PrintGameList(xml_file, loader.GetGames());
@@ -2045,7 +2519,7 @@ int main(int argc, char **argv)
 
   // Create Model 3 emulator
 #ifdef DEBUG
-  Model3 = s_gfxStatePath.empty() ? static_cast<IEmulator *>(new CModel3(s_runtime_config)) : static_cast<IEmulator *>(new CModel3GraphicsState(s_runtime_config, s_gfxStatePath));
+  Model3 = s_gfxStatePath.empty() && s_gfxBenchPath.empty() ? static_cast<IEmulator *>(new CModel3(s_runtime_config)) : static_cast<IEmulator *>(new CModel3GraphicsState(s_runtime_config, s_gfxStatePath));
 #else
   Model3 = new CModel3(s_runtime_config);
 #endif
@@ -30,6 +30,36 @@
 #include "Supermodel.h"
 #include "SDLIncludes.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#undef CreateSemaphore
+#undef CreateMutex
+#undef CreateEvent
+#if !defined(WINAPI_FAMILY) || WINAPI_FAMILY == WINAPI_FAMILY_DESKTOP_APP
+#define THREAD_AFFINITY_WIN32
+#endif
+#endif
+
 void CThread::Sleep(UINT32 ms)
 {
 	SDL_Delay(ms);
@@ -72,6 +102,302 @@ CMutex *CThread::CreateMutex()
 	return new CMutex(impl);
 }
 
+/*
+ * Parking word shared by CEvent and CBarrier.  Threads spin on the value
+ * first and then block while it still holds the value they last saw.  On
+ * Linux the value itself is the futex; elsewhere an SDL mutex and condition
+ * variable stand in for it.  The waiter count lets the signalling side skip
+ * the system call entirely when nobody has gone to sleep.
+ */
+struct ParkingWord
+{
+	std::atomic<int> value;
+	std::atomic<int> waiters;
+	UINT32 spinMicros;
+#ifndef __linux__
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+#endif
+};
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex requires a plain int");
+
+static ParkingWord *CreateParkingWord(int value, UINT32 spinMicros)
+{
+	ParkingWord *word = new ParkingWord;
+	word->value = value;
+	word->waiters = 0;
+	// Spinning only pays off when the signalling thread can run alongside us
+	word->spinMicros = std::thread::hardware_concurrency() > 1 ? spinMicros : 0;
+#ifndef __linux__
+	word->mutex = SDL_CreateMutex();
+	word->cond = SDL_CreateCond();
+	if (word->mutex == NULL || word->cond == NULL)
+	{
+		if (word->mutex != NULL)
+			SDL_DestroyMutex(word->mutex);
+		if (word->cond != NULL)
+			SDL_DestroyCond(word->cond);
+		delete word;
+		return NULL;
+	}
+#endif
+	return word;
+}
+
+static void DestroyParkingWord(ParkingWord *word)
+{
+#ifndef __linux__
+	SDL_DestroyCond(word->cond);
+	SDL_DestroyMutex(word->mutex);
+#endif
+	delete word;
+}
+
+static inline void CPURelax()
+{
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+	_mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#else
+	std::this_thread::yield();
+#endif
+}
+
+// Spins until done() returns true or the spin budget runs out
+template <typename Pred>
+static bool Spin(const ParkingWord *word, Pred done)
+{
+	if (word->spinMicros == 0)
+		return false;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(word->spinMicros);
+	for (unsigned i = 1; ; i++)
+	{
+		if (done())
+			return true;
+		CPURelax();
+		if ((i & 63) == 0 && std::chrono::steady_clock::now() >= deadline)
+			return false;
+	}
+}
+
+// Blocks while the value is still 'value'
+static bool ParkWhile(ParkingWord *word, int value)
+{
+	bool ok = true;
+	word->waiters.fetch_add(1);
+#ifdef __linux__
+	while (word->value.load() == value)
+		syscall(SYS_futex, reinterpret_cast<int *>(&word->value), FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+	if (SDL_LockMutex(word->mutex) == 0)
+	{
+		while (ok && word->value.load() == value)
+			ok = SDL_CondWait(word->cond, word->mutex) == 0;
+		SDL_UnlockMutex(word->mutex);
+	}
+	else
+		ok = false;
+#endif
+	word->waiters.fetch_sub(1);
+	return ok;
+}
+
+// Wakes all threads parked on the word, must be called after changing the value
+static bool Unpark(ParkingWord *word)
+{
+	if (word->waiters.load() == 0)
+		return true;
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<int *>(&word->value), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	return true;
+#else
+	if (SDL_LockMutex(word->mutex) != 0)
+		return false;
+	bool ok = SDL_CondBroadcast(word->cond) == 0;
+	SDL_UnlockMutex(word->mutex);
+	return ok;
+#endif
+}
+
+CEvent *CThread::CreateEvent(UINT32 spinMicros)
+{
+	ParkingWord *impl = CreateParkingWord(0, spinMicros);
+	if (impl == NULL)
+		return NULL;
+	return new CEvent(impl);
+}
+
+CBarrier *CThread::CreateBarrier(UINT32 spinMicros)
+{
+	ParkingWord *impl = CreateParkingWord(0, spinMicros);
+	if (impl == NULL)
+		return NULL;
+	return new CBarrier(impl);
+}
+
+bool CThread::SetAffinity(const std::vector<unsigned> &cpus)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (unsigned cpu : cpus)
+	{
+		if (cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+	}
+	int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err != 0)
+	{
+		SDL_SetError("pthread_setaffinity_np: %s", strerror(err));
+		return false;
+	}
+	return true;
+#elif defined(THREAD_AFFINITY_WIN32)
+	DWORD_PTR mask = 0;
+	for (unsigned cpu : cpus)
+	{
+		if (cpu < sizeof(mask) * 8)
+			mask |= DWORD_PTR(1) << cpu;
+	}
+	if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0)
+	{
+		SDL_SetError("SetThreadAffinityMask failed (error %lu)", ::GetLastError());
+		return false;
+	}
+	return true;
+#else
+	SDL_SetError("Thread affinity is not supported on this platform");
+	return false;
+#endif
+}
+
+bool CThread::SetPriority(Priority priority)
+{
+#if defined(__linux__)
+	if (priority == PRIORITY_REALTIME)
+	{
+		// Low in the FIFO range so that kernel interrupt threads still preempt us
+		sched_param param;
+		param.sched_priority = std::min(sched_get_priority_min(SCHED_FIFO) + 9, sched_get_priority_max(SCHED_FIFO));
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (err != 0)
+		{
+			SDL_SetError("pthread_setschedparam: %s", strerror(err));
+			return false;
+		}
+		return true;
+	}
+	// Linux applies nice values per thread
+	int nice = priority == PRIORITY_LOW ? 5 : (priority == PRIORITY_HIGH ? -5 : 0);
+	if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) != 0)
+	{
+		SDL_SetError("setpriority: %s", strerror(errno));
+		return false;
+	}
+	return true;
+#else
+	static const SDL_ThreadPriority sdlPriority[] = { SDL_THREAD_PRIORITY_LOW, SDL_THREAD_PRIORITY_NORMAL, SDL_THREAD_PRIORITY_HIGH, SDL_THREAD_PRIORITY_TIME_CRITICAL };
+	return SDL_SetThreadPriority(sdlPriority[priority]) == 0;
+#endif
+}
+
+std::vector<std::vector<unsigned>> CThread::GetPhysicalCores()
+{
+	std::vector<std::vector<unsigned>> cores;
+#if defined(__linux__)
+	// Only consider the CPUs this process may run on (cgroups, taskset)
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return cores;
+	std::ifstream online("/sys/devices/system/cpu/online");
+	std::string line;
+	std::vector<unsigned> cpus;
+	if (!std::getline(online, line) || !ParseCPUList(line, &cpus))
+		return cores;
+	for (unsigned cpu : cpus)
+	{
+		if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+			continue;
+		std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list");
+		std::vector<unsigned> siblings;
+		if (!std::getline(file, line) || !ParseCPUList(line, &siblings))
+			return std::vector<std::vector<unsigned>>();
+		siblings.erase(std::remove_if(siblings.begin(), siblings.end(), [&allowed](unsigned sibling) { return sibling >= CPU_SETSIZE || !CPU_ISSET(sibling, &allowed); }), siblings.end());
+		if (std::find(cores.begin(), cores.end(), siblings) == cores.end())
+			cores.push_back(siblings);
+	}
+#elif defined(THREAD_AFFINITY_WIN32)
+	DWORD size = 0;
+	GetLogicalProcessorInformation(NULL, &size);
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (info.empty() || !GetLogicalProcessorInformation(info.data(), &size))
+		return cores;
+	for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION &entry : info)
+	{
+		if (entry.Relationship != RelationProcessorCore)
+			continue;
+		std::vector<unsigned> siblings;
+		for (unsigned cpu = 0; cpu < sizeof(entry.ProcessorMask) * 8; cpu++)
+		{
+			if (entry.ProcessorMask & (ULONG_PTR(1) << cpu))
+				siblings.push_back(cpu);
+		}
+		if (!siblings.empty())
+			cores.push_back(siblings);
+	}
+#endif
+	std::sort(cores.begin(), cores.end());
+	return cores;
+}
+
+// Number of logical CPUs the host has, including offline ones, bounding the
+// CPU numbers ParseCPUList() accepts
+static unsigned long NumHardwareThreads()
+{
+#ifdef __linux__
+	long configured = sysconf(_SC_NPROCESSORS_CONF);
+	if (configured > 0)
+		return (unsigned long)configured;
+#endif
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+bool CThread::ParseCPUList(const std::string &list, std::vector<unsigned> *cpus)
+{
+	cpus->clear();
+	const unsigned long numCPUs = NumHardwareThreads();
+	const char *p = list.c_str();
+	while (*p != '\0' && *p != '\n')
+	{
+		char *end;
+		unsigned long first = strtoul(p, &end, 10);
+		if (end == p)
+			return false;
+		unsigned long last = first;
+		p = end;
+		if (*p == '-')
+		{
+			last = strtoul(++p, &end, 10);
+			if (end == p || last < first)
+				return false;
+			p = end;
+		}
+		// CPUs the host does not have are dropped
+		last = std::min(last, numCPUs - 1);
+		for (unsigned long cpu = first; cpu <= last; cpu++)
+			cpus->push_back((unsigned)cpu);
+		if (*p == ',')
+			p++;
+		else if (*p != '\0' && *p != '\n')
+			return false;
+	}
+	std::sort(cpus->begin(), cpus->end());
+	cpus->erase(std::unique(cpus->begin(), cpus->end()), cpus->end());
+	return true;
+}
+
 const char *CThread::GetLastError()
 {
 	return SDL_GetError();
@@ -183,3 +509,76 @@ bool CMutex::Unlock()
 {
 	return SDL_mutexV((SDL_mutex*)m_impl) == 0;
 }
+
+CEvent::CEvent(void *impl) : m_impl(impl)
+{
+	//
+}
+
+CEvent::~CEvent()
+{
+	DestroyParkingWord((ParkingWord*)m_impl);
+}
+
+bool CEvent::Set()
+{
+	ParkingWord *word = (ParkingWord*)m_impl;
+	word->value.store(1);
+	return Unpark(word);
+}
+
+bool CEvent::Wait()
+{
+	ParkingWord *word = (ParkingWord*)m_impl;
+	bool spun = false;
+	while (word->value.exchange(0, std::memory_order_acquire) == 0)
+	{
+		if (!spun)
+		{
+			spun = true;
+			if (Spin(word, [word] { return word->value.load(std::memory_order_relaxed) != 0; }))
+				continue;
+		}
+		if (!ParkWhile(word, 0))
+			return false;
+	}
+	return true;
+}
+
+CBarrier::CBarrier(void *impl) : m_impl(impl)
+{
+	//
+}
+
+CBarrier::~CBarrier()
+{
+	DestroyParkingWord((ParkingWord*)m_impl);
+}
+
+bool CBarrier::Reset(UINT32 count)
+{
+	((ParkingWord*)m_impl)->value.store((int)count);
+	return true;
+}
+
+bool CBarrier::Arrive()
+{
+	ParkingWord *word = (ParkingWord*)m_impl;
+	if (word->value.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return true;
+	return Unpark(word);
+}
+
+bool CBarrier::Wait()
+{
+	ParkingWord *word = (ParkingWord*)m_impl;
+	Spin(word, [word] { return word->value.load(std::memory_order_acquire) == 0; });
+	int remaining = word->value.load(std::memory_order_acquire);
+	while (remaining != 0)
+	{
+		if (!ParkWhile(word, remaining))
+			return false;
+		remaining = word->value.load(std::memory_order_acquire);
+	}
+	return true;
+}
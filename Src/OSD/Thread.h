@@ -31,10 +31,13 @@
 #include "Types.h"
 
 #include <string>
+#include <vector>
 
 class CSemaphore;
 class CMutex;
 class CCondVar;
+class CEvent;
+class CBarrier;
 
 typedef int (*ThreadStart)(void *startParam);
 
@@ -52,6 +55,18 @@ private:
 	CThread(const std::string &name, void *impl);
 
 public:
+	/*
+	 * Scheduling priorities for SetPriority().  PRIORITY_REALTIME is SCHED_FIFO on Linux and time-critical on Windows,
+	 * and normally requires elevated privileges.
+	 */
+	enum Priority
+	{
+		PRIORITY_LOW,
+		PRIORITY_NORMAL,
+		PRIORITY_HIGH,
+		PRIORITY_REALTIME
+	};
+
 	/*
 	 * Sleep
 	 *
@@ -93,7 +108,51 @@ public:
 	 * Creates a new mutex.
 	 */
 	static CMutex *CreateMutex();
+
+	/*
+	 * CreateEvent
+	 *
+	 * Creates a new auto-reset event.  Waiters spin for up to spinMicros microseconds before blocking.
+	 */
+	static CEvent *CreateEvent(UINT32 spinMicros);
+
+	/*
+	 * CreateBarrier
+	 *
+	 * Creates a new countdown barrier.  Waiters spin for up to spinMicros microseconds before blocking.
+	 */
+	static CBarrier *CreateBarrier(UINT32 spinMicros);
 	
+	/*
+	 * SetAffinity
+	 *
+	 * Restricts the calling thread to the given logical CPUs.
+	 */
+	static bool SetAffinity(const std::vector<unsigned> &cpus);
+
+	/*
+	 * SetPriority
+	 *
+	 * Sets the scheduling priority of the calling thread.
+	 */
+	static bool SetPriority(Priority priority);
+
+	/*
+	 * GetPhysicalCores
+	 *
+	 * Returns the host's logical CPUs grouped by physical core, so that SMT siblings share an entry.  Returns an empty
+	 * list if the topology cannot be determined.
+	 */
+	static std::vector<std::vector<unsigned>> GetPhysicalCores();
+
+	/*
+	 * ParseCPUList
+	 *
+	 * Parses a list of logical CPUs in the form "0,2,4-7".  CPUs beyond the host's hardware thread count are dropped.
+	 * Returns false if the list is malformed.
+	 */
+	static bool ParseCPUList(const std::string &list, std::vector<unsigned> *cpus);
+
 	/*
 	 * GetLastError
 	 *
@@ -239,4 +298,80 @@ public:
 	bool Unlock();
 };
 
+/*
+ * CEvent
+ *
+ * Class that represents an auto-reset event for handing work from one thread
+ * to another.  Wait() first spins on the event for the configured budget, so
+ * that a Set() arriving shortly afterwards costs no system call on either
+ * side, and only then parks the thread in the kernel (a futex on Linux).
+ */
+class CEvent
+{
+friend class CThread;
+
+private:
+	void *m_impl;
+
+	CEvent(void *impl);
+
+public:
+	~CEvent();
+
+	/*
+	 * Set
+	 *
+	 * Signals this event, resuming the thread that is waiting on it (if any).
+	 */
+	bool Set();
+
+	/*
+	 * Wait
+	 *
+	 * Suspends the calling thread until this event is signalled, then resets it.
+	 */
+	bool Wait();
+};
+
+/*
+ * CBarrier
+ *
+ * Class that represents a countdown barrier.  One thread arms it with the
+ * number of threads it is handing work to and waits until each of them has
+ * arrived.  Waiting spins before blocking, like CEvent.
+ */
+class CBarrier
+{
+friend class CThread;
+
+private:
+	void *m_impl;
+
+	CBarrier(void *impl);
+
+public:
+	~CBarrier();
+
+	/*
+	 * Reset
+	 *
+	 * Arms this barrier for the given number of arrivals.  Must not be called while threads are still to arrive.
+	 */
+	bool Reset(UINT32 count);
+
+	/*
+	 * Arrive
+	 *
+	 * Counts the calling thread in, resuming the waiting thread if it was the last one.
+	 */
+	bool Arrive();
+
+	/*
+	 * Wait
+	 *
+	 * Suspends the calling thread until all threads have arrived.
+	 */
+	bool Wait();
+};
+
 #endif	// INCLUDED_THREADS_H
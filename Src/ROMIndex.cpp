@@ -0,0 +1,253 @@
+#include "ROMIndex.h"
+#include "OSD/Logger.h"
+#include "Pkgs/unzip.h"
+#include "Util/Format.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+/*
+ * Index file format (native byte order, rebuilt from scratch if the header
+ * does not match):
+ *
+ *  "SMRI" + version (uint32)
+ *  number of archives (uint32), then for each archive:
+ *    path (uint16 length + chars), mtime (int64), size (uint64), valid (uint8),
+ *    number of entries (uint32), then for each entry:
+ *      filename (uint16 length + chars), uncompressed size (uint32), crc32 (uint32)
+ */
+static const char s_magic[4] = { 'S', 'M', 'R', 'I' };
+static const uint32_t s_version = 1;
+static const size_t s_min_entry_size = sizeof(uint16_t) + 2 * sizeof(uint32_t);
+
+template <typename T>
+static void Write(std::ofstream &file, T value)
+{
+  file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void WriteString(std::ofstream &file, const std::string &str)
+{
+  Write(file, uint16_t(str.size()));
+  file.write(str.data(), str.size());
+}
+
+template <typename T>
+static bool Read(std::ifstream &file, T *value)
+{
+  return bool(file.read(reinterpret_cast<char *>(value), sizeof(*value)));
+}
+
+static bool ReadString(std::ifstream &file, std::string *str)
+{
+  uint16_t length;
+  if (!Read(file, &length))
+    return false;
+  str->resize(length);
+  return bool(file.read(&(*str)[0], length));
+}
+
+bool ROMIndex::Load(const std::string &index_file)
+{
+  m_archives_by_path.clear();
+
+  std::ifstream file(index_file, std::ios::binary | std::ios::ate);
+  if (!file)
+    return true;  // not created yet
+  const std::streamoff file_size = file.tellg();
+  file.seekg(0);
+
+  char magic[4];
+  uint32_t version;
+  uint32_t num_archives;
+  if (!file.read(magic, sizeof(magic)) || memcmp(magic, s_magic, sizeof(magic)) != 0 || !Read(file, &version) || version != s_version || !Read(file, &num_archives))
+  {
+    ErrorLog("'%s' is not a valid ROM index. It will be rebuilt.", index_file.c_str());
+    return true;
+  }
+
+  for (uint32_t i = 0; i < num_archives; i++)
+  {
+    std::string path;
+    Archive archive;
+    uint8_t valid;
+    uint32_t num_entries;
+    if (!ReadString(file, &path) || !Read(file, &archive.mtime) || !Read(file, &archive.size) || !Read(file, &valid) || !Read(file, &num_entries))
+      break;
+    archive.valid = valid != 0;
+    // A corrupt count must not make us allocate more entries than the file holds
+    if (num_entries > uint64_t(file_size - file.tellg()) / s_min_entry_size)
+    {
+      file.setstate(std::ios::failbit);
+      break;
+    }
+    archive.entries.resize(num_entries);
+    for (auto &entry: archive.entries)
+    {
+      if (!ReadString(file, &entry.filename) || !Read(file, &entry.uncompressed_size) || !Read(file, &entry.crc32))
+        break;
+    }
+    if (!file)
+      break;
+    m_archives_by_path[path] = std::move(archive);
+  }
+
+  if (!file)
+  {
+    ErrorLog("ROM index '%s' is truncated. It will be rebuilt.", index_file.c_str());
+    m_archives_by_path.clear();
+    return true;
+  }
+  return false;
+}
+
+bool ROMIndex::Save(const std::string &index_file) const
+{
+  std::ofstream file(index_file, std::ios::binary | std::ios::trunc);
+  if (!file)
+  {
+    ErrorLog("Unable to write ROM index '%s'.", index_file.c_str());
+    return true;
+  }
+
+  file.write(s_magic, sizeof(s_magic));
+  Write(file, s_version);
+  Write(file, uint32_t(m_archives_by_path.size()));
+  for (auto &v: m_archives_by_path)
+  {
+    const Archive &archive = v.second;
+    WriteString(file, v.first);
+    Write(file, archive.mtime);
+    Write(file, archive.size);
+    Write(file, uint8_t(archive.valid));
+    Write(file, uint32_t(archive.entries.size()));
+    for (auto &entry: archive.entries)
+    {
+      WriteString(file, entry.filename);
+      Write(file, entry.uncompressed_size);
+      Write(file, entry.crc32);
+    }
+  }
+
+  if (!file)
+  {
+    ErrorLog("Unable to write ROM index '%s'.", index_file.c_str());
+    return true;
+  }
+  return false;
+}
+
+void ROMIndex::ReadArchive(Archive *archive, const std::string &zipfilename)
+{
+  archive->valid = false;
+  archive->entries.clear();
+
+  unzFile zf = unzOpen(zipfilename.c_str());
+  if (NULL == zf)
+    return;
+
+  int err;
+  for (err = unzGoToFirstFile(zf); err == UNZ_OK; err = unzGoToNextFile(zf))
+  {
+    unz_file_info file_info;
+    char filename_buffer[256];
+    if (UNZ_OK != unzGetCurrentFileInfo(zf, &file_info, filename_buffer, sizeof(filename_buffer), NULL, 0, NULL, 0))
+      continue;
+    filename_buffer[sizeof(filename_buffer) - 1] = '\0';  // not terminated if the name fills the buffer
+    Entry entry;
+    entry.filename = filename_buffer;
+    entry.uncompressed_size = uint32_t(file_info.uncompressed_size);
+    entry.crc32 = uint32_t(file_info.crc);
+    archive->entries.push_back(entry);
+  }
+  archive->valid = err == UNZ_END_OF_LIST_OF_FILE;
+  unzClose(zf);
+}
+
+bool ROMIndex::Scan(Stats *stats, const std::string &directory, unsigned num_threads)
+{
+  namespace fs = std::filesystem;
+  *stats = Stats();
+
+  fs::path dir = fs::path(directory).lexically_normal();
+  if (!dir.has_filename())
+    dir = dir.parent_path();
+
+  // Find the zip archives in the directory. Unchanged ones keep their
+  // entries; new and changed ones are opened below (including those that
+  // could not be read last time, if they have changed since).
+  std::error_code ec, file_ec;
+  std::map<std::string, Archive> found;
+  std::vector<std::pair<std::string, Archive *>> to_scan;
+  for (const auto &dir_entry: fs::directory_iterator(dir, ec))
+  {
+    if (!dir_entry.is_regular_file(file_ec) || Util::ToLower(dir_entry.path().extension().string()) != ".zip")
+      continue;
+    std::string path = (dir / dir_entry.path().filename()).string();
+    Archive &archive = found[path];
+    archive.size = dir_entry.file_size(file_ec);
+    archive.mtime = int64_t(dir_entry.last_write_time(file_ec).time_since_epoch().count());
+    auto it = m_archives_by_path.find(path);
+    if (it != m_archives_by_path.end() && it->second.size == archive.size && it->second.mtime == archive.mtime)
+    {
+      archive.valid = it->second.valid;
+      archive.entries = std::move(it->second.entries);
+    }
+    else
+      to_scan.emplace_back(path, &archive);
+  }
+  if (ec)
+  {
+    ErrorLog("Unable to read ROM directory '%s': %s", directory.c_str(), ec.message().c_str());
+    return true;
+  }
+
+  // Open the new and changed archives in parallel
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = unsigned(std::min<size_t>(num_threads, to_scan.size()));
+  std::atomic<size_t> next(0);
+  auto worker = [&]()
+  {
+    for (size_t i = next++; i < to_scan.size(); i = next++)
+      ReadArchive(to_scan[i].second, to_scan[i].first);
+  };
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < num_threads; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &thread: threads)
+    thread.join();
+
+  for (auto &v: to_scan)
+  {
+    if (!v.second->valid)
+      ErrorLog("Unable to read the contents of '%s'.", v.first.c_str());
+  }
+
+  // Replace this directory's archives in the index, keeping other directories
+  for (auto it = m_archives_by_path.begin(); it != m_archives_by_path.end(); )
+  {
+    if (fs::path(it->first).parent_path() == dir)
+    {
+      if (!found.count(it->first))
+        stats->removed++;
+      it = m_archives_by_path.erase(it);
+    }
+    else
+      ++it;
+  }
+  stats->archives = found.size();
+  stats->scanned = to_scan.size();
+  m_archives_by_path.insert(std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+  return false;
+}
+
+const ROMIndex::Archive *ROMIndex::Find(const std::string &zipfilename) const
+{
+  auto it = m_archives_by_path.find(zipfilename);
+  return it == m_archives_by_path.end() ? nullptr : &it->second;
+}
@@ -0,0 +1,60 @@
+#ifndef INCLUDED_ROMINDEX_H
+#define INCLUDED_ROMINDEX_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Index of the zip archives in a ROM directory: the size and modification
+ * time of each archive and the name, size and CRC32 of every file inside it.
+ * Kept on disk so that a library of ROM sets can be identified without
+ * opening the archives again. Only archives that were added or changed since
+ * the last scan are reopened.
+ */
+class ROMIndex
+{
+public:
+  // Single file inside of a zip archive
+  struct Entry
+  {
+    std::string filename;
+    uint32_t uncompressed_size = 0;
+    uint32_t crc32 = 0;
+  };
+
+  // Zip archive
+  struct Archive
+  {
+    int64_t mtime = 0;
+    uint64_t size = 0;
+    bool valid = false;         // false if the archive could not be read
+    std::vector<Entry> entries;
+  };
+
+  // Scan statistics
+  struct Stats
+  {
+    size_t archives = 0;
+    size_t scanned = 0;         // archives that were added or changed and had to be opened
+    size_t removed = 0;
+  };
+
+  bool Load(const std::string &index_file);
+  bool Save(const std::string &index_file) const;
+  bool Scan(Stats *stats, const std::string &directory, unsigned num_threads = 0);
+
+  const Archive *Find(const std::string &zipfilename) const;
+  const std::map<std::string, Archive> &GetArchives() const
+  {
+    return m_archives_by_path;
+  }
+
+private:
+  std::map<std::string, Archive> m_archives_by_path;
+
+  static void ReadArchive(Archive *archive, const std::string &zipfilename);
+};
+
+#endif  // INCLUDED_ROMINDEX_H
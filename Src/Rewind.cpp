@@ -0,0 +1,367 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2023 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Rewind.cpp
+ *
+ * Rewind history. Implementation of the CRewind class.
+ */
+
+#include "Rewind.h"
+
+#include "Supermodel.h"
+#include "BlockFile.h"
+#include "Model3/IEmulator.h"
+#include "OSD/Thread.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <zlib.h>
+
+
+static const char s_headerName[] = "Supermodel Rewind State";
+
+static double ElapsedMs(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// XORs numBytes of src into dest
+static void XORBytes(uint8_t *dest, const uint8_t *src, size_t numBytes)
+{
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= numBytes; i += sizeof(uint64_t))
+  {
+    uint64_t a, b;
+    memcpy(&a, dest + i, sizeof(a));
+    memcpy(&b, src + i, sizeof(b));
+    a ^= b;
+    memcpy(dest + i, &a, sizeof(a));
+  }
+  for (; i < numBytes; i++)
+    dest[i] ^= src[i];
+}
+
+
+/******************************************************************************
+ Deltas
+******************************************************************************/
+
+// Builds the delta that turns m_next back into m_current
+bool CRewind::MakeDelta(Delta *delta)
+{
+  delta->stateSize = m_current.size();
+  delta->frames = m_nextFrames;
+  delta->whole = m_current.size() != m_next.size();
+
+  const uint8_t *raw = m_current.data();
+  size_t rawSize = m_current.size();
+  if (!delta->whole)
+  {
+    // Gather the XOR of every page that differs
+    m_scratch.resize(m_current.size());
+    rawSize = 0;
+    for (size_t offset = 0; offset < m_current.size(); offset += PAGE_SIZE)
+    {
+      size_t size = std::min(PAGE_SIZE, m_current.size() - offset);
+      if (memcmp(m_current.data() + offset, m_next.data() + offset, size) == 0)
+        continue;
+      uint8_t *dest = m_scratch.data() + rawSize;
+      memcpy(dest, m_current.data() + offset, size);
+      XORBytes(dest, m_next.data() + offset, size);
+      delta->pages.push_back(uint32_t(offset / PAGE_SIZE));
+      rawSize += size;
+    }
+    raw = m_scratch.data();
+  }
+  delta->rawSize = rawSize;
+
+  uLongf compressedSize = compressBound(uLong(rawSize));
+  delta->data.resize(compressedSize);
+  if (Z_OK != compress2(delta->data.data(), &compressedSize, raw, uLong(rawSize), Z_BEST_SPEED))
+    return FAIL;
+  delta->data.resize(compressedSize);
+  delta->data.shrink_to_fit();
+  delta->pages.shrink_to_fit();
+  return OKAY;
+}
+
+// Turns m_current into the snapshot before it
+bool CRewind::ApplyDelta(const Delta &delta)
+{
+  if (delta.whole)
+  {
+    m_current.resize(delta.stateSize);
+    uLongf size = uLongf(delta.stateSize);
+    return (Z_OK == uncompress(m_current.data(), &size, delta.data.data(), uLong(delta.data.size())) && size == delta.stateSize) ? OKAY : FAIL;
+  }
+
+  m_scratch.resize(std::max(m_scratch.size(), delta.rawSize));
+  uLongf size = uLongf(delta.rawSize);
+  if (Z_OK != uncompress(m_scratch.data(), &size, delta.data.data(), uLong(delta.data.size())) || size != delta.rawSize)
+    return FAIL;
+
+  const uint8_t *src = m_scratch.data();
+  for (uint32_t page: delta.pages)
+  {
+    size_t offset = size_t(page) * PAGE_SIZE;
+    size_t size = std::min(PAGE_SIZE, m_current.size() - offset);
+    XORBytes(m_current.data() + offset, src, size);
+    src += size;
+  }
+  return OKAY;
+}
+
+// Drops the oldest deltas until the history fits in the budget
+void CRewind::Trim(void)
+{
+  size_t fixed = m_current.capacity() + m_next.capacity() + m_scratch.capacity();
+  size_t budget = m_budget > fixed ? m_budget - fixed : 0;
+  while (!m_history.empty() && m_historyBytes > budget)
+  {
+    m_historyBytes -= m_history.front().Bytes();
+    m_historyFrames -= m_history.front().frames;
+    m_history.pop_front();
+  }
+  if (budget == 0 && !m_trimWarned)
+  {
+    ErrorLog("Rewind memory budget is too small to hold more than one snapshot (%u MB needed).", unsigned(fixed >> 20) + 1);
+    m_trimWarned = true;
+  }
+}
+
+
+/******************************************************************************
+ Worker Thread
+******************************************************************************/
+
+// Folds the pending snapshot in m_next into the history. Called with the lock
+// held by whoever gets to it first: the worker thread, or Rewind().
+void CRewind::ProcessCapture(void)
+{
+  auto start = std::chrono::steady_clock::now();
+  if (!m_current.empty())
+  {
+    Delta delta;
+    if (OKAY == MakeDelta(&delta))
+    {
+      m_historyBytes += delta.Bytes();
+      m_historyFrames += delta.frames;
+      m_deltaBytes += double(delta.data.size());
+      m_history.push_back(std::move(delta));
+    }
+    else
+    {
+      // The chain is broken, start over from this snapshot
+      m_history.clear();
+      m_historyBytes = 0;
+      m_historyFrames = 0;
+    }
+  }
+  m_current.swap(m_next);
+  Trim();
+  m_compressMs += ElapsedMs(start);
+  m_busy = false;
+}
+
+int CRewind::WorkerThread(void *param)
+{
+  CRewind *self = (CRewind *) param;
+  while (self->m_wake->Wait() && !self->m_quit)
+  {
+    self->m_lock->Lock();
+    if (self->m_busy)
+      self->ProcessCapture();
+    self->m_lock->Unlock();
+  }
+  return 0;
+}
+
+
+/******************************************************************************
+ Capture and Rewind
+******************************************************************************/
+
+bool CRewind::FrameDone(void)
+{
+  ++m_framesSinceCapture;
+  return m_framesSinceCapture >= m_interval;
+}
+
+void CRewind::Capture(void)
+{
+  if (m_busy)
+  {
+    // Still compressing the previous snapshot, try again next frame
+    ++m_skipped;
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  CBlockFile state;
+  state.Create(&m_next, s_headerName, "Supermodel Version " SUPERMODEL_VERSION);
+  m_emulator->SaveState(&state);
+  state.Close();
+  m_captureMs += ElapsedMs(start);
+  ++m_captures;
+
+  m_nextFrames = m_framesSinceCapture;
+  m_framesSinceCapture = 0;
+  m_restored = false;
+  m_busy = true;
+  if (m_thread)
+    m_wake->Post();
+  else
+    ProcessCapture();
+}
+
+bool CRewind::Rewind(void)
+{
+  if (m_lock)
+    m_lock->Lock();   // wait for the worker
+  if (m_busy)
+    ProcessCapture();
+
+  bool result = FAIL;
+  if (!m_current.empty())
+  {
+    // Already went back to the newest snapshot, go back another step
+    if (m_restored && !m_history.empty())
+    {
+      Delta &delta = m_history.back();
+      if (OKAY == ApplyDelta(delta))
+      {
+        m_historyBytes -= delta.Bytes();
+        m_historyFrames -= delta.frames;
+        m_history.pop_back();
+      }
+      else
+      {
+        ErrorLog("Rewind history is corrupt and has been discarded.");
+        m_history.clear();
+        m_historyBytes = 0;
+        m_historyFrames = 0;
+        m_current.clear();
+      }
+    }
+
+    CBlockFile state;
+    if (!m_current.empty() && OKAY == state.Load(m_current.data(), m_current.size()) && OKAY == state.FindBlock(s_headerName))
+    {
+      m_emulator->LoadState(&state);
+      m_framesSinceCapture = 0;
+      m_restored = true;
+      result = OKAY;
+    }
+  }
+
+  if (m_lock)
+    m_lock->Unlock();
+  return result;
+}
+
+
+/******************************************************************************
+ Statistics
+******************************************************************************/
+
+void CRewind::GetStats(Stats *stats)
+{
+  if (m_lock)
+    m_lock->Lock();
+  unsigned processed = m_captures - (m_busy ? 1 : 0);
+  stats->snapshots = unsigned(m_history.size()) + (m_current.empty() ? 0 : 1);
+  stats->frames = m_historyFrames + m_framesSinceCapture;
+  stats->historyBytes = m_historyBytes;
+  stats->stateBytes = m_current.size();
+  stats->captures = m_captures;
+  stats->skipped = m_skipped;
+  stats->captureMs = m_captures ? m_captureMs / m_captures : 0.0;
+  stats->compressMs = processed ? m_compressMs / processed : 0.0;
+  stats->deltaBytes = processed > 1 ? m_deltaBytes / (processed - 1) : 0.0;
+  if (m_lock)
+    m_lock->Unlock();
+}
+
+void CRewind::LogStats(void)
+{
+  Stats stats;
+  GetStats(&stats);
+  InfoLog("Rewind: %u snapshots covering %u frames, %1.1f MB of deltas, %1.1f MB per snapshot.",
+    stats.snapshots, stats.frames, double(stats.historyBytes) / (1 << 20), double(stats.stateBytes) / (1 << 20));
+  InfoLog("Rewind: %u captures (%u deferred), %1.2f ms each on the main thread, %1.2f ms compressing, %1.1f KB per delta.",
+    stats.captures, stats.skipped, stats.captureMs, stats.compressMs, stats.deltaBytes / 1024);
+}
+
+
+/******************************************************************************
+ Construction and Destruction
+******************************************************************************/
+
+CRewind::CRewind(IEmulator *emulator, unsigned interval, size_t budget)
+  : m_emulator(emulator),
+    m_interval(std::max(interval, 1u)),
+    m_budget(budget),
+    m_historyBytes(0),
+    m_historyFrames(0),
+    m_framesSinceCapture(0),
+    m_nextFrames(0),
+    m_restored(false),
+    m_trimWarned(false),
+    m_thread(NULL),
+    m_lock(NULL),
+    m_wake(NULL),
+    m_busy(false),
+    m_quit(false),
+    m_captures(0),
+    m_skipped(0),
+    m_captureMs(0.0),
+    m_compressMs(0.0),
+    m_deltaBytes(0.0)
+{
+  m_lock = CThread::CreateMutex();
+  m_wake = CThread::CreateSemaphore(0);
+  if (m_lock && m_wake)
+    m_thread = CThread::CreateThread("Rewind", WorkerThread, this);
+
+  // Fall back to compressing in Capture()
+  if (!m_thread)
+  {
+    delete m_lock;
+    delete m_wake;
+    m_lock = NULL;
+    m_wake = NULL;
+  }
+}
+
+CRewind::~CRewind(void)
+{
+  if (m_thread)
+  {
+    m_quit = true;
+    m_wake->Post();
+    m_thread->Wait();
+    delete m_thread;
+  }
+  delete m_lock;
+  delete m_wake;
+}
@@ -0,0 +1,194 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2023 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Rewind.h
+ *
+ * Header file for the rewind history.
+ */
+
+#ifndef INCLUDED_REWIND_H
+#define INCLUDED_REWIND_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+class IEmulator;
+class CThread;
+class CMutex;
+class CSemaphore;
+
+/*
+ * CRewind:
+ *
+ * Keeps a history of machine snapshots, taken every few frames, that can be
+ * stepped back through. Snapshots are save states written to memory.
+ *
+ * Only the newest snapshot is kept whole. Each older one is stored as the
+ * XOR of it and its successor, page by page: pages that did not change are
+ * omitted and the rest are compressed, which is done on a worker thread so
+ * that a capture only costs the main thread the save state itself. Stepping
+ * back XORs the newest delta into the newest snapshot and loads the result.
+ * The oldest deltas are dropped when the memory budget is exceeded.
+ *
+ * Capture() and Rewind() must be called from the thread that runs the
+ * emulator, with its threads paused.
+ */
+class CRewind
+{
+public:
+  /*
+   * Stats:
+   *
+   * Running totals, for reporting the cost of keeping the history.
+   */
+  struct Stats
+  {
+    unsigned  snapshots;      // steps available (including the newest snapshot)
+    unsigned  frames;         // frames covered by the history
+    size_t    historyBytes;   // memory held by deltas
+    size_t    stateBytes;     // size of one snapshot
+    unsigned  captures;       // snapshots taken
+    unsigned  skipped;        // captures skipped because the worker was busy
+    double    captureMs;      // average main thread time per capture
+    double    compressMs;     // average worker time per capture
+    double    deltaBytes;     // average compressed delta size
+  };
+
+  /*
+   * FrameDone(void):
+   *
+   * Counts an emulated frame.
+   *
+   * Returns:
+   *    True if a snapshot is due, in which case Capture() should be called.
+   */
+  bool FrameDone(void);
+
+  /*
+   * Capture(void):
+   *
+   * Takes a snapshot. If the worker thread has not finished with the previous
+   * one, the capture is skipped and retried on the next frame.
+   */
+  void Capture(void);
+
+  /*
+   * Rewind(void):
+   *
+   * Restores the newest snapshot or, if the previous call already went back
+   * to it and no snapshot has been taken since, the one before it. Pressing
+   * the rewind key repeatedly therefore steps further and further back.
+   *
+   * Returns:
+   *    OKAY if a snapshot was restored, FAIL if the history is empty.
+   */
+  bool Rewind(void);
+
+  /*
+   * GetStats(stats):
+   *
+   * Returns the history size and the running cost of keeping it.
+   */
+  void GetStats(Stats *stats);
+
+  /*
+   * LogStats(void):
+   *
+   * Writes the statistics to the log.
+   */
+  void LogStats(void);
+
+  /*
+   * CRewind(emulator, interval, budget):
+   * ~CRewind(void):
+   *
+   * Constructor and destructor.
+   *
+   * Parameters:
+   *    emulator  Emulator to snapshot. Must outlive this object.
+   *    interval  Frames between snapshots.
+   *    budget    Memory budget in bytes for the snapshots and their deltas.
+   */
+  CRewind(IEmulator *emulator, unsigned interval, size_t budget);
+  ~CRewind(void);
+
+private:
+  static const size_t PAGE_SIZE = 4096;
+
+  struct Delta
+  {
+    std::vector<uint8_t>  data;       // compressed XOR of the changed pages, or of the whole state if resized
+    std::vector<uint32_t> pages;      // indices of the changed pages
+    size_t                rawSize;    // uncompressed size of data
+    size_t                stateSize;  // size of the older snapshot
+    unsigned              frames;     // frames between the two snapshots
+    bool                  whole;      // sizes differ, data is the whole older snapshot
+
+    size_t Bytes(void) const
+    {
+      return data.capacity() + pages.capacity() * sizeof(uint32_t) + sizeof(Delta);
+    }
+  };
+
+  static int WorkerThread(void *param);
+  void       ProcessCapture(void);
+  bool       MakeDelta(Delta *delta);
+  bool       ApplyDelta(const Delta &delta);
+  void       Trim(void);
+
+  IEmulator             *m_emulator;
+  const unsigned        m_interval;
+  const size_t          m_budget;
+
+  // History, owned by the worker while m_busy is set
+  std::vector<uint8_t>  m_current;        // newest snapshot
+  std::vector<uint8_t>  m_next;           // snapshot being handed to the worker
+  std::vector<uint8_t>  m_scratch;        // XOR pages before compression
+  std::deque<Delta>     m_history;        // oldest first
+  size_t                m_historyBytes;
+  unsigned              m_historyFrames;
+  unsigned              m_framesSinceCapture;
+  unsigned              m_nextFrames;     // frames covered by the snapshot in m_next
+  bool                  m_restored;       // m_current was restored by Rewind()
+  bool                  m_trimWarned;
+
+  // Worker thread
+  CThread               *m_thread;
+  CMutex                *m_lock;          // held while the history is modified
+  CSemaphore            *m_wake;
+  std::atomic<bool>     m_busy;
+  bool                  m_quit;
+
+  // Statistics
+  unsigned              m_captures;
+  unsigned              m_skipped;
+  double                m_captureMs;
+  double                m_compressMs;
+  double                m_deltaBytes;
+};
+
+
+#endif  // INCLUDED_REWIND_H
@@ -1,70 +1,222 @@
 #define MINIMP3_IMPLEMENTATION
 #include "Pkgs/minimp3.h"
 #include "MpegAudio.h"
+#include "OSD/Thread.h"
+#include <atomic>
+#include <cstring>
 
-struct Decoder
+// Number of decoded MPEG frames buffered ahead of playback (1152 samples each)
+#define NUM_AHEAD_FRAMES	8
+
+struct Frame
 {
-	mp3dec_t			mp3d;
-	mp3dec_frame_info_t	info;
+	mp3dec_t			mp3d;		// decoder state after this frame (restored when rewinding)
+	int					pos;		// stream position after this frame
+	int					numSamples;
+	int					channels;
+	short				pcm[MINIMP3_MAX_SAMPLES_PER_FRAME];
+};
+
+struct MpegDec::DecoderState
+{
+	// Stream, as last set by the board (producer reads these under lock)
 	const uint8_t*		buffer;
-	int					size, pos;
+	int					size;
 	bool				loop;
 	bool				stopped;
+
+	// Playback: frame currently being drained and the decoder state after it
+	mp3dec_t			mp3d;
+	int					pos;
 	int					numSamples;
+	int					channels;
 	int					pcmPos;
 	short				pcm[MINIMP3_MAX_SAMPLES_PER_FRAME];
+
+	// Decode-ahead: state after the newest frame in the ring
+	mp3dec_t			aheadMp3d;
+	int					aheadPos;
+	bool				aheadEnd;	// reached end of a non-looping stream
+
+	// Single producer, single consumer ring (free-running indices)
+	Frame				ring[NUM_AHEAD_FRAMES];
+	std::atomic<unsigned>	readIdx;
+	std::atomic<unsigned>	writeIdx;
+
+	// Worker thread
+	CThread				*thread;
+	CMutex				*lock;		// held by whoever is decoding or rewinding
+	CSemaphore			*wake;		// posted whenever there may be work
+	bool				quit;
+	bool				threadFailed;
 };
 
-static Decoder dec = { 0 };
+static bool EndOfBuffer(const MpegDec::DecoderState *s, int pos)
+{
+	return pos >= s->size - HDR_SIZE;
+}
+
+// Decodes the next frame into the ring. Must hold the lock (or have no thread).
+static bool DecodeAhead(MpegDec::DecoderState *s)
+{
+	unsigned w = s->writeIdx.load(std::memory_order_relaxed);
+	if (s->stopped || !s->buffer || s->aheadEnd || (w - s->readIdx.load(std::memory_order_acquire)) >= NUM_AHEAD_FRAMES)
+		return false;
+
+	Frame &f = s->ring[w % NUM_AHEAD_FRAMES];
+	mp3dec_frame_info_t info;
+
+	if (EndOfBuffer(s, s->aheadPos)) {	// e.g. stream shortened under us
+		f.numSamples = 0;
+		f.channels = 0;
+		info.frame_bytes = 0;
+	}
+	else {
+		f.numSamples = mp3dec_decode_frame(&s->aheadMp3d, s->buffer + s->aheadPos, s->size - s->aheadPos, f.pcm, &info);
+		f.channels = info.channels;
+	}
+	s->aheadPos += info.frame_bytes;
+
+	// check end of buffer handling
+	if (EndOfBuffer(s, s->aheadPos)) {
+		if (s->loop) {
+			s->aheadPos = 0;
+		}
+		else {
+			s->aheadEnd = true;
+		}
+	}
+	else if (info.frame_bytes == 0) {
+		s->aheadEnd = true;	// no frame in the rest of the buffer
+	}
+
+	f.mp3d = s->aheadMp3d;
+	f.pos = s->aheadPos;
+	s->writeIdx.store(w + 1, std::memory_order_release);
+	return true;
+}
+
+static int DecoderThread(void *param)
+{
+	MpegDec::DecoderState *s = (MpegDec::DecoderState *) param;
+
+	while (true)
+	{
+		s->lock->Lock();
+		if (s->quit) {
+			s->lock->Unlock();
+			break;
+		}
+		bool decoded = DecodeAhead(s);
+		s->lock->Unlock();
+
+		if (!decoded)
+			s->wake->Wait();
+	}
 
-void MpegDec::SetMemory(const uint8_t *data, int length, bool loop)
+	return 0;
+}
+
+// Discards frames decoded past the playback position so that a change to the
+// stream takes effect exactly there. Returns with the lock held.
+static void BeginUpdate(MpegDec::DecoderState *s)
 {
-	mp3dec_init(&dec.mp3d);
+	if (s->thread)
+		s->lock->Lock();
+	s->writeIdx.store(s->readIdx.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
 
-	dec.buffer		= data;
-	dec.size		= length;
-	dec.pos			= 0;
-	dec.numSamples	= 0;
-	dec.pcmPos		= 0;
-	dec.loop		= loop;
-	dec.stopped		= false;
+static void EndUpdate(MpegDec::DecoderState *s)
+{
+	s->aheadMp3d = s->mp3d;
+	s->aheadPos = s->pos;
+	s->aheadEnd = false;
+
+	if (s->thread) {
+		s->lock->Unlock();
+		s->wake->Post();
+	}
 }
 
-void MpegDec::UpdateMemory(const uint8_t* data, int length, bool loop)
+static void StartThread(MpegDec::DecoderState *s)
 {
+	if (s->thread || s->threadFailed)
+		return;
+
+	s->lock = CThread::CreateMutex();
+	s->wake = CThread::CreateSemaphore(0);
+	if (s->lock && s->wake)
+		s->thread = CThread::CreateThread("MpegDecoder", DecoderThread, s);
+
+	// fall back to decoding on demand in DecodeAudio()
+	if (!s->thread) {
+		delete s->lock;
+		delete s->wake;
+		s->lock = nullptr;
+		s->wake = nullptr;
+		s->threadFailed = true;
+	}
+}
+
+void MpegDec::CDecoder::SetMemory(const uint8_t *data, int length, bool loop)
+{
+	StartThread(m_state);
+	BeginUpdate(m_state);
+
+	mp3dec_init(&m_state->mp3d);
+
+	m_state->buffer		= data;
+	m_state->size		= length;
+	m_state->pos		= 0;
+	m_state->numSamples	= 0;
+	m_state->pcmPos		= 0;
+	m_state->loop		= loop;
+	m_state->stopped	= false;
+
+	EndUpdate(m_state);
+}
+
+void MpegDec::CDecoder::UpdateMemory(const uint8_t* data, int length, bool loop)
+{
+	BeginUpdate(m_state);
+
 	int diff;
-	if (data > dec.buffer) {
-		diff = (int)(data - dec.buffer);
+	if (data > m_state->buffer) {
+		diff = (int)(data - m_state->buffer);
 	}
 	else {
-		diff = -(int)(dec.buffer - data);
+		diff = -(int)(m_state->buffer - data);
 	}
 
-	dec.buffer	= data;
-	dec.size	= length;
-	dec.pos		= dec.pos - diff;		// update position relative to our new start location
-	dec.loop	= loop;
+	m_state->buffer	= data;
+	m_state->size	= length;
+	m_state->pos	= m_state->pos - diff;		// update position relative to our new start location
+	m_state->loop	= loop;
+
+	EndUpdate(m_state);
 }
 
-int MpegDec::GetPosition()
+int MpegDec::CDecoder::GetPosition()
 {
-	return (int)dec.pos;
+	return m_state->pos;
 }
 
-void MpegDec::SetPosition(int pos)
+void MpegDec::CDecoder::SetPosition(int pos)
 {
-	dec.pos = pos;
+	BeginUpdate(m_state);
+	m_state->pos = pos;
+	EndUpdate(m_state);
 }
 
-static void FlushBuffer(int16_t*& left, int16_t*& right, int& numStereoSamples)
+static void FlushBuffer(MpegDec::DecoderState *s, int16_t*& left, int16_t*& right, int& numStereoSamples)
 {
-	int numChans = dec.info.channels;
+	int numChans = s->channels;
 
-	int &i = dec.pcmPos;
+	int &i = s->pcmPos;
 
-	for (; i < (dec.numSamples * numChans) && numStereoSamples; i += numChans) {
-		*left++ = dec.pcm[i];
-		*right++ = dec.pcm[i + numChans - 1];
+	for (; i < (s->numSamples * numChans) && numStereoSamples; i += numChans) {
+		*left++ = s->pcm[i];
+		*right++ = s->pcm[i + numChans - 1];
 		numStereoSamples--;
 	}
 }
@@ -80,55 +232,97 @@ static void EndWithSilence(int16_t*& left, int16_t*& right, int& numStereoSample
 	}
 }
 
-static bool EndOfBuffer()
+// Makes the next decoded frame current. Returns false at the end of the stream.
+static bool NextFrame(MpegDec::DecoderState *s)
 {
-	return dec.pos >= dec.size - HDR_SIZE;
+	unsigned r = s->readIdx.load(std::memory_order_relaxed);
+
+	// ring ran dry: decode on this thread rather than drop out
+	if (r == s->writeIdx.load(std::memory_order_acquire)) {
+		if (s->thread)
+			s->lock->Lock();
+		bool decoded = (r != s->writeIdx.load(std::memory_order_acquire)) || DecodeAhead(s);
+		if (s->thread)
+			s->lock->Unlock();
+		if (!decoded)
+			return false;
+	}
+
+	const Frame &f = s->ring[r % NUM_AHEAD_FRAMES];
+	s->mp3d			= f.mp3d;
+	s->pos			= f.pos;
+	s->numSamples	= f.numSamples;
+	s->channels		= f.channels;
+	s->pcmPos		= 0;	// reset pos
+	memcpy(s->pcm, f.pcm, f.numSamples * f.channels * sizeof(short));
+
+	s->readIdx.store(r + 1, std::memory_order_release);
+	if (s->thread)
+		s->wake->Post();
+	return true;
 }
 
-void MpegDec::Stop()
+void MpegDec::CDecoder::Stop()
 {
-	dec.stopped = true;
+	BeginUpdate(m_state);
+	m_state->stopped = true;
+	EndUpdate(m_state);
 }
 
-bool MpegDec::IsLoaded()
+bool MpegDec::CDecoder::IsLoaded()
 {
-	return dec.buffer != nullptr;
+	return m_state->buffer != nullptr;
 }
 
-void MpegDec::DecodeAudio(int16_t* left, int16_t* right, int numStereoSamples)
+void MpegDec::CDecoder::DecodeAudio(int16_t* left, int16_t* right, int numStereoSamples)
 {
 	// if we are stopped return silence
-	if (dec.stopped || !dec.buffer) {
+	if (m_state->stopped || !m_state->buffer) {
 		EndWithSilence(left, right, numStereoSamples);
 	}
 
 	// copy any left over samples first
-	FlushBuffer(left, right, numStereoSamples);
+	FlushBuffer(m_state, left, right, numStereoSamples);
 
 	while (numStereoSamples) {
-
-		dec.numSamples = mp3dec_decode_frame(
-			&dec.mp3d,
-			dec.buffer + dec.pos,
-			dec.size - dec.pos,
-			dec.pcm,
-			&dec.info);
-
-		dec.pos += dec.info.frame_bytes;
-		dec.pcmPos = 0;	// reset pos
-
-		FlushBuffer(left, right, numStereoSamples);
-
-		// check end of buffer handling
-		if (EndOfBuffer()) {
-			if (dec.loop) {
-				dec.pos = 0;
-			}
-			else {
-				EndWithSilence(left, right, numStereoSamples);
-			}
+		if (!NextFrame(m_state)) {
+			EndWithSilence(left, right, numStereoSamples);
+			break;
 		}
+		FlushBuffer(m_state, left, right, numStereoSamples);
+	}
+}
 
+MpegDec::CDecoder::CDecoder()
+{
+	m_state = new DecoderState();
+	m_state->buffer = nullptr;
+	m_state->stopped = true;
+	m_state->numSamples = 0;
+	m_state->channels = 0;
+	m_state->pcmPos = 0;
+	m_state->readIdx = 0;
+	m_state->writeIdx = 0;
+	m_state->aheadEnd = true;
+	m_state->thread = nullptr;
+	m_state->lock = nullptr;
+	m_state->wake = nullptr;
+	m_state->quit = false;
+	m_state->threadFailed = false;
+}
+
+MpegDec::CDecoder::~CDecoder()
+{
+	if (m_state->thread) {
+		m_state->lock->Lock();
+		m_state->quit = true;
+		m_state->lock->Unlock();
+		m_state->wake->Post();
+		m_state->thread->Wait();
+		delete m_state->thread;
+		delete m_state->lock;
+		delete m_state->wake;
 	}
 
+	delete m_state;
 }
@@ -5,14 +5,36 @@
 
 namespace MpegDec
 {
-	void	SetMemory(const uint8_t *data, int length, bool loop);
-	void	UpdateMemory(const uint8_t *data, int length, bool loop);
-	int		GetPosition();
-	void	SetPosition(int pos);
-	void	DecodeAudio(int16_t* left, int16_t* right, int numStereoSamples);
-	void	Stop();
-	bool	IsLoaded();
+	struct DecoderState;
+
+	/*
+	 * CDecoder:
+	 *
+	 * MPEG audio stream decoder for one Digital Sound Board. Frames are decoded
+	 * ahead of playback on a worker thread into a small ring; DecodeAudio()
+	 * only copies out PCM. All other member functions must be called from the
+	 * same thread as DecodeAudio() and take effect at the current playback
+	 * position, discarding anything decoded beyond it. If the ring runs dry,
+	 * DecodeAudio() decodes synchronously, so output never depends on thread
+	 * timing.
+	 */
+	class CDecoder
+	{
+	public:
+		void	SetMemory(const uint8_t *data, int length, bool loop);
+		void	UpdateMemory(const uint8_t *data, int length, bool loop);
+		int		GetPosition();
+		void	SetPosition(int pos);
+		void	DecodeAudio(int16_t* left, int16_t* right, int numStereoSamples);
+		void	Stop();
+		bool	IsLoaded();
+
+		CDecoder();
+		~CDecoder();
+
+	private:
+		DecoderState	*m_state;
+	};
 }
 
 #endif
-
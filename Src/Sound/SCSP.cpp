@@ -124,6 +124,8 @@ static const double srate=44100;
 static CMutex *MIDILock;	// for safe access to the MIDI FIFOs
 static int (*Run68kCB)(int cycles);
 static void (*Int68kCB)(int irq);
+static int (*Cycles68kCB)(void);	// cycles run so far in the current 68K timeslice
+static void (*End68kCB)(void);		// ends the current 68K timeslice early
 static DWORD IrqTimA;
 static DWORD IrqTimBC;
 static DWORD IrqMidi;
@@ -326,6 +328,9 @@ struct _SCSP
 
 static signed short *RBUFDST;	//this points to where the sample will be stored in the RingBuf
 
+static void SCSP_CatchUp();
+static void SCSP_EndSlice();
+
 
 unsigned char DecodeSCI(unsigned char irq)
 {
@@ -824,6 +829,10 @@ void SCSP_UpdateSlotReg(int s,int r)
 
 void SCSP_UpdateReg(int reg)
 {
+	// Timer and interrupt control: the 68K's next interrupt has to be recomputed
+	if ((reg&0x3f) >= 0x18 && (reg&0x3f) <= 0x29)
+		SCSP_EndSlice();
+
 	switch(reg&0x3f)
 	{
 		case 0x0: // Need to get this working in Supermodel as well
@@ -968,6 +977,8 @@ void SCSP_UpdateRegR(int reg)
 
 		if (s_multiThreaded)
 			MIDILock->Unlock();
+
+		SCSP_EndSlice();	// MIDI IRQ may need to be raised again
 	}
 	break;
 	case 8:
@@ -1011,6 +1022,7 @@ void SCSP_UpdateRegR(int reg)
 
 void SCSP_w8(unsigned int addr,unsigned char val)
 {
+	SCSP_CatchUp();
 	addr&=0xffff;
 	if(addr<0x400)
 	{
@@ -1038,7 +1050,10 @@ void SCSP_w8(unsigned int addr,unsigned char val)
 			else if (addr < 0x7C0)
 				((unsigned char *)SCSP->DSP.MADRS)[(addr - 0x780) ^ 1] = val;
 			else if (addr >= 0x800 && addr < 0xC00)
+			{
 				((unsigned char *)SCSP->DSP.MPRO)[(addr - 0x800) ^ 1] = val;
+				SCSP->DSP.Dirty = true;
+			}
 			else
 				int a = 1;
 			if (addr == 0xBF0)
@@ -1058,7 +1073,10 @@ void SCSP_w8(unsigned int addr,unsigned char val)
 			else if (addr < 0x800)
 				((unsigned char *)SCSP->DSP.MADRS)[(addr - 0x7c0) ^ 1] = val;
 			else if (addr < 0xC00)
+			{
 				((unsigned char *)SCSP->DSP.MPRO)[(addr - 0x800) ^ 1] = val;
+				SCSP->DSP.Dirty = true;
+			}
 			else
 				int a = 1;
 			if (addr == 0xBF0)
@@ -1073,6 +1091,7 @@ void SCSP_w8(unsigned int addr,unsigned char val)
 
 void SCSP_w16(unsigned int addr,unsigned short val)
 {
+	SCSP_CatchUp();
 	addr&=0xffff;
 	if(addr<0x400)
 	{
@@ -1105,7 +1124,10 @@ void SCSP_w16(unsigned int addr,unsigned short val)
 			else if (addr < 0x800)
 				*(unsigned short *) &(SCSP->DSP.MADRS[(addr - 0x780) / 2]) = val;
 			else if (addr < 0xC00)
+			{
 				*(unsigned short *) &(SCSP->DSP.MPRO[(addr - 0x800) / 2]) = val;
+				SCSP->DSP.Dirty = true;
+			}
 			else
 				int a = 1;
 			if (addr == 0xBF0)
@@ -1125,6 +1147,7 @@ void SCSP_w16(unsigned int addr,unsigned short val)
 			else if (addr < 0xC00)
 			{
 				*((UINT16 *)(SCSP->DSP.MPRO + (addr - 0x800) / 2)) = val;
+				SCSP->DSP.Dirty = true;
 			}
 			else
 				int a = 1;
@@ -1138,6 +1161,7 @@ void SCSP_w16(unsigned int addr,unsigned short val)
 
 void SCSP_w32(unsigned int addr,unsigned int val)
 {
+	SCSP_CatchUp();
 	addr&=0xffff;
 	if(addr<0x400)
 	{
@@ -1173,7 +1197,10 @@ void SCSP_w32(unsigned int addr,unsigned int val)
 			else if (addr < 0x800) // MADRS is mirrored twice
 				*(unsigned int *) &(SCSP->DSP.MADRS[(addr-0x7c0)/2]) = val;
 			else if(addr<0xC00)
+			{
 				*(unsigned int *) &(SCSP->DSP.MPRO[(addr-0x800)/2])=val;
+				SCSP->DSP.Dirty = true;
+			}
 			else
 				int a=1;
 			if(addr==0xBF0)
@@ -1187,6 +1214,7 @@ unsigned char SCSP_r8(unsigned int addr)
 {
 	unsigned char v=0;
 	addr&=0xffff;
+	SCSP_CatchUp();
 	if(addr<0x400)
 	{
 		int slot=addr/0x20;
@@ -1211,6 +1239,7 @@ unsigned short SCSP_r16(unsigned int addr)
 {
 	unsigned short v=0;
 	addr&=0xffff;
+	SCSP_CatchUp();
 	if(addr<0x400)
 	{
 		int slot=addr/0x20;
@@ -1510,215 +1539,333 @@ void SCSP_CpuRunScanline()
 
 }
 
-void SCSP_DoMasterSamples(int nsamples)
-{
-	const int slice = 11289600 / 44100;	// 68K clocked at 11.2896MHz (45.1584MHz OSC / 4), which is 256 cycles/sample
-	static int lastdiff = 0;
+/*
+ * 68K Scheduling
+ *
+ * Running the 68K for one 256-cycle slice per output sample means entering
+ * and leaving the CPU core hundreds of times per frame, nearly always just to
+ * find that nothing has changed. Instead, the 68K is run in one go up to the
+ * next point at which its interrupt inputs can change by themselves, i.e. the
+ * next timer overflow (or the next sample, if an interrupt is already pending
+ * and must be re-asserted after acknowledgement, as before), but for no more
+ * than maxSpan samples.
+ *
+ * Samples inside that span are generated lazily. Each sample k belongs at
+ * 68K time k*slice, as before. Whenever the 68K touches an SCSP register,
+ * SCSP_CatchUp() first generates every sample that would have been produced
+ * by then, so register accesses land between the same two samples they did
+ * when the 68K was run slice by slice. Accesses that may change interrupt
+ * state (common registers, MIDI input) end the 68K's timeslice so the next
+ * span can be recomputed.
+ *
+ * Catch-up happens inside a 68K memory handler, i.e. mid-instruction, so
+ * samples generated there only latch pending interrupts. They are asserted
+ * once Run68kCB() has returned.
+ */
 
-	/*
-	 * Compute relative master/slave SCSP balance (note: master is often used
-	 * for the front speakers). Equal balance is a 1.0 scale factor for both.
-	 * When one SCSP is fully attenuated, the other's samples will be multiplied
-	 * by 2.
-	 */
-	float balance = std::max(-100.f,std::min(100.f,s_config->Get("Balance").ValueAs<float>()));
-	balance *= 0.01f;
-	float masterBalance = 1.0f + balance;
-	float slaveBalance = 1.0f - balance;
+static const int slice = 11289600 / 44100;	// 68K clocked at 11.2896MHz (45.1584MHz OSC / 4), which is 256 cycles/sample
+static const int maxSpan = 32;	// longest 68K run in samples; bounds latency of MIDI input arriving from another thread
 
-	float* buffl = bufferfl;
-	float* buffr = bufferfr;
-	float* bufrl = bufferrl;
-	float* bufrr = bufferrr;
+static float *s_buffl, *s_buffr, *s_bufrl, *s_bufrr;
+static float s_masterBalance, s_slaveBalance;
+static int s_numSamples;		// samples to produce in this update
+static int s_sample;			// next sample to produce
+static int s_68kTime;			// 68K time at the start of the current timeslice, relative to sample 0
+static bool s_68kRunning;		// 68K is inside a timeslice started by SCSP_DoMasterSamples()
+static bool s_irqDeferred;		// samples were generated mid-instruction and their interrupts are yet to be asserted
 
-	/*
-	 * Generate samples
-	 */
-	for (INT32 s = 0; s < nsamples; ++s)
-	{
-		signed int smpfl = 0, smpfr = 0;
-		signed int smprl = 0, smprr = 0;
+static void SCSP_GenerateSample(bool assertIRQ)
+{
+	signed int smpfl = 0, smpfr = 0;
+	signed int smprl = 0, smprr = 0;
 
-		for (INT32 sl = 0; sl < 32; ++sl)
-		{
+	for (INT32 sl = 0; sl < 32; ++sl)
+	{
 #if FM_DELAY
-			RBUFDST = SCSPs[0].DELAYBUF + SCSPs[0].DELAYPTR;
+		RBUFDST = SCSPs[0].DELAYBUF + SCSPs[0].DELAYPTR;
 #else
-			RBUFDST = SCSPs[0].RINGBUF + SCSPs[0].BUFPTR;
+		RBUFDST = SCSPs[0].RINGBUF + SCSPs[0].BUFPTR;
 #endif
-			if (SCSPs[0].Slots[sl].active)
-			{
-				_SLOT *slot = SCSPs[0].Slots + sl;
-				UINT16 Enc;
+		if (SCSPs[0].Slots[sl].active)
+		{
+			_SLOT *slot = SCSPs[0].Slots + sl;
+			UINT16 Enc;
 
-				signed int sample = (int)(masterBalance*(float)SCSP_UpdateSlot(slot));
+			signed int sample = (int)(s_masterBalance*(float)SCSP_UpdateSlot(slot));
 
-				Enc = ((TL(slot)) << 0x0) | ((IMXL(slot)) << 0xd);
-				SCSPDSP_SetSample(&SCSPs[0].DSP, (sample*LPANTABLE[Enc]) >> (SHIFT - 2), ISEL(slot), IMXL(slot));
-				Enc = ((TL(slot)) << 0x0) | ((DIPAN(slot)) << 0x8) | ((DISDL(slot)) << 0xd);
+			Enc = ((TL(slot)) << 0x0) | ((IMXL(slot)) << 0xd);
+			SCSPDSP_SetSample(&SCSPs[0].DSP, (sample*LPANTABLE[Enc]) >> (SHIFT - 2), ISEL(slot), IMXL(slot));
+			Enc = ((TL(slot)) << 0x0) | ((DIPAN(slot)) << 0x8) | ((DISDL(slot)) << 0xd);
 #ifdef RB_VOLUME
-				smpfl += (sample * volume[TL(slot) + pan_left[DIPAN(slot)]]) >> 17;
-				smpfr += (sample * volume[TL(slot) + pan_right[DIPAN(slot)]]) >> 17;
+			smpfl += (sample * volume[TL(slot) + pan_left[DIPAN(slot)]]) >> 17;
+			smpfr += (sample * volume[TL(slot) + pan_right[DIPAN(slot)]]) >> 17;
 #else
-				{
-					smpfl += (sample*LPANTABLE[Enc]) >> SHIFT;
-					smpfr += (sample*RPANTABLE[Enc]) >> SHIFT;
-				}
-#endif
+			{
+				smpfl += (sample*LPANTABLE[Enc]) >> SHIFT;
+				smpfr += (sample*RPANTABLE[Enc]) >> SHIFT;
 			}
+#endif
+		}
 #if FM_DELAY
-			SCSPs[0].RINGBUF[(SCSPs[0].BUFPTR + 64 - (FM_DELAY - 1)) & 63] = SCSPs[0].DELAYBUF[(SCSPs[0].DELAYPTR + FM_DELAY - (FM_DELAY - 1)) % FM_DELAY];
+		SCSPs[0].RINGBUF[(SCSPs[0].BUFPTR + 64 - (FM_DELAY - 1)) & 63] = SCSPs[0].DELAYBUF[(SCSPs[0].DELAYPTR + FM_DELAY - (FM_DELAY - 1)) % FM_DELAY];
 #endif
-			++SCSPs[0].BUFPTR;
-			SCSPs[0].BUFPTR &= 63;
+		++SCSPs[0].BUFPTR;
+		SCSPs[0].BUFPTR &= 63;
 #if FM_DELAY
-			++SCSPs[0].DELAYPTR;
-			if (SCSPs[0].DELAYPTR > FM_DELAY - 1) SCSPs[0].DELAYPTR = 0;
+		++SCSPs[0].DELAYPTR;
+		if (SCSPs[0].DELAYPTR > FM_DELAY - 1) SCSPs[0].DELAYPTR = 0;
 #endif
-			if (HasSlaveSCSP)
+		if (HasSlaveSCSP)
 #if FM_DELAY
-				RBUFDST = SCSPs[1].DELAYBUF + SCSPs[1].DELAYPTR;
+			RBUFDST = SCSPs[1].DELAYBUF + SCSPs[1].DELAYPTR;
 #else
-				RBUFDST = SCSPs[1].RINGBUF + SCSPs[1].BUFPTR;
+			RBUFDST = SCSPs[1].RINGBUF + SCSPs[1].BUFPTR;
 #endif
+		{
+			if (SCSPs[1].Slots[sl].active)
 			{
-				if (SCSPs[1].Slots[sl].active)
-				{
-					_SLOT *slot = SCSPs[1].Slots + sl;
-					UINT16 Enc;
+				_SLOT *slot = SCSPs[1].Slots + sl;
+				UINT16 Enc;
 
-					signed int sample = (int)(slaveBalance*(float)SCSP_UpdateSlot(slot));
+				signed int sample = (int)(s_slaveBalance*(float)SCSP_UpdateSlot(slot));
 
-					Enc = ((TL(slot)) << 0x0) | ((IMXL(slot)) << 0xd);
-					SCSPDSP_SetSample(&SCSPs[1].DSP, (sample*LPANTABLE[Enc]) >> (SHIFT - 2), ISEL(slot), IMXL(slot));
-					Enc = ((TL(slot)) << 0x0) | ((DIPAN(slot)) << 0x8) | ((DISDL(slot)) << 0xd);
-					{
+				Enc = ((TL(slot)) << 0x0) | ((IMXL(slot)) << 0xd);
+				SCSPDSP_SetSample(&SCSPs[1].DSP, (sample*LPANTABLE[Enc]) >> (SHIFT - 2), ISEL(slot), IMXL(slot));
+				Enc = ((TL(slot)) << 0x0) | ((DIPAN(slot)) << 0x8) | ((DISDL(slot)) << 0xd);
+				{
 #ifdef RB_VOLUME
-						smprl += (sample * volume[TL(slot) + pan_left[DIPAN(slot)]]) >> 17;
-						smprr += (sample * volume[TL(slot) + pan_right[DIPAN(slot)]]) >> 17;
+					smprl += (sample * volume[TL(slot) + pan_left[DIPAN(slot)]]) >> 17;
+					smprr += (sample * volume[TL(slot) + pan_right[DIPAN(slot)]]) >> 17;
 #else
-						smprl += (sample*LPANTABLE[Enc]) >> SHIFT;
-						smprr += (sample*RPANTABLE[Enc]) >> SHIFT;
-					}
-#endif
+					smprl += (sample*LPANTABLE[Enc]) >> SHIFT;
+					smprr += (sample*RPANTABLE[Enc]) >> SHIFT;
 				}
+#endif
+			}
 #if FM_DELAY
-				SCSPs[1].RINGBUF[(SCSPs[1].BUFPTR + 64 - (FM_DELAY - 1)) & 63] = SCSPs[1].DELAYBUF[(SCSPs[1].DELAYPTR + FM_DELAY - (FM_DELAY - 1)) % FM_DELAY];
+			SCSPs[1].RINGBUF[(SCSPs[1].BUFPTR + 64 - (FM_DELAY - 1)) & 63] = SCSPs[1].DELAYBUF[(SCSPs[1].DELAYPTR + FM_DELAY - (FM_DELAY - 1)) % FM_DELAY];
 #endif
-				++SCSPs[1].BUFPTR;
-				SCSPs[1].BUFPTR &= 63;
+			++SCSPs[1].BUFPTR;
+			SCSPs[1].BUFPTR &= 63;
 #if FM_DELAY
-				++SCSPs[1].DELAYPTR;
-				if (SCSPs[1].DELAYPTR > FM_DELAY - 1) SCSPs[1].DELAYPTR = 0;
+			++SCSPs[1].DELAYPTR;
+			if (SCSPs[1].DELAYPTR > FM_DELAY - 1) SCSPs[1].DELAYPTR = 0;
 #endif
-			}
+		}
 
 	}
 
-		SCSPDSP_Step(&SCSPs[0].DSP);
-		if (HasSlaveSCSP)
-			SCSPDSP_Step(&SCSPs[1].DSP);
+	SCSPDSP_Step(&SCSPs[0].DSP);
+	if (HasSlaveSCSP)
+		SCSPDSP_Step(&SCSPs[1].DSP);
 
-		//		smpl=0;
-		//		smpr=0;
-		for (INT32 i = 0; i < 16; ++i)
-		{
-			_SLOT *slot = SCSPs[0].Slots + i;
-			if (legacySound == true) {
+	//		smpl=0;
+	//		smpr=0;
+	for (INT32 i = 0; i < 16; ++i)
+	{
+		_SLOT *slot = SCSPs[0].Slots + i;
+		if (legacySound == true) {
+			if (EFSDL(slot))
+			{
+				// For legacy option, 14 is the most reasonable value I can set at the moment for the EFSDL slot. - Paul
+				UINT16 Enc = ((EFPAN(slot)) << 0x8) | ((EFSDL(slot)) << 0xe);
+				smpfl += (int)(s_masterBalance*(float)(((SCSPs[0].DSP.EFREG[i] * LPANTABLE[Enc]) >> SHIFT)));
+				smpfr += (int)(s_masterBalance*(float)(((SCSPs[0].DSP.EFREG[i] * RPANTABLE[Enc]) >> SHIFT)));
+			}
+			if (HasSlaveSCSP)
+			{
+				_SLOT *slot = SCSPs[1].Slots + i;
 				if (EFSDL(slot))
 				{
-					// For legacy option, 14 is the most reasonable value I can set at the moment for the EFSDL slot. - Paul
 					UINT16 Enc = ((EFPAN(slot)) << 0x8) | ((EFSDL(slot)) << 0xe);
-					smpfl += (int)(masterBalance*(float)(((SCSPs[0].DSP.EFREG[i] * LPANTABLE[Enc]) >> SHIFT)));
-					smpfr += (int)(masterBalance*(float)(((SCSPs[0].DSP.EFREG[i] * RPANTABLE[Enc]) >> SHIFT)));
-				}
-				if (HasSlaveSCSP)
-				{
-					_SLOT *slot = SCSPs[1].Slots + i;
-					if (EFSDL(slot))
-					{
-						UINT16 Enc = ((EFPAN(slot)) << 0x8) | ((EFSDL(slot)) << 0xe);
-						smprl += (int)(slaveBalance*(float)(((SCSPs[1].DSP.EFREG[i] * LPANTABLE[Enc]) >> SHIFT)));
-						smprr += (int)(slaveBalance*(float)(((SCSPs[1].DSP.EFREG[i] * RPANTABLE[Enc]) >> SHIFT)));
-					}
+					smprl += (int)(s_slaveBalance*(float)(((SCSPs[1].DSP.EFREG[i] * LPANTABLE[Enc]) >> SHIFT)));
+					smprr += (int)(s_slaveBalance*(float)(((SCSPs[1].DSP.EFREG[i] * RPANTABLE[Enc]) >> SHIFT)));
 				}
 			}
-			else {
+		}
+		else {
+			if (EFSDL(slot))
+			{
+				UINT16 Enc = ((EFPAN(slot)) << 0x8) | ((EFSDL(slot)) << 0xd);
+				smpfl += (int)(s_masterBalance*(float)(((SCSPs[0].DSP.EFREG[i] * LPANTABLE[Enc]) >> SHIFT)));
+				smpfr += (int)(s_masterBalance*(float)(((SCSPs[0].DSP.EFREG[i] * RPANTABLE[Enc]) >> SHIFT)));
+			}
+			if (HasSlaveSCSP)
+			{
+				_SLOT *slot = SCSPs[1].Slots + i;
 				if (EFSDL(slot))
 				{
 					UINT16 Enc = ((EFPAN(slot)) << 0x8) | ((EFSDL(slot)) << 0xd);
-					smpfl += (int)(masterBalance*(float)(((SCSPs[0].DSP.EFREG[i] * LPANTABLE[Enc]) >> SHIFT)));
-					smpfr += (int)(masterBalance*(float)(((SCSPs[0].DSP.EFREG[i] * RPANTABLE[Enc]) >> SHIFT)));
-				}
-				if (HasSlaveSCSP)
-				{
-					_SLOT *slot = SCSPs[1].Slots + i;
-					if (EFSDL(slot))
-					{
-						UINT16 Enc = ((EFPAN(slot)) << 0x8) | ((EFSDL(slot)) << 0xd);
-						smprl += (int)(slaveBalance*(float)(((SCSPs[1].DSP.EFREG[i] * LPANTABLE[Enc]) >> SHIFT)));
-						smprr += (int)(slaveBalance*(float)(((SCSPs[1].DSP.EFREG[i] * RPANTABLE[Enc]) >> SHIFT)));
-					}
+					smprl += (int)(s_slaveBalance*(float)(((SCSPs[1].DSP.EFREG[i] * LPANTABLE[Enc]) >> SHIFT)));
+					smprr += (int)(s_slaveBalance*(float)(((SCSPs[1].DSP.EFREG[i] * RPANTABLE[Enc]) >> SHIFT)));
 				}
 			}
 		}
+	}
 
-		if (DAC18B((&SCSP[0])))
-		{
-			smpfl = ICLIP18(smpfl);
-			smpfr = ICLIP18(smpfr);
+	if (DAC18B((&SCSP[0])))
+	{
+		smpfl = ICLIP18(smpfl);
+		smpfr = ICLIP18(smpfr);
 
 #ifdef CORRECT_FOR_18BIT_DAC
-			*buffl++ = (float)smpfl * 0.25f;
-			*buffr++ = (float)smpfr * 0.25f;
+		*s_buffl++ = (float)smpfl * 0.25f;
+		*s_buffr++ = (float)smpfr * 0.25f;
 #else
-			*buffl++ = (float)smpfl;
-			*buffr++ = (float)smpfr;
+		*s_buffl++ = (float)smpfl;
+		*s_buffr++ = (float)smpfr;
 #endif
-		}
-		else
-		{
-			smpfl = ICLIP16(smpfl >> 2);
-			smpfr = ICLIP16(smpfr >> 2);
+	}
+	else
+	{
+		smpfl = ICLIP16(smpfl >> 2);
+		smpfr = ICLIP16(smpfr >> 2);
 
-			*buffl++ = (float)smpfl;
-			*buffr++ = (float)smpfr;
-		}
+		*s_buffl++ = (float)smpfl;
+		*s_buffr++ = (float)smpfr;
+	}
 
-		if (HasSlaveSCSP)
+	if (HasSlaveSCSP)
+	{
+		if (DAC18B((&SCSPs[1])))
 		{
-			if (DAC18B((&SCSPs[1])))
-			{
-				smprl = ICLIP18(smprl);
-				smprr = ICLIP18(smprr);
+			smprl = ICLIP18(smprl);
+			smprr = ICLIP18(smprr);
 
 #ifdef CORRECT_FOR_18BIT_DAC
-				*bufrl++ = (float)smprl * 0.25f;
-				*bufrr++ = (float)smprr * 0.25f;
+			*s_bufrl++ = (float)smprl * 0.25f;
+			*s_bufrr++ = (float)smprr * 0.25f;
 #else
-				*bufrl++ = (float)smprl;
-				*bufrr++ = (float)smprr;
+			*s_bufrl++ = (float)smprl;
+			*s_bufrr++ = (float)smprr;
 #endif
-			}
-			else
-			{
-				smprl = ICLIP16(smprl >> 2);
-				smprr = ICLIP16(smprr >> 2);
-
-				*bufrl++ = (float)smprl;
-				*bufrr++ = (float)smprr;
-			}
 		}
 		else
 		{
-			*bufrl++ = (float)smprl;
-			*bufrr++ = (float)smprr;
+			smprl = ICLIP16(smprl >> 2);
+			smprr = ICLIP16(smprr >> 2);
+
+			*s_bufrl++ = (float)smprl;
+			*s_bufrr++ = (float)smprr;
 		}
+	}
+	else
+	{
+		*s_bufrl++ = (float)smprl;
+		*s_bufrr++ = (float)smprr;
+	}
 
-		SCSP_TimersAddTicks(1);
+	SCSP_TimersAddTicks(1);
+	if (assertIRQ)
 		CheckPendingIRQ();
-		lastdiff = Run68kCB(slice - lastdiff);
+	else
+	{
+		if (MidiW != MidiR)
+			SCSPs->data[0x20 / 2] |= 8;
+		s_irqDeferred = true;
+	}
+	++s_sample;
+}
+
+// Number of samples (timer ticks) until the next timer overflow, or 0 if an interrupt is pending right now
+static int SCSP_SamplesToNextEvent()
+{
+	DWORD pend = SCSPs->data[0x20 / 2];
+	DWORD en = SCSPs->data[0x1e / 2];
+
+	if (MidiW != MidiR)
+		pend |= 8;
+	if (pend & en & (0x40 | 0x80 | 0x100 | 0x8))
+		return 0;
+
+	int n = 0x7fffffff;
+	for (int i = 0; i < 3; i++)
+	{
+		if (TimCnt[i] <= 0xff00)
+		{
+			int inc = 1 << (8 - ((SCSPs->data[(0x18 + 2 * i) / 2] >> 8) & 0x7));
+			n = std::min(n, (0xff00 - TimCnt[i]) / inc + 1);
+		}
+	}
+	return n;
+}
+
+// Generates all samples due at the 68K's current position
+static void SCSP_CatchUp()
+{
+	if (!s_68kRunning)
+		return;
+
+	int due = std::min(s_numSamples, (s_68kTime + Cycles68kCB()) / slice + 1);
+	bool ended = false;
+	while (s_sample < due)
+	{
+		SCSP_GenerateSample(false);
+		if (!ended && SCSP_SamplesToNextEvent() == 0)
+		{
+			// Interrupt became pending (e.g., MIDI from the main board): let it be re-checked every sample
+			End68kCB();
+			ended = true;
+		}
+	}
+}
+
+// Ends the 68K timeslice after an access that may change interrupt state
+static void SCSP_EndSlice()
+{
+	if (s_68kRunning)
+		End68kCB();
+}
+
+void SCSP_DoMasterSamples(int nsamples)
+{
+	static int lastdiff = 0;
+
+	/*
+	 * Compute relative master/slave SCSP balance (note: master is often used
+	 * for the front speakers). Equal balance is a 1.0 scale factor for both.
+	 * When one SCSP is fully attenuated, the other's samples will be multiplied
+	 * by 2.
+	 */
+	float balance = std::max(-100.f,std::min(100.f,s_config->Get("Balance").ValueAs<float>()));
+	balance *= 0.01f;
+	s_masterBalance = 1.0f + balance;
+	s_slaveBalance = 1.0f - balance;
+
+	s_buffl = bufferfl;
+	s_buffr = bufferfr;
+	s_bufrl = bufferrl;
+	s_bufrr = bufferrr;
+
+	/*
+	 * Generate samples, running the 68K in between. The 68K overshoots its
+	 * timeslices by a few cycles, which is carried over in lastdiff.
+	 */
+	s_numSamples = nsamples;
+	s_sample = 0;
+	s_68kTime = lastdiff;
+	while (true)
+	{
+		int due = std::min(nsamples, s_68kTime / slice + 1);
+		while (s_sample < due)
+			SCSP_GenerateSample(true);
+		if (s_sample >= nsamples && s_68kTime >= nsamples * slice)
+			break;
+
+		// Run up to the start of the sample at which an interrupt may next be raised
+		int stop = s_sample + std::max(0, std::min(maxSpan, SCSP_SamplesToNextEvent()) - 1);
+		stop = std::min(stop, nsamples);
+		s_68kRunning = true;
+		int diff = Run68kCB(stop * slice - s_68kTime);
+		s_68kRunning = false;
+		s_68kTime = stop * slice + diff;
+		if (s_irqDeferred)
+		{
+			s_irqDeferred = false;
+			CheckPendingIRQ();
+		}
 	}
+	lastdiff = s_68kTime - nsamples * slice;
 }
 
 void SCSP_Update()
@@ -1726,10 +1873,12 @@ void SCSP_Update()
 	SCSP_DoMasterSamples(length);
 }
 
-void SCSP_SetCB(int (*Run68k)(int cycles),void (*Int68k)(int irq))
+void SCSP_SetCB(int (*Run68k)(int cycles),void (*Int68k)(int irq),int (*Cycles68k)(void),void (*End68k)(void))
 {
 	Int68kCB=Int68k;
 	Run68kCB=Run68k;
+	Cycles68kCB=Cycles68k;
+	End68kCB=End68k;
 }
 
 void SCSP_MidiIn(BYTE val)
@@ -2121,6 +2270,7 @@ void SCSP_LoadState(CBlockFile *StateFile)
 		StateFile->Read(SCSPs[i].DSP.EFREG, sizeof(SCSPs[i].DSP.EFREG));
 		StateFile->Read(&(SCSPs[i].DSP.Stopped), sizeof(SCSPs[i].DSP.Stopped));
 		StateFile->Read(&(SCSPs[i].DSP.LastStep), sizeof(SCSPs[i].DSP.LastStep));
+		SCSPs[i].DSP.Dirty = true;	// compiled program is not saved
 	}
 }
 
@@ -39,7 +39,7 @@ UINT8 SCSP_r8(UINT32 addr);
 UINT16 SCSP_r16(UINT32 addr);
 UINT32 SCSP_r32(UINT32 addr);
 
-void SCSP_SetCB(int (*Run68k)(int cycles),void (*Int68k)(int irq));
+void SCSP_SetCB(int (*Run68k)(int cycles),void (*Int68k)(int irq),int (*Cycles68k)(void),void (*End68k)(void));
 void SCSP_Update();
 void SCSP_MidiIn(UINT8);
 void SCSP_MidiOutW(UINT8);
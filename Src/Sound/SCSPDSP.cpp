@@ -203,6 +203,7 @@ void SCSPDSP_Init(_SCSPDSP *DSP)
 	DSP->Stopped = 1;
 }
 //#ifndef DYNDSP
+#ifdef DSP_INTERPRETER
 void SCSPDSP_Step(_SCSPDSP *DSP)
 {
 	INT32 ACC = 0;    //26 bit
@@ -443,6 +444,312 @@ void SCSPDSP_Step(_SCSPDSP *DSP)
 	--DSP->DEC;
 	memset(DSP->MIXS, 0, 4 * 16);
 }
+#else
+
+/*
+ * Microprogram compiler
+ *
+ * MPRO only changes when the 68K uploads a new program, so rather than
+ * decoding all four words of every step for every sample, the program is
+ * decoded once into an array of _SCSPDSPOps. While doing so:
+ *
+ *	- Memory reads/writes on even steps are dropped (they never take effect).
+ *	- The accumulator is only computed when the following step reads it,
+ *	  either through the shifter or through B.
+ *	- Steps that end up with no visible effect are removed entirely.
+ *	- Each op gets a handler specialised on its shifter mode and on whether
+ *	  it has to produce ACC, so those decisions are not made per sample.
+ *
+ * Registers like FRC_REG, Y_REG, ADRS_REG and MEMVAL are evaluated in exactly
+ * the same order as the step-by-step interpreter, so output is identical.
+ */
+
+enum
+{
+	DSPOP_TWT		= 1<<0,
+	DSPOP_IWT		= 1<<1,
+	DSPOP_MRD		= 1<<2,
+	DSPOP_MWT		= 1<<3,
+	DSPOP_EWT		= 1<<4,
+	DSPOP_FRCL		= 1<<5,
+	DSPOP_YRL		= 1<<6,
+	DSPOP_ADRL		= 1<<7,
+	DSPOP_TABLE		= 1<<8,
+	DSPOP_NOFL		= 1<<9,
+	DSPOP_ADREB		= 1<<10,
+	DSPOP_NXADR		= 1<<11,
+	DSPOP_XSEL		= 1<<12,
+	DSPOP_ZERO		= 1<<13,
+	DSPOP_BSEL		= 1<<14,
+	DSPOP_NEGB		= 1<<15,
+	DSPOP_INPUTS	= 1<<16,	// INPUTS is consumed by this step
+	DSPOP_SHIFTED	= 1<<17		// SHIFTED is consumed by this step
+};
+
+template <UINT32 SHIFT>
+static inline INT32 DSPShift(INT32 ACC)
+{
+	INT32 SHIFTED;
+	if (SHIFT == 0 || SHIFT == 1)
+	{
+		SHIFTED = (SHIFT == 1) ? ACC * 2 : ACC;
+		if (SHIFTED > 0x007FFFFF)
+			SHIFTED = 0x007FFFFF;
+		if (SHIFTED < (-0x00800000))
+			SHIFTED = -0x00800000;
+	}
+	else
+	{
+		SHIFTED = (SHIFT == 2) ? ACC * 2 : ACC;
+		SHIFTED <<= 8;
+		SHIFTED >>= 8;
+	}
+	return SHIFTED;
+}
+
+template <UINT32 SHIFT, bool CALC_ACC>
+static void DSPOp(_SCSPDSP *DSP, const _SCSPDSPOp *Op, _SCSPDSPRegs *R)
+{
+	const UINT32 F = Op->Flags;
+	INT32 INPUTS = 0;
+	INT32 SHIFTED = 0;
+
+	if (F & DSPOP_INPUTS)
+	{
+		UINT32 IRA = Op->IRA;
+		if (IRA <= 0x1f)
+			INPUTS = DSP->MEMS[IRA];
+		else if (IRA <= 0x2F)
+			INPUTS = DSP->MIXS[IRA - 0x20] << 4;  //MIXS is 20 bit
+		else
+			INPUTS = DSP->EXTS[IRA - 0x30] << 8;  //EXTS is 16 bit
+		INPUTS <<= 8;
+		INPUTS >>= 8;
+	}
+
+	if (F & DSPOP_IWT)
+	{
+		DSP->MEMS[Op->IWA] = R->MEMVAL;  //MEMVAL was selected in previous MRD
+		if (Op->IRA == Op->IWA)
+			INPUTS = R->MEMVAL;
+	}
+
+	// Shifter works on the ACC left by the previous step
+	if (F & DSPOP_SHIFTED)
+		SHIFTED = DSPShift<SHIFT>(R->ACC);
+
+	if (CALC_ACC)
+	{
+		INT32 B = 0;
+		INT32 X, Y;
+
+		if (!(F & DSPOP_ZERO))
+		{
+			if (F & DSPOP_BSEL)
+				B = R->ACC;
+			else
+			{
+				B = DSP->TEMP[(Op->TRA + DSP->DEC) & 0x7F];
+				B <<= 8;
+				B >>= 8;
+			}
+			if (F & DSPOP_NEGB)
+				B = 0 - B;
+		}
+
+		if (F & DSPOP_XSEL)
+			X = INPUTS;
+		else
+		{
+			X = DSP->TEMP[(Op->TRA + DSP->DEC) & 0x7F];
+			X <<= 8;
+			X >>= 8;
+		}
+
+		switch (Op->YSEL)
+		{
+		case 0:		Y = R->FRC_REG; break;
+		case 1:		Y = DSP->COEF[Op->COEF] >> 3; break;	//COEF is 16 bits
+		case 2:		Y = (R->Y_REG >> 11) & 0x1FFF; break;
+		default:	Y = (R->Y_REG >> 4) & 0x0FFF; break;
+		}
+		Y <<= 19;
+		Y >>= 19;
+
+		R->ACC = (int)(((INT64)X*(INT64)Y) >> 12) + B;
+	}
+
+	if (F & DSPOP_YRL)
+		R->Y_REG = INPUTS;
+
+	if (F & DSPOP_TWT)
+		DSP->TEMP[(Op->TWA + DSP->DEC) & 0x7F] = SHIFTED;
+
+	if (F & DSPOP_FRCL)
+	{
+		if (SHIFT == 3)
+			R->FRC_REG = SHIFTED & 0x0FFF;
+		else
+			R->FRC_REG = (SHIFTED >> 11) & 0x1FFF;
+	}
+
+	if (F & (DSPOP_MRD | DSPOP_MWT))
+	{
+		UINT32 ADDR = DSP->MADRS[Op->MASA];
+		if (!(F & DSPOP_TABLE))
+			ADDR += DSP->DEC;
+		if (F & DSPOP_ADREB)
+			ADDR += R->ADRS_REG & 0x0FFF;
+		if (F & DSPOP_NXADR)
+			ADDR++;
+		if (!(F & DSPOP_TABLE))
+			ADDR &= DSP->RBL - 1;
+		else
+			ADDR &= 0xFFFF;
+		ADDR += DSP->RBP << 12;
+		if (ADDR > 0x7ffff) ADDR = 0;
+		if (F & DSPOP_MRD)
+		{
+			if (F & DSPOP_NOFL)
+				R->MEMVAL = DSP->SCSPRAM[ADDR] << 8;
+			else
+				R->MEMVAL = UNPACK(DSP->SCSPRAM[ADDR]);
+		}
+		if (F & DSPOP_MWT)
+		{
+			if (F & DSPOP_NOFL)
+				DSP->SCSPRAM[ADDR] = SHIFTED >> 8;
+			else
+				DSP->SCSPRAM[ADDR] = PACK(SHIFTED);
+		}
+	}
+
+	if (F & DSPOP_ADRL)
+	{
+		if (SHIFT == 3)
+			R->ADRS_REG = (SHIFTED >> 12) & 0xFFF;
+		else
+			R->ADRS_REG = (INPUTS >> 16);
+	}
+
+	if (F & DSPOP_EWT)
+		DSP->EFREG[Op->EWA] += SHIFTED >> 8;
+}
+
+static void (* const DSPOpTable[4][2])(_SCSPDSP *, const _SCSPDSPOp *, _SCSPDSPRegs *) =
+{
+	{ DSPOp<0,false>, DSPOp<0,true> },
+	{ DSPOp<1,false>, DSPOp<1,true> },
+	{ DSPOp<2,false>, DSPOp<2,true> },
+	{ DSPOp<3,false>, DSPOp<3,true> }
+};
+
+void SCSPDSP_Compile(_SCSPDSP *DSP)
+{
+	_SCSPDSPOp decoded[128];
+	UINT32 shift[128];
+	bool keep[128];
+	int numSteps = DSP->LastStep;
+
+	DSP->Abort = false;
+	DSP->Dirty = false;
+
+	// Decode every step of the program
+	for (int step = 0; step < DSP->LastStep; ++step)
+	{
+		const UINT16 *IPtr = DSP->MPRO + step * 4;
+		_SCSPDSPOp *Op = &decoded[step];
+
+		Op->TRA = (IPtr[0] >> 8) & 0x7F;
+		Op->TWA = (IPtr[0] >> 0) & 0x7F;
+		Op->IRA = (IPtr[1] >> 6) & 0x3F;
+		Op->IWA = (IPtr[1] >> 0) & 0x1F;
+		Op->EWA = (IPtr[2] >> 8) & 0x0F;
+		Op->YSEL = (IPtr[1] >> 13) & 0x03;
+		Op->COEF = (IPtr[3] >> 9) & 0x3f;
+		Op->MASA = (IPtr[3] >> 2) & 0x1f;
+		shift[step] = (IPtr[2] >> 4) & 0x03;
+
+		// An out of range IRA ends the sample right there (see interpreter)
+		if (Op->IRA > 0x31)
+		{
+			numSteps = step;
+			DSP->Abort = true;
+			break;
+		}
+
+		UINT32 F = 0;
+		if ((IPtr[0] >> 7) & 1)		F |= DSPOP_TWT;
+		if ((IPtr[1] >> 15) & 1)	F |= DSPOP_XSEL;
+		if ((IPtr[1] >> 5) & 1)		F |= DSPOP_IWT;
+		if ((IPtr[2] >> 15) & 1)	F |= DSPOP_TABLE;
+		if ((IPtr[2] >> 12) & 1)	F |= DSPOP_EWT;
+		if ((IPtr[2] >> 7) & 1)		F |= DSPOP_ADRL;
+		if ((IPtr[2] >> 6) & 1)		F |= DSPOP_FRCL;
+		if ((IPtr[2] >> 3) & 1)		F |= DSPOP_YRL;
+		if ((IPtr[2] >> 2) & 1)		F |= DSPOP_NEGB;
+		if ((IPtr[2] >> 1) & 1)		F |= DSPOP_ZERO;
+		if ((IPtr[2] >> 0) & 1)		F |= DSPOP_BSEL;
+		if ((IPtr[3] >> 15) & 1)	F |= DSPOP_NOFL;
+		if ((IPtr[3] >> 1) & 1)		F |= DSPOP_ADREB;
+		if ((IPtr[3] >> 0) & 1)		F |= DSPOP_NXADR;
+		if (step & 1)	//memory only allowed on odd? DoA inserts NOPs on even
+		{
+			if ((IPtr[2] >> 14) & 1)	F |= DSPOP_MWT;
+			if ((IPtr[2] >> 13) & 1)	F |= DSPOP_MRD;
+		}
+		if ((F & (DSPOP_TWT | DSPOP_FRCL | DSPOP_MWT | DSPOP_EWT)) || ((F & DSPOP_ADRL) && shift[step] == 3))
+			F |= DSPOP_SHIFTED;
+		Op->Flags = F;
+	}
+
+	// Backwards pass: a step must compute ACC only if the next step reads it
+	bool calcAcc = false;
+	for (int step = numSteps - 1; step >= 0; --step)
+	{
+		_SCSPDSPOp *Op = &decoded[step];
+		UINT32 F = Op->Flags;
+
+		if (!calcAcc)
+			F &= ~(DSPOP_ZERO | DSPOP_BSEL | DSPOP_NEGB | DSPOP_XSEL);
+		if (((F & DSPOP_XSEL) && calcAcc) || (F & DSPOP_YRL) || ((F & DSPOP_ADRL) && shift[step] != 3))
+			F |= DSPOP_INPUTS;
+		Op->Flags = F;
+		Op->Exec = DSPOpTable[shift[step]][calcAcc ? 1 : 0];
+		keep[step] = calcAcc;
+		calcAcc = (F & DSPOP_SHIFTED) || (calcAcc && !(F & DSPOP_ZERO) && (F & DSPOP_BSEL));
+	}
+
+	// Emit only steps that do something
+	const UINT32 effects = DSPOP_TWT | DSPOP_IWT | DSPOP_MRD | DSPOP_MWT | DSPOP_EWT | DSPOP_FRCL | DSPOP_YRL | DSPOP_ADRL;
+	DSP->NumOps = 0;
+	for (int step = 0; step < numSteps; ++step)
+	{
+		if (keep[step] || (decoded[step].Flags & effects))
+			DSP->Ops[DSP->NumOps++] = decoded[step];
+	}
+}
+
+void SCSPDSP_Step(_SCSPDSP *DSP)
+{
+	_SCSPDSPRegs R = { 0, 0, 0, 0, 0 };
+
+	if (DSP->Stopped)
+		return;
+
+	if (DSP->Dirty)
+		SCSPDSP_Compile(DSP);
+
+	memset(DSP->EFREG, 0, 2 * 16);
+	const _SCSPDSPOp *Op = DSP->Ops;
+	for (int i = 0; i < DSP->NumOps; ++i, ++Op)
+		Op->Exec(DSP, Op, &R);
+	if (DSP->Abort)
+		return;
+	--DSP->DEC;
+	memset(DSP->MIXS, 0, 4 * 16);
+}
+#endif
 
 void SCSPDSP_SetSample(_SCSPDSP *DSP, INT32 sample, int SEL, int MXL)
 {
@@ -464,6 +771,7 @@ void SCSPDSP_Start(_SCSPDSP *DSP)
 			break;
 	}
 	DSP->LastStep = i + 1;
+	DSP->Dirty = true;
 
 /*
 	int test=0;
@@ -33,8 +33,37 @@
 
 //#define DYNDSP
 #define DYNOPT	1		//set to 1 to enable optimization of recompiler
+//#define DSP_INTERPRETER	//decode MPRO on every step instead of running the compiled program
 
 
+struct _SCSPDSP;
+struct _SCSPDSPOp;
+
+//Registers that carry over from one step to the next within a sample
+struct _SCSPDSPRegs
+{
+	INT32 ACC;		//26 bit
+	INT32 MEMVAL;
+	INT32 FRC_REG;	//13 bit
+	INT32 Y_REG;	//24 bit
+	UINT32 ADRS_REG;	//13 bit
+};
+
+//A pre-decoded MPRO step, built by SCSPDSP_Compile() whenever MPRO changes
+struct _SCSPDSPOp
+{
+	void (*Exec)(_SCSPDSP *DSP, const _SCSPDSPOp *Op, _SCSPDSPRegs *R);	//specialised handler for this op's shape
+	UINT32 Flags;	//DSPOP_* bits
+	UINT8 TRA;
+	UINT8 TWA;
+	UINT8 IRA;
+	UINT8 IWA;
+	UINT8 EWA;
+	UINT8 YSEL;
+	UINT8 COEF;
+	UINT8 MASA;
+};
+
 //the DSP Context
 struct _SCSPDSP
 {
@@ -62,6 +91,12 @@ struct _SCSPDSP
 	
 	bool Stopped;
 	int LastStep;
+
+//compiled microprogram
+	_SCSPDSPOp Ops[128];
+	int NumOps;
+	bool Abort;		//program hits an invalid IRA and stops mid-sample
+	bool Dirty;		//MPRO has been written since the last compile
 #ifdef DYNDSP
 	INT32 ACC;	//26 bit
 	INT32 SHIFTED;	//24 bit
@@ -83,6 +118,7 @@ void SCSPDSP_Init(_SCSPDSP *DSP);
 void SCSPDSP_SetSample(_SCSPDSP *DSP,INT32 sample,int SEL,int MXL);
 void SCSPDSP_Step(_SCSPDSP *DSP);
 void SCSPDSP_Start(_SCSPDSP *DSP);
+void SCSPDSP_Compile(_SCSPDSP *DSP);
 
 
 
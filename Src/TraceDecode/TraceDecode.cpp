@@ -0,0 +1,554 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * TraceDecode.cpp
+ *
+ * Offline decoder for PowerPC execution traces recorded with -ppc-trace.
+ * Built with "make tracedecode" as a separate binary.
+ *
+ * Besides a disassembly listing, it reconstructs the call stack as the trace
+ * is read: a branch with LK set that does not fall through is a call, and
+ * reaching the return address of a frame on the stack returns to it (so
+ * that functions which unwind several frames at once are handled). Taken
+ * exceptions push a frame that returns to SRR0. Tail calls made with plain
+ * branches are counted against the caller.
+ *
+ * From the stacks it produces basic-block frequencies, a call graph with the
+ * self cost of each function, and folded stacks ("frame;frame;... weight")
+ * as read by flamegraph.pl and compatible tools. Costs are counted in
+ * instructions, or in cycles if the trace has them.
+ */
+
+#include "Supermodel.h"
+#include "CPU/PowerPC/PPCDisasm.h"
+#include "CPU/PowerPC/PPCTrace.h"
+#include "OSD/Logger.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace PPCTrace;
+
+
+/******************************************************************************
+ Instruction Classification
+******************************************************************************/
+
+static inline bool IsBranch(UINT32 op)
+{
+  switch (op >> 26)
+  {
+  case 16:  // bc
+  case 17:  // sc
+  case 18:  // b
+    return true;
+  case 19:
+  {
+    UINT32 xo = (op >> 1) & 0x3FF;
+    return xo == 16 || xo == 50 || xo == 528;  // bclr, rfi, bcctr
+  }
+  default:
+    return false;
+  }
+}
+
+static inline bool IsCall(UINT32 op)
+{
+  if (!(op & 1))  // LK
+    return false;
+  switch (op >> 26)
+  {
+  case 16:
+  case 18:
+    return true;
+  case 19:
+  {
+    UINT32 xo = (op >> 1) & 0x3FF;
+    return xo == 16 || xo == 528;
+  }
+  default:
+    return false;
+  }
+}
+
+
+/******************************************************************************
+ Stack Reconstruction
+******************************************************************************/
+
+class CTraceAnalyzer
+{
+public:
+  struct Node
+  {
+    UINT32 parent;
+    UINT32 entry;       // function entry or exception vector
+    bool exception;
+    UINT64 weight = 0;  // self cost
+  };
+
+  struct Block
+  {
+    UINT32 end = 0;
+    UINT64 count = 0;
+    UINT64 instructions = 0;
+    UINT64 weight = 0;
+  };
+
+  void Add(const Record &record)
+  {
+    if (m_nodes.empty())
+      m_nodes.push_back({ 0, record.pc, false });  // root: whatever the trace starts in
+
+    UINT64 weight = m_useCycles ? record.cycles - m_lastCycles : 1;
+    m_lastCycles = record.cycles;
+    if (m_havePending)
+      Account(m_pending, m_pendingNode, weight);
+    else if (m_afterException && m_useCycles)
+      m_nodes[CurrentNode()].weight += weight;  // cost of taking the exception
+    m_havePending = false;
+    m_afterException = false;
+
+    if (record.exception)
+    {
+      UINT32 interrupted = CurrentNode();
+      m_exceptions++;
+      m_stack.push_back({ record.pc, GetChild(interrupted, record.ea, true) });
+      m_calls[std::make_pair(m_nodes[interrupted].entry, record.ea)]++;
+      m_afterException = true;
+      m_blockBreak = true;
+      m_haveLast = false;
+      return;
+    }
+
+    if (m_haveLast && IsCall(m_last.opcode) && record.pc != m_last.pc + 4)
+    {
+      UINT32 caller = CurrentNode();
+      m_stack.push_back({ m_last.pc + 4, GetChild(caller, record.pc, false) });
+      m_calls[std::make_pair(m_nodes[caller].entry, record.pc)]++;
+      if (m_stack.size() > MAX_DEPTH)
+        m_stack.erase(m_stack.begin());  // lost track of returns
+    }
+    else
+    {
+      // Unwind to the innermost frame returning here
+      size_t search = std::min<size_t>(m_stack.size(), RETURN_SEARCH_DEPTH);
+      for (size_t i = 0; i < search; i++)
+      {
+        size_t frame = m_stack.size() - 1 - i;
+        if (m_stack[frame].ret == record.pc)
+        {
+          m_stack.resize(frame);
+          break;
+        }
+      }
+    }
+
+    m_instructions++;
+    m_pending = record;
+    m_pendingNode = CurrentNode();
+    m_havePending = true;
+    m_last = record;
+    m_haveLast = true;
+  }
+
+  void Finish(void)
+  {
+    if (m_havePending)
+      Account(m_pending, m_pendingNode, 1);
+    m_havePending = false;
+    FlushBlock();
+  }
+
+  const std::vector<Node> &GetNodes(void) const
+  {
+    return m_nodes;
+  }
+
+  const std::unordered_map<UINT32, Block> &GetBlocks(void) const
+  {
+    return m_blocks;
+  }
+
+  const std::map<std::pair<UINT32, UINT32>, UINT64> &GetCalls(void) const
+  {
+    return m_calls;
+  }
+
+  UINT64 GetInstructions(void) const
+  {
+    return m_instructions;
+  }
+
+  UINT64 GetExceptions(void) const
+  {
+    return m_exceptions;
+  }
+
+  UINT64 GetTotalWeight(void) const
+  {
+    return m_totalWeight;
+  }
+
+  CTraceAnalyzer(bool useCycles)
+    : m_useCycles(useCycles)
+  {
+  }
+
+private:
+  static const size_t MAX_DEPTH = 4096;
+  static const size_t RETURN_SEARCH_DEPTH = 64;
+
+  struct Frame
+  {
+    UINT32 ret;
+    UINT32 node;
+  };
+
+  UINT32 CurrentNode(void) const
+  {
+    return m_stack.empty() ? 0 : m_stack.back().node;
+  }
+
+  UINT32 GetChild(UINT32 parent, UINT32 entry, bool exception)
+  {
+    UINT64 key = (UINT64(parent) << 33) | (UINT64(exception) << 32) | entry;
+    auto it = m_children.find(key);
+    if (it != m_children.end())
+      return it->second;
+    UINT32 node = UINT32(m_nodes.size());
+    m_nodes.push_back({ parent, entry, exception });
+    m_children[key] = node;
+    return node;
+  }
+
+  void Account(const Record &record, UINT32 node, UINT64 weight)
+  {
+    m_nodes[node].weight += weight;
+    m_totalWeight += weight;
+
+    if (m_blockBreak || record.pc != m_blockLast + 4)
+    {
+      FlushBlock();
+      m_blockStart = record.pc;
+      m_inBlock = true;
+    }
+    m_blockLast = record.pc;
+    m_blockInstructions++;
+    m_blockWeight += weight;
+    m_blockBreak = IsBranch(record.opcode);
+  }
+
+  void FlushBlock(void)
+  {
+    if (!m_inBlock)
+      return;
+    Block &block = m_blocks[m_blockStart];
+    block.end = std::max(block.end, m_blockLast);
+    block.count++;
+    block.instructions += m_blockInstructions;
+    block.weight += m_blockWeight;
+    m_blockInstructions = 0;
+    m_blockWeight = 0;
+    m_inBlock = false;
+  }
+
+  const bool m_useCycles;
+
+  // Call stack tree: node 0 is the root
+  std::vector<Node> m_nodes;
+  std::unordered_map<UINT64, UINT32> m_children;
+  std::vector<Frame> m_stack;
+  std::map<std::pair<UINT32, UINT32>, UINT64> m_calls;  // (caller, callee) -> count
+
+  // Instruction awaiting its cost (the cycles up to the next record)
+  Record m_pending;
+  UINT32 m_pendingNode = 0;
+  bool m_havePending = false;
+  bool m_afterException = false;
+  UINT64 m_lastCycles = 0;
+
+  // Previous instruction, for detecting calls
+  Record m_last;
+  bool m_haveLast = false;
+
+  // Basic block being executed
+  std::unordered_map<UINT32, Block> m_blocks;
+  UINT32 m_blockStart = 0;
+  UINT32 m_blockLast = 0;
+  UINT64 m_blockInstructions = 0;
+  UINT64 m_blockWeight = 0;
+  bool m_inBlock = false;
+  bool m_blockBreak = true;
+
+  UINT64 m_instructions = 0;
+  UINT64 m_exceptions = 0;
+  UINT64 m_totalWeight = 0;
+};
+
+static std::string FrameName(const CTraceAnalyzer::Node &node)
+{
+  char name[32];
+  sprintf(name, node.exception ? "exception_%08X" : "func_%08X", node.entry);
+  return name;
+}
+
+
+/******************************************************************************
+ Output
+******************************************************************************/
+
+static void PrintListing(CPPCTraceReader *reader, UINT64 count)
+{
+  bool cycles = (reader->GetFields() & FIELD_CYCLES) != 0;
+  Record record;
+  for (UINT64 n = 0; (count == 0 || n < count) && reader->Next(&record); n++)
+  {
+    if (cycles)
+      printf("%12llu  ", (unsigned long long) record.cycles);
+    if (record.exception)
+    {
+      printf("-- exception %u at %08X -> %08X\n", record.opcode, record.pc, record.ea);
+      continue;
+    }
+    char mnem[16];
+    char oprs[48];
+    if (DisassemblePowerPC(record.opcode, record.pc, mnem, oprs, true) != OKAY && mnem[0] == '\0')
+    {
+      strcpy(mnem, "?");
+      oprs[0] = '\0';
+    }
+    if (record.hasEA)
+      printf("%08X: %08X  %-8s %-24s ; ea=%08X\n", record.pc, record.opcode, mnem, oprs, record.ea);
+    else
+      printf("%08X: %08X  %-8s %s\n", record.pc, record.opcode, mnem, oprs);
+  }
+}
+
+static void PrintSummary(const CTraceAnalyzer &analyzer, bool useCycles)
+{
+  printf("%llu instructions, %llu exceptions", (unsigned long long) analyzer.GetInstructions(), (unsigned long long) analyzer.GetExceptions());
+  if (useCycles)
+    printf(", %llu cycles", (unsigned long long) analyzer.GetTotalWeight());
+  printf("\n\n");
+}
+
+static double Percent(UINT64 part, UINT64 total)
+{
+  return total ? 100.0 * double(part) / double(total) : 0.0;
+}
+
+static void PrintBlocks(const CTraceAnalyzer &analyzer, size_t top, bool useCycles)
+{
+  const char *unit = useCycles ? "Cycles" : "Instructions";
+  PrintSummary(analyzer, useCycles);
+  std::vector<std::pair<UINT32, CTraceAnalyzer::Block>> blocks(analyzer.GetBlocks().begin(), analyzer.GetBlocks().end());
+  std::sort(blocks.begin(), blocks.end(), [](const auto &a, const auto &b) { return a.second.weight > b.second.weight; });
+  if (top != 0 && blocks.size() > top)
+    blocks.resize(top);
+
+  printf("%-8s %-8s %12s %8s %14s %7s\n", "Start", "End", "Executed", "Length", unit, "%");
+  for (auto &v: blocks)
+  {
+    const CTraceAnalyzer::Block &block = v.second;
+    printf("%08X %08X %12llu %8.1f %14llu %6.2f%%\n", v.first, block.end, (unsigned long long) block.count,
+      double(block.instructions) / double(block.count), (unsigned long long) block.weight, Percent(block.weight, analyzer.GetTotalWeight()));
+  }
+}
+
+static void PrintCallGraph(const CTraceAnalyzer &analyzer, size_t top, bool useCycles)
+{
+  const char *unit = useCycles ? "Cycles" : "Instructions";
+  PrintSummary(analyzer, useCycles);
+
+  struct Function
+  {
+    std::string name;
+    UINT64 self = 0;
+    UINT64 calls = 0;
+    std::vector<std::pair<UINT64, UINT32>> callees;
+  };
+  std::map<UINT32, Function> functions;
+  for (auto &node: analyzer.GetNodes())
+  {
+    Function &function = functions[node.entry];
+    function.name = FrameName(node);
+    function.self += node.weight;
+  }
+  for (auto &v: analyzer.GetCalls())
+  {
+    functions[v.first.second].calls += v.second;
+    functions[v.first.first].callees.emplace_back(v.second, v.first.second);
+  }
+
+  std::vector<const Function *> sorted;
+  for (auto &v: functions)
+    sorted.push_back(&v.second);
+  std::sort(sorted.begin(), sorted.end(), [](const Function *a, const Function *b) { return a->self > b->self; });
+  if (top != 0 && sorted.size() > top)
+    sorted.resize(top);
+
+  printf("%-18s %12s %14s %7s\n", "Function", "Calls", unit, "%");
+  for (const Function *function: sorted)
+  {
+    printf("%-18s %12llu %14llu %6.2f%%\n", function->name.c_str(), (unsigned long long) function->calls,
+      (unsigned long long) function->self, Percent(function->self, analyzer.GetTotalWeight()));
+    std::vector<std::pair<UINT64, UINT32>> callees = function->callees;
+    std::sort(callees.rbegin(), callees.rend());
+    for (auto &callee: callees)
+      printf("    -> %-15s %8llu\n", functions[callee.second].name.c_str(), (unsigned long long) callee.first);
+  }
+}
+
+static void PrintStacks(const CTraceAnalyzer &analyzer)
+{
+  const std::vector<CTraceAnalyzer::Node> &nodes = analyzer.GetNodes();
+  std::vector<std::string> paths(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++)
+  {
+    // Parents always come before their children
+    paths[i] = i == 0 ? FrameName(nodes[i]) : paths[nodes[i].parent] + ";" + FrameName(nodes[i]);
+    if (nodes[i].weight != 0)
+      printf("%s %llu\n", paths[i].c_str(), (unsigned long long) nodes[i].weight);
+  }
+}
+
+
+/******************************************************************************
+ Entry Point
+******************************************************************************/
+
+static void Help(void)
+{
+  puts("Usage: tracedecode <trace file> [options]");
+  puts("Decodes a PowerPC execution trace recorded with -ppc-trace.");
+  puts("");
+  puts("Output (one of):");
+  puts("  -listing                Disassembly of every instruction [Default]");
+  puts("  -blocks                 Basic blocks by cost");
+  puts("  -calls                  Functions by self cost, with the functions they call");
+  puts("  -stacks                 Folded stacks for flame graph tools");
+  puts("");
+  puts("Options:");
+  puts("  -count=<n>              Stop the listing after <n> records");
+  puts("  -top=<n>                Number of blocks or functions to print [Default: 50,");
+  puts("                          0 for all]");
+  puts("  -weight=<w>             Cost in instructions [Default] or cycles (requires a");
+  puts("                          trace recorded with -ppc-trace-fields=cycles)");
+  puts("  -help                   Print this message");
+}
+
+static bool ParseValue(const std::string &arg, const char *option, std::string *value)
+{
+  size_t len = strlen(option);
+  if (arg.compare(0, len, option) != 0 || arg.size() <= len || arg[len] != '=')
+    return false;
+  *value = arg.substr(len + 1);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  SetLogger(std::make_shared<CConsoleErrorLogger>());
+
+  enum class Mode { Listing, Blocks, Calls, Stacks };
+  Mode mode = Mode::Listing;
+  std::string filename;
+  UINT64 count = 0;
+  size_t top = 50;
+  bool useCycles = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg(argv[i]);
+    std::string value;
+    if (arg == "-listing")
+      mode = Mode::Listing;
+    else if (arg == "-blocks")
+      mode = Mode::Blocks;
+    else if (arg == "-calls")
+      mode = Mode::Calls;
+    else if (arg == "-stacks")
+      mode = Mode::Stacks;
+    else if (ParseValue(arg, "-count", &value))
+      count = strtoull(value.c_str(), NULL, 10);
+    else if (ParseValue(arg, "-top", &value))
+      top = size_t(strtoull(value.c_str(), NULL, 10));
+    else if (ParseValue(arg, "-weight", &value) && (value == "instructions" || value == "cycles"))
+      useCycles = value == "cycles";
+    else if (arg == "-help" || arg == "--help" || arg == "-?")
+    {
+      Help();
+      return 0;
+    }
+    else if (arg[0] != '-' && filename.empty())
+      filename = arg;
+    else
+    {
+      ErrorLog("Unrecognized option: %s", arg.c_str());
+      return 1;
+    }
+  }
+  if (filename.empty())
+  {
+    Help();
+    return 1;
+  }
+
+  CPPCTraceReader reader;
+  if (OKAY != reader.Open(filename))
+    return 1;
+  if (useCycles && !(reader.GetFields() & FIELD_CYCLES))
+  {
+    ErrorLog("'%s' was recorded without cycle counts.", filename.c_str());
+    return 1;
+  }
+
+  if (mode == Mode::Listing)
+    PrintListing(&reader, count);
+  else
+  {
+    CTraceAnalyzer analyzer(useCycles);
+    Record record;
+    while (reader.Next(&record))
+      analyzer.Add(record);
+    analyzer.Finish();
+
+    if (mode == Mode::Blocks)
+      PrintBlocks(analyzer, top, useCycles);
+    else if (mode == Mode::Calls)
+      PrintCallGraph(analyzer, top, useCycles);
+    else
+      PrintStacks(analyzer);
+  }
+
+  if (reader.IsTruncated())
+    ErrorLog("'%s' is truncated or corrupt. It was decoded up to the last complete record.", filename.c_str());
+  return 0;
+}
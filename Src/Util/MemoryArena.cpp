@@ -0,0 +1,369 @@
+#include "Util/MemoryArena.h"
+#include "Supermodel.h"
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+#endif
+
+namespace Util
+{
+  namespace
+  {
+    enum class HugePages
+    {
+      Off,
+      Transparent,
+      Explicit
+    };
+
+    struct Block
+    {
+      uint8_t *base;
+      size_t size;      // Linux: rounded up to huge pages, plus the guard gap that follows
+      bool inUse;
+      std::string name;
+      size_t regionSize;
+      HugePages pages;
+      int fd;
+    };
+
+    const char *GetPagesName(HugePages pages)
+    {
+      switch (pages)
+      {
+      case HugePages::Transparent:
+        return "transparent";
+      case HugePages::Explicit:
+        return "explicit";
+      default:
+        return "off";
+      }
+    }
+
+    std::mutex s_mutex;
+    std::vector<Block> s_blocks;  // in address order
+    HugePages s_hugePages = HugePages::Transparent;
+  }
+
+  bool MemoryArena::SetHugePages(const std::string &mode)
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (mode == "off")
+      s_hugePages = HugePages::Off;
+    else if (mode == "transparent")
+      s_hugePages = HugePages::Transparent;
+    else if (mode == "explicit")
+      s_hugePages = HugePages::Explicit;
+    else
+      return FAIL;
+    return OKAY;
+  }
+
+#ifdef __linux__
+
+  namespace
+  {
+    const size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+    const size_t GUARD_SIZE = HUGE_PAGE_SIZE;
+    const size_t ARENA_SIZE = sizeof(void *) >= 8 ? (size_t(16) << 30) : (size_t(1) << 30);
+
+    uint8_t *s_arena = nullptr;
+    bool s_explicitWarned = false;
+
+    size_t RoundUp(size_t size)
+    {
+      return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    }
+
+    bool Reserve()
+    {
+      // Over-reserve so that the arena can start on a huge page boundary
+      void *ptr = mmap(nullptr, ARENA_SIZE + HUGE_PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (ptr == MAP_FAILED)
+        return ErrorLog("Unable to reserve %u MB of address space for emulated memory: %s", unsigned(ARENA_SIZE >> 20), strerror(errno));
+      uint8_t *start = (uint8_t *) ptr;
+      uint8_t *aligned = (uint8_t *) ((uintptr_t(start) + HUGE_PAGE_SIZE - 1) & ~uintptr_t(HUGE_PAGE_SIZE - 1));
+      if (aligned > start)
+        munmap(start, aligned - start);
+      munmap(aligned + ARENA_SIZE, start + HUGE_PAGE_SIZE - aligned);
+      s_arena = aligned;
+
+      // The first huge page stays a guard in front of the first region
+      s_blocks.push_back({ s_arena + GUARD_SIZE, ARENA_SIZE - GUARD_SIZE, false, std::string(), 0, HugePages::Off, -1 });
+      return OKAY;
+    }
+
+    // Returns a range to reserved, inaccessible address space and discards its contents
+    void Decommit(uint8_t *base, size_t size)
+    {
+      mmap(base, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    }
+
+    bool Commit(Block &block, unsigned flags)
+    {
+      size_t size = RoundUp(block.regionSize);
+      HugePages pages = (flags & MemoryArena::SMALL_PAGES) ? HugePages::Off : s_hugePages;
+      bool hugetlb = false;
+      void *ptr = MAP_FAILED;
+
+      // Hugetlbfs mappings are reserved when they are made, so an exhausted
+      // pool fails here rather than on first touch
+      if (flags & MemoryArena::SHARED)
+      {
+        if (pages == HugePages::Explicit)
+        {
+          block.fd = int(syscall(SYS_memfd_create, block.name.c_str(), MFD_HUGETLB));
+          if (block.fd >= 0 && ftruncate(block.fd, off_t(size)) == 0)
+            ptr = mmap(block.base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, block.fd, 0);
+          hugetlb = ptr != MAP_FAILED;
+          if (!hugetlb && block.fd >= 0)
+          {
+            close(block.fd);
+            block.fd = -1;
+          }
+        }
+        if (!hugetlb)
+        {
+          block.fd = int(syscall(SYS_memfd_create, block.name.c_str(), 0));
+          if (block.fd >= 0 && ftruncate(block.fd, off_t(size)) == 0)
+            ptr = mmap(block.base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, block.fd, 0);
+          if (ptr == MAP_FAILED && block.fd >= 0)
+          {
+            close(block.fd);
+            block.fd = -1;
+          }
+        }
+      }
+      else
+      {
+        if (pages == HugePages::Explicit)
+          ptr = mmap(block.base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0);
+        hugetlb = ptr != MAP_FAILED;
+        if (!hugetlb)
+          ptr = mmap(block.base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+      }
+
+      if (ptr == MAP_FAILED)
+      {
+        Decommit(block.base, size);
+        return FAIL;
+      }
+
+      if (pages == HugePages::Explicit && !hugetlb)
+      {
+        pages = HugePages::Transparent;
+        if (!s_explicitWarned)
+        {
+          InfoLog("Not enough explicit huge pages available (see vm.nr_hugepages), using transparent huge pages.");
+          s_explicitWarned = true;
+        }
+      }
+      if (pages == HugePages::Transparent)
+        madvise(block.base, size, MADV_HUGEPAGE);
+      else if (pages == HugePages::Off)
+        madvise(block.base, size, MADV_NOHUGEPAGE);
+      block.pages = pages;
+      return OKAY;
+    }
+
+    void Merge(size_t i)
+    {
+      if (i + 1 < s_blocks.size() && !s_blocks[i + 1].inUse)
+      {
+        s_blocks[i].size += s_blocks[i + 1].size;
+        s_blocks.erase(s_blocks.begin() + i + 1);
+      }
+      if (i > 0 && !s_blocks[i - 1].inUse)
+      {
+        s_blocks[i - 1].size += s_blocks[i].size;
+        s_blocks.erase(s_blocks.begin() + i);
+      }
+    }
+  }
+
+  uint8_t *MemoryArena::Allocate(const char *name, size_t size, unsigned flags)
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (s_arena == nullptr && OKAY != Reserve())
+      return nullptr;
+
+    size_t needed = RoundUp(size) + GUARD_SIZE;
+    for (size_t i = 0; i < s_blocks.size(); i++)
+    {
+      if (s_blocks[i].inUse || s_blocks[i].size < needed)
+        continue;
+      if (s_blocks[i].size > needed)
+        s_blocks.insert(s_blocks.begin() + i + 1, { s_blocks[i].base + needed, s_blocks[i].size - needed, false, std::string(), 0, HugePages::Off, -1 });
+      Block &block = s_blocks[i];
+      block.size = needed;
+      block.inUse = true;
+      block.name = name;
+      block.regionSize = size;
+      block.fd = -1;
+      if (OKAY != Commit(block, flags))
+      {
+        block.inUse = false;
+        Merge(i);
+        return nullptr;
+      }
+      return block.base;
+    }
+
+    ErrorLog("Emulated memory arena is full (%s needs %1.1f MB).", name, float(size) / float(0x100000));
+    return nullptr;
+  }
+
+  void MemoryArena::Free(uint8_t *ptr)
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (size_t i = 0; i < s_blocks.size(); i++)
+    {
+      Block &block = s_blocks[i];
+      if (!block.inUse || block.base != ptr)
+        continue;
+      Decommit(block.base, RoundUp(block.regionSize));
+      if (block.fd >= 0)
+        close(block.fd);
+      block.fd = -1;
+      block.inUse = false;
+      block.name.clear();
+      Merge(i);
+      return;
+    }
+  }
+
+  std::vector<MemoryArena::Region> MemoryArena::GetMap()
+  {
+    std::vector<Region> map;
+    {
+      std::lock_guard<std::mutex> lock(s_mutex);
+      for (const Block &block : s_blocks)
+      {
+        if (block.inUse)
+          map.push_back({ block.name, block.base, block.regionSize, GetPagesName(block.pages), 0, 0 });
+      }
+    }
+
+    // Sum up the mappings that make up each region (write protection may have
+    // split a region into several)
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if (fp == nullptr)
+      return map;
+    char line[512];
+    Region *current = nullptr;
+    while (fgets(line, sizeof(line), fp) != nullptr)
+    {
+      unsigned long start, end, kb;
+      char field[64];
+      if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+      {
+        current = nullptr;
+        for (Region &region : map)
+        {
+          if ((uint8_t *) start >= region.base && (uint8_t *) start < region.base + region.size)
+            current = &region;
+        }
+      }
+      else if (current != nullptr && sscanf(line, "%63[^:]: %lu kB", field, &kb) == 2)
+      {
+        size_t bytes = size_t(kb) << 10;
+        if (!strcmp(field, "Rss"))
+          current->resident += bytes;
+        else if (!strcmp(field, "AnonHugePages") || !strcmp(field, "ShmemPmdMapped"))
+          current->huge += bytes;
+        else if (!strcmp(field, "Shared_Hugetlb") || !strcmp(field, "Private_Hugetlb"))
+        {
+          current->resident += bytes;   // not included in Rss
+          current->huge += bytes;
+        }
+      }
+    }
+    fclose(fp);
+    return map;
+  }
+
+  int MemoryArena::GetFile(const uint8_t *ptr)
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (const Block &block : s_blocks)
+    {
+      if (block.inUse && block.base == ptr)
+        return block.fd;
+    }
+    return -1;
+  }
+
+#else
+
+  uint8_t *MemoryArena::Allocate(const char *name, size_t size, unsigned flags)
+  {
+    if (flags & SHARED)
+      return nullptr;
+    uint8_t *ptr = new(std::nothrow) uint8_t[size];
+    if (ptr == nullptr)
+      return nullptr;
+    memset(ptr, 0, size);
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_blocks.push_back({ ptr, size, true, name, size, HugePages::Off, -1 });
+    return ptr;
+  }
+
+  void MemoryArena::Free(uint8_t *ptr)
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (size_t i = 0; i < s_blocks.size(); i++)
+    {
+      if (s_blocks[i].base == ptr)
+      {
+        delete [] ptr;
+        s_blocks.erase(s_blocks.begin() + i);
+        return;
+      }
+    }
+  }
+
+  std::vector<MemoryArena::Region> MemoryArena::GetMap()
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    std::vector<Region> map;
+    for (const Block &block : s_blocks)
+      map.push_back({ block.name, block.base, block.regionSize, GetPagesName(block.pages), 0, 0 });
+    return map;
+  }
+
+  int MemoryArena::GetFile(const uint8_t *ptr)
+  {
+    return -1;
+  }
+
+#endif  // __linux__
+
+  void MemoryArena::LogMap()
+  {
+    std::vector<Region> map = GetMap();
+    size_t size = 0;
+    size_t resident = 0;
+    InfoLog("Emulated memory map:");
+    for (const Region &region : map)
+    {
+      InfoLog("  %p-%p %-16s %7.1f MB, %7.1f MB resident (%.1f MB in huge pages, %s)",
+        region.base, region.base + region.size - 1, region.name.c_str(),
+        float(region.size) / float(0x100000), float(region.resident) / float(0x100000),
+        float(region.huge) / float(0x100000), region.pages);
+      size += region.size;
+      resident += region.resident;
+    }
+    InfoLog("  Total %1.1f MB, %1.1f MB resident", float(size) / float(0x100000), float(resident) / float(0x100000));
+  }
+} // Util
@@ -0,0 +1,71 @@
+#ifndef INCLUDED_UTIL_MEMORYARENA_H
+#define INCLUDED_UTIL_MEMORYARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Util
+{
+  /*
+   * Arena for emulated memory.
+   *
+   * All large memory pools (RAM, ROMs and the renderers' read-only snapshots)
+   * are carved out of one reserved range of address space. Each region starts
+   * on a 2 MB boundary, is backed by huge pages where possible to cut TLB
+   * misses on the emulation and render threads, and is followed by an
+   * inaccessible guard gap so that overruns fault instead of corrupting the
+   * next region.
+   *
+   * Huge pages are controlled by SetHugePages():
+   *
+   *  - "transparent": regions are advised to use transparent huge pages
+   *    (the default).
+   *  - "explicit": regions are taken from the preallocated hugetlbfs pool
+   *    (vm.nr_hugepages), falling back to transparent huge pages when it is
+   *    too small.
+   *  - "off": regular pages only.
+   *
+   * Regions are zero filled. Linux only; elsewhere regions are ordinary heap
+   * blocks, SHARED regions cannot be allocated and no residency is reported.
+   */
+  class MemoryArena
+  {
+  public:
+    enum Flags
+    {
+      SHARED      = 1,  // backed by a memory file that can be mapped a second time (see GetFile())
+      SMALL_PAGES = 2   // never huge pages (e.g. write protected page by page)
+    };
+
+    struct Region
+    {
+      std::string name;
+      uint8_t *base;
+      size_t size;
+      const char *pages;  // huge page mode requested for the region
+      size_t resident;    // bytes currently in memory
+      size_t huge;        // ... of which in huge pages
+    };
+
+    // Sets the huge page mode for subsequent allocations. Returns FAIL if the
+    // mode is not recognized.
+    static bool SetHugePages(const std::string &mode);
+
+    // Allocates a named region of at least size bytes, or returns null
+    static uint8_t *Allocate(const char *name, size_t size, unsigned flags = 0);
+    static void Free(uint8_t *ptr);
+
+    // Memory file descriptor of a SHARED region (offset 0 is its base), or -1
+    static int GetFile(const uint8_t *ptr);
+
+    // Current regions in address order, with their residency
+    static std::vector<Region> GetMap();
+
+    // Writes the memory map to the log
+    static void LogMap();
+  };
+} // Util
+
+#endif  // INCLUDED_UTIL_MEMORYARENA_H
@@ -0,0 +1,401 @@
+#include "Util/WriteWatch.h"
+#include "Supermodel.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/userfaultfd.h>
+#endif
+
+#if defined(__linux__) && defined(UFFDIO_WRITEPROTECT) && defined(UFFD_USER_MODE_ONLY)
+#define WRITEWATCH_UFFD
+
+// Newer than some system headers
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC       (1 << 15)
+#endif
+
+namespace
+{
+  // From <linux/fs.h> (Linux 6.7)
+  struct PageRegion
+  {
+    uint64_t start;
+    uint64_t end;
+    uint64_t categories;
+  };
+
+  struct PMScanArg
+  {
+    uint64_t size;
+    uint64_t flags;
+    uint64_t start;
+    uint64_t end;
+    uint64_t walkEnd;
+    uint64_t vec;
+    uint64_t vecLen;
+    uint64_t maxPages;
+    uint64_t categoryInverted;
+    uint64_t categoryMask;
+    uint64_t categoryAnyofMask;
+    uint64_t returnMask;
+  };
+
+  const uint64_t PAGE_IS_WRITTEN        = 1 << 1;
+  const uint64_t PM_SCAN_WP_MATCHING    = 1 << 0;
+  const uint64_t PM_SCAN_CHECK_WPASYNC  = 1 << 1;
+  const unsigned long PAGEMAP_SCAN_IOCTL = _IOWR('f', 16, PMScanArg);
+}
+#endif
+
+namespace Util
+{
+#ifdef __linux__
+
+  namespace
+  {
+    struct Region
+    {
+      uint8_t *base;
+      size_t size;
+      uint8_t *dirty;
+      unsigned pageWidth;
+      uint8_t *written;   // mprotect: one bit per host page unprotected since Update()
+    };
+
+    enum class Method
+    {
+      None,
+      Userfaultfd,
+      Mprotect
+    };
+
+    // Global so that the fault handler can find them. Only modified while no
+    // watched memory is being written.
+    const int MAX_GLOBAL_REGIONS = 32;
+    Region s_regions[MAX_GLOBAL_REGIONS];
+    Method s_method = Method::None;
+    size_t s_pageSize = 0;
+    int s_uffd = -1;
+    int s_pagemap = -1;
+    struct sigaction s_prevAction;
+
+    void MarkDirty(const Region &region, size_t start, size_t end)
+    {
+      end = std::min(end, region.size);
+      for (size_t page = start >> region.pageWidth; page <= (end - 1) >> region.pageWidth; page++)
+        region.dirty[page >> 3] |= 1 << (page & 7);
+    }
+
+    void FaultHandler(int sig, siginfo_t *info, void *context)
+    {
+      uint8_t *fault = (uint8_t *) info->si_addr;
+      for (const Region &region : s_regions)
+      {
+        if (region.base == nullptr || fault < region.base || fault >= region.base + region.size)
+          continue;
+
+        size_t hostPage = size_t(fault - region.base) / s_pageSize;
+        MarkDirty(region, hostPage * s_pageSize, (hostPage + 1) * s_pageSize);
+        region.written[hostPage >> 3] |= 1 << (hostPage & 7);
+        if (mprotect(region.base + hostPage * s_pageSize, s_pageSize, PROT_READ | PROT_WRITE) == 0)
+          return;   // retry the write
+        break;
+      }
+
+      // Not ours: hand over to whatever was installed before, or crash as usual
+      if (s_prevAction.sa_flags & SA_SIGINFO)
+        s_prevAction.sa_sigaction(sig, info, context);
+      else if (s_prevAction.sa_handler != SIG_DFL && s_prevAction.sa_handler != SIG_IGN)
+        s_prevAction.sa_handler(sig);
+      else
+      {
+        signal(sig, SIG_DFL);
+        raise(sig);
+      }
+    }
+
+#ifdef WRITEWATCH_UFFD
+    bool InitUserfaultfd()
+    {
+      s_uffd = int(syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+      if (s_uffd < 0)
+        return FAIL;
+      struct uffdio_api api;
+      memset(&api, 0, sizeof(api));
+      api.api = UFFD_API;
+      api.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED;
+      s_pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+      if (ioctl(s_uffd, UFFDIO_API, &api) != 0 || s_pagemap < 0)
+      {
+        close(s_uffd);
+        s_uffd = -1;
+        if (s_pagemap >= 0)
+          close(s_pagemap);
+        s_pagemap = -1;
+        return FAIL;
+      }
+      return OKAY;
+    }
+
+    bool WriteProtect(uint8_t *base, size_t size, bool enable)
+    {
+      struct uffdio_writeprotect wp;
+      wp.range.start = uint64_t(base);
+      wp.range.len = size;
+      wp.mode = enable ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+      return ioctl(s_uffd, UFFDIO_WRITEPROTECT, &wp) == 0 ? OKAY : FAIL;
+    }
+
+    // Collects and write-protects again the pages written since the last scan
+    void ScanWritten(const Region &region)
+    {
+      PageRegion vec[64];
+      PMScanArg arg;
+      memset(&arg, 0, sizeof(arg));
+      arg.size = sizeof(arg);
+      arg.flags = PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC;
+      arg.start = uint64_t(region.base);
+      arg.end = uint64_t(region.base) + (region.size + s_pageSize - 1) / s_pageSize * s_pageSize;
+      arg.vec = uint64_t(vec);
+      arg.vecLen = sizeof(vec) / sizeof(vec[0]);
+      arg.categoryMask = PAGE_IS_WRITTEN;
+      arg.returnMask = PAGE_IS_WRITTEN;
+      while (arg.start < arg.end)
+      {
+        long n = ioctl(s_pagemap, PAGEMAP_SCAN_IOCTL, &arg);
+        if (n < 0)
+        {
+          // Should not happen; mark everything rather than miss writes
+          MarkDirty(region, 0, region.size);
+          return;
+        }
+        for (long i = 0; i < n; i++)
+          MarkDirty(region, size_t(vec[i].start - uint64_t(region.base)), size_t(vec[i].end - uint64_t(region.base)));
+        arg.start = arg.walkEnd;
+      }
+    }
+#endif
+
+    bool InitMethod()
+    {
+      if (s_method != Method::None)
+        return OKAY;
+      s_pageSize = size_t(sysconf(_SC_PAGESIZE));
+#ifdef WRITEWATCH_UFFD
+      if (OKAY == InitUserfaultfd())
+      {
+        s_method = Method::Userfaultfd;
+        return OKAY;
+      }
+#endif
+      struct sigaction action;
+      memset(&action, 0, sizeof(action));
+      action.sa_sigaction = FaultHandler;
+      action.sa_flags = SA_SIGINFO | SA_NODEFER;  // writes may fault inside other fault handlers
+      sigemptyset(&action.sa_mask);
+      if (sigaction(SIGSEGV, &action, &s_prevAction) != 0)
+        return ErrorLog("Unable to install write watch fault handler: %s", strerror(errno));
+      s_method = Method::Mprotect;
+      return OKAY;
+    }
+  }
+
+  bool WriteWatch::IsSupported()
+  {
+    return true;
+  }
+
+  const char *WriteWatch::GetMethod()
+  {
+    switch (s_method)
+    {
+    case Method::Userfaultfd:
+      return "userfaultfd";
+    case Method::Mprotect:
+      return "mprotect";
+    default:
+      return "none";
+    }
+  }
+
+  bool WriteWatch::Watch(uint8_t *base, size_t size, uint8_t *dirty, unsigned pageWidth)
+  {
+    if (OKAY != InitMethod())
+      return FAIL;
+    if (m_numRegions >= MAX_REGIONS || (uintptr_t(base) & (s_pageSize - 1)) != 0)
+      return ErrorLog("Unable to watch memory region at %p.", base);
+
+    int idx = 0;
+    while (idx < MAX_GLOBAL_REGIONS && s_regions[idx].base != nullptr)
+      idx++;
+    if (idx == MAX_GLOBAL_REGIONS)
+      return ErrorLog("Too many watched memory regions.");
+
+    size_t hostPages = (size + s_pageSize - 1) / s_pageSize;
+    uint8_t *written = nullptr;
+    if (s_method == Method::Mprotect)
+    {
+      written = new(std::nothrow) uint8_t[(hostPages + 7) / 8]();
+      if (written == nullptr)
+        return ErrorLog("Insufficient memory to watch memory region.");
+      if (mprotect(base, hostPages * s_pageSize, PROT_READ) != 0)
+      {
+        delete [] written;
+        return ErrorLog("Unable to write protect memory region: %s", strerror(errno));
+      }
+    }
+#ifdef WRITEWATCH_UFFD
+    else
+    {
+      struct uffdio_register reg;
+      memset(&reg, 0, sizeof(reg));
+      reg.range.start = uint64_t(base);
+      reg.range.len = hostPages * s_pageSize;
+      reg.mode = UFFDIO_REGISTER_MODE_WP;
+      if (ioctl(s_uffd, UFFDIO_REGISTER, &reg) != 0)
+        return ErrorLog("Unable to register memory region with userfaultfd: %s", strerror(errno));
+      if (OKAY != WriteProtect(base, hostPages * s_pageSize, true))
+      {
+        ioctl(s_uffd, UFFDIO_UNREGISTER, &reg.range);
+        return ErrorLog("Unable to write protect memory region: %s", strerror(errno));
+      }
+    }
+#endif
+
+    s_regions[idx].dirty = dirty;
+    s_regions[idx].pageWidth = pageWidth;
+    s_regions[idx].written = written;
+    s_regions[idx].size = size;
+    s_regions[idx].base = base;
+    m_regions[m_numRegions++] = idx;
+    return OKAY;
+  }
+
+  void WriteWatch::Update()
+  {
+    for (unsigned i = 0; i < m_numRegions; i++)
+    {
+      Region &region = s_regions[m_regions[i]];
+      size_t hostPages = (region.size + s_pageSize - 1) / s_pageSize;
+
+#ifdef WRITEWATCH_UFFD
+      if (s_method == Method::Userfaultfd)
+      {
+        if (m_unprotected)
+          WriteProtect(region.base, hostPages * s_pageSize, true);
+        else
+          ScanWritten(region);
+        continue;
+      }
+#endif
+
+      // Dirty pages were marked by the fault handler; protect runs of written
+      // pages with one call each
+      size_t page = 0;
+      while (page < hostPages)
+      {
+        if ((region.written[page >> 3] & (1 << (page & 7))) == 0)
+        {
+          page += region.written[page >> 3] == 0 ? 8 - (page & 7) : 1;
+          continue;
+        }
+        size_t first = page;
+        while (page < hostPages && (region.written[page >> 3] & (1 << (page & 7))))
+          page++;
+        mprotect(region.base + first * s_pageSize, (page - first) * s_pageSize, PROT_READ);
+      }
+      memset(region.written, 0, (hostPages + 7) / 8);
+    }
+    m_unprotected = false;
+  }
+
+  void WriteWatch::Unprotect()
+  {
+    for (unsigned i = 0; i < m_numRegions; i++)
+    {
+      Region &region = s_regions[m_regions[i]];
+      size_t hostPages = (region.size + s_pageSize - 1) / s_pageSize;
+#ifdef WRITEWATCH_UFFD
+      if (s_method == Method::Userfaultfd)
+      {
+        WriteProtect(region.base, hostPages * s_pageSize, false);
+        continue;
+      }
+#endif
+      mprotect(region.base, hostPages * s_pageSize, PROT_READ | PROT_WRITE);
+      memset(region.written, 0xFF, (hostPages + 7) / 8);
+    }
+    m_unprotected = true;
+  }
+
+  void WriteWatch::Unwatch()
+  {
+    for (unsigned i = 0; i < m_numRegions; i++)
+    {
+      Region &region = s_regions[m_regions[i]];
+      size_t hostPages = (region.size + s_pageSize - 1) / s_pageSize;
+#ifdef WRITEWATCH_UFFD
+      if (s_method == Method::Userfaultfd)
+      {
+        struct uffdio_range range;
+        range.start = uint64_t(region.base);
+        range.len = hostPages * s_pageSize;
+        ioctl(s_uffd, UFFDIO_UNREGISTER, &range);
+      }
+      else
+#endif
+        mprotect(region.base, hostPages * s_pageSize, PROT_READ | PROT_WRITE);
+      region.base = nullptr;
+      delete [] region.written;
+    }
+    m_numRegions = 0;
+  }
+
+#else
+
+  bool WriteWatch::IsSupported()
+  {
+    return false;
+  }
+
+  const char *WriteWatch::GetMethod()
+  {
+    return "none";
+  }
+
+  bool WriteWatch::Watch(uint8_t *base, size_t size, uint8_t *dirty, unsigned pageWidth)
+  {
+    return FAIL;
+  }
+
+  void WriteWatch::Update()
+  {
+  }
+
+  void WriteWatch::Unprotect()
+  {
+  }
+
+  void WriteWatch::Unwatch()
+  {
+  }
+
+#endif
+
+  WriteWatch::~WriteWatch()
+  {
+    Unwatch();
+  }
+} // Util
@@ -0,0 +1,69 @@
+#ifndef INCLUDED_UTIL_WRITEWATCH_H
+#define INCLUDED_UTIL_WRITEWATCH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Util
+{
+  /*
+   * Page dirty tracking by hardware write protection.
+   *
+   * Watched regions are write-protected, so that the first write to each host
+   * page after Update() is caught by the MMU and every further write to it is
+   * free. Update() fills in the caller's dirty page array (same layout as the
+   * MARK_DIRTY macros: bit n of byte i covers page i*8+n of 1<<pageWidth
+   * bytes) and protects the written pages again, normally once per frame
+   * just before the dirty pages are consumed.
+   *
+   * Two methods are used, the first available:
+   *
+   *  - userfaultfd asynchronous write protection (Linux 6.7+): the kernel
+   *    resolves write faults itself and PAGEMAP_SCAN collects and re-protects
+   *    the written pages in one call.
+   *  - mprotect(): a SIGSEGV handler records the page and unprotects it.
+   *    Writes must come from ordinary code (a system call writing to a
+   *    protected page fails with EFAULT instead).
+   *
+   * Writes must not race with Update(). Linux only; elsewhere IsSupported()
+   * is false and Watch() fails.
+   */
+  class WriteWatch
+  {
+  public:
+    static bool IsSupported();
+
+    // Name of the method in use, once a region is being watched
+    static const char *GetMethod();
+
+    // Starts watching size bytes at base (which must be page aligned, e.g. a
+    // SMALL_PAGES region from MemoryArena)
+    bool Watch(uint8_t *base, size_t size, uint8_t *dirty, unsigned pageWidth);
+
+    // Marks the pages written since the last call dirty and protects them
+    void Update();
+
+    // Makes all watched pages writable ahead of bulk writes whose result the
+    // caller accounts for itself. They are not marked dirty, and writes are
+    // not tracked until the next Update().
+    void Unprotect();
+
+    // Stops watching all regions (must be called before their memory is freed)
+    void Unwatch();
+
+    bool Active() const
+    {
+      return m_numRegions > 0;
+    }
+
+    ~WriteWatch();
+
+  private:
+    static const unsigned MAX_REGIONS = 8;
+    int m_regions[MAX_REGIONS];  // indices into the global region table
+    unsigned m_numRegions = 0;
+    bool m_unprotected = false;
+  };
+} // Util
+
+#endif  // INCLUDED_UTIL_WRITEWATCH_H